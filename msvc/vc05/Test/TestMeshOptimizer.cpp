@@ -0,0 +1,111 @@
+/**
+ * @file TestMeshOptimizer.cpp
+ * @brief Tests of the welding and cleanup of meshes after loading.
+ */
+
+#include "lucPCH.h"
+#include "scene/mesh.hpp"
+#include "scene/mesh_optimizer.hpp"
+
+#include <boost/test/auto_unit_test.hpp>
+#include <algorithm>
+#include <vector>
+
+using namespace Luc;
+
+namespace {
+
+// a vertex of the flat test mesh, lying on z = 0 and facing +z
+MeshVertex grid_vertex( int x, int y )
+{
+    MeshVertex vertex;
+    vertex.position = Vector3( real_t( x ), real_t( y ), 0 );
+    vertex.normal = Vector3( 0, 0, 1 );
+    vertex.tex_coord = Vector2( x / real_t( 2 ), y / real_t( 2 ) );
+    return vertex;
+}
+
+// adds a triangle with vertices of its own, as an unindexed file has them
+void add_triangle( std::vector< MeshVertex >& vertices, std::vector< MeshTriangle >& triangles,
+                   const MeshVertex& a, const MeshVertex& b, const MeshVertex& c )
+{
+    MeshTriangle tri;
+    for ( unsigned int i = 0; i < 3; ++i )
+        tri.vertices[i] = static_cast< unsigned int >( vertices.size() ) + i;
+    vertices.push_back( a );
+    vertices.push_back( b );
+    vertices.push_back( c );
+    triangles.push_back( tri );
+}
+
+typedef std::vector< real_t > TriangleKey;
+
+/*
+ * The attributes of the corners of a triangle, starting at the smallest
+ * corner but keeping the winding, so equal triangles have equal keys
+ * however their vertices are numbered.
+ */
+TriangleKey triangle_key( const std::vector< MeshVertex >& vertices, const MeshTriangle& tri )
+{
+    TriangleKey corners[3];
+    for ( size_t i = 0; i < 3; ++i ) {
+        const MeshVertex& vertex = vertices[tri.vertices[i]];
+        for ( size_t axis = 0; axis < 3; ++axis )
+            corners[i].push_back( vertex.position[axis] );
+        for ( size_t axis = 0; axis < 3; ++axis )
+            corners[i].push_back( vertex.normal[axis] );
+        corners[i].push_back( vertex.tex_coord.x );
+        corners[i].push_back( vertex.tex_coord.y );
+    }
+    size_t first = std::min_element( corners, corners + 3 ) - corners;
+    TriangleKey key;
+    for ( size_t i = 0; i < 3; ++i )
+        key.insert( key.end(), corners[( first + i ) % 3].begin(), corners[( first + i ) % 3].end() );
+    return key;
+}
+
+std::vector< TriangleKey > triangle_keys( const std::vector< MeshVertex >& vertices,
+                                          const std::vector< MeshTriangle >& triangles )
+{
+    std::vector< TriangleKey > keys;
+    for ( size_t i = 0; i < triangles.size(); ++i )
+        keys.push_back( triangle_key( vertices, triangles[i] ) );
+    std::sort( keys.begin(), keys.end() );
+    return keys;
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(optimize_mesh_welds_and_drops_degenerate_triangles)
+{
+    // two by two quads over a grid of 3 by 3 points, each triangle with
+    // vertices of its own
+    std::vector< MeshVertex > vertices;
+    std::vector< MeshTriangle > triangles;
+    for ( int y = 0; y < 2; ++y ) {
+        for ( int x = 0; x < 2; ++x ) {
+            add_triangle( vertices, triangles, grid_vertex( x, y ), grid_vertex( x + 1, y ), grid_vertex( x + 1, y + 1 ) );
+            add_triangle( vertices, triangles, grid_vertex( x, y ), grid_vertex( x + 1, y + 1 ), grid_vertex( x, y + 1 ) );
+        }
+    }
+    std::vector< TriangleKey > expected = triangle_keys( vertices, triangles );
+
+    // a triangle of collinear points, and one using a vertex twice
+    add_triangle( vertices, triangles, grid_vertex( 0, 0 ), grid_vertex( 1, 0 ), grid_vertex( 2, 0 ) );
+    MeshTriangle repeated = { { 0, 0, 1 } };
+    triangles.push_back( repeated );
+
+    size_t num_vertices = vertices.size();
+    MeshOptimizeStats stats;
+    optimize_mesh( vertices, triangles, MeshOptimizeSettings(), &stats );
+
+    // all 27 vertices are copies of the 9 grid points
+    BOOST_CHECK_EQUAL( num_vertices, 27u );
+    BOOST_CHECK_EQUAL( stats.welded_vertices, 18u );
+    BOOST_CHECK_EQUAL( vertices.size(), 9u );
+    BOOST_CHECK_EQUAL( stats.removed_triangles, 2u );
+    BOOST_REQUIRE_EQUAL( triangles.size(), 8u );
+
+    // the same surface as before, only numbered and ordered differently
+    BOOST_CHECK( triangle_keys( vertices, triangles ) == expected );
+}
@@ -0,0 +1,122 @@
+/**
+ * @file TestPhotonMap.cpp
+ * @brief Tests of the nearest photon lookups and irradiance of photon maps.
+ */
+
+#include "lucPCH.h"
+#include "app/photon_map.hpp"
+
+#include <boost/test/auto_unit_test.hpp>
+#include <vector>
+
+using namespace Luc;
+
+namespace {
+
+// the cone filter of the photon map
+const real_t CONE_FILTER_K = 1.1f;
+
+void add_photon( std::vector< Photon >& photons, const Vector3& position, const Color3& power )
+{
+    Photon photon;
+    photon.position = position;
+    photon.direction = Vector3( 0, 0, 1 );
+    photon.power = power;
+    photon.axis = 0;
+    photons.push_back( photon );
+}
+
+/*
+ * Four red photons at distance 1 of the origin and four green ones at
+ * distance 2, on the plane z = 0 and coming from above, and a grid of blue
+ * ones far above them.
+ */
+void build_photons( PhotonMap* map, real_t max_radius )
+{
+    std::vector< Photon > photons;
+    for ( int y = -2; y <= 2; ++y ) {
+        for ( int x = -2; x <= 2; ++x )
+            add_photon( photons, Vector3( real_t( x ), real_t( y ), 10 ), Color3( 0, 0, 1 ) );
+    }
+    for ( real_t distance = 1; distance <= 2; ++distance ) {
+        Color3 power = 1 == distance ? Color3( 1, 0, 0 ) : Color3( 0, 1, 0 );
+        add_photon( photons, Vector3( distance, 0, 0 ), power );
+        add_photon( photons, Vector3( -distance, 0, 0 ), power );
+        add_photon( photons, Vector3( 0, distance, 0 ), power );
+        add_photon( photons, Vector3( 0, -distance, 0 ), power );
+    }
+    map->build( photons, max_radius );
+}
+
+// weight of the cone filter at a distance from the lookup of that radius
+real_t cone_weight( real_t distance, real_t radius )
+{
+    return 1 - distance / ( CONE_FILTER_K * radius );
+}
+
+// area the cone filter normalizes by
+real_t cone_area( real_t radius )
+{
+    return ( 1 - 2 / ( 3 * CONE_FILTER_K ) ) * PI * radius * radius;
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(photon_map_gathers_the_nearest_photons)
+{
+    PhotonMap map;
+    build_photons( &map, 100 );
+    BOOST_CHECK_EQUAL( map.size(), 33u );
+
+    Vector3 origin( 0, 0, 0 );
+    Vector3 up( 0, 0, 1 );
+
+    // the four closest are the red ones
+    Color3 near = map.irradiance( origin, up, 4 );
+    BOOST_CHECK( near.r > 0 );
+    BOOST_CHECK_EQUAL( near.g, 0 );
+    BOOST_CHECK_EQUAL( near.b, 0 );
+
+    // one more takes a green one too, but none of the far blue ones
+    Color3 more = map.irradiance( origin, up, 5 );
+    BOOST_CHECK( more.r > 0 );
+    BOOST_CHECK( more.g > 0 );
+    BOOST_CHECK_EQUAL( more.b, 0 );
+
+    // from the far side of the plane the photons light nothing
+    Color3 below = map.irradiance( origin, Vector3( 0, 0, -1 ), 8 );
+    BOOST_CHECK_EQUAL( below.r, 0 );
+    BOOST_CHECK_EQUAL( below.g, 0 );
+    BOOST_CHECK_EQUAL( below.b, 0 );
+}
+
+BOOST_AUTO_TEST_CASE(photon_map_irradiance)
+{
+    PhotonMap map;
+    build_photons( &map, 100 );
+
+    // the eight photons in the plane, spread over a disc of radius 2
+    Color3 irradiance = map.irradiance( Vector3( 0, 0, 0 ), Vector3( 0, 0, 1 ), 8 );
+    BOOST_CHECK_CLOSE( irradiance.r, 4 * cone_weight( 1, 2 ) / cone_area( 2 ), 1e-3f );
+    BOOST_CHECK_CLOSE( irradiance.g, 4 * cone_weight( 2, 2 ) / cone_area( 2 ), 1e-3f );
+    BOOST_CHECK_EQUAL( irradiance.b, 0 );
+}
+
+BOOST_AUTO_TEST_CASE(photon_map_gathers_within_the_radius)
+{
+    PhotonMap map;
+    build_photons( &map, 1.5f );
+
+    // only the red photons are close enough, and fewer than were asked
+    // for, so they are spread over the whole gather radius
+    Color3 irradiance = map.irradiance( Vector3( 0, 0, 0 ), Vector3( 0, 0, 1 ), 8 );
+    BOOST_CHECK_CLOSE( irradiance.r, 4 * cone_weight( 1, 1.5f ) / cone_area( 1.5f ), 1e-3f );
+    BOOST_CHECK_EQUAL( irradiance.g, 0 );
+    BOOST_CHECK_EQUAL( irradiance.b, 0 );
+
+    // and nothing is close to a point away from all of them
+    Color3 empty = map.irradiance( Vector3( 5, 5, 0 ), Vector3( 0, 0, 1 ), 8 );
+    BOOST_CHECK_EQUAL( empty.r, 0 );
+    BOOST_CHECK_EQUAL( empty.g, 0 );
+    BOOST_CHECK_EQUAL( empty.b, 0 );
+}
@@ -0,0 +1,107 @@
+/**
+ * @file TestRenderServer.cpp
+ * @brief Tests of the job lines the render server accepts.
+ */
+
+#include "lucPCH.h"
+#include "app/render_server.hpp"
+
+#include <boost/test/auto_unit_test.hpp>
+#include <string>
+
+using namespace Luc;
+
+namespace {
+
+// parses a job line of a server rendering 640 by 480 by default
+bool parse( const std::string& line, RenderServer::Job* job, std::string* error )
+{
+    return RenderServer::parse_job( line, 640, 480, job, error );
+}
+
+// whether a job line is refused, with a reason
+bool is_refused( const std::string& line )
+{
+    RenderServer::Job job;
+    std::string error;
+    return !parse( line, &job, &error ) && !error.empty();
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(parse_job_defaults)
+{
+    RenderServer::Job job;
+    std::string error;
+    BOOST_REQUIRE( parse( "scene=scenes/cornell.scene", &job, &error ) );
+    BOOST_CHECK_EQUAL( job.scene_filename, "scenes/cornell.scene" );
+    BOOST_CHECK_EQUAL( job.width, 640u );
+    BOOST_CHECK_EQUAL( job.height, 480u );
+    BOOST_CHECK_EQUAL( job.samples, 0u );
+    BOOST_CHECK_EQUAL( job.pixel_samples, 1u );
+    BOOST_CHECK_EQUAL( job.priority, 0 );
+    BOOST_CHECK( !job.has_camera );
+    BOOST_CHECK_EQUAL( job.fov, 0 );
+    BOOST_CHECK( !job.has_region );
+    BOOST_CHECK( !job.raw );
+}
+
+BOOST_AUTO_TEST_CASE(parse_job_every_key)
+{
+    RenderServer::Job job;
+    std::string error;
+    BOOST_REQUIRE( parse( "scene=a.scene width=320 height=200 samples=16 aa=2 priority=-3 "
+                          "camera=1,2,3,0,0,0 fov=45 region=10,20,100,50 format=raw", &job, &error ) );
+    BOOST_CHECK_EQUAL( job.scene_filename, "a.scene" );
+    BOOST_CHECK_EQUAL( job.width, 320u );
+    BOOST_CHECK_EQUAL( job.height, 200u );
+    BOOST_CHECK_EQUAL( job.samples, 16u );
+    BOOST_CHECK_EQUAL( job.pixel_samples, 2u );
+    BOOST_CHECK_EQUAL( job.priority, -3 );
+    BOOST_CHECK( job.has_camera );
+    BOOST_CHECK( job.camera_position == Vector3( 1, 2, 3 ) );
+    BOOST_CHECK( job.camera_target == Vector3( 0, 0, 0 ) );
+    BOOST_CHECK_EQUAL( job.fov, 45 );
+    BOOST_CHECK( job.has_region );
+    BOOST_CHECK_EQUAL( job.region_x, 10u );
+    BOOST_CHECK_EQUAL( job.region_y, 20u );
+    BOOST_CHECK_EQUAL( job.region_width, 100u );
+    BOOST_CHECK_EQUAL( job.region_height, 50u );
+    BOOST_CHECK( job.raw );
+}
+
+BOOST_AUTO_TEST_CASE(parse_job_refuses_malformed_lines)
+{
+    // no scene, or an empty one
+    BOOST_CHECK( is_refused( "" ) );
+    BOOST_CHECK( is_refused( "width=100" ) );
+    BOOST_CHECK( is_refused( "scene=" ) );
+    // not key=value, or an unknown key
+    BOOST_CHECK( is_refused( "scene=a.scene 100" ) );
+    BOOST_CHECK( is_refused( "scene=a.scene depth=3" ) );
+    // sizes that are not numbers, empty, negative or too large
+    BOOST_CHECK( is_refused( "scene=a.scene width=wide" ) );
+    BOOST_CHECK( is_refused( "scene=a.scene width=100px" ) );
+    BOOST_CHECK( is_refused( "scene=a.scene height=0" ) );
+    BOOST_CHECK( is_refused( "scene=a.scene width=-1" ) );
+    BOOST_CHECK( is_refused( "scene=a.scene width=1000000" ) );
+    BOOST_CHECK( is_refused( "scene=a.scene samples=1000000" ) );
+    BOOST_CHECK( is_refused( "scene=a.scene aa=0" ) );
+    BOOST_CHECK( is_refused( "scene=a.scene priority=high" ) );
+    // a camera needs six numbers and cannot look at itself
+    BOOST_CHECK( is_refused( "scene=a.scene camera=1,2,3" ) );
+    BOOST_CHECK( is_refused( "scene=a.scene camera=1,2,3,1,2,3" ) );
+    BOOST_CHECK( is_refused( "scene=a.scene fov=0" ) );
+    BOOST_CHECK( is_refused( "scene=a.scene fov=180" ) );
+    BOOST_CHECK( is_refused( "scene=a.scene format=jpg" ) );
+    // regions must be within the image and not empty
+    BOOST_CHECK( is_refused( "scene=a.scene region=0,0,0,10" ) );
+    BOOST_CHECK( is_refused( "scene=a.scene region=600,0,100,10" ) );
+    BOOST_CHECK( is_refused( "scene=a.scene width=100 height=100 region=0,50,100,51" ) );
+    BOOST_CHECK( is_refused( "scene=a.scene region=1,2,3" ) );
+
+    // a region exactly as large as the image is fine
+    RenderServer::Job job;
+    std::string error;
+    BOOST_CHECK( parse( "scene=a.scene width=100 height=100 region=0,0,100,100", &job, &error ) );
+}
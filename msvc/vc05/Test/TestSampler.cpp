@@ -0,0 +1,98 @@
+/**
+ * @file TestSampler.cpp
+ * @brief Tests that sample sequences depend only on their seed and sample.
+ */
+
+#include "lucPCH.h"
+#include "math/sampler.hpp"
+
+#include <boost/scoped_ptr.hpp>
+#include <boost/test/auto_unit_test.hpp>
+#include <vector>
+
+using namespace Luc;
+
+namespace {
+
+const SamplerType SAMPLER_TYPES[] = { SAMPLER_RANDOM, SAMPLER_HALTON, SAMPLER_SOBOL };
+const size_t NUM_SAMPLER_TYPES = sizeof SAMPLER_TYPES / sizeof SAMPLER_TYPES[0];
+
+// dimensions drawn per sample, past the tabulated primes of the Halton sampler
+const size_t NUM_DIMENSIONS = 40;
+
+// the values of a sample, alternating single and paired dimensions
+std::vector< real_t > draw_sample( Sampler* sampler, uint32_t pixel, uint32_t index )
+{
+    std::vector< real_t > values;
+    sampler->start_sample( pixel, index );
+    while ( values.size() < NUM_DIMENSIONS ) {
+        values.push_back( sampler->next_1d() );
+        Vector2 pair = sampler->next_2d();
+        values.push_back( pair.x );
+        values.push_back( pair.y );
+    }
+    return values;
+}
+
+// the samples of a few pixels, in order
+std::vector< real_t > draw_samples( Sampler* sampler )
+{
+    std::vector< real_t > values;
+    for ( uint32_t pixel = 0; pixel < 4; ++pixel ) {
+        for ( uint32_t index = 0; index < 16; ++index ) {
+            std::vector< real_t > sample = draw_sample( sampler, pixel * 7919, index );
+            values.insert( values.end(), sample.begin(), sample.end() );
+        }
+    }
+    return values;
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(sampler_is_deterministic_for_a_seed)
+{
+    for ( size_t i = 0; i < NUM_SAMPLER_TYPES; ++i ) {
+        boost::scoped_ptr< Sampler > first( Sampler::create( SAMPLER_TYPES[i], 1234 ) );
+        boost::scoped_ptr< Sampler > second( Sampler::create( SAMPLER_TYPES[i], 1234 ) );
+        boost::scoped_ptr< Sampler > other( Sampler::create( SAMPLER_TYPES[i], 4321 ) );
+        BOOST_TEST_MESSAGE( first->get_name() );
+
+        std::vector< real_t > values = draw_samples( first.get() );
+        BOOST_CHECK( draw_samples( second.get() ) == values );
+        // and the same again from a sampler that was used before
+        BOOST_CHECK( draw_samples( first.get() ) == values );
+        // while another seed decorrelates the render
+        BOOST_CHECK( draw_samples( other.get() ) != values );
+
+        for ( size_t j = 0; j < values.size(); ++j ) {
+            BOOST_REQUIRE( values[j] >= 0 );
+            BOOST_REQUIRE( values[j] < 1 );
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sampler_sample_does_not_depend_on_earlier_samples)
+{
+    for ( size_t i = 0; i < NUM_SAMPLER_TYPES; ++i ) {
+        boost::scoped_ptr< Sampler > sampler( Sampler::create( SAMPLER_TYPES[i], 99 ) );
+        BOOST_TEST_MESSAGE( sampler->get_name() );
+
+        std::vector< real_t > fresh = draw_sample( sampler.get(), 12, 5 );
+        // half a sample of another pixel, then the same sample again, as
+        // a thread that picks up another tile would draw them
+        sampler->start_sample( 31, 2 );
+        sampler->next_2d();
+        sampler->next_1d();
+        BOOST_CHECK( draw_sample( sampler.get(), 12, 5 ) == fresh );
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sample_02_sequence_is_deterministic_for_a_seed)
+{
+    for ( uint32_t index = 0; index < 64; ++index ) {
+        Vector2 point = sample_02_sequence( index, 77 );
+        BOOST_CHECK( sample_02_sequence( index, 77 ) == point );
+        BOOST_CHECK( point.x >= 0 && point.x < 1 );
+        BOOST_CHECK( point.y >= 0 && point.y < 1 );
+    }
+}
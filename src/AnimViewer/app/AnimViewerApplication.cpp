@@ -2,11 +2,21 @@
 #include "AnimViewerApplication.hpp"
 #include "scene/image/imageio.hpp"
 
+#include <SDL/SDL_timer.h>
+
 #define BUFFER_SIZE(w,h) ( (size_t) ( 4 * (w) * (h) ) )
 
 
 #define KEY_RAYTRACE SDLK_r
 #define KEY_SCREENSHOT SDLK_f
+#define KEY_PATHTRACE SDLK_p
+#define KEY_DENOISE SDLK_n
+#define KEY_LIVEVIEW SDLK_l
+#define BUTTON_REGION SDL_BUTTON_RIGHT
+
+// share of the frame time the live view spends tracing, the rest is
+// left for scaling and drawing the image
+static const Luc::real_t LIVE_FRAME_SHARE = 0.8f;
 
 namespace Luc {
 
@@ -104,6 +114,7 @@ bool AnimationViewerApplication::initialize()
 {
     // copy camera into camera control so it can be moved via mouse
     camera_control.camera = scene.camera;
+    apply_raytracer_options( options, &raytracer );
     bool load_gl = true; //options.open_window;
 
     try {
@@ -127,6 +138,9 @@ bool AnimationViewerApplication::initialize()
             }
         }
 
+        // the triangles are occluded by the meshes too
+        Luc::bake_triangle_occlusion( &scene, scene.occlusion, raytracer.get_thread_count() );
+
     } catch ( std::bad_alloc const& ) {
         std::cout << "Out of memory error while initializing scene\n.";
         return false;
@@ -172,11 +186,21 @@ void AnimationViewerApplication::destroy()
 
 void AnimationViewerApplication::update( Luc::real_t delta_time )
 {
-    if ( raytracing ) {
+    if ( raytracing && live_view ) {
+        update_live_view( delta_time );
+    } else if ( raytracing ) {
+        // the progressive view follows the camera, starting over when it moves
+        if ( raytracer.is_path_tracing() ) {
+            camera_control.update( delta_time );
+            scene.camera = camera_control.camera;
+            if ( raytracer.update_camera( camera_control.camera ) && region_tracing )
+                clear_region();
+        }
         // do part of the raytrace
         if ( !raytrace_finished ) {
             assert( buffer );
             raytrace_finished = raytracer.raytrace( buffer, &delta_time );
+            update_checkpoint();
         }
     } else {
         // copy camera over from camera control (if not raytracing)
@@ -185,6 +209,53 @@ void AnimationViewerApplication::update( Luc::real_t delta_time )
     }
 }
 
+void AnimationViewerApplication::update_live_view( Luc::real_t delta_time )
+{
+    camera_control.update( delta_time );
+    scene.camera = camera_control.camera;
+
+    // while the camera moves, trace whole frames, as large as the frame
+    // rate allows, and scale them to the window
+    if ( raytracer.update_camera( camera_control.camera ) ) {
+        size_t width, height;
+        resolution_scaler.get_size( &width, &height );
+        raytracer.set_verbose( false );
+        raytracer.set_resolution( width, height );
+        live_buffer.resize( BUFFER_SIZE( width, height ) );
+
+        unsigned int start_time = SDL_GetTicks();
+        raytracer.raytrace( &live_buffer[0], 0 );
+        resolution_scaler.report( width * height, ( SDL_GetTicks() - start_time ) / 1000.0f );
+
+        Luc::resize_image( &live_buffer[0], width, height, buffer, buf_width, buf_height );
+        live_refining = false;
+        return;
+    }
+
+    // once it stops, refine to the full resolution, over the last frame
+    if ( !live_refining ) {
+        raytracer.set_verbose( true );
+        raytracer.set_resolution( buf_width, buf_height );
+        live_refining = true;
+        raytrace_finished = false;
+    }
+    if ( !raytrace_finished )
+        raytrace_finished = raytracer.raytrace( buffer, &delta_time );
+}
+
+void AnimationViewerApplication::update_checkpoint()
+{
+    // only whole images, a region is traced again in seconds anyway
+    if ( options.mCheckpoint.empty() || region_tracing )
+        return;
+
+    unsigned int now = SDL_GetTicks();
+    if ( !raytrace_finished && now - last_checkpoint < options.mCheckpointInterval * 1000 )
+        return;
+    raytracer.save_checkpoint( options.mCheckpoint, buffer );
+    last_checkpoint = now;
+}
+
 void AnimationViewerApplication::render()
 {
     int width, height;
@@ -213,6 +284,21 @@ void AnimationViewerApplication::render()
         glRasterPos2f( -1.0f, -1.0f );
         glDrawPixels( buf_width, buf_height, GL_RGBA, GL_UNSIGNED_BYTE, &buffer[0] );
 
+        // outline the region while it is dragged, and until it is traced
+        if ( region_dragging || ( region_tracing && !raytrace_finished ) ) {
+            float left   = 2.0f * std::min( region_x0, region_x1 ) / buf_width - 1.0f;
+            float right  = 2.0f * ( std::max( region_x0, region_x1 ) + 1 ) / buf_width - 1.0f;
+            float bottom = 2.0f * std::min( region_y0, region_y1 ) / buf_height - 1.0f;
+            float top    = 2.0f * ( std::max( region_y0, region_y1 ) + 1 ) / buf_height - 1.0f;
+            glColor4d( 1.0, 1.0, 0.0, 1.0 );
+            glBegin( GL_LINE_LOOP );
+            glVertex2f( left, bottom );
+            glVertex2f( right, bottom );
+            glVertex2f( right, top );
+            glVertex2f( left, top );
+            glEnd();
+        }
+
     } else {
         // else, render the scene using opengl
         glPushAttrib( GL_ALL_ATTRIB_BITS );
@@ -225,7 +311,7 @@ void AnimationViewerApplication::handle_event( const SDL_Event& event )
 {
     int width, height;
 
-    if ( !raytracing ) {
+    if ( !raytracing || raytracer.is_path_tracing() || live_view ) {
         camera_control.handle_event( this, event );
     }
 
@@ -241,14 +327,95 @@ void AnimationViewerApplication::handle_event( const SDL_Event& event )
         case KEY_SCREENSHOT:
             output_image();
             break;
+        case KEY_PATHTRACE:
+            raytracer.set_path_tracing( !raytracer.is_path_tracing() );
+            std::cout << ( raytracer.is_path_tracing() ? "Path tracing" : "Whitted raytracing" ) << " mode.\n";
+            // restart a running raytrace in the new mode
+            if ( raytracing ) {
+                get_dimension( &width, &height );
+                toggle_raytracing( width, height );
+                toggle_raytracing( width, height );
+            }
+            break;
+        case KEY_LIVEVIEW:
+            live_view = !live_view;
+            std::cout << "Live view " << ( live_view ? "on" : "off" ) << ".\n";
+            // restart a running raytrace in the new mode
+            if ( raytracing ) {
+                get_dimension( &width, &height );
+                toggle_raytracing( width, height );
+                toggle_raytracing( width, height );
+            }
+            break;
+        case KEY_DENOISE:
+            raytracer.set_denoise( !raytracer.is_denoising() );
+            std::cout << "Denoising " << ( raytracer.is_denoising() ? "on" : "off" ) << ".\n";
+            // restart a running raytrace with the new setting
+            if ( raytracing ) {
+                get_dimension( &width, &height );
+                toggle_raytracing( width, height );
+                toggle_raytracing( width, height );
+            }
+            break;
         default:
             break;
         }
+        break;
+
+    // drag a rectangle over the raytraced image to trace just it again
+    case SDL_MOUSEBUTTONDOWN:
+        if ( event.button.button == BUTTON_REGION && raytracing && !live_view ) {
+            region_dragging = true;
+            region_x0 = region_x1 = std::max( 0, std::min( (int)event.button.x, buf_width - 1 ) );
+            region_y0 = region_y1 = std::max( 0, std::min( buf_height - 1 - (int)event.button.y, buf_height - 1 ) );
+        }
+        break;
+    case SDL_MOUSEMOTION:
+        if ( region_dragging ) {
+            region_x1 = std::max( 0, std::min( (int)event.motion.x, buf_width - 1 ) );
+            region_y1 = std::max( 0, std::min( buf_height - 1 - (int)event.motion.y, buf_height - 1 ) );
+        }
+        break;
+    case SDL_MOUSEBUTTONUP:
+        if ( event.button.button == BUTTON_REGION && region_dragging ) {
+            region_dragging = false;
+            trace_region();
+        }
+        break;
     default:
         break;
     }
 }
 
+void AnimationViewerApplication::trace_region()
+{
+    int x = std::min( region_x0, region_x1 );
+    int y = std::min( region_y0, region_y1 );
+    int width = std::max( region_x0, region_x1 ) - x + 1;
+    int height = std::max( region_y0, region_y1 ) - y + 1;
+
+    // a click, rather than a drag, goes back to the whole image
+    if ( width < 2 || height < 2 ) {
+        if ( region_tracing )
+            clear_region();
+        return;
+    }
+
+    raytracer.set_pixel_samples( std::max( 1, options.mRegionSamples ) );
+    raytracer.set_region( x, y, width, height );
+    region_tracing = true;
+    raytrace_finished = false;
+    std::cout << "Raytracing region " << width << "x" << height << " at (" << x << ", " << y << ").\n";
+}
+
+void AnimationViewerApplication::clear_region()
+{
+    raytracer.set_pixel_samples( 1 );
+    raytracer.clear_region();
+    region_tracing = false;
+    raytrace_finished = false;
+}
+
 void AnimationViewerApplication::toggle_raytracing( int width, int height )
 {
     assert( width > 0 && height > 0 );
@@ -278,6 +445,21 @@ void AnimationViewerApplication::toggle_raytracing( int width, int height )
 
         // reset flag that says we are done
         raytrace_finished = false;
+
+        // a new raytrace covers the whole buffer again
+        raytracer.set_pixel_samples( 1 );
+        region_dragging = false;
+        region_tracing = false;
+
+        // go on from where an earlier run of the same image stopped
+        if ( options.mResume && !options.mCheckpoint.empty() )
+            raytracer.load_checkpoint( options.mCheckpoint, buffer );
+        last_checkpoint = SDL_GetTicks();
+
+        // the live view starts with a full frame, until the camera moves
+        raytracer.set_verbose( true );
+        live_refining = true;
+        resolution_scaler.reset( LIVE_FRAME_SHARE / std::max( 1.0f, options.mFps ), width, height );
     }
 
     raytracing = !raytracing;
@@ -309,6 +491,10 @@ void AnimationViewerApplication::output_image()
     } else {
         std::cout << "Error saving raytraced image to '" << filename << "'.\n";
     }
+
+    // what the pixels cost, to find the slow parts of the image
+    if ( !options.mCostMap.empty() )
+        raytracer.get_cost_map().save( options.mCostMap );
 }
 
 bool AnimationViewerApplication::load_scene( const char* filename )
@@ -321,6 +507,9 @@ bool AnimationViewerApplication::load_scene( const char* filename )
 
 AnimationViewerApplication::AnimationViewerApplication( const Options& opt ) : 
     options( opt ), buffer( 0 ), buf_width( 0 ), buf_height( 0 ), raytracing( false ),
+    live_view( opt.mLiveView ), live_refining( false ),
+    region_dragging( false ), region_tracing( false ),
+    region_x0( 0 ), region_y0( 0 ), region_x1( 0 ), region_y1( 0 ), last_checkpoint( 0 ),
     m_FCNHandle(Luc::FileChangeNotification::INVALID_HANDLE)
 {
 
@@ -335,4 +524,6 @@ AnimationViewerApplication::~AnimationViewerApplication()
 void AnimationViewerApplication::OnFileChangeNotification()
 {
     scene.reload();
+    // cached light of the old scene
+    raytracer.clear_irradiance_cache();
 }
@@ -6,6 +6,7 @@
 #include "application/opengl.hpp"
 #include "scene/scene.hpp"
 #include "app/raytracer.hpp"
+#include "app/resolution_scaler.hpp"
 #include "app/options.hpp"
 #include "files/fileChangeNotification/FileChangeNotification.h"
 
@@ -35,6 +36,15 @@ public:
 
     // flips raytracing, does any necessary initialization
     void toggle_raytracing( int width, int height );
+
+    // traces a frame of the live view, small while the camera moves
+    void update_live_view( Luc::real_t delta_time );
+    // traces the dragged rectangle again, at the region quality
+    void trace_region();
+    // goes back to tracing the whole buffer at the normal quality
+    void clear_region();
+    // saves the progress of the raytrace, if a checkpoint is due
+    void update_checkpoint();
     // writes the current raytrace buffer to the output file
     void output_image();
 
@@ -59,6 +69,26 @@ public:
     bool raytracing;
     // false if there is more raytracing to do
     bool raytrace_finished;
+
+    // true if the raytraced view follows the camera at a lower resolution
+    // while it moves, and refines to the full one once it stops
+    bool live_view;
+    // true once the live view traces at the full resolution
+    bool live_refining;
+    // sizes the frames of the live view to the frame rate
+    Luc::ResolutionScaler resolution_scaler;
+    // the last frame of the live view, before it is scaled to the buffer
+    std::vector< unsigned char > live_buffer;
+
+    // true while a rectangle is dragged with the right mouse button
+    bool region_dragging;
+    // true while only the dragged rectangle is traced
+    bool region_tracing;
+    // corners of the rectangle, in buffer pixels from the bottom left
+    int region_x0, region_y0, region_x1, region_y1;
+
+    // SDL ticks of the last checkpoint, or of the start of the raytrace
+    unsigned int last_checkpoint;
     Luc::FileChangeNotification::FCNHandle m_FCNHandle;
 
 };
@@ -0,0 +1,136 @@
+/**
+ * @file cost_map.cpp
+ * @brief What each pixel of a raytraced image cost, saved as heatmaps.
+ */
+#include "lucPCH.h"
+#include "cost_map.hpp"
+#include "scene/image/imageio.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+namespace Luc {
+
+// bump whenever the layout of a cost file changes
+static const uint32_t COST_MAP_VERSION = 1;
+static const char COST_MAP_MAGIC[8] = { 'L', 'U', 'C', 'C', 'O', 'S', 'T', 0 };
+// share of the pixels below the top of the heatmap scale, the rest saturate
+static const float HEATMAP_PERCENTILE = 0.99f;
+
+static const char* const CHANNEL_NAMES[CostMap::NUM_CHANNELS] = {
+    "time", "rays", "boxes", "triangles", "depth"
+};
+
+// blue through cyan, green and yellow to red, for v from 0 to 1
+static void heat_color( float v, unsigned char* rgba )
+{
+    static const float STOPS[5][3] = {
+        { 0, 0, 1 }, { 0, 1, 1 }, { 0, 1, 0 }, { 1, 1, 0 }, { 1, 0, 0 }
+    };
+    v = std::min( std::max( v, 0.0f ), 1.0f ) * 4;
+    size_t i = std::min< size_t >( static_cast< size_t >( v ), 3 );
+    float f = v - i;
+    for ( size_t c = 0; c < 3; ++c )
+        rgba[c] = static_cast< unsigned char >( 255 * ( STOPS[i][c] + ( STOPS[i + 1][c] - STOPS[i][c] ) * f ) + 0.5f );
+    rgba[3] = 255;
+}
+
+CostMap::CostMap() : m_width( 0 ), m_height( 0 ) { }
+
+CostMap::~CostMap() { }
+
+void CostMap::reset( size_t width, size_t height )
+{
+    PixelCost free_pixel;
+    memset( &free_pixel, 0, sizeof free_pixel );
+    m_width = width;
+    m_height = height;
+    // swapped in, so an empty map frees its memory
+    std::vector< PixelCost >( width * height, free_pixel ).swap( m_costs );
+}
+
+void CostMap::clear( size_t x, size_t y, size_t width, size_t height )
+{
+    for ( size_t row = y; row < y + height && row < m_height; ++row ) {
+        for ( size_t column = x; column < x + width && column < m_width; ++column )
+            memset( &m_costs[row * m_width + column], 0, sizeof( PixelCost ) );
+    }
+}
+
+void CostMap::add( size_t index, uint64_t time, const TraceCounters& before, const TraceCounters& after )
+{
+    PixelCost& cost = m_costs[index];
+    cost.time += static_cast< float >( time );
+    cost.rays += static_cast< float >( after.total_rays() - before.total_rays() );
+    cost.boxes += static_cast< float >( after.boxes - before.boxes );
+    cost.triangles += static_cast< float >( after.triangles - before.triangles );
+    cost.depth = std::max( cost.depth, static_cast< float >( after.max_depth ) );
+}
+
+bool CostMap::save( const std::string& name ) const
+{
+    if ( m_costs.empty() ) {
+        std::cout << "No pixel costs to save.\n";
+        return false;
+    }
+
+    size_t num_pixels = m_costs.size();
+    const float* values = reinterpret_cast< const float* >( &m_costs[0] );
+    std::vector< float > channel( num_pixels );
+    std::vector< unsigned char > image( 4 * num_pixels );
+    bool ok = true;
+    for ( size_t c = 0; c < NUM_CHANNELS; ++c ) {
+        for ( size_t i = 0; i < num_pixels; ++i )
+            channel[i] = values[i * NUM_CHANNELS + c];
+
+        // a few very slow pixels would leave the rest of the map blue
+        std::vector< float >::iterator top = channel.begin() +
+            std::min( num_pixels - 1, static_cast< size_t >( num_pixels * HEATMAP_PERCENTILE ) );
+        std::nth_element( channel.begin(), top, channel.end() );
+        float scale = *top > 0 ? 1 / *top : 0;
+
+        for ( size_t i = 0; i < num_pixels; ++i )
+            heat_color( values[i * NUM_CHANNELS + c] * scale, &image[4 * i] );
+        std::string filename = name + "_" + CHANNEL_NAMES[c] + ".png";
+        if ( !imageio_save_image( filename.c_str(), &image[0], static_cast< int >( m_width ),
+                                  static_cast< int >( m_height ) ) ) {
+            std::cout << "Error saving cost map to '" << filename << "'.\n";
+            ok = false;
+        }
+    }
+
+    std::string filename = name + ".cost";
+    FILE* fp = fopen( filename.c_str(), "wb" );
+    uint32_t header[4] = {
+        COST_MAP_VERSION, static_cast< uint32_t >( m_width ), static_cast< uint32_t >( m_height ),
+        static_cast< uint32_t >( NUM_CHANNELS )
+    };
+    bool written = fp &&
+                   fwrite( COST_MAP_MAGIC, sizeof COST_MAP_MAGIC, 1, fp ) == 1 &&
+                   fwrite( header, sizeof header, 1, fp ) == 1 &&
+                   fwrite( &m_costs[0], sizeof( PixelCost ), num_pixels, fp ) == num_pixels;
+    if ( fp )
+        written = ( 0 == fclose( fp ) ) && written;
+    if ( !written ) {
+        std::cout << "Error saving pixel costs to '" << filename << "'.\n";
+        return false;
+    }
+
+    // the worst pixel, for a start
+    size_t slowest = 0;
+    for ( size_t i = 1; i < num_pixels; ++i ) {
+        if ( m_costs[i].time > m_costs[slowest].time )
+            slowest = i;
+    }
+    const PixelCost& worst = m_costs[slowest];
+    printf( "Saved pixel costs to '%s_*.png' and '%s'. Slowest pixel (%u, %u): %.0f us, "
+            "%.0f rays, %.0f boxes, %.0f triangles, depth %.0f.\n",
+            name.c_str(), filename.c_str(), (unsigned int)( slowest % m_width ),
+            (unsigned int)( slowest / m_width ), worst.time / 1000, worst.rays, worst.boxes,
+            worst.triangles, worst.depth );
+    return ok;
+}
+
+} /* Luc */
@@ -0,0 +1,80 @@
+/**
+ * @file cost_map.hpp
+ * @brief What each pixel of a raytraced image cost, saved as heatmaps.
+ */
+
+#ifndef _LUC_APP_COST_MAP_HPP_
+#define _LUC_APP_COST_MAP_HPP_
+
+#include "scene/trace_counters.hpp"
+
+#include <string>
+#include <vector>
+
+namespace Luc {
+
+/*
+ * The cost of a pixel, summed over its samples and passes, except the
+ * depth, which is the deepest of them. Floats, so the map is saved as is.
+ */
+struct PixelCost
+{
+    // nanoseconds spent on the pixel
+    float time;
+    float rays;
+    float boxes;
+    float triangles;
+    float depth;
+};
+
+/*
+ * Per pixel cost of an image, to find the objects that make it slow: deep
+ * glass-on-glass shows in the rays and the depth, dense meshes in the
+ * triangles. Tracing threads add to the pixels of their own tiles, so
+ * they need no lock.
+ */
+class CostMap
+{
+public:
+
+    // number of floats of a pixel in a saved cost file
+    static const size_t NUM_CHANNELS = sizeof( PixelCost ) / sizeof( float );
+
+    CostMap();
+    ~CostMap();
+
+    /// Sizes the map to an image, with every pixel at no cost.
+    void reset( size_t width, size_t height );
+    /// Drops the cost of a rectangle, in pixels from the bottom left corner.
+    void clear( size_t x, size_t y, size_t width, size_t height );
+    bool empty() const { return m_costs.empty(); }
+
+    /*
+     * Adds a pixel traced again, between two readings of the counters of
+     * the thread that traced it.
+     * @param index The pixel, row by row from the bottom left corner.
+     * @param time Nanoseconds it took.
+     */
+    void add( size_t index, uint64_t time, const TraceCounters& before, const TraceCounters& after );
+
+    const PixelCost& get( size_t index ) const { return m_costs[index]; }
+
+    /*
+     * Writes a false color heatmap of every kind of cost, as name_time.png,
+     * name_rays.png, name_boxes.png, name_triangles.png and name_depth.png,
+     * each running from blue to red at the 99th percentile of its pixels.
+     * The costs themselves go to name.cost: the magic "LUCCOST", a version,
+     * the width, the height and NUM_CHANNELS, all 32 bit, then the floats
+     * of PixelCost of every pixel, from the bottom row up.
+     */
+    bool save( const std::string& name ) const;
+
+private:
+
+    size_t m_width, m_height;
+    std::vector< PixelCost > m_costs;
+};
+
+} /* Luc */
+
+#endif /* _LUC_APP_COST_MAP_HPP_ */
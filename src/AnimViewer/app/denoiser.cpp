@@ -0,0 +1,215 @@
+/**
+ * @file denoiser.cpp
+ * @brief Edge-aware a-trous wavelet filter for noisy raytraced images.
+ */
+#include "lucPCH.h"
+#include "denoiser.hpp"
+
+#include <boost/thread/thread.hpp>
+#include <boost/thread/barrier.hpp>
+#include <algorithm>
+#include <cmath>
+
+namespace Luc {
+
+// weights of the B3 spline, the 1D kernel of each filter pass
+static const real_t KERNEL[5] = { 1.0f / 16, 1.0f / 4, 3.0f / 8, 1.0f / 4, 1.0f / 16 };
+
+// albedo channels are clamped to this before dividing by them
+static const real_t MIN_ALBEDO = 0.01f;
+
+static real_t luminance( const Color3& c )
+{
+    return 0.2126f * c.r + 0.7152f * c.g + 0.0722f * c.b;
+}
+
+static Color3 clamp_albedo( const Color3& albedo )
+{
+    return Color3( std::max( albedo.r, MIN_ALBEDO ),
+                   std::max( albedo.g, MIN_ALBEDO ),
+                   std::max( albedo.b, MIN_ALBEDO ) );
+}
+
+/*
+ * Runs every stage of the filter on a band of rows, waiting for the other
+ * bands between stages, since each pass reads the rows around its band.
+ */
+struct DenoiseWorker
+{
+    Denoiser*       denoiser;
+    boost::barrier* barrier;
+    size_t          y_begin;
+    size_t          y_end;
+    Color3*         output;
+
+    void operator()() const
+    {
+        denoiser->prepare_rows( y_begin, y_end );
+        barrier->wait();
+        unsigned int iterations = denoiser->settings.iterations;
+        for ( unsigned int i = 0; i < iterations; ++i ) {
+            denoiser->filter_rows( y_begin, y_end, i, i % 2 );
+            barrier->wait();
+        }
+        denoiser->finish_rows( y_begin, y_end, iterations % 2, output );
+    }
+};
+
+DenoiseSettings::DenoiseSettings()
+    : iterations( 5 ), color_sigma( 4 ), normal_sigma( 128 ), depth_sigma( 0.01f ) { }
+
+Denoiser::Denoiser() { }
+
+Denoiser::~Denoiser() { }
+
+void Denoiser::denoise( const DenoiseInput& input, size_t num_threads, Color3* output )
+{
+    m_input = input;
+    size_t num_pixels = input.width * input.height;
+    for ( size_t i = 0; i < 2; ++i ) {
+        m_color[i].resize( num_pixels );
+        m_variance[i].resize( num_pixels );
+    }
+    if ( 0 == num_pixels )
+        return;
+
+    num_threads = std::max< size_t >( 1, std::min( num_threads, input.height ) );
+    boost::barrier barrier( static_cast< unsigned int >( num_threads ) );
+    std::vector< DenoiseWorker > workers( num_threads );
+    for ( size_t i = 0; i < num_threads; ++i ) {
+        DenoiseWorker& worker = workers[i];
+        worker.denoiser = this;
+        worker.barrier  = &barrier;
+        worker.y_begin  = input.height * i / num_threads;
+        worker.y_end    = input.height * ( i + 1 ) / num_threads;
+        worker.output   = output;
+    }
+
+    boost::thread_group threads;
+    for ( size_t i = 1; i < num_threads; ++i )
+        threads.create_thread( workers[i] );
+    workers[0]();
+    threads.join_all();
+}
+
+Color3 Denoiser::demodulate( const Color3& color, const Color3& albedo )
+{
+    Color3 a = clamp_albedo( albedo );
+    return Color3( color.r / a.r, color.g / a.g, color.b / a.b );
+}
+
+void Denoiser::prepare_rows( size_t y_begin, size_t y_end )
+{
+    const size_t width = m_input.width;
+    const size_t height = m_input.height;
+
+    // lighting only, with the texture divided out
+    for ( size_t y = y_begin; y < y_end; ++y ) {
+        for ( size_t x = 0; x < width; ++x ) {
+            size_t p = y * width + x;
+            m_color[0][p] = demodulate( m_input.color[p], m_input.albedo[p] );
+        }
+    }
+
+    if ( m_input.variance ) {
+        std::copy( m_input.variance + y_begin * width, m_input.variance + y_end * width,
+                   m_variance[0].begin() + y_begin * width );
+        return;
+    }
+
+    // without a per pixel estimate, take the variance of the 3x3 neighbourhood
+    for ( size_t y = y_begin; y < y_end; ++y ) {
+        for ( size_t x = 0; x < width; ++x ) {
+            real_t sum = 0, sum_sq = 0;
+            size_t count = 0;
+            for ( size_t qy = y > 0 ? y - 1 : 0; qy <= std::min( y + 1, height - 1 ); ++qy ) {
+                for ( size_t qx = x > 0 ? x - 1 : 0; qx <= std::min( x + 1, width - 1 ); ++qx ) {
+                    size_t q = qy * width + qx;
+                    // rows of other bands may not be demodulated yet
+                    real_t l = luminance( demodulate( m_input.color[q], m_input.albedo[q] ) );
+                    sum += l;
+                    sum_sq += l * l;
+                    count++;
+                }
+            }
+            real_t mean = sum / count;
+            m_variance[0][y * width + x] = std::max( real_t( 0 ), sum_sq / count - mean * mean );
+        }
+    }
+}
+
+void Denoiser::filter_rows( size_t y_begin, size_t y_end, unsigned int iteration, size_t source )
+{
+    const int width = static_cast< int >( m_input.width );
+    const int height = static_cast< int >( m_input.height );
+    const int step = 1 << iteration;
+    const std::vector< Color3 >& color = m_color[source];
+    const std::vector< real_t >& variance = m_variance[source];
+    std::vector< Color3 >& color_out = m_color[1 - source];
+    std::vector< real_t >& variance_out = m_variance[1 - source];
+
+    for ( int y = static_cast< int >( y_begin ); y < static_cast< int >( y_end ); ++y ) {
+        for ( int x = 0; x < width; ++x ) {
+            size_t p = y * width + x;
+            real_t depth = m_input.depth[p];
+
+            // the background has nothing to guide the filter
+            if ( depth <= 0 ) {
+                color_out[p] = color[p];
+                variance_out[p] = variance[p];
+                continue;
+            }
+
+            const Vector3& normal = m_input.normal[p];
+            real_t lum = luminance( color[p] );
+            real_t lum_scale = 1 / ( settings.color_sigma * sqrt( variance[p] ) + 1e-4f );
+
+            Color3 sum_color( 0, 0, 0 );
+            real_t sum_variance = 0;
+            real_t sum_weight = 0;
+            for ( int dy = -2; dy <= 2; ++dy ) {
+                int qy = y + dy * step;
+                if ( qy < 0 || qy >= height )
+                    continue;
+                for ( int dx = -2; dx <= 2; ++dx ) {
+                    int qx = x + dx * step;
+                    if ( qx < 0 || qx >= width )
+                        continue;
+                    size_t q = qy * width + qx;
+                    real_t q_depth = m_input.depth[q];
+                    if ( q_depth <= 0 )
+                        continue;
+
+                    real_t distance = static_cast< real_t >( step * std::max( abs( dx ), abs( dy ) ) );
+                    real_t w_normal = pow( std::max( real_t( 0 ), dot( normal, m_input.normal[q] ) ), settings.normal_sigma );
+                    real_t w_depth = fabs( depth - q_depth ) / ( settings.depth_sigma * depth * distance + 1e-6f );
+                    real_t w_color = fabs( lum - luminance( color[q] ) ) * lum_scale;
+                    real_t weight = KERNEL[dx + 2] * KERNEL[dy + 2] * w_normal * exp( -w_depth - w_color );
+
+                    sum_color += color[q] * weight;
+                    sum_variance += weight * weight * variance[q];
+                    sum_weight += weight;
+                }
+            }
+
+            // the center pixel always has weight, unless its normal is unknown
+            if ( sum_weight > 0 ) {
+                color_out[p] = sum_color * ( 1 / sum_weight );
+                variance_out[p] = sum_variance / ( sum_weight * sum_weight );
+            } else {
+                color_out[p] = color[p];
+                variance_out[p] = variance[p];
+            }
+        }
+    }
+}
+
+void Denoiser::finish_rows( size_t y_begin, size_t y_end, size_t source, Color3* output )
+{
+    const size_t width = m_input.width;
+    for ( size_t p = y_begin * width; p < y_end * width; ++p ) {
+        output[p] = m_color[source][p] * clamp_albedo( m_input.albedo[p] );
+    }
+}
+
+} /* Luc */
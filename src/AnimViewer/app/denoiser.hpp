@@ -0,0 +1,97 @@
+/**
+ * @file denoiser.hpp
+ * @brief Edge-aware a-trous wavelet filter for noisy raytraced images.
+ */
+
+#ifndef _LUC_APP_DENOISER_HPP_
+#define _LUC_APP_DENOISER_HPP_
+
+#include "math/color.hpp"
+#include "math/vector.hpp"
+
+#include <vector>
+
+namespace Luc {
+
+struct DenoiseSettings
+{
+    DenoiseSettings();
+
+    // filter passes, each one doubling the reach of the 5x5 kernel
+    unsigned int iterations;
+    // luminance edge stop, in standard deviations of the pixel's noise
+    real_t color_sigma;
+    // exponent of the normal edge stop, higher keeps sharper creases
+    real_t normal_sigma;
+    // depth edge stop, as a fraction of the pixel's depth per pixel of distance
+    real_t depth_sigma;
+};
+
+/*
+ * The guide buffers and noisy color of an image, one entry per pixel, row
+ * by row. A depth of 0 marks a pixel whose eye ray hit nothing.
+ */
+struct DenoiseInput
+{
+    const Color3*  color;
+    const Color3*  albedo;
+    const Vector3* normal;
+    const real_t*  depth;
+    // variance of the mean of each pixel's color luminance, NULL if unknown
+    const real_t*  variance;
+    size_t         width;
+    size_t         height;
+};
+
+/*
+ * Filters noise out of a raytraced image while keeping the edges that its
+ * guide buffers show (Dammertz et al., "Edge-Avoiding A-Trous Wavelet
+ * Transform", with the variance guided color stop of SVGF).
+ *
+ * The color is divided by the albedo before filtering and multiplied back
+ * after, so texture detail is never blurred, only the lighting.
+ */
+class Denoiser
+{
+public:
+
+    Denoiser();
+    ~Denoiser();
+
+    /*
+     * Filters an image on several threads, each one owning a band of rows.
+     * @param output    Receives width * height filtered colors, may be the
+     *                  input's color buffer.
+     */
+    void denoise( const DenoiseInput& input, size_t num_threads, Color3* output );
+
+    /// The lighting part of a color, which is what gets filtered.
+    static Color3 demodulate( const Color3& color, const Color3& albedo );
+
+    DenoiseSettings settings;
+
+private:
+
+    friend struct DenoiseWorker;
+
+    // demodulates the input and estimates the variance where it is unknown
+    void prepare_rows( size_t y_begin, size_t y_end );
+    // one a-trous pass over a band of rows, from buffer 'source' to the other
+    void filter_rows( size_t y_begin, size_t y_end, unsigned int iteration, size_t source );
+    // remodulates the filtered lighting with the albedo
+    void finish_rows( size_t y_begin, size_t y_end, size_t source, Color3* output );
+
+    DenoiseInput m_input;
+
+    // ping-pong buffers of the demodulated color and its variance
+    std::vector< Color3 > m_color[2];
+    std::vector< real_t > m_variance[2];
+
+    // prevent copy/assignment
+    Denoiser( const Denoiser& );
+    Denoiser& operator=( const Denoiser& );
+};
+
+} /* Luc */
+
+#endif /* _LUC_APP_DENOISER_HPP_ */
@@ -0,0 +1,109 @@
+/**
+ * @file frame_stats.cpp
+ * @brief What tracing an image cost, per tracing thread, reported as text
+ *  or JSON.
+ */
+#include "lucPCH.h"
+#include "frame_stats.hpp"
+
+#include <cstdio>
+#include <iostream>
+
+namespace Luc {
+
+static double to_milliseconds( uint64_t nanoseconds )
+{
+    return static_cast< double >( nanoseconds ) / 1000000.0;
+}
+
+static void write_json_counters( std::ostream& out, const TraceCounters& counters )
+{
+    out << "\"rays\": " << counters.total_rays() << ", \"rays_by_type\": {";
+    for ( size_t i = 0; i < NUM_RAY_TYPES; ++i ) {
+        out << ( i > 0 ? ", " : "" ) << "\"" << get_ray_type_name( static_cast< RayType >( i ) )
+            << "\": " << counters.rays[i];
+    }
+    out << "}, \"boxes\": " << counters.boxes << ", \"triangles\": " << counters.triangles
+        << ", \"spheres\": " << counters.spheres << ", \"max_depth\": " << counters.max_depth;
+}
+
+FrameStats::FrameStats() : m_time( 0 ) { }
+
+FrameStats::~FrameStats() { }
+
+void FrameStats::clear()
+{
+    m_threads.clear();
+    m_time = 0;
+}
+
+void FrameStats::add_thread( size_t thread, const TraceCounters& counters, uint64_t busy_time )
+{
+    if ( thread >= m_threads.size() ) {
+        ThreadStats idle;
+        idle.busy_time = 0;
+        m_threads.resize( thread + 1, idle );
+    }
+    m_threads[thread].counters.add( counters );
+    m_threads[thread].busy_time += busy_time;
+}
+
+TraceCounters FrameStats::get_totals() const
+{
+    TraceCounters totals;
+    for ( size_t i = 0; i < m_threads.size(); ++i )
+        totals.add( m_threads[i].counters );
+    return totals;
+}
+
+double FrameStats::get_rays_per_second() const
+{
+    if ( 0 == m_time )
+        return 0;
+    return static_cast< double >( get_totals().total_rays() ) * 1e9 / static_cast< double >( m_time );
+}
+
+void FrameStats::print( std::ostream& out ) const
+{
+    TraceCounters totals = get_totals();
+    double rays = static_cast< double >( totals.total_rays() );
+    char line[256];
+    sprintf( line, "Traced %.0f rays in %.0f milliseconds, %.2f million rays per second, on %u threads.\n",
+             rays, to_milliseconds( m_time ), get_rays_per_second() / 1e6, (unsigned int)m_threads.size() );
+    out << line << " ";
+    for ( size_t i = 0; i < NUM_RAY_TYPES; ++i ) {
+        out << ( i > 0 ? ", " : " " ) << get_ray_type_name( static_cast< RayType >( i ) ) << " "
+            << totals.rays[i];
+    }
+    out << ".\n";
+
+    if ( rays > 0 ) {
+        sprintf( line, "  %.1f box, %.1f triangle and %.2f sphere tests per ray, bounces up to %u.\n",
+                 totals.boxes / rays, totals.triangles / rays, totals.spheres / rays, totals.max_depth );
+        out << line;
+    }
+
+    // uneven busy times show threads waiting on others at the end of a pass
+    for ( size_t i = 0; i < m_threads.size(); ++i ) {
+        const ThreadStats& thread = m_threads[i];
+        sprintf( line, "  thread %u: %.0f rays, busy %.0f milliseconds.\n", (unsigned int)i,
+                 static_cast< double >( thread.counters.total_rays() ), to_milliseconds( thread.busy_time ) );
+        out << line;
+    }
+}
+
+void FrameStats::write_json( std::ostream& out ) const
+{
+    out << "{\"time_ms\": " << to_milliseconds( m_time ) << ", \"rays_per_second\": "
+        << static_cast< uint64_t >( get_rays_per_second() ) << ", ";
+    write_json_counters( out, get_totals() );
+    out << ", \"threads\": [";
+    for ( size_t i = 0; i < m_threads.size(); ++i ) {
+        out << ( i > 0 ? ", " : "" ) << "{\"busy_ms\": " << to_milliseconds( m_threads[i].busy_time ) << ", ";
+        write_json_counters( out, m_threads[i].counters );
+        out << "}";
+    }
+    out << "]}";
+}
+
+} /* Luc */
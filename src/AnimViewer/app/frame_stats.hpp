@@ -0,0 +1,68 @@
+/**
+ * @file frame_stats.hpp
+ * @brief What tracing an image cost, per tracing thread, reported as text
+ *  or JSON.
+ */
+
+#ifndef _LUC_APP_FRAME_STATS_HPP_
+#define _LUC_APP_FRAME_STATS_HPP_
+
+#include "scene/trace_counters.hpp"
+
+#include <iosfwd>
+#include <vector>
+
+namespace Luc {
+
+/*
+ * The rays and intersection tests of an image, and the wall clock time it
+ * took. Each tracing thread counts into TraceCounters of its own, without
+ * locks, and hands them over when a raytrace call ends; the raytracer
+ * does so under its tile lock, as these are not thread safe.
+ */
+class FrameStats
+{
+public:
+
+    FrameStats();
+    ~FrameStats();
+
+    void clear();
+
+    /*
+     * Adds what a tracing thread did in a raytrace call.
+     * @param busy_time Nanoseconds it spent tracing tiles, without waiting.
+     */
+    void add_thread( size_t thread, const TraceCounters& counters, uint64_t busy_time );
+    /// Adds the wall clock nanoseconds of a raytrace call.
+    void add_time( uint64_t time ) { m_time += time; }
+
+    /// The counts of every thread together.
+    TraceCounters get_totals() const;
+    /// Wall clock nanoseconds spent tracing.
+    uint64_t get_time() const { return m_time; }
+    double get_rays_per_second() const;
+
+    /// Prints a report of a few lines.
+    void print( std::ostream& out ) const;
+    /*
+     * Writes the report as a JSON object, with the totals, the rays of
+     * each type, and the counts and busy time of each thread.
+     */
+    void write_json( std::ostream& out ) const;
+
+private:
+
+    struct ThreadStats
+    {
+        TraceCounters counters;
+        uint64_t busy_time;
+    };
+
+    std::vector< ThreadStats > m_threads;
+    uint64_t m_time;
+};
+
+} /* Luc */
+
+#endif /* _LUC_APP_FRAME_STATS_HPP_ */
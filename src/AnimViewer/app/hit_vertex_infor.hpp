@@ -30,6 +30,15 @@ struct HitVertexInfor
     // infinity, i.e. opaque. Any other value means transparent with the
     // given refractive index.
     real_t refractive_index;
+
+    // baked ambient occlusion, 1 in the open and 0 fully enclosed
+    real_t occlusion;
+
+    // change of the position and normal per pixel, only set if the ray
+    // carried differentials
+    bool has_differential;
+    Vector3 dpdx, dpdy;
+    Vector3 dndx, dndy;
 };
 
 }
@@ -0,0 +1,313 @@
+/**
+ * @file irradiance_cache.cpp
+ * @brief Cache of indirect diffuse irradiance samples, interpolated between.
+ */
+#include "lucPCH.h"
+#include "irradiance_cache.hpp"
+
+#include <boost/thread/locks.hpp>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <ostream>
+
+namespace Luc {
+
+// deepest level of the octree
+static const unsigned int MAX_OCTREE_DEPTH = 20;
+
+static Color3 difference( const Color3& a, const Color3& b )
+{
+    return Color3( a.r - b.r, a.g - b.g, a.b - b.b );
+}
+
+IrradianceSettings::IrradianceSettings()
+    : max_error( 0.2f ), theta_strata( 8 ), min_pixels( 1.5f ), max_pixels( 20 ),
+      max_memory( 64 * 1024 * 1024 ) { }
+
+IrradianceCache::Node::Node()
+{
+    std::fill( children, children + 8, -1 );
+}
+
+IrradianceCache::IrradianceCache()
+    : m_half_size( 0 ), m_valid( false ), m_memory( 0 ), m_rejected( 0 ) { }
+
+IrradianceCache::~IrradianceCache() { }
+
+void IrradianceCache::reset( const BoundingBox& bounds )
+{
+    boost::unique_lock< boost::shared_mutex > lock( m_mutex );
+    std::vector< IrradianceRecord >().swap( m_records );
+    m_nodes.assign( 1, Node() );
+    m_bounds = bounds;
+
+    // a cube around the bounds, so the octants stay cubes
+    Vector3 lo = bounds.get_left_bottom_front_corner();
+    Vector3 hi = bounds.get_right_top_back_corner();
+    m_center = ( lo + hi ) * 0.5f;
+    m_half_size = std::max( std::max( hi.x - lo.x, hi.y - lo.y ), hi.z - lo.z ) * 0.5f * 1.01f;
+    m_half_size = std::max( m_half_size, 1e-3f );
+    m_memory = sizeof( Node );
+    m_valid = true;
+}
+
+bool IrradianceCache::is_valid_for( const BoundingBox& bounds ) const
+{
+    boost::shared_lock< boost::shared_mutex > lock( m_mutex );
+    return m_valid &&
+           m_bounds.get_left_bottom_front_corner() == bounds.get_left_bottom_front_corner() &&
+           m_bounds.get_right_top_back_corner() == bounds.get_right_top_back_corner();
+}
+
+void IrradianceCache::clear()
+{
+    boost::unique_lock< boost::shared_mutex > lock( m_mutex );
+    std::vector< IrradianceRecord >().swap( m_records );
+    m_nodes.assign( 1, Node() );
+    m_memory = sizeof( Node );
+    m_valid = false;
+}
+
+real_t IrradianceCache::weight( const IrradianceRecord& record, const Vector3& position, const Vector3& normal ) const
+{
+    real_t cos_normal = dot( normal, record.normal );
+    if ( cos_normal <= 0 )
+        return 0;
+
+    // a sample in front of the point sees other surroundings
+    Vector3 offset = position - record.position;
+    if ( dot( offset, normal + record.normal ) * 0.5f < -0.01f * record.radius )
+        return 0;
+
+    real_t error = length( offset ) / record.radius + sqrt( std::max< real_t >( 0, 1 - cos_normal ) );
+    if ( error >= settings.max_error )
+        return 0;
+    return 1 / std::max( error, 1e-6f );
+}
+
+bool IrradianceCache::lookup( const Vector3& position, const Vector3& normal, Color3* irradiance )
+{
+    Color3 sum( 0, 0, 0 );
+    real_t sum_weight = 0;
+    {
+        boost::shared_lock< boost::shared_mutex > lock( m_mutex );
+        if ( m_nodes.empty() )
+            return false;
+
+        // the records of every node down to the point's leaf may apply
+        uint32_t node = 0;
+        Vector3 center = m_center;
+        real_t half_size = m_half_size;
+        while ( true ) {
+            const std::vector< uint32_t >& records = m_nodes[node].records;
+            for ( size_t i = 0; i < records.size(); ++i ) {
+                const IrradianceRecord& record = m_records[records[i]];
+                real_t w = weight( record, position, normal );
+                if ( w <= 0 )
+                    continue;
+
+                // first order extrapolation to the point and its normal
+                Vector3 offset = position - record.position;
+                Vector3 turn = cross( record.normal, normal );
+                Color3 e( record.irradiance.r + dot( turn, record.rotational[0] ) + dot( offset, record.translational[0] ),
+                          record.irradiance.g + dot( turn, record.rotational[1] ) + dot( offset, record.translational[1] ),
+                          record.irradiance.b + dot( turn, record.rotational[2] ) + dot( offset, record.translational[2] ) );
+                sum += e * w;
+                sum_weight += w;
+            }
+
+            int child = ( position.x > center.x ? 1 : 0 ) |
+                        ( position.y > center.y ? 2 : 0 ) |
+                        ( position.z > center.z ? 4 : 0 );
+            if ( m_nodes[node].children[child] < 0 )
+                break;
+            node = static_cast< uint32_t >( m_nodes[node].children[child] );
+            half_size *= 0.5f;
+            center += Vector3( child & 1 ? half_size : -half_size,
+                               child & 2 ? half_size : -half_size,
+                               child & 4 ? half_size : -half_size );
+        }
+    }
+
+    bool hit = sum_weight > 0;
+    if ( hit ) {
+        Color3 e = sum * ( 1 / sum_weight );
+        *irradiance = Color3( std::max< real_t >( 0, e.r ), std::max< real_t >( 0, e.g ), std::max< real_t >( 0, e.b ) );
+    }
+
+    // counted by the thread, so lookups share no lock but the read lock
+    if ( TraceCounters* counters = get_trace_counters() ) {
+        counters->irradiance_lookups++;
+        if ( hit )
+            counters->irradiance_hits++;
+    }
+    return hit;
+}
+
+void IrradianceCache::insert( const IrradianceRecord& record )
+{
+    boost::unique_lock< boost::shared_mutex > lock( m_mutex );
+    if ( m_nodes.empty() || m_memory + sizeof( IrradianceRecord ) > settings.max_memory ) {
+        m_rejected++;
+        return;
+    }
+
+    uint32_t index = static_cast< uint32_t >( m_records.size() );
+    m_records.push_back( record );
+    m_memory += sizeof( IrradianceRecord );
+    insert_node( 0, m_center, m_half_size, index, record.position, settings.max_error * record.radius, 0 );
+}
+
+void IrradianceCache::insert_node( uint32_t node, const Vector3& center, real_t half_size,
+                                   uint32_t record, const Vector3& position, real_t influence, unsigned int depth )
+{
+    // a node not much larger than the area of influence keeps the record
+    if ( half_size < 2 * influence || depth >= MAX_OCTREE_DEPTH ) {
+        m_nodes[node].records.push_back( record );
+        m_memory += sizeof( uint32_t );
+        return;
+    }
+
+    real_t child_half_size = half_size * 0.5f;
+    bool inserted = false;
+    for ( int child = 0; child < 8; ++child ) {
+        Vector3 child_center = center + Vector3( child & 1 ? child_half_size : -child_half_size,
+                                                 child & 2 ? child_half_size : -child_half_size,
+                                                 child & 4 ? child_half_size : -child_half_size );
+        if ( fabs( position.x - child_center.x ) > child_half_size + influence ||
+             fabs( position.y - child_center.y ) > child_half_size + influence ||
+             fabs( position.z - child_center.z ) > child_half_size + influence )
+            continue;
+
+        if ( m_nodes[node].children[child] < 0 ) {
+            m_nodes[node].children[child] = static_cast< int32_t >( m_nodes.size() );
+            m_nodes.push_back( Node() );
+            m_memory += sizeof( Node );
+        }
+        insert_node( static_cast< uint32_t >( m_nodes[node].children[child] ), child_center, child_half_size,
+                     record, position, influence, depth + 1 );
+        inserted = true;
+    }
+
+    // outside the octree, the root keeps it
+    if ( !inserted ) {
+        m_nodes[node].records.push_back( record );
+        m_memory += sizeof( uint32_t );
+    }
+}
+
+Vector3 IrradianceCache::stratum_direction( const Vector3& normal, const Vector3& tangent, const Vector3& bitangent,
+                                            unsigned int j, unsigned int k, real_t u1, real_t u2 ) const
+{
+    real_t sin_theta = sqrt( ( j + u1 ) / get_theta_strata() );
+    real_t cos_theta = sqrt( std::max< real_t >( 0, 1 - sin_theta * sin_theta ) );
+    real_t phi = 2 * PI * ( k + u2 ) / get_phi_strata();
+    return tangent * ( sin_theta * cos( phi ) ) + bitangent * ( sin_theta * sin( phi ) ) + normal * cos_theta;
+}
+
+IrradianceRecord IrradianceCache::make_record( const Vector3& position, const Vector3& normal,
+                                               const Vector3& tangent, const Vector3& bitangent,
+                                               const Color3* radiance, const real_t* distance,
+                                               real_t pixel_size ) const
+{
+    const unsigned int M = get_theta_strata();
+    const unsigned int N = get_phi_strata();
+
+    IrradianceRecord record;
+    record.position = position;
+    record.normal = normal;
+    record.irradiance = Color3( 0, 0, 0 );
+    for ( int c = 0; c < 3; ++c ) {
+        record.rotational[c] = Vector3::Zero;
+        record.translational[c] = Vector3::Zero;
+    }
+
+    real_t inverse_distance_sum = 0;
+    for ( unsigned int k = 0; k < N; ++k ) {
+        real_t phi = 2 * PI * ( k + 0.5f ) / N;
+        real_t phi_minus = 2 * PI * k / N;
+        Vector3 u_k = tangent * cos( phi ) + bitangent * sin( phi );
+        Vector3 v_k = bitangent * cos( phi ) - tangent * sin( phi );
+        Vector3 v_k_minus = bitangent * cos( phi_minus ) - tangent * sin( phi_minus );
+        unsigned int k_prev = ( k + N - 1 ) % N;
+
+        Color3 rotational_sum( 0, 0, 0 );
+        for ( unsigned int j = 0; j < M; ++j ) {
+            const Color3& L = radiance[k * M + j];
+            real_t R = distance[k * M + j];
+            record.irradiance += L;
+            inverse_distance_sum += 1 / R;
+
+            // turning the normal tilts the strata, weighted by tan(theta)
+            real_t sin_theta = sqrt( ( j + 0.5f ) / M );
+            real_t tan_theta = sin_theta / sqrt( 1 - sin_theta * sin_theta );
+            rotational_sum += L * -tan_theta;
+
+            // moving the point shifts the boundaries between the strata,
+            // toward the closer of the two surfaces each one sees
+            real_t sin_minus = sqrt( real_t( j ) / M );
+            real_t sin_plus = sqrt( real_t( j + 1 ) / M );
+            const Color3& L_prev_k = radiance[k_prev * M + j];
+            real_t R_prev_k = std::min( R, distance[k_prev * M + j] );
+            Color3 dL_phi = difference( L, L_prev_k ) * ( ( sin_plus - sin_minus ) / R_prev_k );
+            Color3 dL_theta( 0, 0, 0 );
+            if ( j > 0 ) {
+                const Color3& L_prev_j = radiance[k * M + j - 1];
+                real_t R_prev_j = std::min( R, distance[k * M + j - 1] );
+                real_t cos_sq_minus = 1 - sin_minus * sin_minus;
+                dL_theta = difference( L, L_prev_j ) * ( 2 * PI / N * sin_minus * cos_sq_minus / R_prev_j );
+            }
+            record.translational[0] += u_k * dL_theta.r + v_k_minus * dL_phi.r;
+            record.translational[1] += u_k * dL_theta.g + v_k_minus * dL_phi.g;
+            record.translational[2] += u_k * dL_theta.b + v_k_minus * dL_phi.b;
+        }
+        record.rotational[0] += v_k * rotational_sum.r;
+        record.rotational[1] += v_k * rotational_sum.g;
+        record.rotational[2] += v_k * rotational_sum.b;
+    }
+
+    real_t scale = PI / ( M * N );
+    record.irradiance *= scale;
+    for ( int c = 0; c < 3; ++c ) {
+        record.rotational[c] *= scale;
+    }
+
+    // harmonic mean distance of the surroundings, which bounds how far
+    // the irradiance stays about the same
+    real_t radius = inverse_distance_sum > 0 ? M * N / inverse_distance_sum : FLT_MAX;
+    // and no farther than the gradient takes it to zero
+    const real_t irradiance[3] = { record.irradiance.r, record.irradiance.g, record.irradiance.b };
+    for ( int c = 0; c < 3; ++c ) {
+        real_t gradient = length( record.translational[c] );
+        if ( gradient > 0 )
+            radius = std::min( radius, irradiance[c] / gradient );
+    }
+
+    // keep samples between a few pixels and a few dozen apart on screen
+    if ( pixel_size <= 0 )
+        pixel_size = m_half_size * 1e-3f;
+    record.radius = std::max( settings.min_pixels * pixel_size, std::min( radius, settings.max_pixels * pixel_size ) );
+    return record;
+}
+
+void IrradianceCache::reset_stats()
+{
+    boost::unique_lock< boost::shared_mutex > lock( m_mutex );
+    m_rejected = 0;
+}
+
+void IrradianceCache::print_stats( std::ostream& os, const TraceCounters& counters ) const
+{
+    boost::shared_lock< boost::shared_mutex > lock( m_mutex );
+    uint64_t lookups = counters.irradiance_lookups;
+    uint64_t hits = counters.irradiance_hits;
+    os << "Irradiance cache: " << m_records.size() << " samples, " << m_memory / 1024
+       << " of " << settings.max_memory / 1024 << " KB, " << lookups << " lookups, "
+       << hits << " hits, " << m_rejected << " over budget";
+    if ( lookups > 0 )
+        os << " (" << 100.0 * hits / lookups << "% hit rate)";
+    os << ".\n";
+}
+
+} /* Luc */
@@ -0,0 +1,150 @@
+/**
+ * @file irradiance_cache.hpp
+ * @brief Cache of indirect diffuse irradiance samples, interpolated between.
+ */
+
+#ifndef _LUC_APP_IRRADIANCE_CACHE_HPP_
+#define _LUC_APP_IRRADIANCE_CACHE_HPP_
+
+#include "math/color.hpp"
+#include "math/vector.hpp"
+#include "scene/bounding_box.hpp"
+#include "scene/trace_counters.hpp"
+
+#include <boost/thread/shared_mutex.hpp>
+#include <iosfwd>
+#include <vector>
+
+namespace Luc {
+
+struct IrradianceSettings
+{
+    IrradianceSettings();
+
+    // largest allowed interpolation error, Ward's 'a'; smaller is more samples
+    real_t max_error;
+    // strata of the hemisphere rays of a sample, with three times as many
+    // strata around the normal as away from it
+    unsigned int theta_strata;
+    // bounds of a sample's radius of validity, in pixels at the sample
+    real_t min_pixels;
+    real_t max_pixels;
+    // most memory of the cached samples, past which new ones are not kept
+    size_t max_memory;
+};
+
+/*
+ * The irradiance at a point, with its gradients for moving the point and
+ * turning its normal (Ward and Heckbert, "Irradiance Gradients").
+ */
+struct IrradianceRecord
+{
+    Vector3 position;
+    Vector3 normal;
+    Color3  irradiance;
+    // harmonic mean distance of the surfaces around, clamped
+    real_t  radius;
+    // gradients of the red, green and blue irradiance
+    Vector3 rotational[3];
+    Vector3 translational[3];
+};
+
+/*
+ * Indirect diffuse light changes slowly over a surface, so it is computed
+ * at a few points and interpolated in between (Ward et al., "A Ray Tracing
+ * Solution for Diffuse Interreflection"). Samples are kept in an octree
+ * by their area of influence, and looked up and added by any number of
+ * threads at once.
+ *
+ * The samples only depend on the scene, not on the camera, so the cache
+ * stays valid when the camera moves, as long as geometry and lights stay.
+ */
+class IrradianceCache
+{
+public:
+
+    IrradianceCache();
+    ~IrradianceCache();
+
+    /// Drops every sample, and sets the space the octree divides.
+    void reset( const BoundingBox& bounds );
+    /// True if reset with these bounds and not cleared since.
+    bool is_valid_for( const BoundingBox& bounds ) const;
+    /// Drops every sample, until the next reset.
+    void clear();
+
+    /*
+     * Interpolates the irradiance at a point from the samples around.
+     * @return false if no sample is close enough, or all disagree.
+     */
+    bool lookup( const Vector3& position, const Vector3& normal, Color3* irradiance );
+
+    /// Adds a sample, unless the memory budget is used up.
+    void insert( const IrradianceRecord& record );
+
+    /*
+     * Direction of the hemisphere ray of stratum (j, k), j counting away
+     * from the normal and k around it, with (u1, u2) its place within it.
+     * The directions have a cosine distributed density.
+     */
+    Vector3 stratum_direction( const Vector3& normal, const Vector3& tangent, const Vector3& bitangent,
+                               unsigned int j, unsigned int k, real_t u1, real_t u2 ) const;
+
+    /*
+     * Computes a sample from the radiance and hit distance along its
+     * hemisphere rays, theta_strata * phi_strata of them, k major.
+     */
+    IrradianceRecord make_record( const Vector3& position, const Vector3& normal,
+                                  const Vector3& tangent, const Vector3& bitangent,
+                                  const Color3* radiance, const real_t* distance,
+                                  real_t pixel_size ) const;
+
+    unsigned int get_theta_strata() const { return settings.theta_strata; }
+    unsigned int get_phi_strata() const { return 3 * settings.theta_strata; }
+
+    void reset_stats();
+    /*
+     * Prints the cache size along with the lookups and hits, which each
+     * tracing thread counts in its trace counters.
+     * @param counters  The counters of all tracing threads, summed.
+     */
+    void print_stats( std::ostream& os, const TraceCounters& counters ) const;
+
+    IrradianceSettings settings;
+
+private:
+
+    struct Node
+    {
+        Node();
+        int32_t children[8];
+        std::vector< uint32_t > records;
+    };
+
+    // adds a record to the nodes its influence overlaps, below 'node'
+    void insert_node( uint32_t node, const Vector3& center, real_t half_size,
+                      uint32_t record, const Vector3& position, real_t influence, unsigned int depth );
+
+    // weight of a record at a point, 0 if it does not apply there
+    real_t weight( const IrradianceRecord& record, const Vector3& position, const Vector3& normal ) const;
+
+    // guards the records, the octree and m_rejected
+    mutable boost::shared_mutex m_mutex;
+    std::vector< IrradianceRecord > m_records;
+    std::vector< Node > m_nodes;
+    BoundingBox m_bounds;
+    Vector3 m_center;
+    real_t m_half_size;
+    bool m_valid;
+    size_t m_memory;
+    // records not inserted as the cache was full
+    size_t m_rejected;
+
+    // prevent copy/assignment
+    IrradianceCache( const IrradianceCache& );
+    IrradianceCache& operator=( const IrradianceCache& );
+};
+
+} /* Luc */
+
+#endif /* _LUC_APP_IRRADIANCE_CACHE_HPP_ */
@@ -1,7 +1,9 @@
 #include "lucPCH.h"
 #include "options.hpp"
+#include "raytracer.hpp"
 #include <stdio.h>
 #include <algorithm>
+#include <iostream>
 #include <boost/algorithm/string/trim.hpp>
 #include "platform/path.h"
 
@@ -84,6 +86,112 @@ bool Options::LoadConfig()
                 mFps = static_cast<float>(atof(str.c_str()));
                 noError &= true;
             }
+            else if (0 == key.compare("bvh_cache"))
+            {
+                mUseBvhCache = (0 != atoi(str.c_str()));
+                noError &= true;
+            }
+            else if (0 == key.compare("bvh_cache_dir"))
+            {
+                mBvhCacheDir = str;
+                noError &= true;
+            }
+            else if (0 == key.compare("page_budget_mb"))
+            {
+                // a negative budget would wrap to a huge one as a size_t
+                mPageBudgetMB = std::max(0, atoi(str.c_str()));
+                noError &= true;
+            }
+            else if (0 == key.compare("threads"))
+            {
+                mThreads = atoi(str.c_str());
+                noError &= true;
+            }
+            else if (0 == key.compare("tessellation_budget_mb"))
+            {
+                mTessellationBudgetMB = std::max(0, atoi(str.c_str()));
+                noError &= true;
+            }
+            else if (0 == key.compare("sampler"))
+            {
+                mSampler = str;
+                noError &= true;
+            }
+            else if (0 == key.compare("shadow_samples"))
+            {
+                mShadowSamples = atoi(str.c_str());
+                noError &= true;
+            }
+            else if (0 == key.compare("light_samples"))
+            {
+                mLightSamples = atoi(str.c_str());
+                noError &= true;
+            }
+            else if (0 == key.compare("denoise"))
+            {
+                mDenoise = (0 != atoi(str.c_str()));
+                noError &= true;
+            }
+            else if (0 == key.compare("irradiance_cache"))
+            {
+                mIrradianceCache = (0 != atoi(str.c_str()));
+                noError &= true;
+            }
+            else if (0 == key.compare("photons"))
+            {
+                mPhotons = atoi(str.c_str());
+                noError &= true;
+            }
+            else if (0 == key.compare("photon_gather"))
+            {
+                mPhotonGather = atoi(str.c_str());
+                noError &= true;
+            }
+            else if (0 == key.compare("photon_radius"))
+            {
+                mPhotonRadius = static_cast<float>(atof(str.c_str()));
+                noError &= true;
+            }
+            else if (0 == key.compare("proxy_depth"))
+            {
+                mProxyDepth = atoi(str.c_str());
+                noError &= true;
+            }
+            else if (0 == key.compare("proxy_shadows"))
+            {
+                mProxyShadows = (0 != atoi(str.c_str()));
+                noError &= true;
+            }
+            else if (0 == key.compare("live_view"))
+            {
+                mLiveView = (0 != atoi(str.c_str()));
+                noError &= true;
+            }
+            else if (0 == key.compare("region_samples"))
+            {
+                mRegionSamples = atoi(str.c_str());
+                noError &= true;
+            }
+            else if (0 == key.compare("checkpoint"))
+            {
+                mCheckpoint = str;
+                noError &= true;
+            }
+            else if (0 == key.compare("checkpoint_interval"))
+            {
+                mCheckpointInterval = static_cast<float>(atof(str.c_str()));
+                noError &= true;
+            }
+            else if (0 == key.compare("resume"))
+            {
+                mResume = (0 != atoi(str.c_str()));
+                noError &= true;
+            }
+            else if (0 == key.compare("cost_map"))
+            {
+                mCostMap = str;
+                noError &= true;
+            }
         }
     }
     if (input_filename.empty())
@@ -92,7 +200,7 @@ bool Options::LoadConfig()
     return noError;
 }
 
-Options::Options() : m_bInitialized(false), m_FCNHandle(Luc::FileChangeNotification::INVALID_HANDLE)
+Options::Options() : width(800), height(600), mFps(30), mUseBvhCache(true), mPageBudgetMB(256), mTessellationBudgetMB(64), mThreads(0), mDenoise(false), mShadowSamples(32), mLightSamples(8), mIrradianceCache(false), mPhotons(100000), mPhotonGather(64), mPhotonRadius(0), mProxyDepth(1), mProxyShadows(true), mLiveView(false), mRegionSamples(3), mCheckpointInterval(300), mResume(false), m_bInitialized(false), m_FCNHandle(Luc::FileChangeNotification::INVALID_HANDLE)
 {
     if (false == m_bInitialized)
     {
@@ -112,3 +220,26 @@ void Options::OnFileChangeNotification()
 {
     LoadConfig();
 }
+
+void apply_raytracer_options( const Options& options, Luc::Raytracer* raytracer )
+{
+    raytracer->set_num_threads( options.mThreads );
+    raytracer->set_denoise( options.mDenoise );
+    raytracer->set_shadow_samples( static_cast< unsigned int >( std::max( 1, options.mShadowSamples ) ) );
+    raytracer->set_light_samples( static_cast< unsigned int >( std::max( 0, options.mLightSamples ) ) );
+    raytracer->set_irradiance_caching( options.mIrradianceCache );
+    raytracer->set_proxy_depth( static_cast< unsigned int >( std::max( 0, options.mProxyDepth ) ) );
+    raytracer->set_proxy_shadows( options.mProxyShadows );
+    raytracer->set_cost_recording( !options.mCostMap.empty() );
+    Luc::PhotonSettings& photon_settings = raytracer->get_photon_settings();
+    photon_settings.photon_count = static_cast< size_t >( std::max( 0, options.mPhotons ) );
+    photon_settings.gather_count = static_cast< size_t >( std::max( 1, options.mPhotonGather ) );
+    photon_settings.gather_radius = std::max( 0.0f, options.mPhotonRadius );
+    if ( !options.mSampler.empty() ) {
+        Luc::SamplerType sampler_type;
+        if ( Luc::Sampler::parse_type( options.mSampler.c_str(), &sampler_type ) )
+            raytracer->set_sampler( sampler_type );
+        else
+            std::cout << "unknown sampler '" << options.mSampler << "'.\n";
+    }
+}
@@ -26,6 +26,28 @@ public:
     int width, height; // window dimensions
     float mFps;
 
+    bool        mUseBvhCache;   // map mesh BVHs from disk instead of rebuilding
+    std::string mBvhCacheDir;   // empty to store BVH caches next to the meshes
+    int         mPageBudgetMB;  // resident set budget of out-of-core meshes, never negative
+    int         mTessellationBudgetMB;  // budget of patches tessellated on demand, never negative
+    int         mThreads;       // raytracing threads, 0 for one per core
+    bool        mDenoise;       // denoise raytraced images
+    std::string mSampler;       // path tracing sample sequence, sobol if empty
+    int         mShadowSamples; // most shadow rays per area light and point
+    int         mLightSamples;  // lights shaded per point in scenes with more, 0 for all
+    bool        mIrradianceCache;   // cached indirect diffuse light instead of ambient
+    int         mPhotons;       // photons shot for caustics, 0 for none
+    int         mPhotonGather;  // photons averaged per caustics lookup
+    float       mPhotonRadius;  // largest caustics lookup radius, 0 for automatic
+    int         mProxyDepth;    // first bounce that traces mesh proxies, 0 for never
+    bool        mProxyShadows;  // shadow rays trace mesh proxies
+    bool        mLiveView;      // raytraced view follows the camera at the frame rate
+    int         mRegionSamples; // eye rays per pixel side of a dragged region
+    std::string mCheckpoint;    // file the render progress is saved to, empty for none
+    float       mCheckpointInterval;    // seconds between checkpoints
+    bool        mResume;        // go on from the checkpoint when raytracing starts
+    std::string mCostMap;       // name of the pixel cost maps saved with the image, empty for none
+
 private:
     bool m_bInitialized;
     Luc::FileChangeNotification::FCNHandle m_FCNHandle;
@@ -37,4 +59,12 @@ private:
 
 //Loki::SingletonHolder<Options>
 
+namespace Luc { class Raytracer; }
+
+/**
+ * Sets up a raytracer with the tracing options, shared by the viewer and
+ * the batch renderer.
+ */
+void apply_raytracer_options( const Options& options, Luc::Raytracer* raytracer );
+
 #endif // APPLICATION_OPTIONS_H
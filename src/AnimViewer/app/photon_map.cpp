@@ -0,0 +1,168 @@
+/**
+ * @file photon_map.cpp
+ * @brief Photons stored in a kd-tree, for the caustics of refractive geometry.
+ */
+#include "lucPCH.h"
+#include "photon_map.hpp"
+#include "scene/bounding_box.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace Luc {
+
+// most photons of a lookup, which live on the stack
+static const size_t MAX_GATHER = 256;
+// slope of the cone filter, from full weight at the point to 1 - 1/k at the radius
+static const real_t CONE_FILTER_K = 1.1f;
+
+namespace {
+
+struct PositionLess
+{
+    const Photon* photons;
+    size_t axis;
+
+    bool operator()( uint32_t a, uint32_t b ) const
+    {
+        return photons[a].position[axis] < photons[b].position[axis];
+    }
+};
+
+} // namespace
+
+PhotonSettings::PhotonSettings() : photon_count( 100000 ), gather_count( 64 ), gather_radius( 0 ) { }
+
+PhotonMap::PhotonMap() : m_max_radius( 0 ) { }
+
+PhotonMap::~PhotonMap() { }
+
+void PhotonMap::clear()
+{
+    std::vector< Photon >().swap( m_photons );
+}
+
+void PhotonMap::build( std::vector< Photon >& photons, real_t max_radius )
+{
+    std::vector< uint32_t > order( photons.size() );
+    for ( size_t i = 0; i < order.size(); ++i ) {
+        order[i] = static_cast< uint32_t >( i );
+    }
+    build_node( order, 0, order.size(), photons );
+
+    m_photons.resize( photons.size() );
+    for ( size_t i = 0; i < order.size(); ++i ) {
+        m_photons[i] = photons[order[i]];
+    }
+    std::vector< Photon >().swap( photons );
+    m_max_radius = max_radius;
+}
+
+void PhotonMap::build_node( std::vector< uint32_t >& order, size_t begin, size_t end, std::vector< Photon >& photons )
+{
+    if ( begin >= end )
+        return;
+
+    // split at the median along the axis of the largest extent
+    BoundingBox bounds;
+    for ( size_t i = begin; i < end; ++i ) {
+        bounds.filter_vertex( photons[order[i]].position );
+    }
+    Vector3 extent = bounds.get_right_top_back_corner() - bounds.get_left_bottom_front_corner();
+    PositionLess less = { &photons[0], 0 };
+    if ( extent.y > extent[less.axis] ) less.axis = 1;
+    if ( extent.z > extent[less.axis] ) less.axis = 2;
+    size_t mid = begin + ( end - begin ) / 2;
+    std::nth_element( order.begin() + begin, order.begin() + mid, order.begin() + end, less );
+    photons[order[mid]].axis = static_cast< uint32_t >( less.axis );
+
+    build_node( order, begin, mid, photons );
+    build_node( order, mid + 1, end, photons );
+}
+
+void PhotonMap::locate( size_t begin, size_t end, const Vector3& position, size_t count,
+                        Neighbor* neighbors, size_t* found, real_t* max_distance_sq ) const
+{
+    if ( begin >= end )
+        return;
+
+    size_t mid = begin + ( end - begin ) / 2;
+    const Photon& photon = m_photons[mid];
+
+    // the side of the split the point is on first, the other if it is close
+    real_t delta = position[photon.axis] - photon.position[photon.axis];
+    if ( delta < 0 ) {
+        locate( begin, mid, position, count, neighbors, found, max_distance_sq );
+        if ( delta * delta < *max_distance_sq )
+            locate( mid + 1, end, position, count, neighbors, found, max_distance_sq );
+    } else {
+        locate( mid + 1, end, position, count, neighbors, found, max_distance_sq );
+        if ( delta * delta < *max_distance_sq )
+            locate( begin, mid, position, count, neighbors, found, max_distance_sq );
+    }
+
+    Vector3 offset = photon.position - position;
+    real_t distance_sq = dot( offset, offset );
+    if ( distance_sq >= *max_distance_sq )
+        return;
+
+    Neighbor neighbor = { distance_sq, static_cast< uint32_t >( mid ) };
+    if ( *found < count ) {
+        // sift up into the heap
+        size_t i = ( *found )++;
+        while ( i > 0 && neighbors[( i - 1 ) / 2] < neighbor ) {
+            neighbors[i] = neighbors[( i - 1 ) / 2];
+            i = ( i - 1 ) / 2;
+        }
+        neighbors[i] = neighbor;
+    } else {
+        // replace the farthest, and sift down
+        size_t i = 0;
+        while ( true ) {
+            size_t child = 2 * i + 1;
+            if ( child >= count )
+                break;
+            if ( child + 1 < count && neighbors[child] < neighbors[child + 1] )
+                child++;
+            if ( !( neighbor < neighbors[child] ) )
+                break;
+            neighbors[i] = neighbors[child];
+            i = child;
+        }
+        neighbors[i] = neighbor;
+    }
+
+    // once full, only closer photons than the farthest one matter
+    if ( *found == count )
+        *max_distance_sq = neighbors[0].distance_sq;
+}
+
+Color3 PhotonMap::irradiance( const Vector3& position, const Vector3& normal, size_t count ) const
+{
+    count = std::min( count, MAX_GATHER );
+    if ( m_photons.empty() || 0 == count )
+        return Color3::Black;
+
+    Neighbor neighbors[MAX_GATHER];
+    size_t found = 0;
+    real_t max_distance_sq = m_max_radius * m_max_radius;
+    locate( 0, m_photons.size(), position, count, neighbors, &found, &max_distance_sq );
+    if ( 0 == found )
+        return Color3::Black;
+
+    // the photons are spread over the disc to the farthest of them, or the
+    // whole gather radius if there were fewer
+    real_t radius = sqrt( max_distance_sq );
+    Color3 sum = Color3::Black;
+    for ( size_t i = 0; i < found; ++i ) {
+        const Photon& photon = m_photons[neighbors[i].photon];
+        if ( dot( normal, photon.direction ) <= 0 )
+            continue;
+        real_t weight = 1 - sqrt( neighbors[i].distance_sq ) / ( CONE_FILTER_K * radius );
+        sum += photon.power * weight;
+    }
+    real_t area = ( 1 - 2 / ( 3 * CONE_FILTER_K ) ) * PI * radius * radius;
+    return sum * ( 1 / area );
+}
+
+} /* Luc */
@@ -0,0 +1,107 @@
+/**
+ * @file photon_map.hpp
+ * @brief Photons stored in a kd-tree, for the caustics of refractive geometry.
+ */
+
+#ifndef _LUC_APP_PHOTON_MAP_HPP_
+#define _LUC_APP_PHOTON_MAP_HPP_
+
+#include "math/color.hpp"
+#include "math/vector.hpp"
+
+#include <vector>
+
+namespace Luc {
+
+struct PhotonSettings
+{
+    PhotonSettings();
+
+    // photons shot at the refractive geometry of a scene, 0 for no caustics
+    size_t photon_count;
+    // nearest photons averaged per lookup
+    size_t gather_count;
+    // largest distance of the photons of a lookup, in world units, or 0 to
+    // take it from the size of the refractive geometry
+    real_t gather_radius;
+};
+
+/*
+ * A bundle of light that went through refractive geometry and stopped at
+ * a diffuse surface.
+ */
+struct Photon
+{
+    Vector3 position;
+    // the way it came from, away from the surface
+    Vector3 direction;
+    // the irradiance it carries, times the area of the lookups it is in
+    Color3  power;
+    // axis of its split in the kd-tree
+    uint32_t axis;
+};
+
+/*
+ * Photons in a balanced kd-tree, each node the median of its photons along
+ * the axis of their largest extent (Jensen, "Realistic Image Synthesis Using
+ * Photon Mapping"). The tree is implicit in the order of the photons: the
+ * photons [begin, end) of a subtree have their split at the middle, and the
+ * two halves around it as children. Lookups only read, so any number of
+ * threads may share them.
+ */
+class PhotonMap
+{
+public:
+
+    PhotonMap();
+    ~PhotonMap();
+
+    /// Drops every photon.
+    void clear();
+
+    /*
+     * Builds the tree, taking the photons.
+     *
+     * @param photons       The photons, left empty.
+     * @param max_radius    Largest distance of the photons of a lookup.
+     */
+    void build( std::vector< Photon >& photons, real_t max_radius );
+
+    bool empty() const { return m_photons.empty(); }
+    size_t size() const { return m_photons.size(); }
+
+    /*
+     * Estimates the irradiance at a surface from the photons closest to a
+     * point on it, weighted by a cone filter that keeps caustics sharp.
+     *
+     * @param position  The point.
+     * @param normal    Normal of the side lit by the photons.
+     * @param count     Most photons to gather.
+     */
+    Color3 irradiance( const Vector3& position, const Vector3& normal, size_t count ) const;
+
+private:
+
+    struct Neighbor
+    {
+        real_t distance_sq;
+        uint32_t photon;
+
+        bool operator<( const Neighbor& other ) const { return distance_sq < other.distance_sq; }
+    };
+
+    // sorts order[begin, end) into the subtree over those photons
+    void build_node( std::vector< uint32_t >& order, size_t begin, size_t end, std::vector< Photon >& photons );
+
+    // adds the photons of [begin, end) closer than max_distance_sq to the
+    // max-heap of neighbors, which shrinks max_distance_sq once full
+    void locate( size_t begin, size_t end, const Vector3& position, size_t count,
+                 Neighbor* neighbors, size_t* found, real_t* max_distance_sq ) const;
+
+    std::vector< Photon > m_photons;
+    real_t m_max_radius;
+};
+
+} /* Luc */
+
+#endif /* _LUC_APP_PHOTON_MAP_HPP_ */
@@ -1,8 +1,15 @@
 #include "lucPCH.h"
 #include "raycasting.hpp"
+#include "scene/trace_counters.hpp"
+
+#include <algorithm>
+#include <cmath>
 
 namespace Luc{
 
+// most probes taken along the footprint of a pixel on a texture
+static const float MAX_ANISOTROPY = 8;
+
 /**
  * Ray casting  for triangle. 
  * This function is called by both Model and Triangle.
@@ -20,6 +27,10 @@ bool ray_casting_triangle(const Ray& line,
                           const real_t tMin, const real_t tMax,
                           float& t,          float& beta,       float& gamma)
 {
+    TraceCounters* counters = get_trace_counters();
+    if (counters)
+        counters->triangles++;
+
     // see Shirley's Fundamentals of Computer Graphics, page 208
     Vector3 edge1 = p0 - p1;
     Vector3 edge2 = p0 - p2;
@@ -62,15 +73,16 @@ bool ray_casting_triangle(const Ray& line,
     return true;
 }
 
-Color3 interpolate_texture_color(Vector2 tex_coord, const Material* material)
+// bilinear lookup into one mip level of a texture
+static Color3 interpolate_texture_level(Vector2 tex_coord, const Material* material, int level)
 {
     float x = tex_coord.x - int(tex_coord.x);
     float y = tex_coord.y - int(tex_coord.y);
     if (x<0) x = x + 1.0f;
     if (y<0) y = y + 1.0f;
 
-    int tex_width  = material->get_texture_width();
-    int tex_height = material->get_texture_height();
+    int tex_width, tex_height;
+    material->get_texture_level_size(level, &tex_width, &tex_height);
     float x_repeated = x * tex_width;
     float y_repeated = y * tex_height;
     int left    = int(x_repeated);
@@ -83,16 +95,108 @@ Color3 interpolate_texture_color(Vector2 tex_coord, const Material* material)
     if (top == tex_height)
         top = 0;
 
-    Color3 lt_color = material->get_texture_pixel(left,  top);
-    Color3 lb_color = material->get_texture_pixel(left,  bottom);
-    Color3 rt_color = material->get_texture_pixel(right, top);
-    Color3 rb_color = material->get_texture_pixel(right, bottom);
+    Color3 lt_color = material->get_texture_pixel(left,  top,    level);
+    Color3 lb_color = material->get_texture_pixel(left,  bottom, level);
+    Color3 rt_color = material->get_texture_pixel(right, top,    level);
+    Color3 rb_color = material->get_texture_pixel(right, bottom, level);
 
     Color3 tex_color = bilinear_interpolation( lt_color, lb_color, rt_color, rb_color, 
                                                x_repeated-left, y_repeated-bottom );
     return tex_color;
 }
 
+Color3 interpolate_texture_color(Vector2 tex_coord, const Material* material)
+{
+    if (0 == material->get_texture_levels())
+        return Color3::White;
+    return interpolate_texture_level(tex_coord, material, 0);
+}
+
+// trilinear lookup, blending the two mip levels around a level of detail
+static Color3 interpolate_texture_lod(Vector2 tex_coord, const Material* material, float lod)
+{
+    int levels = material->get_texture_levels();
+    lod = std::min<float>(std::max<float>(lod, 0), float(levels - 1));
+    int level = int(lod);
+    float blend = lod - level;
+    Color3 tex_color = interpolate_texture_level(tex_coord, material, level);
+    if (blend > 0 && level + 1 < levels)
+        tex_color = tex_color * (1 - blend) +
+                    interpolate_texture_level(tex_coord, material, level + 1) * blend;
+    return tex_color;
+}
+
+Color3 interpolate_texture_color(Vector2 tex_coord, const Material* material,
+                                 const Vector2& dtdx, const Vector2& dtdy)
+{
+    if (0 == material->get_texture_levels())
+        return Color3::White;
+
+    // footprint of the pixel in texels of the finest level
+    Vector2 size(real_t(material->get_texture_width()), real_t(material->get_texture_height()));
+    Vector2 axis_x(dtdx.x * size.x, dtdx.y * size.y);
+    Vector2 axis_y(dtdy.x * size.x, dtdy.y * size.y);
+    float length_x = length(axis_x);
+    float length_y = length(axis_y);
+    Vector2 major = length_x > length_y ? dtdx : dtdy;
+    float major_length = std::max(length_x, length_y);
+    float minor_length = std::min(length_x, length_y);
+
+    // a footprint within one texel is magnified, or the differentials were lost
+    if (!(major_length > 1.0f))
+        return interpolate_texture_level(tex_coord, material, 0);
+
+    // a stretched footprint is covered by several probes along its major
+    // axis, each filtered to the width of the minor axis
+    int probes = int(ceil(std::min(major_length / std::max(minor_length, 1e-6f), MAX_ANISOTROPY)));
+    float lod = log(major_length / probes) / log(2.0f);
+    if (1 == probes)
+        return interpolate_texture_lod(tex_coord, material, lod);
+
+    Color3 tex_color(0, 0, 0);
+    for (int i = 0; i < probes; ++i)
+    {
+        float offset = (i + 0.5f) / probes - 0.5f;
+        tex_color += interpolate_texture_lod(tex_coord + major * offset, material, lod);
+    }
+    return tex_color * (1.0f / probes);
+}
+
+void transfer_ray_differential(const Ray& line, float t, const Vector3& normal,
+                               Vector3& dpdx, Vector3& dpdy)
+{
+    const RayDifferential& differential = line.Differential();
+    Vector3 direction = line.Direction();
+    dpdx = differential.dpdx + t * differential.dddx;
+    dpdy = differential.dpdy + t * differential.dddy;
+
+    // move along the ray to the tangent plane of the hit point, unless the
+    // ray grazes the surface and the footprint is unbounded
+    real_t dn = dot(direction, normal);
+    if (fabs(dn) > 1e-8f) {
+        dpdx = dpdx - direction * (dot(dpdx, normal) / dn);
+        dpdy = dpdy - direction * (dot(dpdy, normal) / dn);
+    }
+}
+
+void barycentric_differentials(const Vector3& e1, const Vector3& e2, const Vector3& dp,
+                               float& dbeta, float& dgamma)
+{
+    // least squares solution of dp = dbeta * e1 + dgamma * e2
+    real_t a = dot(e1, e1);
+    real_t b = dot(e1, e2);
+    real_t c = dot(e2, e2);
+    real_t det = a * c - b * b;
+    if (fabs(det) < 1e-20f) {
+        dbeta = dgamma = 0;
+        return;
+    }
+    real_t p1 = dot(e1, dp);
+    real_t p2 = dot(e2, dp);
+    dbeta  = (c * p1 - b * p2) / det;
+    dgamma = (a * p2 - b * p1) / det;
+}
+
 
 } // namespace Luc
 
@@ -89,6 +89,35 @@ inline Color3 bilinear_interpolation(Color3 lrc, Color3 lbc, Color3 rtc, Color3
  */
 Color3 interpolate_texture_color(Vector2 tex_coord, const Material* material);
 
+/*
+ * Texture color filtered over the footprint of a pixel. A stretched
+ * footprint is sampled at up to 8 points along its longer axis, each a
+ * trilinear lookup into the mip level matching the shorter axis.
+ * @param dtdx      Change of the texture coordinates per pixel in x.
+ * @param dtdy      Change of the texture coordinates per pixel in y.
+ */
+Color3 interpolate_texture_color(Vector2 tex_coord, const Material* material,
+                                 const Vector2& dtdx, const Vector2& dtdy);
+
+/*
+ * Transfers the differentials of a ray to the point where it hits a surface,
+ * giving the change of that point per pixel, within the surface's tangent
+ * plane. Both the ray and the normal are in world coordinates.
+ *
+ * @see Igehy, "Tracing Ray Differentials", section 3.1
+ */
+void transfer_ray_differential(const Ray& line, float t, const Vector3& normal,
+                               Vector3& dpdx, Vector3& dpdy);
+
+/*
+ * Change of the barycentric coordinates on a triangle, from a change of a
+ * point within its plane.
+ * @param e1    Edge from the first to the second vertex.
+ * @param e2    Edge from the first to the third vertex.
+ */
+void barycentric_differentials(const Vector3& e1, const Vector3& e2, const Vector3& dp,
+                               float& dbeta, float& dgamma);
+
 
 } // namespace Luc
 
@@ -13,18 +13,227 @@
 #include "raytracer.hpp"
 #include "scene/scene.hpp"
 #include "math/camera.hpp"
+#include "scene/paged_file.hpp"
+#include "scene/tessellation_cache.hpp"
+#include "math/sampler.hpp"
+#include "math/mathUtils.h"
+#include "platform/timer.h"
+#include "scene/trace_counters.hpp"
+#include "files/fileutils.h"
 
+#include <boost/thread/thread.hpp>
 #include <SDL/SDL_timer.h>
+#include <algorithm>
 #include <iostream>
-#include <time.h>
 #include <cmath>
+#include <cstdio>
+#include <cstring>
 #include <float.h>
 
 
 namespace Luc {
 
+// paths shorter than this are never cut short by russian roulette
+static const int MIN_ROULETTE_DEPTH = 3;
+
+// bounces of a Whitted eye ray, counting the eye ray itself
+static const int MAX_RECURSION = 4;
+
+// samples per pixel needed before their variance guides the denoiser
+static const unsigned int MIN_VARIANCE_SAMPLES = 4;
+
+// bump whenever the checkpoint layout, or what it depends on, changes
+static const uint32_t CHECKPOINT_VERSION = 1;
+static const char CHECKPOINT_MAGIC[8] = { 'L', 'U', 'C', 'C', 'K', 'P', 'T', 0 };
+
+/*
+ * Header of a checkpoint file, followed by the RGBA buffer of the whole
+ * image, and then the accumulation and guide buffers of the region, as
+ * far as the settings in the key use them.
+ */
+struct CheckpointHeader
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t real_size;
+    uint64_t key;
+    uint64_t width, height;
+    uint64_t region_x, region_y, region_width, region_height;
+    uint64_t next_tile;
+    uint64_t pass;
+};
+
+namespace {
+
+template< class T >
+bool write_values( FILE* fp, const std::vector< T >& values )
+{
+    return values.empty() || fwrite( &values[0], sizeof( T ), values.size(), fp ) == values.size();
+}
+
+template< class T >
+bool read_values( FILE* fp, size_t count, std::vector< T >* values )
+{
+    values->resize( count );
+    return 0 == count || fread( &( *values )[0], sizeof( T ), count, fp ) == count;
+}
+
+// folds the size and modification time of a file into a key, zeros if it is missing
+uint64_t hash_file_stamp( const std::string& filename, uint64_t hash )
+{
+    uint64_t stamp[2] = { 0, 0 };
+    GetFileStamp( filename, stamp[0], stamp[1] );
+    return Math::FNV1aHash64( stamp, sizeof stamp, hash );
+}
+
+} // namespace
+
+/*
+ * Traces tiles until the raytracer runs out of them or of time. One worker
+ * runs on the calling thread, the others on threads of their own.
+ */
+struct RaytraceWorker
+{
+    Raytracer*     raytracer;
+    unsigned char* buffer;
+    // index of the worker, for the statistics of its thread
+    size_t         thread;
+
+    void operator()() const
+    {
+        // samplers keep the state of their current sample, one per thread
+        boost::scoped_ptr< Sampler > sampler( Sampler::create( raytracer->m_sampler_type ) );
+        // what the rays of this thread cost, for the statistics of the image
+        // and the costs of its pixels
+        TraceCounters counters;
+        set_trace_counters( &counters );
+        RecentPatches recent_patches;
+        set_recent_patches( &recent_patches );
+        uint64_t busy_time = 0;
+        size_t tile;
+        unsigned int pass;
+        while ( raytracer->acquire_tile( &tile, &pass ) ) {
+            uint64_t start_time = GetTimeNanoseconds();
+            raytracer->trace_tile( tile, pass, *sampler, buffer );
+            busy_time += GetTimeNanoseconds() - start_time;
+            raytracer->release_tile();
+        }
+        set_trace_counters( 0 );
+        set_recent_patches( 0 );
+
+        boost::mutex::scoped_lock lock( raytracer->m_tile_mutex );
+        raytracer->m_stats.add_thread( thread, counters, busy_time );
+    }
+};
+
+struct PhotonWorker
+{
+    Raytracer* raytracer;
+
+    void operator()() const
+    {
+        // every chunk has its own list, so the threads never share one
+        size_t chunk;
+        while ( raytracer->acquire_photon_chunk( &chunk ) ) {
+            raytracer->shoot_photon_chunk( chunk, &raytracer->m_chunk_photons[chunk] );
+        }
+    }
+};
+
+static real_t luminance( const Color3& c )
+{
+    return 0.2126f * c.r + 0.7152f * c.g + 0.0722f * c.b;
+}
+
+// direction around the normal with a density proportional to the cosine
+static Vector3 sample_cosine_hemisphere( const Vector3& normal, real_t u1, real_t u2 )
+{
+    Vector3 tangent = fabs( normal.x ) > 0.5f ? Vector3::UnitY : Vector3::UnitX;
+    tangent = normalize( cross( tangent, normal ) );
+    Vector3 bitangent = cross( normal, tangent );
+
+    real_t radius = sqrt( u1 );
+    real_t phi = 2 * PI * u2;
+    return normalize( tangent * ( radius * cos( phi ) ) +
+                      bitangent * ( radius * sin( phi ) ) +
+                      normal * sqrt( std::max( real_t( 0 ), 1 - u1 ) ) );
+}
+
+// differentials of a ray reflected at a hit, see Igehy section 3.2
+static RayDifferential reflect_differential( const RayDifferential& differential, const Vector3& direction,
+                                             const HitVertexInfor& hit_vertex )
+{
+    const Vector3& normal = hit_vertex.normal;
+    real_t dn = dot( direction, normal );
+    real_t ddndx = dot( differential.dddx, normal ) + dot( direction, hit_vertex.dndx );
+    real_t ddndy = dot( differential.dddy, normal ) + dot( direction, hit_vertex.dndy );
+
+    RayDifferential reflected;
+    reflected.dpdx = hit_vertex.dpdx;
+    reflected.dpdy = hit_vertex.dpdy;
+    reflected.dddx = differential.dddx - 2 * ( dn * hit_vertex.dndx + ddndx * normal );
+    reflected.dddy = differential.dddy - 2 * ( dn * hit_vertex.dndy + ddndy * normal );
+    return reflected;
+}
+
+/*
+ * Differentials of a ray refracted at a hit into the direction 'refracted',
+ * see Igehy section 3.2. The refractive index outside the surface is
+ * 'outside_index', as in refraction_happened.
+ */
+static RayDifferential refract_differential( const RayDifferential& differential, const Vector3& direction,
+                                             const Vector3& refracted, const HitVertexInfor& hit_vertex,
+                                             real_t outside_index )
+{
+    // the normal faces the side the ray comes from
+    Vector3 normal = hit_vertex.normal;
+    Vector3 dndx = hit_vertex.dndx;
+    Vector3 dndy = hit_vertex.dndy;
+    real_t eta = outside_index / hit_vertex.refractive_index;
+    if ( dot( direction, normal ) > 0 ) {
+        normal = -normal;
+        dndx = -dndx;
+        dndy = -dndy;
+        eta = 1 / eta;
+    }
+
+    // refracted = eta * direction - mu * normal
+    real_t dn = dot( direction, normal );
+    real_t tn = dot( refracted, normal );
+    real_t mu = eta * dn - tn;
+    real_t dmu = tn != 0 ? eta - eta * eta * dn / tn : 0;
+    real_t ddndx = dot( differential.dddx, normal ) + dot( direction, dndx );
+    real_t ddndy = dot( differential.dddy, normal ) + dot( direction, dndy );
+
+    RayDifferential result;
+    result.dpdx = hit_vertex.dpdx;
+    result.dpdy = hit_vertex.dpdy;
+    result.dddx = eta * differential.dddx - ( mu * dndx + dmu * ddndx * normal );
+    result.dddy = eta * differential.dddy - ( mu * dndy + dmu * ddndy * normal );
+    return result;
+}
+
+// narrows a differential to a fraction of a pixel
+static void scale_differential( RayDifferential* differential, real_t scale )
+{
+    differential->dpdx *= scale;
+    differential->dpdy *= scale;
+    differential->dddx *= scale;
+    differential->dddy *= scale;
+}
+
 Raytracer::Raytracer()
-: scene( 0 ), width( 0 ), height( 0 ), SLOPE_FACTOR(FLT_MIN) { }
+: scene( 0 ), m_build_time( 0 ), width( 0 ), height( 0 ),
+  m_region_x( 0 ), m_region_y( 0 ), m_region_width( 0 ), m_region_height( 0 ),
+  m_num_tiles_x( 0 ), m_num_tiles_y( 0 ), m_tile_size( DEFAULT_TILE_SIZE ),
+  m_num_threads( 0 ), m_path_tracing( false ), m_sampler_type( SAMPLER_SOBOL ), m_pixel_samples( 1 ),
+  m_shadow_samples( 32 ),
+  m_light_samples( 8 ), m_verbose( true ), m_record_costs( false ),
+  m_proxy_depth( 1 ), m_proxy_shadows( true ), m_use_light_tree( false ),
+  m_next_tile( 0 ), m_tiles_in_flight( 0 ),
+  m_pass( 0 ), m_deadline( 0 ), m_has_deadline( false ), m_stopped( false ),
+  m_denoise( false ), m_irradiance_caching( false ), m_next_photon_chunk( 0 ),
+  m_ray_epsilon( 0 ), SLOPE_FACTOR(FLT_MIN) { }
 
 Raytracer::~Raytracer() { }
 
@@ -43,13 +252,57 @@ bool Raytracer::initialize( Scene* scene, size_t width, size_t height, Camera& c
     this->width = width;
     this->height = height;
 
-    current_row = 0;
+    reset_region();
+    setup_camera(camera);
+
+    // build inverse transformation matrix for all geometries, and their
+    // bounds, so the tracing threads never build either lazily
+    Geometry* const* geometries = scene->get_geometries();
+    size_t geometry_count = scene->num_geometries();
+    BoundingBox scene_bounds;
+    for (size_t i=0; i<geometry_count; i++)
+    {
+        Geometry* pGeom = geometries[i];
+        pGeom->build_inverse_transformation_matrix();
+        scene_bounds.merge(pGeom->get_world_bounds());
+    }
+
+    // secondary rays start this far off their surface, relative to the scene size
+    Vector3 extent = scene_bounds.get_right_top_back_corner() - scene_bounds.get_left_bottom_front_corner();
+    m_ray_epsilon = geometry_count > 0 ? std::max(length(extent) * 1e-5f, 1e-6f) : 1e-4f;
+
+    // build the acceleration structure chosen by the scene
+    uint64_t build_start_time = GetTimeNanoseconds();
+    m_acceleration.reset(Acceleration::create(scene->acceleration));
+    m_acceleration->build(geometries, geometry_count);
+    m_build_time = GetTimeNanoseconds() - build_start_time;
+    printf( "Built %s acceleration structure in %.1f milliseconds.\n",
+            m_acceleration->get_name(), m_build_time / 1e6 );
+
+    // the cached irradiance stays valid while the scene does
+    if (m_irradiance_caching && !m_irradiance_cache.is_valid_for(scene_bounds))
+        m_irradiance_cache.reset(scene_bounds);
+
+    // caustics, which need the acceleration structure to shoot the photons
+    begin_ray_capture();
+    build_caustics(get_thread_count());
+
+    // with many lights, shade a few picked by the light tree instead of all
+    size_t light_count = scene->num_lights() + scene->num_area_lights();
+    m_use_light_tree = m_light_samples > 0 && light_count > m_light_samples;
+    if (m_use_light_tree)
+        m_light_tree.build(scene);
+
+    restart();
+    return true;
+}
+
+void Raytracer::setup_camera( const Camera& camera )
+{
+    m_camera = camera;
     real_t fWidth  = static_cast<real_t>(width);
     real_t fHeight = static_cast<real_t>(height);
 
-    // TODO any initialization or precompuation before the trace
-    // Spatial Data Structure implementation here
-
     // get near clip plane and far clip plane, up and right step vector
     real_t near_clip = camera.GetNearClip();
     real_t far_clip  = camera.GetFarClip();
@@ -66,69 +319,154 @@ bool Raytracer::initialize( Scene* scene, size_t width, size_t height, Camera& c
 
     m_near_clip = near_clip;
     m_far_clip = far_clip;
+}
 
-    // build inverse transformation matrix for all geometries
-    Geometry* const* geometries = scene->get_geometries();
-    size_t geometry_count = scene->num_geometries();
-    for (size_t i=0; i<geometry_count; i++)
-    {
-        Geometry* pGeom = geometries[i];
-        pGeom->build_inverse_transformation_matrix();
-    }
+bool Raytracer::update_camera( const Camera& camera )
+{
+    if ( !scene )
+        return false;
+    if ( camera.GetPosition() == m_camera.GetPosition() &&
+         camera.GetDirection() == m_camera.GetDirection() &&
+         camera.GetUp() == m_camera.GetUp() &&
+         camera.GetFovRadians() == m_camera.GetFovRadians() )
+        return false;
 
+    setup_camera( camera );
+    restart();
     return true;
 }
 
+void Raytracer::set_resolution( size_t width, size_t height )
+{
+    if ( !scene || ( width == this->width && height == this->height ) )
+        return;
+
+    this->width = width;
+    this->height = height;
+    reset_region();
+
+    // the steps between pixels depend on the size
+    setup_camera( m_camera );
+    restart();
+}
+
+void Raytracer::reset_region()
+{
+    m_region_x = 0;
+    m_region_y = 0;
+    m_region_width = width;
+    m_region_height = height;
+    update_tiles();
+}
+
+void Raytracer::update_tiles()
+{
+    m_num_tiles_x = ( m_region_width + m_tile_size - 1 ) / m_tile_size;
+    m_num_tiles_y = ( m_region_height + m_tile_size - 1 ) / m_tile_size;
+}
+
+void Raytracer::set_tile_size( size_t size )
+{
+    m_tile_size = std::max< size_t >( 1, size );
+    if ( !scene )
+        return;
+
+    update_tiles();
+    restart();
+}
+
+void Raytracer::set_region( size_t x, size_t y, size_t width, size_t height )
+{
+    if ( !scene )
+        return;
+
+    m_region_x = std::min( x, this->width );
+    m_region_y = std::min( y, this->height );
+    m_region_width = std::min( width, this->width - m_region_x );
+    m_region_height = std::min( height, this->height - m_region_y );
+    update_tiles();
+    restart();
+}
+
+void Raytracer::clear_region()
+{
+    if ( !scene )
+        return;
+
+    reset_region();
+    restart();
+}
+
+void Raytracer::restart()
+{
+    boost::mutex::scoped_lock lock( m_tile_mutex );
+    m_next_tile = 0;
+    m_tiles_in_flight = 0;
+    m_pass = 0;
+    size_t num_pixels = m_region_width * m_region_height;
+    if ( m_path_tracing || m_denoise )
+        m_accumulation.assign( num_pixels, Color3::Black );
+    else
+        std::vector< Color3 >().swap( m_accumulation );
+
+    if ( m_denoise ) {
+        m_albedo.assign( num_pixels, Color3::White );
+        m_normal.assign( num_pixels, Vector3::UnitZ );
+        m_depth.assign( num_pixels, 0 );
+        m_luminance_sq.assign( num_pixels, 0 );
+    } else {
+        std::vector< Color3 >().swap( m_albedo );
+        std::vector< Vector3 >().swap( m_normal );
+        std::vector< real_t >().swap( m_depth );
+        std::vector< real_t >().swap( m_luminance_sq );
+        std::vector< real_t >().swap( m_variance );
+        std::vector< Color3 >().swap( m_denoised );
+    }
+
+    // a region traced again keeps the costs of the rest of the image
+    if ( !m_record_costs )
+        m_cost_map.reset( 0, 0 );
+    else if ( !has_region() || m_cost_map.empty() )
+        m_cost_map.reset( width, height );
+    else
+        m_cost_map.clear( m_region_x, m_region_y, m_region_width, m_region_height );
+    m_stats.clear();
+}
+
 /*
  * Detect if a ray will hit any geometry in legal time cost range. If hit 
  * any geometry, output intersection point information.
  * 
- * @param scene             The scene object, which contains all geometries 
- *                          information.
  * @param ray_dir           Direction vector of ray.
  * @param ray_pos           Start point of ray.
  * @param tMin              Minimum legal time cost for this ray.
  * @param tMax              Maximum legal time cost for this ray.
  * @param hit_vertex[out]   A struct storing all useful intersection point 
  *                          information.
+ * @param type              What the ray is traced for, for ray capture and statistics.
+ * @param differential      Differentials of the ray, NULL if it has none.
+ * @param use_proxy         Trace the proxies of meshes that have one.
  *
  * @return true if hit any geometry, otherwise false.
  */
-bool Raytracer::ray_hit(Scene const*scene,                                    // geometries
-                        const Vector3 &direction, const Vector3 &position,    // ray
+bool Raytracer::ray_hit(const Vector3 &direction, const Vector3 &position,    // ray
                         const float tMin,         const float tMax,           // ray range
-                        HitVertexInfor& hit_vertex  // intersection point information)
+                        HitVertexInfor& hit_vertex, // intersection point information
+                        RayType type,
+                        const RayDifferential* differential,
+                        bool use_proxy
                        )
 {
-    // possible closest hit point information
-    float closest_t = tMax+1;
+    if (m_ray_stream.is_open())
+        m_ray_stream.record(type, position, direction, tMin, tMax, use_proxy, 0 != differential);
+    TraceCounters* counters = get_trace_counters();
+    if (counters)
+        counters->rays[type]++;
 
-    // for each geometry, test hit
-    Geometry* const* geometries = scene->get_geometries();
-    size_t geometry_count = scene->num_geometries();
-    for (size_t i=0; i<geometry_count; i++)
-    {
-        Geometry* pGeom = geometries[i];
-
-        Ray ray(position, direction);
-
-        // current hit point information
-        float cur_t;
-        HitVertexInfor cur_hit_vertex;
-        // if this ray hit a geometry, compare t
-        if ( pGeom->ray_casting(ray, tMin, tMax, cur_t, cur_hit_vertex) )
-        {
-            if (cur_t < closest_t)
-            {
-                closest_t = cur_t;
-                hit_vertex = cur_hit_vertex;
-            } // end of is closer
-        } // end of if hit
-    } // end of all geometry loop
-
-    if (closest_t < tMax) // hit a geometry
-        return true;
-    return false;           // if not hit any geometry
+    float t;
+    Ray ray = differential ? Ray(position, direction, *differential) : Ray(position, direction);
+    ray.SetUseProxy(use_proxy);
+    return m_acceleration->intersect(ray, tMin, tMax, t, hit_vertex);
 }
 
 /* 
@@ -138,14 +476,41 @@ bool Raytracer::ray_hit(Scene const*scene,                                    //
  *                      information.
  * @param hit_vertex    A struct storing all useful intersection point 
  *                      information.
+ * @param sampler       Sample values of the pixel, one per area light to
+ *                      scramble its shadow rays.
  *
  * @return Direct illumination color.
  */
 Color3 Raytracer::calculate_DI_light(Scene const*scene, 
-                                     const HitVertexInfor &hit_vertex)
+                                     const HitVertexInfor &hit_vertex,
+                                     Sampler& sampler)
+{
+    // ambient light, or the indirect light it stands in for
+    Color3 ambient_light = hit_vertex.ambient * scene->ambient_light * hit_vertex.occlusion;
+    if (m_irradiance_caching)
+        ambient_light = hit_vertex.diffuse * calculate_irradiance(scene, hit_vertex, sampler) * (1 / PI);
+
+    Color3 diffuse_light = calculate_direct_light(scene, hit_vertex, sampler);
+
+    // caustics, where glass blocks the shadow rays
+    if (!m_caustics.empty())
+        diffuse_light += hit_vertex.diffuse * m_caustics.irradiance(hit_vertex.position, hit_vertex.normal,
+                                                                    m_photon_settings.gather_count);
+
+    // final direct illumination is multiplication of texture color and diffuse light
+    return hit_vertex.tex_color * (ambient_light + diffuse_light);
+}
+
+Color3 Raytracer::calculate_direct_light(Scene const*scene, 
+                                         const HitVertexInfor &hit_vertex,
+                                         Sampler& sampler)
 {
-    // ambient light
-    Color3 ambient_light = hit_vertex.ambient * scene->ambient_light;
+    if (m_use_light_tree)
+    {
+        real_t u = sampler.next_1d();
+        uint32_t seed = static_cast<uint32_t>(sampler.next_1d() * 16777216.0f);
+        return sample_light_tree(scene, hit_vertex.position, hit_vertex.normal, u, seed) * hit_vertex.diffuse;
+    }
 
     // accumulate all point light diffuse components
     Color3 diffuse_light(0, 0, 0);
@@ -163,8 +528,10 @@ Color3 Raytracer::calculate_DI_light(Scene const*scene,
 
         // shadow ray hit test
         HitVertexInfor tmp_hit_vertex; // temp variable, didn't use it actually
-        bool bExistObstacle = ray_hit(scene, shadow_ray_dir, shadow_ray_pos,
-            distance/1000000, distance, tmp_hit_vertex);
+        // a light closer than the offset lights nothing, as in sample_point_light
+        bool bExistObstacle = distance <= m_ray_epsilon ||
+            ray_hit(shadow_ray_dir, shadow_ray_pos,
+            m_ray_epsilon, distance - m_ray_epsilon, tmp_hit_vertex, RAY_SHADOW, 0, m_proxy_shadows);
 
         // if did not hit other geometry, accumulate diffuse light
         if (!bExistObstacle)
@@ -175,8 +542,171 @@ Color3 Raytracer::calculate_DI_light(Scene const*scene,
         }
     }
 
-    // final direct illumination is multiplication of texture color and diffuse light
-    return hit_vertex.tex_color * (ambient_light + diffuse_light);
+    // area lights, with more shadow rays in their penumbrae
+    const AreaLight* area_lights = scene->get_area_lights();
+    for (size_t i=0; i<scene->num_area_lights(); i++)
+    {
+        uint32_t seed = static_cast<uint32_t>(sampler.next_1d() * 16777216.0f);
+        diffuse_light += shade_area_light(area_lights[i], hit_vertex.position, hit_vertex.normal, seed) *
+                         hit_vertex.diffuse;
+    }
+
+    return diffuse_light;
+}
+
+/*
+ * Indirect irradiance at a hit, from the irradiance cache if it has samples
+ * close enough, or else from rays over the hemisphere, one per stratum,
+ * which see the direct light of the surfaces around.
+ */
+Color3 Raytracer::calculate_irradiance(Scene const*scene, 
+                                       const HitVertexInfor &hit_vertex,
+                                       Sampler& sampler)
+{
+    Color3 irradiance;
+    const Vector3& position = hit_vertex.position;
+    const Vector3& normal = hit_vertex.normal;
+    if (m_irradiance_cache.lookup(position, normal, &irradiance))
+        return irradiance;
+
+    Vector3 tangent = fabs(normal.x) > 0.5f ? Vector3::UnitY : Vector3::UnitX;
+    tangent = normalize(cross(tangent, normal));
+    Vector3 bitangent = cross(normal, tangent);
+
+    const unsigned int theta_strata = m_irradiance_cache.get_theta_strata();
+    const unsigned int phi_strata = m_irradiance_cache.get_phi_strata();
+    std::vector<Color3> radiance(theta_strata * phi_strata);
+    std::vector<real_t> distance(theta_strata * phi_strata);
+    Pcg32 rng(static_cast<uint64_t>(sampler.next_1d() * 16777216.0f), 0);
+    for (unsigned int k = 0; k < phi_strata; ++k)
+    {
+        for (unsigned int j = 0; j < theta_strata; ++j)
+        {
+            real_t u1 = rng.next_real();
+            real_t u2 = rng.next_real();
+            Vector3 direction = m_irradiance_cache.stratum_direction(normal, tangent, bitangent, j, k, u1, u2);
+            size_t index = k * theta_strata + j;
+
+            HitVertexInfor indirect_hit;
+            if (!ray_hit(direction, position, m_ray_epsilon, 1000000, indirect_hit, RAY_DIFFUSE, 0, use_proxy_at(1)))
+            {
+                radiance[index] = scene->background_color;
+                distance[index] = FLT_MAX;
+                continue;
+            }
+
+            // one bounce, the direct light of diffuse surfaces
+            distance[index] = std::max<real_t>(length(indirect_hit.position - position), m_ray_epsilon);
+            if (indirect_hit.refractive_index == 0)
+                radiance[index] = indirect_hit.tex_color * calculate_direct_light(scene, indirect_hit, sampler);
+            else
+                radiance[index] = Color3::Black;
+        }
+    }
+
+    // the pixel footprint at the hit bounds the spacing of the samples
+    real_t pixel_size = 0;
+    if (hit_vertex.has_differential)
+        pixel_size = std::max(length(hit_vertex.dpdx), length(hit_vertex.dpdy));
+
+    IrradianceRecord record = m_irradiance_cache.make_record(position, normal, tangent, bitangent,
+                                                             &radiance[0], &distance[0], pixel_size);
+    m_irradiance_cache.insert(record);
+    return record.irradiance;
+}
+
+Color3 Raytracer::sample_point_light(const PointLight& light,
+                                     const Vector3& position, const Vector3& normal)
+{
+    Vector3 light_dir = light.position - position;
+    real_t distance = length(light_dir);
+    if (distance <= m_ray_epsilon)
+        return Color3::Black;
+    light_dir = light_dir / distance;
+    real_t cos_theta = dot(normal, light_dir);
+    if (cos_theta <= 0)
+        return Color3::Black;
+
+    HitVertexInfor shadow_hit_vertex;
+    if (ray_hit(light_dir, position, m_ray_epsilon, distance - m_ray_epsilon, shadow_hit_vertex,
+                RAY_SHADOW, 0, m_proxy_shadows))
+        return Color3::Black;
+    return light.get_attenuation_color(distance) * cos_theta;
+}
+
+Color3 Raytracer::sample_area_light(const AreaLight& light,
+                                    const Vector3& position, const Vector3& normal,
+                                    const Vector2& u)
+{
+    Vector3 light_point;
+    Color3 color = light.sample(position, u, &light_point);
+    if (color == Color3::Black)
+        return Color3::Black;
+
+    Vector3 light_dir = light_point - position;
+    real_t distance = length(light_dir);
+    if (distance <= m_ray_epsilon)
+        return Color3::Black;
+    light_dir = light_dir / distance;
+    real_t cos_theta = dot(normal, light_dir);
+    if (cos_theta <= 0)
+        return Color3::Black;
+
+    HitVertexInfor shadow_hit_vertex;
+    if (ray_hit(light_dir, position, m_ray_epsilon, distance - m_ray_epsilon, shadow_hit_vertex,
+                RAY_SHADOW, 0, m_proxy_shadows))
+        return Color3::Black;
+    return color * cos_theta;
+}
+
+Color3 Raytracer::shade_area_light(const AreaLight& light,
+                                   const Vector3& position, const Vector3& normal,
+                                   uint32_t seed)
+{
+    Color3 sum(0, 0, 0);
+    unsigned int dark = 0;
+    unsigned int count = 0;
+    unsigned int batch_end = std::min(MIN_SHADOW_SAMPLES, m_shadow_samples);
+    while (true)
+    {
+        for (; count < batch_end; ++count)
+        {
+            Color3 sample = sample_area_light(light, position, normal, sample_02_sequence(count, seed));
+            if (sample == Color3::Black)
+                dark++;
+            sum += sample;
+        }
+
+        // a first batch that agrees is taken to be fully lit or in umbra
+        if (0 == dark || count == dark || count >= m_shadow_samples)
+            break;
+        batch_end = std::min(2 * count, m_shadow_samples);
+    }
+    return sum * (1.0f / count);
+}
+
+Color3 Raytracer::sample_light_tree(Scene const* scene,
+                                    const Vector3& position, const Vector3& normal,
+                                    real_t u, uint32_t seed)
+{
+    size_t num_point_lights = scene->num_lights();
+    Color3 sum(0, 0, 0);
+    for (unsigned int i = 0; i < m_light_samples; ++i)
+    {
+        size_t light;
+        real_t probability;
+        if (!m_light_tree.sample(position, normal, (i + u) / m_light_samples, &light, &probability))
+            continue;
+
+        Color3 sample;
+        if (light < num_point_lights)
+            sample = sample_point_light(scene->get_lights()[light], position, normal);
+        else
+            sample = sample_area_light(scene->get_area_lights()[light - num_point_lights],
+                                       position, normal, sample_02_sequence(i, seed));
+        sum += sample * (1 / probability);
+    }
+    return sum * (1.0f / m_light_samples);
 }
 
 /*
@@ -247,28 +777,38 @@ bool Raytracer::refraction_happened(Scene   const*  scene,
  * @param scene     The scene object, which contains all geometries information.
  * @param recursion The level of recursive light. If the level is larger or 
  *                  equal to 4, stop recursion.
+ * @param type      What the ray is traced for, eye, reflected or refracted.
  * @param ray_dir   Direction vector of ray.
  * @param ray_pos   Start point of ray.
  * @param tMin      Minimum legal time cost for this ray.
  * @param tMax      Maximum legal time cost for this ray.
+ * @param sampler   Sample values of the pixel, for the area lights.
  *
  * @return  The color of this ray.
  */
 Color3 Raytracer::trace_ray(Scene const*scene,      // geometries
                             const int recursion,    // recursion level
+                            RayType type,
                             const Vector3 &ray_dir, const Vector3 &ray_pos, // ray
-                            const float tMin,       const float tMax        // ray range
+                            const float tMin,       const float tMax,       // ray range
+                            const RayDifferential* differential,
+                            Sampler& sampler
                            )
 {
     // if this function go beyond the last recursive level, stop and return black color.
     if (recursion <= 0)
         return Color3(0, 0, 0);
 
+    TraceCounters* counters = get_trace_counters();
+    if (counters)
+        counters->max_depth = std::max<uint32_t>(counters->max_depth, MAX_RECURSION - recursion);
+
     // intersection point information
     HitVertexInfor hit_vertex;
 
     // if not hit any geometry, return background color
-    bool bHit = ray_hit(scene, ray_dir, ray_pos, tMin, tMax, hit_vertex);
+    bool bHit = ray_hit(ray_dir, ray_pos, tMin, tMax, hit_vertex, type, differential,
+                        use_proxy_at(MAX_RECURSION - recursion));
     if (!bHit)
         return scene->background_color;
 
@@ -279,7 +819,7 @@ Color3 Raytracer::trace_ray(Scene const*scene,      // geometries
 
     // 1. direct illumination
     if (hit_vertex.refractive_index == 0)
-        DI_light = calculate_DI_light(scene, hit_vertex);
+        DI_light = calculate_DI_light(scene, hit_vertex, sampler);
 
     // 2. reflection light
     if (hit_vertex.specular != Color3(0, 0, 0)) // avoid non-necessary reflection calculation
@@ -288,9 +828,13 @@ Color3 Raytracer::trace_ray(Scene const*scene,      // geometries
         Vector3 rfl_ray_dir = normalize(
             ray_dir - 2 * dot(ray_dir, hit_vertex.normal) * hit_vertex.normal);
 
+        RayDifferential rfl_differential;
+        if (differential)
+            rfl_differential = reflect_differential(*differential, ray_dir, hit_vertex);
+
         reflected_light = hit_vertex.specular * hit_vertex.tex_color *
-                          trace_ray(scene, recursion-1, rfl_ray_dir, hit_vertex.position,
-                                    SLOPE_FACTOR, 1000000);
+                          trace_ray(scene, recursion-1, RAY_REFLECTED, rfl_ray_dir, hit_vertex.position,
+                                    m_ray_epsilon, 1000000, differential ? &rfl_differential : 0, sampler);
     }
 
     if (hit_vertex.refractive_index == 0)   // avoid non-necessary refraction calculation
@@ -300,13 +844,171 @@ Color3 Raytracer::trace_ray(Scene const*scene,      // geometries
     Vector3 rfr_ray_dir; // refractive ray direction
     float R;
     if (refraction_happened(scene, ray_dir, hit_vertex, rfr_ray_dir, R))
+    {
+        RayDifferential rfr_differential;
+        if (differential)
+            rfr_differential = refract_differential(*differential, ray_dir, rfr_ray_dir, hit_vertex,
+                                                    scene->refractive_index);
+
         refracted_light = hit_vertex.tex_color *
-                          trace_ray(scene, recursion-1, rfr_ray_dir, hit_vertex.position, 
-                                    SLOPE_FACTOR, 1000000);
+                          trace_ray(scene, recursion-1, RAY_REFRACTED, rfr_ray_dir, hit_vertex.position, 
+                                    m_ray_epsilon, 1000000, differential ? &rfr_differential : 0, sampler);
+    }
 
     return DI_light + R * reflected_light + (1-R) * refracted_light;
 }
 
+/*
+ * Trace a path from the camera, calculating the light it carries back.
+ * The ambient term of the Whitted tracer is left out, as the indirect light
+ * it stands in for is traced here.
+ *
+ * @param scene     The scene object, which contains all geometries information.
+ * @param ray_dir   Direction vector of ray.
+ * @param ray_pos   Start point of ray.
+ * @param differential  Differentials of the eye ray, which follow the path
+ *                      until its first diffuse bounce.
+ * @param sampler   Sample values of this path, started at its pixel.
+ *
+ * @return  The radiance along the path.
+ */
+Color3 Raytracer::trace_path(Scene const* scene,
+                             Vector3 ray_dir, Vector3 ray_pos,
+                             const RayDifferential* differential,
+                             Sampler& sampler)
+{
+    RayDifferential path_differential;
+    if (differential)
+        path_differential = *differential;
+    bool has_differential = differential != 0;
+
+    Color3 radiance(0, 0, 0);
+    Color3 throughput(1, 1, 1);
+    real_t tMin = m_near_clip;
+    real_t tMax = m_far_clip;
+
+    const PointLight* lights = scene->get_lights();
+    size_t num_lights = scene->num_lights();
+    const AreaLight* area_lights = scene->get_area_lights();
+    size_t num_area_lights = scene->num_area_lights();
+    TraceCounters* counters = get_trace_counters();
+    // what the next ray of the path is, from the lobe the last bounce took
+    RayType ray_type = RAY_EYE;
+
+    for (int depth = 0; depth < MAX_PATH_DEPTH; ++depth)
+    {
+        if (counters)
+            counters->max_depth = std::max<uint32_t>(counters->max_depth, depth);
+
+        // every bounce takes the same dimensions of the sample, whichever
+        // way it goes, so they line up across the samples of a pixel
+        Vector2 u_direction = sampler.next_2d();
+        real_t u_lobe = sampler.next_1d();
+        real_t u_roulette = sampler.next_1d();
+        Vector2 u_light = sampler.next_2d();
+        real_t u_light_pick = sampler.next_1d();
+
+        HitVertexInfor hit_vertex;
+        if (!ray_hit(ray_dir, ray_pos, tMin, tMax, hit_vertex, ray_type,
+                     has_differential ? &path_differential : 0, use_proxy_at(depth)))
+        {
+            radiance += throughput * scene->background_color;
+            break;
+        }
+        ray_pos = hit_vertex.position;
+        tMin = m_ray_epsilon;
+        tMax = 1000000;
+
+        // dielectrics reflect or refract, chosen by the Fresnel coefficient
+        if (hit_vertex.refractive_index != 0)
+        {
+            Vector3 rfr_ray_dir;
+            float R;
+            bool refracted = refraction_happened(scene, ray_dir, hit_vertex, rfr_ray_dir, R);
+            if (!refracted || u_lobe < R)
+            {
+                throughput *= hit_vertex.specular * hit_vertex.tex_color;
+                if (has_differential)
+                    path_differential = reflect_differential(path_differential, ray_dir, hit_vertex);
+                ray_dir = normalize(ray_dir - 2 * dot(ray_dir, hit_vertex.normal) * hit_vertex.normal);
+                ray_type = RAY_REFLECTED;
+            }
+            else
+            {
+                throughput *= hit_vertex.tex_color;
+                if (has_differential)
+                    path_differential = refract_differential(path_differential, ray_dir, rfr_ray_dir,
+                                                             hit_vertex, scene->refractive_index);
+                ray_dir = normalize(rfr_ray_dir);
+                ray_type = RAY_REFRACTED;
+            }
+            continue;
+        }
+
+        // opaque surfaces are lit from both sides
+        Vector3 normal = hit_vertex.normal;
+        if (dot(normal, ray_dir) > 0)
+            normal = -normal;
+
+        // next event estimation, a shadow ray to every point light, and to
+        // one point of every area light, whose penumbrae the passes fill in;
+        // with many lights, to a few of them picked by the light tree
+        Color3 albedo = hit_vertex.tex_color * hit_vertex.diffuse;
+        if (albedo != Color3::Black && m_use_light_tree)
+        {
+            uint32_t seed = static_cast<uint32_t>(u_light.x * 16777216.0f);
+            radiance += throughput * albedo * sample_light_tree(scene, ray_pos, normal, u_light_pick, seed);
+        }
+        else if (albedo != Color3::Black)
+        {
+            for (size_t i = 0; i < num_lights; ++i)
+                radiance += throughput * albedo * sample_point_light(lights[i], ray_pos, normal);
+            for (size_t i = 0; i < num_area_lights; ++i)
+                radiance += throughput * albedo * sample_area_light(area_lights[i], ray_pos, normal, u_light);
+        }
+
+        // caustics, which the paths never find as they never hit the lights
+        if (albedo != Color3::Black && !m_caustics.empty())
+            radiance += throughput * albedo * m_caustics.irradiance(ray_pos, normal, m_photon_settings.gather_count);
+
+        // continue along the mirror or the diffuse lobe, in proportion to their weight
+        Color3 mirror = hit_vertex.specular * hit_vertex.tex_color;
+        real_t mirror_weight = luminance(mirror);
+        real_t diffuse_weight = luminance(albedo);
+        if (mirror_weight + diffuse_weight <= 0)
+            break;
+        real_t mirror_probability = mirror_weight / (mirror_weight + diffuse_weight);
+        if (u_lobe < mirror_probability)
+        {
+            throughput *= mirror * (1 / mirror_probability);
+            if (has_differential)
+                path_differential = reflect_differential(path_differential, ray_dir, hit_vertex);
+            ray_dir = normalize(ray_dir - 2 * dot(ray_dir, normal) * normal);
+            ray_type = RAY_REFLECTED;
+        }
+        else
+        {
+            // a diffuse bounce spreads over the hemisphere, past what a
+            // differential describes, so textures are sampled unfiltered
+            has_differential = false;
+            // cosine sampling cancels the cosine and the 1/pi of the diffuse BRDF
+            throughput *= albedo * (1 / (1 - mirror_probability));
+            ray_dir = sample_cosine_hemisphere(normal, u_direction.x, u_direction.y);
+            ray_type = RAY_DIFFUSE;
+        }
+
+        // russian roulette, end dim paths early without biasing the estimate
+        if (depth + 1 >= MIN_ROULETTE_DEPTH)
+        {
+            real_t survival = std::min(real_t(0.95f), std::max(throughput.r, std::max(throughput.g, throughput.b)));
+            if (u_roulette >= survival)
+                break;
+            throughput *= 1 / survival;
+        }
+    }
+    return radiance;
+}
+
 /**
  * Performs a raytrace on the given pixel on the current scene.
  * The pixel is relative to the bottom-left corner of the image.
@@ -315,22 +1017,523 @@ Color3 Raytracer::trace_ray(Scene const*scene,      // geometries
  * @param y The y-coordinate of the pixel to trace.
  * @param width The width of the screen in pixels.
  * @param height The height of the screen in pixels.
+ * @param sampler The sample values of the pixel, started at it.
  * @return The color of that pixel in the final image.
  */
-Color3 Raytracer::trace_pixel( const Scene* scene, size_t x, size_t y, size_t width, size_t height )
+Color3 Raytracer::trace_pixel( const Scene* scene, size_t x, size_t y, size_t width, size_t height,
+                               Sampler& sampler )
 {
     assert( 0 <= x && x < width );
     assert( 0 <= y && y < height );
 
     // get ray direction
     Vector3 position  = m_camera_pos;
+    RayDifferential differential;
+    if ( m_pixel_samples <= 1 ) {
+        Vector3 direction = get_eye_direction( static_cast<real_t>(x), static_cast<real_t>(y), &differential );
+
+        // trace a ray and return its color
+        return trace_ray( scene, MAX_RECURSION, RAY_EYE, direction, position, m_near_clip, m_far_clip, &differential, sampler );
+    }
+
+    // average a grid of rays over the pixel, each filtering the textures
+    // over its share of the pixel
+    real_t step = real_t( 1 ) / m_pixel_samples;
+    Color3 color = Color3::Black;
+    for ( unsigned int j = 0; j < m_pixel_samples; ++j ) {
+        for ( unsigned int i = 0; i < m_pixel_samples; ++i ) {
+            Vector3 direction = get_eye_direction( x + ( i + 0.5f ) * step - 0.5f, y + ( j + 0.5f ) * step - 0.5f,
+                                                   &differential );
+            scale_differential( &differential, step );
+            color += trace_ray( scene, MAX_RECURSION, RAY_EYE, direction, position, m_near_clip, m_far_clip, &differential, sampler );
+        }
+    }
+    return color * ( step * step );
+}
+
+Vector3 Raytracer::get_eye_direction( real_t x, real_t y, RayDifferential* differential ) const
+{
     Vector3 direction = m_camera_dir +                    // camera direction
-                        m_up_step    * (y*1.0f-height/2) + // vertical increasement
-                        m_right_step * (x*1.0f-width /2);  // horizontal increasement
-    direction = normalize(direction);
+                        m_up_step    * (y-height/2.0f) +  // vertical increasement
+                        m_right_step * (x-width /2.0f);   // horizontal increasement
+
+    if ( differential ) {
+        // all eye rays start at the camera, and their direction is normalized
+        real_t dd = dot( direction, direction );
+        real_t scale = 1 / ( dd * sqrt( dd ) );
+        differential->dpdx = Vector3::Zero;
+        differential->dpdy = Vector3::Zero;
+        differential->dddx = ( dd * m_right_step - dot( direction, m_right_step ) * direction ) * scale;
+        differential->dddy = ( dd * m_up_step    - dot( direction, m_up_step    ) * direction ) * scale;
+    }
+    return normalize(direction);
+}
+
+void Raytracer::trace_guide( size_t index, const Vector3& direction, const RayDifferential* differential )
+{
+    HitVertexInfor hit_vertex;
+    if ( !ray_hit( direction, m_camera_pos, m_near_clip, m_far_clip, hit_vertex, RAY_EYE, differential ) ) {
+        m_albedo[index] = Color3::White;
+        m_normal[index] = -direction;
+        m_depth[index] = 0;
+        return;
+    }
+
+    Vector3 normal = hit_vertex.normal;
+    if ( dot( normal, direction ) > 0 )
+        normal = -normal;
+
+    // mirrors and glass show the colors of what they reflect, not their own
+    Color3 albedo = hit_vertex.tex_color * hit_vertex.diffuse;
+    if ( hit_vertex.refractive_index != 0 || luminance( albedo ) <= 0 )
+        albedo = Color3::White;
+
+    m_albedo[index] = albedo;
+    m_normal[index] = normal;
+    m_depth[index] = length( hit_vertex.position - m_camera_pos );
+}
+
+void Raytracer::denoise_image( unsigned char* buffer, size_t num_threads )
+{
+    size_t num_pixels = m_region_width * m_region_height;
+    if ( 0 == num_pixels )
+        return;
+    bool has_variance = m_path_tracing && m_pass >= MIN_VARIANCE_SAMPLES;
+    m_denoised.resize( num_pixels );
+    m_variance.resize( has_variance ? num_pixels : 0 );
+
+    for ( size_t y = 0; y < m_region_height; ++y ) {
+        for ( size_t x = 0; x < m_region_width; ++x ) {
+            size_t index = y * m_region_width + x;
+            // tiles already traced in the current pass have one sample more
+            size_t tile = ( y / m_tile_size ) * m_num_tiles_x + x / m_tile_size;
+            real_t samples = 1;
+            if ( m_path_tracing )
+                samples = static_cast< real_t >( m_pass + ( tile < m_next_tile ? 1 : 0 ) );
+
+            Color3 mean = m_accumulation[index] * ( 1 / samples );
+            m_denoised[index] = mean;
+            if ( has_variance ) {
+                // variance of the mean, which shrinks with every sample
+                real_t l = luminance( Denoiser::demodulate( mean, m_albedo[index] ) );
+                real_t variance = m_luminance_sq[index] / samples - l * l;
+                m_variance[index] = std::max( real_t( 0 ), variance ) / samples;
+            }
+        }
+    }
+
+    DenoiseInput input;
+    input.color    = &m_denoised[0];
+    input.albedo   = &m_albedo[0];
+    input.normal   = &m_normal[0];
+    input.depth    = &m_depth[0];
+    input.variance = has_variance ? &m_variance[0] : 0;
+    input.width    = m_region_width;
+    input.height   = m_region_height;
+    m_denoiser.denoise( input, num_threads, &m_denoised[0] );
+
+    for ( size_t y = 0; y < m_region_height; ++y ) {
+        for ( size_t x = 0; x < m_region_width; ++x ) {
+            size_t index = ( m_region_y + y ) * width + m_region_x + x;
+            m_denoised[y * m_region_width + x].to_array( &buffer[4 * index] );
+        }
+    }
+}
+
+size_t Raytracer::get_thread_count() const
+{
+    if ( 0 == m_num_threads )
+        return std::max< size_t >( 1, boost::thread::hardware_concurrency() );
+    return m_num_threads;
+}
+
+void Raytracer::build_caustics( size_t num_threads )
+{
+    m_caustics.clear();
+    m_photon_targets.clear();
+    m_photon_emitters.clear();
+    m_photon_chunks.clear();
+    if ( 0 == m_photon_settings.photon_count )
+        return;
+
+    // aim at every refractive geometry, or at all of them at once if many
+    Geometry* const* geometries = scene->get_geometries();
+    std::vector< BoundingBox > target_bounds;
+    BoundingBox all_bounds;
+    for ( size_t i = 0; i < scene->num_geometries(); ++i ) {
+        if ( geometries[i]->is_refractive() ) {
+            target_bounds.push_back( geometries[i]->get_world_bounds() );
+            all_bounds.merge( target_bounds.back() );
+        }
+    }
+    if ( target_bounds.empty() )
+        return;
+    if ( target_bounds.size() > MAX_PHOTON_TARGETS )
+        target_bounds.assign( 1, all_bounds );
+
+    real_t max_radius = 0;
+    for ( size_t i = 0; i < target_bounds.size(); ++i ) {
+        PhotonTarget target;
+        Vector3 lo = target_bounds[i].get_left_bottom_front_corner();
+        Vector3 hi = target_bounds[i].get_right_top_back_corner();
+        target.center = ( lo + hi ) * 0.5f;
+        target.radius = std::max( 0.5f * length( hi - lo ), m_ray_epsilon );
+        m_photon_targets.push_back( target );
+        max_radius = std::max( max_radius, target.radius );
+    }
+
+    // share the photons among the lights by how bright they are, and how
+    // much of their light the targets cover
+    size_t num_point_lights = scene->num_lights();
+    size_t num_lights = num_point_lights + scene->num_area_lights();
+    const PointLight* point_lights = scene->get_lights();
+    const AreaLight* area_lights = scene->get_area_lights();
+    std::vector< real_t > weights( num_lights, 0 );
+    real_t total_weight = 0;
+    for ( size_t i = 0; i < num_lights; ++i ) {
+        bool is_point = i < num_point_lights;
+        const Vector3& position = is_point ? point_lights[i].position : area_lights[i - num_point_lights].position;
+        const Color3& color = is_point ? point_lights[i].color : area_lights[i - num_point_lights].color;
+        real_t solid_angle = 0;
+        for ( size_t j = 0; j < m_photon_targets.size(); ++j ) {
+            real_t distance = length( m_photon_targets[j].center - position );
+            real_t sin_max = m_photon_targets[j].radius / std::max( distance, m_ray_epsilon );
+            solid_angle += sin_max >= 1 ? 4 * PI : 2 * PI * ( 1 - sqrt( 1 - sin_max * sin_max ) );
+        }
+        weights[i] = luminance( color ) * std::min< real_t >( solid_angle, 4 * PI );
+        total_weight += weights[i];
+    }
+    if ( total_weight <= 0 )
+        return;
+
+    for ( size_t i = 0; i < num_lights; ++i ) {
+        PhotonEmitter emitter;
+        emitter.light = i;
+        emitter.photons = static_cast< size_t >( m_photon_settings.photon_count * weights[i] / total_weight + 0.5f );
+        if ( 0 == emitter.photons )
+            continue;
+        for ( size_t first = 0; first < emitter.photons; first += PHOTON_CHUNK_SIZE ) {
+            PhotonChunk chunk = { m_photon_emitters.size(), emitter.photons - first };
+            if ( chunk.photons > PHOTON_CHUNK_SIZE )
+                chunk.photons = PHOTON_CHUNK_SIZE;
+            m_photon_chunks.push_back( chunk );
+        }
+        m_photon_emitters.push_back( emitter );
+    }
+
+    unsigned int start_time = SDL_GetTicks();
+    m_chunk_photons.assign( m_photon_chunks.size(), std::vector< Photon >() );
+    m_next_photon_chunk = 0;
+    PhotonWorker worker = { this };
+    boost::thread_group threads;
+    for ( size_t i = 1; i < num_threads; ++i )
+        threads.create_thread( worker );
+    worker();
+    threads.join_all();
+
+    size_t num_photons = 0;
+    for ( size_t i = 0; i < m_chunk_photons.size(); ++i ) {
+        num_photons += m_chunk_photons[i].size();
+    }
+    std::vector< Photon > photons;
+    photons.reserve( num_photons );
+    for ( size_t i = 0; i < m_chunk_photons.size(); ++i ) {
+        photons.insert( photons.end(), m_chunk_photons[i].begin(), m_chunk_photons[i].end() );
+    }
+    std::vector< std::vector< Photon > >().swap( m_chunk_photons );
+
+    // without a given radius, caustics spread over a fraction of the glass
+    real_t gather_radius = m_photon_settings.gather_radius;
+    if ( gather_radius <= 0 )
+        gather_radius = 0.1f * max_radius;
+    m_caustics.build( photons, gather_radius );
+    printf( "Shot %u photons, %u of them caustics, in %u milliseconds.\n",
+            (unsigned int)m_photon_settings.photon_count, (unsigned int)m_caustics.size(),
+            SDL_GetTicks() - start_time );
+}
+
+bool Raytracer::acquire_photon_chunk( size_t* chunk )
+{
+    boost::mutex::scoped_lock lock( m_photon_mutex );
+    if ( m_next_photon_chunk >= m_photon_chunks.size() )
+        return false;
+    *chunk = m_next_photon_chunk++;
+    return true;
+}
+
+void Raytracer::shoot_photon_chunk( size_t chunk, std::vector< Photon >* photons )
+{
+    const PhotonEmitter& emitter = m_photon_emitters[m_photon_chunks[chunk].emitter];
+    size_t num_point_lights = scene->num_lights();
+    const PointLight* point_light = emitter.light < num_point_lights ? &scene->get_lights()[emitter.light] : 0;
+    const AreaLight* area_light = point_light ? 0 : &scene->get_area_lights()[emitter.light - num_point_lights];
 
-    // trace a ray and return its color
-    return trace_ray( scene, 4, direction, position, m_near_clip, m_far_clip );
+    Pcg32 rng( 0, chunk );
+    for ( size_t i = 0; i < m_photon_chunks[chunk].photons; ++i ) {
+        Vector2 u_direction( rng.next_real(), rng.next_real() );
+        real_t u_target = rng.next_real();
+        Vector2 u_origin( rng.next_real(), rng.next_real() );
+
+        Vector3 origin;
+        Vector3 direction;
+        real_t density;
+        Color3 intensity;
+        if ( point_light ) {
+            origin = point_light->position;
+            density = sample_photon_direction( origin, u_direction, u_target, &direction );
+            intensity = point_light->color;
+        } else if ( AreaLight::SPHERE == area_light->shape ) {
+            // from the disc facing the way the photon goes, as the light is
+            // sampled from the disc facing the lit point
+            density = sample_photon_direction( area_light->position, u_direction, u_target, &direction );
+            Vector3 tangent = fabs( direction.x ) > 0.5f ? Vector3::UnitY : Vector3::UnitX;
+            tangent = normalize( cross( tangent, direction ) );
+            Vector3 bitangent = cross( direction, tangent );
+            real_t r = area_light->radius * sqrt( u_origin.x );
+            real_t phi = 2 * PI * u_origin.y;
+            origin = area_light->position + tangent * ( r * cos( phi ) ) + bitangent * ( r * sin( phi ) );
+            intensity = area_light->color;
+        } else {
+            origin = area_light->position + area_light->axis_x * ( u_origin.x - 0.5f ) +
+                                            area_light->axis_z * ( u_origin.y - 0.5f );
+            density = sample_photon_direction( origin, u_direction, u_target, &direction );
+            intensity = area_light->color * std::max( dot( area_light->normal, direction ), 0.0f );
+        }
+        if ( density <= 0 || intensity == Color3::Black )
+            continue;
+
+        const PointLight::Attenuation& attenuation = point_light ? point_light->attenuation : area_light->attenuation;
+        trace_photon( origin, direction, intensity * ( 1 / ( density * emitter.photons ) ), attenuation, rng, photons );
+    }
+}
+
+real_t Raytracer::sample_photon_direction( const Vector3& origin, const Vector2& u, real_t u_target,
+                                           Vector3* direction ) const
+{
+    // the cone of each target, by the cosine of its half angle
+    const size_t num_targets = m_photon_targets.size();
+    real_t cos_max[MAX_PHOTON_TARGETS];
+    Vector3 axis[MAX_PHOTON_TARGETS];
+    real_t solid_angle[MAX_PHOTON_TARGETS];
+    real_t total_solid_angle = 0;
+    for ( size_t i = 0; i < num_targets; ++i ) {
+        Vector3 to_target = m_photon_targets[i].center - origin;
+        real_t distance = length( to_target );
+        real_t radius = m_photon_targets[i].radius;
+        if ( distance <= radius ) {
+            cos_max[i] = -1;
+            axis[i] = Vector3::UnitY;
+        } else {
+            cos_max[i] = sqrt( 1 - ( radius * radius ) / ( distance * distance ) );
+            axis[i] = to_target / distance;
+        }
+        solid_angle[i] = 2 * PI * ( 1 - cos_max[i] );
+        total_solid_angle += solid_angle[i];
+    }
+
+    size_t target = 0;
+    real_t threshold = u_target * total_solid_angle;
+    while ( target + 1 < num_targets && threshold >= solid_angle[target] ) {
+        threshold -= solid_angle[target];
+        target++;
+    }
+
+    // uniform over the cone
+    real_t cos_theta = 1 - u.x * ( 1 - cos_max[target] );
+    real_t sin_theta = sqrt( std::max< real_t >( 0, 1 - cos_theta * cos_theta ) );
+    real_t phi = 2 * PI * u.y;
+    const Vector3& w = axis[target];
+    Vector3 tangent = fabs( w.x ) > 0.5f ? Vector3::UnitY : Vector3::UnitX;
+    tangent = normalize( cross( tangent, w ) );
+    Vector3 bitangent = cross( w, tangent );
+    *direction = normalize( tangent * ( sin_theta * cos( phi ) ) + bitangent * ( sin_theta * sin( phi ) ) +
+                            w * cos_theta );
+
+    // the cones overlap, so each one that holds the direction adds to it
+    size_t covering = 0;
+    for ( size_t i = 0; i < num_targets; ++i ) {
+        if ( dot( *direction, axis[i] ) >= cos_max[i] )
+            covering++;
+    }
+    return std::max< size_t >( covering, 1 ) / total_solid_angle;
+}
+
+void Raytracer::trace_photon( Vector3 position, Vector3 direction, Color3 power,
+                              const PointLight::Attenuation& attenuation, Pcg32& rng,
+                              std::vector< Photon >* photons )
+{
+    real_t path_length = 0;
+    for ( int depth = 0; depth <= MAX_PHOTON_DEPTH; ++depth )
+    {
+        HitVertexInfor hit_vertex;
+        if ( !ray_hit( direction, position, m_ray_epsilon, 1000000, hit_vertex, RAY_PHOTON ) )
+            return;
+        path_length += length( hit_vertex.position - position );
+        position = hit_vertex.position;
+
+        if ( hit_vertex.refractive_index == 0 ) {
+            // only photons through glass, the rest is the direct light;
+            // their density falls off with the square of the distance,
+            // which turns into the light's own attenuation
+            if ( depth > 0 ) {
+                real_t falloff = attenuation.constant +
+                                 path_length * attenuation.linear +
+                                 path_length * path_length * attenuation.quadratic;
+                Photon photon;
+                photon.position = position;
+                photon.direction = -direction;
+                photon.power = power * ( path_length * path_length / std::max( falloff, 1e-6f ) );
+                photon.axis = 0;
+                photons->push_back( photon );
+            }
+            return;
+        }
+
+        // reflect or refract, chosen by the Fresnel coefficient
+        Vector3 rfr_ray_dir;
+        float R;
+        bool refracted = refraction_happened( scene, direction, hit_vertex, rfr_ray_dir, R );
+        if ( !refracted || rng.next_real() < R ) {
+            power *= hit_vertex.specular * hit_vertex.tex_color;
+            direction = normalize( direction - 2 * dot( direction, hit_vertex.normal ) * hit_vertex.normal );
+        } else {
+            power *= hit_vertex.tex_color;
+            direction = normalize( rfr_ray_dir );
+        }
+        if ( power == Color3::Black )
+            return;
+    }
+}
+
+bool Raytracer::acquire_tile( size_t* tile, unsigned int* pass )
+{
+    static const size_t PRINT_INTERVAL = 64;
+
+    boost::mutex::scoped_lock lock( m_tile_mutex );
+    size_t num_tiles = m_num_tiles_x * m_num_tiles_y;
+    while ( true ) {
+        if ( m_stopped || ( m_has_deadline && SDL_GetTicks() >= m_deadline ) )
+            return false;
+        if ( m_next_tile < num_tiles )
+            break;
+        if ( !m_path_tracing )
+            return false;
+
+        if ( 0 == m_tiles_in_flight ) {
+            // every tile of the pass is written, start the next one
+            m_pass++;
+            m_next_tile = 0;
+            // power of two pass counts
+            if ( m_verbose && 0 == ( m_pass & ( m_pass - 1 ) ) )
+                printf( "Path tracing (%u samples per pixel)...\n", m_pass );
+            // without a time limit, a call traces one pass
+            if ( !m_has_deadline ) {
+                m_stopped = true;
+                m_tile_released.notify_all();
+            }
+            continue;
+        }
+
+        // a tile must not be traced by two threads at once, so wait for the
+        // last tiles of the pass before starting the next one
+        m_tile_released.wait( lock );
+    }
+
+    if ( m_verbose && !m_path_tracing && m_next_tile % PRINT_INTERVAL == 0 )
+        printf( "Raytracing (tile %u of %u)...\n", (unsigned int)m_next_tile, (unsigned int)num_tiles );
+
+    *tile = m_next_tile++;
+    *pass = m_pass;
+    m_tiles_in_flight++;
+    return true;
+}
+
+void Raytracer::release_tile()
+{
+    boost::mutex::scoped_lock lock( m_tile_mutex );
+    if ( 0 == --m_tiles_in_flight )
+        m_tile_released.notify_all();
+}
+
+void Raytracer::get_tile_bounds( size_t tile, size_t* x, size_t* y, size_t* width, size_t* height ) const
+{
+    *x = m_region_x + ( tile % m_num_tiles_x ) * m_tile_size;
+    *y = m_region_y + ( tile / m_num_tiles_x ) * m_tile_size;
+    *width = std::min( m_tile_size, m_region_x + m_region_width - *x );
+    *height = std::min( m_tile_size, m_region_y + m_region_height - *y );
+}
+
+void Raytracer::trace_tile( size_t tile, unsigned int pass, Sampler& sampler, unsigned char* buffer )
+{
+    size_t x_begin, y_begin, tile_width, tile_height;
+    get_tile_bounds( tile, &x_begin, &y_begin, &tile_width, &tile_height );
+    size_t x_end = x_begin + tile_width;
+    size_t y_end = y_begin + tile_height;
+    // the counters of this thread, when the pixels' costs are recorded
+    TraceCounters* counters = m_record_costs ? get_trace_counters() : 0;
+
+    for ( size_t y = y_begin; y < y_end; ++y ) {
+        for ( size_t x = x_begin; x < x_end; ++x ) {
+            // pixel in the image, and in the buffers of the region
+            size_t index = y * width + x;
+            size_t local = ( y - m_region_y ) * m_region_width + x - m_region_x;
+            Color3 color;
+
+            TraceCounters before;
+            uint64_t start_time = 0;
+            if ( counters ) {
+                counters->max_depth = 0;
+                before = *counters;
+                start_time = GetTimeNanoseconds();
+            }
+
+            if ( m_path_tracing ) {
+                // jitter the eye ray within the pixel, which antialiases the image
+                sampler.start_sample( static_cast< uint32_t >( index ), pass );
+                Vector2 jitter = sampler.next_2d();
+                RayDifferential differential;
+                Vector3 direction = get_eye_direction( x + jitter.x - 0.5f, y + jitter.y - 0.5f, &differential );
+                if ( m_denoise && 0 == pass ) {
+                    RayDifferential guide_differential;
+                    Vector3 guide_direction = get_eye_direction( static_cast< real_t >( x ), static_cast< real_t >( y ),
+                                                                 &guide_differential );
+                    trace_guide( local, guide_direction, &guide_differential );
+                }
+
+                // the samples of later passes filter the textures over a
+                // shrinking footprint, as the jitter already antialiases them
+                scale_differential( &differential, std::max< real_t >( 0.125f, 1 / sqrt( real_t( pass + 1 ) ) ) );
+                Color3 sample = trace_path( scene, direction, m_camera_pos, &differential, sampler );
+                m_accumulation[local] += sample;
+                if ( counters )
+                    m_cost_map.add( index, GetTimeNanoseconds() - start_time, before, *counters );
+                if ( m_denoise ) {
+                    real_t l = luminance( Denoiser::demodulate( sample, m_albedo[local] ) );
+                    m_luminance_sq[local] += l * l;
+                    // after the first pass, the buffer shows the denoised image of the last one
+                    if ( pass > 0 )
+                        continue;
+                }
+                color = m_accumulation[local] * ( 1.0f / ( pass + 1 ) );
+            } else {
+                // trace a pixel
+                sampler.start_sample( static_cast< uint32_t >( index ), 0 );
+                color = trace_pixel( scene, x, y, width, height, sampler );
+                if ( m_denoise ) {
+                    RayDifferential differential;
+                    Vector3 direction = get_eye_direction( static_cast< real_t >( x ), static_cast< real_t >( y ),
+                                                           &differential );
+                    trace_guide( local, direction, &differential );
+                    m_accumulation[local] = color;
+                }
+                if ( counters )
+                    m_cost_map.add( index, GetTimeNanoseconds() - start_time, before, *counters );
+            }
+
+            // write the result to the buffer, always use 1.0 as the alpha
+            color.to_array( &buffer[4 * index] );
+        }
+    }
 }
 
 /**
@@ -347,54 +1550,222 @@ Color3 Raytracer::trace_pixel( const Scene* scene, size_t x, size_t y, size_t wi
  */
 bool Raytracer::raytrace( unsigned char *buffer, real_t* max_time )
 {
-    // TODO Add any modifications to this algorithm, if needed.
-
-    static long start_time; // used to show how long time ray tracing cost
-    if (0 == current_row)
-        start_time = clock();
-
-    static const size_t PRINT_INTERVAL = 64;
+    if (0 == m_next_tile && 0 == m_pass)
+    {
+        PageCacheSingleton::Instance().reset_stats();
+        TessellationCacheSingleton::Instance().reset_stats();
+        m_irradiance_cache.reset_stats();
+    }
 
-    // the time in milliseconds that we should stop
-    unsigned int end_time = 0;
-    bool is_done = false;
+    begin_ray_capture();
 
+    m_has_deadline = max_time != 0;
     if ( max_time ) {
         // convert duration to milliseconds
         unsigned int duration = (unsigned int) ( *max_time * 1000 );
-        end_time = SDL_GetTicks() + duration;
+        m_deadline = SDL_GetTicks() + duration;
     }
+    m_stopped = false;
 
-    // until time is up, run the raytrace. we render an entire row at once
-    // for simplicity and efficiency.
-    for ( ; !max_time || end_time > SDL_GetTicks(); ++current_row ) {
+    // trace tiles on every core until time is up, or the pass is done
+    size_t num_threads = get_thread_count();
 
-        if ( current_row % PRINT_INTERVAL == 0 ) {
-            printf( "Raytracing (row %u)...\n", current_row );
-        }
+    unsigned int start_pass = m_pass;
+    // wall clock time, clock() adds up the time of every thread on some systems
+    uint64_t start_time = GetTimeNanoseconds();
+    boost::thread_group threads;
+    for ( size_t i = 1; i < num_threads; ++i ) {
+        RaytraceWorker worker = { this, buffer, i };
+        threads.create_thread( worker );
+    }
+    RaytraceWorker worker = { this, buffer, 0 };
+    worker();
+    threads.join_all();
+    m_stats.add_time( GetTimeNanoseconds() - start_time );
 
-        // we're done if we finish the last row
-        is_done = current_row == height;
-        // break if we finish
-        if ( is_done )
-            break;
+    // path tracing refines the image for as long as it is shown
+    bool is_done = !m_path_tracing && m_next_tile == m_num_tiles_x * m_num_tiles_y;
+    if ( m_denoise && ( m_path_tracing ? m_pass != start_pass : is_done ) )
+        denoise_image( buffer, num_threads );
 
-        for ( size_t x = 0; x < width; ++x ) {
-            // trace a pixel
-            Color3 color = trace_pixel( scene, x, current_row, width, height );
-            // write the result to the buffer, always use 1.0 as the alpha
-            color.to_array( &buffer[4 * ( current_row * width + x )] );
-        }
+    if ( m_ray_stream.is_open() && ( m_path_tracing ? m_pass != start_pass : is_done ) ) {
+        uint64_t num_rays = m_ray_stream.num_rays();
+        if ( m_ray_stream.close() )
+            printf( "Recorded %.0f rays.\n", static_cast< double >( num_rays ) );
     }
 
-    if ( is_done ) {
-        printf( "Done raytracing!\n" );
-        printf( "Used %d milliseconds.\n", clock()-start_time );
+    // a path traced image is never done, so its statistics follow every pass
+    if ( m_verbose && ( m_path_tracing ? m_pass != start_pass : is_done ) ) {
+        if ( is_done )
+            printf( "Done raytracing!\n" );
+        else
+            printf( "Finished path tracing pass %u.\n", m_pass );
+        m_stats.print( std::cout );
+        PageCacheSingleton::Instance().print_stats( std::cout );
+        TessellationCacheSingleton::Instance().print_stats( std::cout );
+        if ( m_irradiance_caching )
+            m_irradiance_cache.print_stats( std::cout, m_stats.get_totals() );
     }
 
-
     return is_done;
 }
 
-} 
+uint64_t Raytracer::get_checkpoint_key() const
+{
+    uint32_t settings[] = {
+        static_cast< uint32_t >( width ), static_cast< uint32_t >( height ),
+        m_path_tracing, m_denoise, static_cast< uint32_t >( m_sampler_type ),
+        m_pixel_samples, m_shadow_samples, m_light_samples,
+        static_cast< uint32_t >( m_tile_size ),
+        m_proxy_depth, m_proxy_shadows, m_irradiance_caching,
+        static_cast< uint32_t >( m_photon_settings.photon_count ),
+        static_cast< uint32_t >( scene->num_geometries() ),
+        static_cast< uint32_t >( scene->num_lights() + scene->num_area_lights() )
+    };
+    // the eye ray setup covers the camera and its field of view
+    real_t camera[] = {
+        m_camera_pos.x, m_camera_pos.y, m_camera_pos.z,
+        m_camera_dir.x, m_camera_dir.y, m_camera_dir.z,
+        m_up_step.x, m_up_step.y, m_up_step.z,
+        m_right_step.x, m_right_step.y, m_right_step.z,
+        m_near_clip, m_far_clip
+    };
+    uint64_t key = Math::FNV1aHash64( &CHECKPOINT_VERSION, sizeof CHECKPOINT_VERSION );
+    key = Math::FNV1aHash64( settings, sizeof settings, key );
+    key = Math::FNV1aHash64( camera, sizeof camera, key );
+
+    // an edit of the scene or of a mesh file invalidates the image even
+    // when the counts above stay the same
+    key = hash_file_stamp( scene->get_filename(), key );
+    Mesh* const* meshes = scene->get_meshes();
+    for ( size_t i = 0; i < scene->num_meshes(); ++i )
+        key = hash_file_stamp( meshes[i]->filename, key );
+    return key;
+}
+
+void Raytracer::begin_ray_capture()
+{
+    if ( m_ray_capture_path.empty() || !scene )
+        return;
+    m_ray_stream.open( m_ray_capture_path, scene->get_filename() );
+    m_ray_capture_path.clear();
+}
+
+bool Raytracer::save_checkpoint( const std::string& path, const unsigned char* buffer ) const
+{
+    if ( !scene )
+        return false;
+
+    // write to a temporary file first, so a crash never loses the last checkpoint
+    std::string tmp_path = path + ".tmp";
+    FILE* fp = fopen( tmp_path.c_str(), "wb" );
+    if ( !fp ) {
+        std::cout << "Cannot write checkpoint file '" << tmp_path << "'.\n";
+        return false;
+    }
+
+    CheckpointHeader header;
+    memset( &header, 0, sizeof header );
+    memcpy( header.magic, CHECKPOINT_MAGIC, sizeof CHECKPOINT_MAGIC );
+    header.version = CHECKPOINT_VERSION;
+    header.real_size = sizeof( real_t );
+    header.key = get_checkpoint_key();
+    header.width = width;
+    header.height = height;
+    header.region_x = m_region_x;
+    header.region_y = m_region_y;
+    header.region_width = m_region_width;
+    header.region_height = m_region_height;
+    header.next_tile = m_next_tile;
+    header.pass = m_pass;
+
+    size_t buffer_size = 4 * width * height;
+    bool ok = fwrite( &header, sizeof header, 1, fp ) == 1 &&
+              ( 0 == buffer_size || fwrite( buffer, 1, buffer_size, fp ) == buffer_size ) &&
+              write_values( fp, m_accumulation ) &&
+              write_values( fp, m_albedo ) &&
+              write_values( fp, m_normal ) &&
+              write_values( fp, m_depth ) &&
+              write_values( fp, m_luminance_sq );
+    ok = ( 0 == fclose( fp ) ) && ok;
+
+    ok = ok && ReplaceExistingFile( tmp_path, path );
+    if ( !ok ) {
+        std::cout << "Error writing checkpoint file '" << path << "'.\n";
+        remove( tmp_path.c_str() );
+        return false;
+    }
+
+    if ( m_verbose ) {
+        printf( "Saved checkpoint to '%s' (tile %u of %u, pass %u).\n", path.c_str(),
+                (unsigned int)m_next_tile, (unsigned int)( m_num_tiles_x * m_num_tiles_y ), m_pass );
+    }
+    return true;
+}
+
+bool Raytracer::load_checkpoint( const std::string& path, unsigned char* buffer )
+{
+    if ( !scene )
+        return false;
+    FILE* fp = fopen( path.c_str(), "rb" );
+    if ( !fp )
+        return false;
+
+    CheckpointHeader header;
+    bool ok = fread( &header, sizeof header, 1, fp ) == 1 &&
+              0 == memcmp( header.magic, CHECKPOINT_MAGIC, sizeof CHECKPOINT_MAGIC ) &&
+              header.version == CHECKPOINT_VERSION &&
+              header.real_size == sizeof( real_t ) &&
+              header.key == get_checkpoint_key() &&
+              header.width == width && header.height == height &&
+              header.region_x + header.region_width <= width &&
+              header.region_y + header.region_height <= height;
+
+    // read everything before changing anything, so a torn file changes nothing
+    size_t num_tiles_x = static_cast< size_t >( ( header.region_width + m_tile_size - 1 ) / m_tile_size );
+    size_t num_tiles_y = static_cast< size_t >( ( header.region_height + m_tile_size - 1 ) / m_tile_size );
+    size_t num_pixels = static_cast< size_t >( header.region_width * header.region_height );
+    size_t accumulation_size = ( m_path_tracing || m_denoise ) ? num_pixels : 0;
+    size_t guide_size = m_denoise ? num_pixels : 0;
+    std::vector< unsigned char > image;
+    std::vector< Color3 > accumulation, albedo;
+    std::vector< Vector3 > normal;
+    std::vector< real_t > depth, luminance_sq;
+    ok = ok && header.next_tile <= num_tiles_x * num_tiles_y &&
+         read_values( fp, 4 * width * height, &image ) &&
+         read_values( fp, accumulation_size, &accumulation ) &&
+         read_values( fp, guide_size, &albedo ) &&
+         read_values( fp, guide_size, &normal ) &&
+         read_values( fp, guide_size, &depth ) &&
+         read_values( fp, guide_size, &luminance_sq );
+    fclose( fp );
+
+    if ( !ok ) {
+        std::cout << "Ignoring checkpoint file '" << path << "', which is incomplete or of another image.\n";
+        return false;
+    }
+
+    boost::mutex::scoped_lock lock( m_tile_mutex );
+    m_region_x = static_cast< size_t >( header.region_x );
+    m_region_y = static_cast< size_t >( header.region_y );
+    m_region_width = static_cast< size_t >( header.region_width );
+    m_region_height = static_cast< size_t >( header.region_height );
+    m_num_tiles_x = num_tiles_x;
+    m_num_tiles_y = num_tiles_y;
+    m_next_tile = static_cast< size_t >( header.next_tile );
+    m_tiles_in_flight = 0;
+    m_pass = static_cast< unsigned int >( header.pass );
+    m_accumulation.swap( accumulation );
+    m_albedo.swap( albedo );
+    m_normal.swap( normal );
+    m_depth.swap( depth );
+    m_luminance_sq.swap( luminance_sq );
+    if ( !image.empty() )
+        memcpy( buffer, &image[0], image.size() );
+
+    std::cout << "Resumed from checkpoint file '" << path << "' (tile " << m_next_tile << " of "
+              << m_num_tiles_x * m_num_tiles_y << ", pass " << m_pass << ").\n";
+    return true;
+}
 
+}
@@ -13,14 +13,33 @@
 
 #include "math/color.hpp"
 #include "math/vector.hpp"
+#include "math/camera.hpp"
+#include "math/sampler.hpp"
+#include "scene/acceleration.hpp"
+#include "scene/light_tree.hpp"
+#include "scene/ray_stream.hpp"
+#include "cost_map.hpp"
+#include "denoiser.hpp"
+#include "frame_stats.hpp"
+#include "irradiance_cache.hpp"
+#include "photon_map.hpp"
+
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <algorithm>
+#include <string>
+#include <vector>
 
 namespace Luc {
 
 class Scene;
-class Camera;
 struct MeshVertex;
 class Geometry;
 struct HitVertexInfor;
+struct RayDifferential;
+struct AreaLight;
+struct PointLight;
 
 class Raytracer
 {
@@ -32,11 +51,287 @@ public:
     bool initialize( Scene* scene, size_t width, size_t height, Camera& camera );
     bool raytrace( unsigned char* buffer, real_t* max_time );
 
+    /*
+     * Switches between the Whitted tracer, which finishes after one pass,
+     * and progressive path tracing, which keeps adding a sample per pixel
+     * with every pass. Takes effect at the next initialize.
+     */
+    void set_path_tracing( bool enabled ) { m_path_tracing = enabled; }
+    bool is_path_tracing() const { return m_path_tracing; }
+
+    /*
+     * Filters the noise out of the image with the denoiser, guided by the
+     * albedo, normal and depth of the surfaces the eye rays hit. A path
+     * traced image is then shown once a pass is complete, denoised, instead
+     * of tile by tile. Takes effect at the next initialize.
+     */
+    void set_denoise( bool enabled ) { m_denoise = enabled; }
+    bool is_denoising() const { return m_denoise; }
+    DenoiseSettings& get_denoise_settings() { return m_denoiser.settings; }
+
+    /*
+     * Replaces the constant ambient term of the Whitted tracer with the
+     * indirect diffuse light of the scene, sampled sparsely and kept in the
+     * irradiance cache. The cache outlives the image, so moving the camera
+     * through a scene with unchanged geometry and lights reuses it. Takes
+     * effect at the next initialize.
+     */
+    void set_irradiance_caching( bool enabled ) { m_irradiance_caching = enabled; }
+    bool is_caching_irradiance() const { return m_irradiance_caching; }
+    IrradianceSettings& get_irradiance_settings() { return m_irradiance_cache.settings; }
+    /// Drops the cached irradiance, for when the scene changed.
+    void clear_irradiance_cache() { m_irradiance_cache.clear(); }
+
+    /*
+     * Photons shot from the lights through the refractive geometry, which
+     * add the caustics both tracers miss, as glass blocks their shadow
+     * rays. Takes effect at the next initialize, which shoots them.
+     */
+    PhotonSettings& get_photon_settings() { return m_photon_settings; }
+
+    /// Sequence of the path tracing samples, see Sampler.
+    void set_sampler( SamplerType type ) { m_sampler_type = type; }
+
+    /*
+     * Most shadow rays the Whitted tracer sends to an area light from one
+     * point. It starts with a few, and only sends the rest in penumbrae,
+     * where the first ones disagree.
+     */
+    void set_shadow_samples( unsigned int count ) { m_shadow_samples = std::max( 1u, count ); }
+
+    /*
+     * Once a scene has more lights than this, each shaded point sends this
+     * many shadow rays to lights picked by the light tree, instead of one
+     * to every light. 0 always shades every light. Takes effect at the
+     * next initialize.
+     */
+    void set_light_samples( unsigned int count ) { m_light_samples = count; }
+
+    /*
+     * Rays from this bounce on trace the simplified proxies of the meshes
+     * that have one, with 1 for every ray past the eye rays, and 0 for none.
+     */
+    void set_proxy_depth( unsigned int depth ) { m_proxy_depth = depth; }
+    /// Whether shadow rays trace the proxies of the meshes.
+    void set_proxy_shadows( bool enabled ) { m_proxy_shadows = enabled; }
+
+    /*
+     * Side length of the square tiles handed out to the tracing threads.
+     * Smaller tiles keep more threads busy at the end of a pass, larger
+     * ones hand out less often. Starts the image over.
+     */
+    void set_tile_size( size_t size );
+
+    /// Number of tracing threads, 0 for one per core.
+    void set_num_threads( size_t count ) { m_num_threads = count; }
+    /// Tracing threads to use, resolving 0 to one per core.
+    size_t get_thread_count() const;
+
+    /*
+     * Aims the eye rays with a new camera. If the camera moved, the image
+     * starts over, dropping the samples accumulated so far.
+     * @return true if the camera moved.
+     */
+    bool update_camera( const Camera& camera );
+
+    /*
+     * Changes the size of the image, keeping the scene, its acceleration
+     * structure and the camera, and starts the image over. The live view
+     * traces small images while the camera moves, and the full size once
+     * it stops.
+     */
+    void set_resolution( size_t width, size_t height );
+    size_t get_width() const { return width; }
+    size_t get_height() const { return height; }
+
+    /*
+     * Traces only a rectangle of the image, in pixels from its bottom left
+     * corner, clamped to the image, and starts it over. The rest of the
+     * buffer is left as it is, so a region can be traced again at a higher
+     * quality over the image already shown.
+     */
+    void set_region( size_t x, size_t y, size_t width, size_t height );
+    /// Traces the whole image again, and starts it over.
+    void clear_region();
+    bool has_region() const { return m_region_width != width || m_region_height != height; }
+
+    /*
+     * Eye rays of a pixel of a Whitted image along each side, n by n of
+     * them spread evenly over the pixel. Path tracing jitters its eye rays
+     * instead. Takes effect for the pixels traced from then on.
+     */
+    void set_pixel_samples( unsigned int count ) { m_pixel_samples = std::max( 1u, count ); }
+
+    /// Whether progress and statistics are printed, on by default.
+    void set_verbose( bool enabled ) { m_verbose = enabled; }
+
+    /// Number of finished path tracing passes, i.e. samples per pixel.
+    unsigned int num_passes() const { return m_pass; }
+
+    /// Drops the accumulated samples and starts the image over.
+    void restart();
+
+    /*
+     * Tiles of the image, or of its region, and how many of the current
+     * pass are written, in order. Between raytrace calls every tile before
+     * that one is in the buffer.
+     */
+    size_t num_tiles() const { return m_num_tiles_x * m_num_tiles_y; }
+    size_t num_tiles_done() const { return m_next_tile; }
+    /// Pixels of a tile, counted from the bottom left corner of the image.
+    void get_tile_bounds( size_t tile, size_t* x, size_t* y, size_t* width, size_t* height ) const;
+
+    /*
+     * Writes the progress of the image to a file: the buffer, the samples
+     * accumulated so far, and the tiles and passes that are done, so a
+     * render that dies can go on from there. Call it between raytrace
+     * calls. An older checkpoint is replaced only once the new one is
+     * complete.
+     */
+    bool save_checkpoint( const std::string& path, const unsigned char* buffer ) const;
+
+    /*
+     * Goes on from a checkpoint of the same image, after initialize: same
+     * size, camera and settings. Copies the image saved in it to the buffer.
+     * @return false, and the image is left as it was, if there is no
+     *  checkpoint or it is of another image.
+     */
+    bool load_checkpoint( const std::string& path, unsigned char* buffer );
+
+    /*
+     * Records every ray traced for the next image, or path tracing pass,
+     * to a ray stream file, see ray_stream.hpp. Recording starts at the
+     * next initialize, which also records the photons of the caustics, or
+     * raytrace call, and the file is written once the image is done.
+     */
+    void capture_rays( const std::string& path ) { m_ray_capture_path = path; }
+
+    /*
+     * Records what every pixel costs to trace, in time, rays, bounding box
+     * and triangle tests and bounces, see CostMap. Timing each pixel slows
+     * the tracing slightly. Takes effect when the image starts over.
+     */
+    void set_cost_recording( bool enabled ) { m_record_costs = enabled; }
+    bool is_recording_costs() const { return m_record_costs; }
+    /// The costs of the pixels traced so far, empty unless recording.
+    const CostMap& get_cost_map() const { return m_cost_map; }
+
+    /*
+     * The rays and intersection tests of the image so far, by thread, and
+     * the time spent tracing them. Starts over with the image.
+     */
+    const FrameStats& get_stats() const { return m_stats; }
+    /// Nanoseconds the last initialize spent building the acceleration structure.
+    uint64_t get_build_time() const { return m_build_time; }
+
 private:
 
+    friend struct RaytraceWorker;
+    friend struct PhotonWorker;
+
+    // side length of the square tiles, unless set_tile_size changes it
+    static const size_t DEFAULT_TILE_SIZE = 16;
+    // longest path traced in path tracing mode
+    static const int MAX_PATH_DEPTH = 16;
+    // shadow rays sent to an area light before deciding if it is a penumbra
+    static const unsigned int MIN_SHADOW_SAMPLES = 4;
+    // photons shot per chunk, each chunk with its own random stream
+    static const size_t PHOTON_CHUNK_SIZE = 4096;
+    // most refractive surfaces a photon passes or reflects off
+    static const int MAX_PHOTON_DEPTH = 8;
+    // more refractive geometries than this are aimed at as one
+    static const size_t MAX_PHOTON_TARGETS = 16;
+
+    // a light, numbered as in the light tree, and the photons it shoots
+    struct PhotonEmitter
+    {
+        size_t light;
+        size_t photons;
+    };
+    // some photons of an emitter, shot by one thread
+    struct PhotonChunk
+    {
+        size_t emitter;
+        size_t photons;
+    };
+    // a sphere around refractive geometry, which the photons are aimed at
+    struct PhotonTarget
+    {
+        Vector3 center;
+        real_t radius;
+    };
+
+    // computes the eye ray setup of a camera
+    void setup_camera( const Camera& camera );
+    // makes the region the whole image, and tiles it
+    void reset_region();
+    // splits the region into tiles of the tile size
+    void update_tiles();
+    // identifies the image a checkpoint is of, from the size, camera and settings
+    uint64_t get_checkpoint_key() const;
+    // starts recording rays, if capture_rays asked for it
+    void begin_ray_capture();
+
+    /*
+     * Hands out the next tile to trace, or returns false once the pass is
+     * done or the time is up. In path tracing mode a finished pass wraps
+     * around to the next one, after every tile of it has been written.
+     */
+    bool acquire_tile( size_t* tile, unsigned int* pass );
+    void release_tile();
+
+    // traces and writes one tile of the image, with the calling thread's sampler
+    void trace_tile( size_t tile, unsigned int pass, Sampler& sampler, unsigned char* buffer );
+
+    // fills the denoiser's guide buffers at a pixel from its eye ray
+    void trace_guide( size_t index, const Vector3& direction, const RayDifferential* differential );
+
+    // denoises the image traced so far and writes it to the buffer
+    void denoise_image( unsigned char* buffer, size_t num_threads );
+
+    /*
+     * Shoots the photons of every light at the refractive geometry of the
+     * scene, spread over the threads in chunks, and builds the caustics
+     * photon map from the ones that come out on diffuse surfaces. The chunks
+     * have their own random streams and keep their order, so the map does
+     * not depend on the number of threads.
+     */
+    void build_caustics( size_t num_threads );
+    // hands out the next chunk of photons to shoot, false once all are
+    bool acquire_photon_chunk( size_t* chunk );
+    void shoot_photon_chunk( size_t chunk, std::vector< Photon >* photons );
+
+    /*
+     * Picks a direction from a point into the cone of one of the photon
+     * targets, chosen in proportion to the solid angle of their cones.
+     *
+     * @return Density of the direction over the sphere of directions.
+     */
+    real_t sample_photon_direction( const Vector3& origin, const Vector2& u, real_t u_target,
+                                    Vector3* direction ) const;
+
+    /*
+     * Follows a photon through refractive geometry, reflecting or
+     * refracting it by the Fresnel coefficient, and stores it where it
+     * stops on a diffuse surface after at least one of them.
+     *
+     * @param power         Light of the photon, as if it were never attenuated.
+     * @param attenuation   Attenuation of its light, over the whole path.
+     */
+    void trace_photon( Vector3 position, Vector3 direction, Color3 power,
+                       const PointLight::Attenuation& attenuation, Pcg32& rng,
+                       std::vector< Photon >* photons );
+
+    /*
+     * Direction of the eye ray through a point of the image plane, and
+     * optionally how it changes from one pixel to the next.
+     */
+    Vector3 get_eye_direction( real_t x, real_t y, RayDifferential* differential = 0 ) const;
+
     Color3 trace_pixel( const Scene* scene, 
                         size_t x, size_t y, 
-                        size_t width, size_t height );
+                        size_t width, size_t height,
+                        Sampler& sampler );
 
     /*
      * Trace a ray, calculating the color of this ray.
@@ -46,17 +341,24 @@ private:
      *                  information.
      * @param recursion The level of recursive light. If the level is larger or 
      *                  equal to 4, stop recursion.
+     * @param type      What the ray is traced for, eye, reflected or refracted.
      * @param ray_dir   Direction vector of ray.
      * @param ray_pos   Start point of ray.
      * @param tMin      Minimum legal time cost for this ray.
      * @param tMax      Maximum legal time cost for this ray.
+     * @param differential  Differentials of the ray, for filtering the 
+     *                      textures it hits. NULL to sample them unfiltered.
+     * @param sampler   Sample values of the pixel, for the area lights.
      *
      * @return  The color of this ray.
      */
     Color3 trace_ray( Scene const* scene,   // geometries   
                       const int recursion,  // recursion level
+                      RayType type,
                       const Vector3 &ray_dir, const Vector3 &ray_pos,  // ray
-                      const float tMin,       const float tMax         // ray range
+                      const float tMin,       const float tMax,        // ray range
+                      const RayDifferential* differential,
+                      Sampler& sampler
                       );
     /*
      * Check if this ray will be refracted. If refract, calculate direction of 
@@ -87,40 +389,220 @@ private:
      *                          information.
      * @param hit_vertex[out]   A struct storing all useful intersection point 
      *                          information.
+     * @param sampler           Sample values of the pixel, one per area light
+     *                          to scramble its shadow rays.
      *
      * @return Direct illumination color.
      */
-    Color3 calculate_DI_light(Scene const*scene, const HitVertexInfor &hit_vertex);
+    Color3 calculate_DI_light(Scene const*scene, const HitVertexInfor &hit_vertex, Sampler& sampler);
+
+    /*
+     * Light of the lights reaching a hit, weighted by its diffuse color
+     * and the cosine at the surface, without the ambient term and texture.
+     */
+    Color3 calculate_direct_light(Scene const*scene, const HitVertexInfor &hit_vertex, Sampler& sampler);
+
+    /*
+     * Indirect irradiance at a hit, interpolated from the irradiance cache,
+     * or sampled over the hemisphere and added to it if no cached sample
+     * is close enough.
+     */
+    Color3 calculate_irradiance(Scene const*scene, const HitVertexInfor &hit_vertex, Sampler& sampler);
+
+    /*
+     * Light from a point light reaching a surface point, weighted by the
+     * cosine at the surface. Black if the shadow ray to it is blocked.
+     */
+    Color3 sample_point_light(const PointLight& light,
+                              const Vector3& position, const Vector3& normal);
+
+    /*
+     * Light from one point of an area light reaching a surface point, 
+     * weighted by the cosine at the surface. Black if the shadow ray to it
+     * is blocked.
+     *
+     * @param u     Sample in [0, 1)^2 choosing the point of the light.
+     */
+    Color3 sample_area_light(const AreaLight& light,
+                             const Vector3& position, const Vector3& normal,
+                             const Vector2& u);
+
+    /*
+     * Average light of an area light reaching a surface point, from up to
+     * m_shadow_samples shadow rays. The first MIN_SHADOW_SAMPLES decide:
+     * if all of them are lit, or all dark, the point is taken to be out of
+     * the penumbra and no more are sent. Otherwise the count doubles until
+     * the limit, with each batch filling in the gaps of the ones before.
+     *
+     * @param seed  Scrambles the points of the light, see sample_02_sequence.
+     */
+    Color3 shade_area_light(const AreaLight& light,
+                            const Vector3& position, const Vector3& normal,
+                            uint32_t seed);
+
+    /*
+     * Estimate of the light of all the lights reaching a surface point,
+     * from m_light_samples shadow rays to lights picked by the light tree,
+     * each one weighted by the inverse of its chance of being picked.
+     *
+     * @param u     Sample in [0, 1), stratified over the picks.
+     * @param seed  Scrambles the points of the picked area lights.
+     */
+    Color3 sample_light_tree(Scene const* scene,
+                             const Vector3& position, const Vector3& normal,
+                             real_t u, uint32_t seed);
+
+    /*
+     * Trace a path from the camera, calculating the light it carries back.
+     * At every diffuse hit, the point lights and one point of each area
+     * light are sampled directly with a shadow ray (next event estimation),
+     * or in scenes with many lights, a few lights from the light tree, 
+     * and the path continues in a
+     * cosine distributed direction; mirrors and dielectrics continue it
+     * in their one reflected or refracted direction.
+     *
+     * @param scene     The scene object, which contains all geometries 
+     *                  information.
+     * @param ray_dir   Direction vector of ray.
+     * @param ray_pos   Start point of ray.
+     * @param differential  Differentials of the eye ray, which follow the
+     *                      path until its first diffuse bounce.
+     * @param sampler   Sample values of this path, started at its pixel.
+     *
+     * @return  The radiance along the path.
+     */
+    Color3 trace_path( Scene const* scene,
+                       Vector3 ray_dir, Vector3 ray_pos,
+                       const RayDifferential* differential,
+                       Sampler& sampler );
 
 
     /*
      * Detect if a ray will hit any geometry in legal time cost range. If hit 
      * any geometry, output intersection point information.
      * 
-     * @param scene             The scene object, which contains all geometries 
-     *                          information.
      * @param ray_dir           Direction vector of ray.
      * @param ray_pos           Start point of ray.
      * @param tMin              Minimum legal time cost for this ray.
      * @param tMax              Maximum legal time cost for this ray.
      * @param hit_vertex[out]   A struct storing all useful intersection point 
      *                          information.
+     * @param type              What the ray is traced for, for ray capture and statistics.
+     * @param differential      Differentials of the ray, NULL if it has none.
+     * @param use_proxy         Trace the proxies of meshes that have one.
      *
      * @return true if hit any geometry, otherwise false.
      */
-    bool ray_hit( Scene const*scene,                                    // geometries
-                  const Vector3 &ray_dir,   const Vector3 &ray_pos,     // ray
+    bool ray_hit( const Vector3 &ray_dir,   const Vector3 &ray_pos,     // ray
                   const float tMin,         const float tMax,           // ray range
-                  HitVertexInfor& hit_vertex);  // intersection point information 
+                  HitVertexInfor& hit_vertex,   // intersection point information 
+                  RayType type,
+                  const RayDifferential* differential = 0,
+                  bool use_proxy = false);
+
+    // whether rays of a bounce trace the mesh proxies, see set_proxy_depth
+    bool use_proxy_at( int depth ) const
+    {
+        return m_proxy_depth > 0 && depth >= static_cast< int >( m_proxy_depth );
+    }
 
     // the scene to trace
     Scene* scene;
 
+    // finds the geometries hit by rays, built in initialize
+    boost::scoped_ptr< Acceleration > m_acceleration;
+    // nanoseconds initialize spent building m_acceleration
+    uint64_t m_build_time;
+
     // the dimensions of the image to trace
     size_t width, height;
 
-    // the next row to raytrace
-    size_t current_row;
+    // the rectangle of the image that is traced, see set_region
+    size_t m_region_x, m_region_y, m_region_width, m_region_height;
+
+    // tiles of the region, row by row, and their side length
+    size_t m_num_tiles_x, m_num_tiles_y;
+    size_t m_tile_size;
+
+    // tracing threads to use, 0 for one per core
+    size_t m_num_threads;
+    // trace paths instead of Whitted rays, see set_path_tracing
+    bool m_path_tracing;
+    // sequence of the path samples, see set_sampler
+    SamplerType m_sampler_type;
+    // eye rays per pixel side in a Whitted image, see set_pixel_samples
+    unsigned int m_pixel_samples;
+    // most shadow rays per area light in a Whitted image, see set_shadow_samples
+    unsigned int m_shadow_samples;
+    // shadow rays per point in scenes with many lights, see set_light_samples
+    unsigned int m_light_samples;
+    // prints progress and statistics, see set_verbose
+    bool m_verbose;
+    // where the rays of the next image go, and the rays of this one, see capture_rays
+    std::string m_ray_capture_path;
+    RayStreamWriter m_ray_stream;
+    // per pixel costs of the image, see set_cost_recording
+    bool m_record_costs;
+    CostMap m_cost_map;
+    // what the image cost, by thread, see get_stats
+    FrameStats m_stats;
+    // first bounce that traces mesh proxies, see set_proxy_depth
+    unsigned int m_proxy_depth;
+    // shadow rays trace mesh proxies, see set_proxy_shadows
+    bool m_proxy_shadows;
+    // picks the lights to shade if m_use_light_tree, built in initialize
+    LightTree m_light_tree;
+    bool m_use_light_tree;
+
+    // guards the tile state below while the threads trace
+    boost::mutex m_tile_mutex;
+    boost::condition_variable m_tile_released;
+    // the next tile to hand out in the current pass
+    size_t m_next_tile;
+    // tiles handed out but not written yet
+    size_t m_tiles_in_flight;
+    // the current pass, equal to the samples in every finished pixel
+    unsigned int m_pass;
+    // SDL ticks at which the threads stop, if m_has_deadline
+    unsigned int m_deadline;
+    bool m_has_deadline;
+    // set once the current raytrace call has no more tiles to hand out
+    bool m_stopped;
+
+    // sum of the path samples of every pixel of the region, row by row
+    std::vector< Color3 > m_accumulation;
+
+    // denoise the image, see set_denoise
+    bool m_denoise;
+    Denoiser m_denoiser;
+    // guide buffers, from the first hit of each pixel's eye ray
+    std::vector< Color3 > m_albedo;
+    std::vector< Vector3 > m_normal;
+    std::vector< real_t > m_depth;
+    // sum of the squared demodulated luminance of the path samples
+    std::vector< real_t > m_luminance_sq;
+    // denoiser input and output, the mean color and luminance variance
+    std::vector< real_t > m_variance;
+    std::vector< Color3 > m_denoised;
+
+    // replace the ambient term with cached irradiance, see set_irradiance_caching
+    bool m_irradiance_caching;
+    IrradianceCache m_irradiance_cache;
+
+    // caustics from the photons, built in initialize, see get_photon_settings
+    PhotonSettings m_photon_settings;
+    PhotonMap m_caustics;
+    // what build_caustics shoots, and the photons of each chunk, kept in order
+    std::vector< PhotonTarget > m_photon_targets;
+    std::vector< PhotonEmitter > m_photon_emitters;
+    std::vector< PhotonChunk > m_photon_chunks;
+    std::vector< std::vector< Photon > > m_chunk_photons;
+    // guards the next chunk while the threads shoot
+    boost::mutex m_photon_mutex;
+    size_t m_next_photon_chunk;
+
+    // the camera the eye rays are set up for
+    Camera m_camera;
 
     // camera properties, used to calculate eye ray equation
     Vector3 m_camera_pos;   // line = eye + t * d
@@ -130,6 +612,9 @@ private:
     real_t m_near_clip;      // minimum t when direction is unit vector
     real_t m_far_clip;       // maximum t when direction is unit vector
 
+    // offset of secondary rays, to step off the surface they start on
+    real_t m_ray_epsilon;
+
     // const slope factor
     const float SLOPE_FACTOR; /* = 1e-5 */
 
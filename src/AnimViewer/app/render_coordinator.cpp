@@ -0,0 +1,327 @@
+/**
+ * @file render_coordinator.cpp
+ * @brief Renders frames on several render servers at once, a chunk of the
+ *  image on each.
+ */
+#include "lucPCH.h"
+#include "render_coordinator.hpp"
+
+#include <SDL/SDL.h>
+#include <boost/thread/thread.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+namespace Luc {
+
+static const size_t DEFAULT_CHUNK_SIZE = 128;
+// a chunk in flight this many times longer than the average is handed out again
+static const unsigned int SLOW_CHUNK_FACTOR = 3;
+// milliseconds a worker with nothing to do waits before checking for slow chunks
+static const unsigned int SLOW_CHUNK_POLL = 50;
+
+RenderCoordinator::RenderCoordinator()
+    : m_chunk_size( DEFAULT_CHUNK_SIZE ), m_width( 0 ), m_height( 0 ), m_buffer( 0 ),
+      m_next_chunk( 0 ), m_chunks_done( 0 ), m_reissued( 0 ), m_finished( false ),
+      m_chunk_time( 0 ), m_frame_time( 0 ) { }
+
+RenderCoordinator::~RenderCoordinator() { }
+
+void RenderCoordinator::add_worker( const std::string& host, unsigned short port )
+{
+    Worker worker;
+    worker.host = host;
+    worker.port = port;
+    worker.alive = true;
+    m_workers.push_back( worker );
+}
+
+bool RenderCoordinator::render( const std::string& job, size_t width, size_t height,
+                                unsigned char* buffer )
+{
+    unsigned int start_time = SDL_GetTicks();
+    m_job = job;
+    m_width = width;
+    m_height = height;
+    m_buffer = buffer;
+
+    // chunks row by row, from the top
+    size_t chunk_size = std::max< size_t >( 1, m_chunk_size );
+    m_chunks.clear();
+    for ( size_t y = 0; y < height; y += chunk_size ) {
+        for ( size_t x = 0; x < width; x += chunk_size ) {
+            Chunk chunk;
+            chunk.x = x;
+            chunk.y = y;
+            chunk.width = std::min( chunk_size, width - x );
+            chunk.height = std::min( chunk_size, height - y );
+            chunk.done = false;
+            chunk.in_flight = 0;
+            chunk.issued_at = 0;
+            m_chunks.push_back( chunk );
+        }
+    }
+    m_next_chunk = 0;
+    m_chunks_done = 0;
+    m_reissued = 0;
+    m_finished = false;
+    m_chunk_time = 0;
+    for ( size_t i = 0; i < m_workers.size(); ++i ) {
+        Worker& worker = m_workers[i];
+        worker.alive = true;
+        worker.chunks = 0;
+        worker.pixels = 0;
+        worker.wasted = 0;
+        worker.busy_time = 0;
+        worker.render_time = 0;
+        worker.socket.reset();
+    }
+
+    boost::thread_group threads;
+    for ( size_t i = 0; i < m_workers.size(); ++i )
+        threads.add_thread( new boost::thread( &RenderCoordinator::run_worker, this, i ) );
+
+    {
+        boost::mutex::scoped_lock lock( m_mutex );
+        while ( m_chunks_done < m_chunks.size() ) {
+            size_t alive = 0;
+            for ( size_t i = 0; i < m_workers.size(); ++i )
+                alive += m_workers[i].alive;
+            if ( 0 == alive )
+                break;
+            m_changed.wait( lock );
+        }
+
+        // a worker tracing a chunk that is done already, or stuck, would
+        // keep the frame from finishing, so cut it off
+        m_finished = true;
+        for ( size_t i = 0; i < m_workers.size(); ++i ) {
+            if ( m_workers[i].socket ) {
+                boost::system::error_code error;
+                m_workers[i].socket->shutdown( boost::asio::ip::tcp::socket::shutdown_both, error );
+            }
+        }
+        m_changed.notify_all();
+    }
+    threads.join_all();
+
+    m_frame_time = SDL_GetTicks() - start_time;
+    return m_chunks_done == m_chunks.size();
+}
+
+bool RenderCoordinator::acquire_chunk( size_t* chunk )
+{
+    boost::mutex::scoped_lock lock( m_mutex );
+    while ( true ) {
+        if ( m_finished || m_chunks_done == m_chunks.size() )
+            return false;
+
+        // chunks handed back by dead workers first, then the next new one
+        size_t returned = m_next_chunk;
+        for ( size_t i = 0; i < m_next_chunk && returned == m_next_chunk; ++i ) {
+            if ( !m_chunks[i].done && 0 == m_chunks[i].in_flight )
+                returned = i;
+        }
+        if ( returned < m_next_chunk ) {
+            *chunk = returned;
+            m_reissued++;
+        } else if ( m_next_chunk < m_chunks.size() ) {
+            *chunk = m_next_chunk++;
+        } else if ( m_chunks_done > 0 ) {
+            // out of chunks, so help with the slowest one in flight
+            unsigned int now = SDL_GetTicks();
+            unsigned int slow_time = SLOW_CHUNK_FACTOR * m_chunk_time / static_cast< unsigned int >( m_chunks_done );
+            size_t slowest = m_chunks.size();
+            for ( size_t i = 0; i < m_chunks.size(); ++i ) {
+                const Chunk& candidate = m_chunks[i];
+                if ( candidate.done || candidate.in_flight != 1 || now - candidate.issued_at <= slow_time )
+                    continue;
+                if ( slowest == m_chunks.size() || candidate.issued_at < m_chunks[slowest].issued_at )
+                    slowest = i;
+            }
+            if ( slowest == m_chunks.size() ) {
+                m_changed.timed_wait( lock, boost::posix_time::milliseconds( SLOW_CHUNK_POLL ) );
+                continue;
+            }
+            *chunk = slowest;
+            m_reissued++;
+        } else {
+            m_changed.timed_wait( lock, boost::posix_time::milliseconds( SLOW_CHUNK_POLL ) );
+            continue;
+        }
+
+        Chunk& acquired = m_chunks[*chunk];
+        if ( 0 == acquired.in_flight )
+            acquired.issued_at = SDL_GetTicks();
+        acquired.in_flight++;
+        return true;
+    }
+}
+
+void RenderCoordinator::run_worker( size_t index )
+{
+    std::vector< unsigned char > pixels;
+    size_t chunk_index;
+    while ( acquire_chunk( &chunk_index ) ) {
+        unsigned int start_time = SDL_GetTicks();
+        Chunk chunk;
+        {
+            boost::mutex::scoped_lock lock( m_mutex );
+            chunk = m_chunks[chunk_index];
+        }
+        unsigned int render_time = 0;
+        bool traced = trace_chunk( index, chunk, &pixels, &render_time );
+        unsigned int elapsed = SDL_GetTicks() - start_time;
+
+        boost::mutex::scoped_lock lock( m_mutex );
+        Worker& worker = m_workers[index];
+        Chunk& shared = m_chunks[chunk_index];
+        shared.in_flight--;
+        worker.socket.reset();
+        if ( !traced ) {
+            // its chunk goes back to the others, unless the frame is done
+            if ( !m_finished ) {
+                std::cout << "Lost worker " << worker.host << ":" << worker.port << ".\n";
+                worker.alive = false;
+            }
+            m_changed.notify_all();
+            return;
+        }
+
+        worker.busy_time += elapsed;
+        if ( shared.done ) {
+            worker.wasted++;
+            continue;
+        }
+        // rows from the top into the image, which is bottom row first
+        for ( size_t row = 0; row < chunk.height; ++row ) {
+            size_t y = m_height - 1 - ( chunk.y + row );
+            memcpy( &m_buffer[4 * ( y * m_width + chunk.x )], &pixels[4 * row * chunk.width],
+                    4 * chunk.width );
+        }
+        shared.done = true;
+        m_chunks_done++;
+        m_chunk_time += elapsed;
+        worker.chunks++;
+        worker.pixels += chunk.width * chunk.height;
+        worker.render_time += render_time;
+        m_changed.notify_all();
+    }
+}
+
+bool RenderCoordinator::trace_chunk( size_t index, const Chunk& chunk,
+                                     std::vector< unsigned char >* pixels,
+                                     unsigned int* render_time )
+{
+    using boost::asio::ip::tcp;
+
+    SocketPtr socket( new tcp::socket( m_io_service ) );
+    std::string host;
+    unsigned short port;
+    {
+        boost::mutex::scoped_lock lock( m_mutex );
+        m_workers[index].socket = socket;
+        host = m_workers[index].host;
+        port = m_workers[index].port;
+    }
+
+    boost::system::error_code error;
+    tcp::resolver resolver( m_io_service );
+    std::ostringstream port_name;
+    port_name << port;
+    tcp::resolver::iterator endpoint = resolver.resolve( tcp::resolver::query( host, port_name.str() ), error );
+    if ( error )
+        return false;
+    boost::asio::connect( *socket, endpoint, error );
+    if ( error )
+        return false;
+    {
+        // the frame may have been finished, and the socket shut down,
+        // before it was connected
+        boost::mutex::scoped_lock lock( m_mutex );
+        if ( m_finished )
+            return false;
+    }
+
+    std::ostringstream request;
+    request << m_job << " width=" << m_width << " height=" << m_height << " region=" << chunk.x
+            << "," << chunk.y << "," << chunk.width << "," << chunk.height << " format=raw\n";
+    boost::asio::write( *socket, boost::asio::buffer( request.str() ), error );
+    if ( error )
+        return false;
+
+    pixels->assign( 4 * chunk.width * chunk.height, 0 );
+    size_t pixels_received = 0;
+    boost::asio::streambuf reply;
+    std::istream stream( &reply );
+    while ( true ) {
+        boost::asio::read_until( *socket, reply, '\n', error );
+        if ( error )
+            return false;
+        std::string line;
+        std::getline( stream, line );
+
+        unsigned int x, y, width, height, bytes;
+        if ( 5 == sscanf( line.c_str(), "TILE %u %u %u %u %u", &x, &y, &width, &height, &bytes ) ) {
+            if ( x < chunk.x || y < chunk.y || x + width > chunk.x + chunk.width ||
+                 y + height > chunk.y + chunk.height || bytes != 4 * width * height )
+                return false;
+            if ( reply.size() < bytes ) {
+                boost::asio::read( *socket, reply, boost::asio::transfer_exactly( bytes - reply.size() ), error );
+                if ( error )
+                    return false;
+            }
+            for ( size_t row = 0; row < height; ++row ) {
+                size_t offset = 4 * ( ( y - chunk.y + row ) * chunk.width + x - chunk.x );
+                stream.read( reinterpret_cast< char* >( &( *pixels )[offset] ), 4 * width );
+            }
+            pixels_received += width * height;
+        } else if ( 1 == sscanf( line.c_str(), "DONE %u", render_time ) ) {
+            return pixels_received == chunk.width * chunk.height;
+        } else if ( 0 == line.compare( 0, 5, "ERROR" ) ) {
+            std::cout << "Worker " << host << ":" << port << " failed: " << line.substr( 5 ) << "\n";
+            return false;
+        }
+        // anything else, like ACCEPTED, is progress only
+    }
+}
+
+void RenderCoordinator::print_report( std::ostream& out ) const
+{
+    size_t alive = 0;
+    unsigned int render_time = 0;
+    for ( size_t i = 0; i < m_workers.size(); ++i ) {
+        alive += m_workers[i].alive;
+        render_time += m_workers[i].render_time;
+    }
+    out << "Rendered " << m_chunks_done << " of " << m_chunks.size() << " chunks on "
+        << alive << " of " << m_workers.size() << " workers in " << m_frame_time << " milliseconds";
+    if ( m_reissued > 0 )
+        out << ", handing out " << m_reissued << " chunks again";
+    out << ".\n";
+
+    for ( size_t i = 0; i < m_workers.size(); ++i ) {
+        const Worker& worker = m_workers[i];
+        out << "  " << worker.host << ":" << worker.port << ": " << worker.chunks << " chunks, "
+            << worker.pixels << " pixels, busy " << worker.busy_time << " ms, tracing "
+            << worker.render_time << " ms";
+        if ( worker.wasted > 0 )
+            out << ", " << worker.wasted << " chunks wasted";
+        if ( !worker.alive )
+            out << ", lost";
+        out << "\n";
+    }
+
+    // how many workers the frame was worth, against how many it had
+    if ( m_frame_time > 0 && !m_workers.empty() ) {
+        double speedup = double( render_time ) / m_frame_time;
+        char line[128];
+        sprintf( line, "Scaling efficiency: %.0f%% (speedup %.2f on %u workers).\n",
+                 100.0 * speedup / m_workers.size(), speedup, (unsigned int)m_workers.size() );
+        out << line;
+    }
+}
+
+} /* Luc */
@@ -0,0 +1,127 @@
+/**
+ * @file render_coordinator.hpp
+ * @brief Renders frames on several render servers at once, a chunk of the
+ *  image on each.
+ */
+
+#ifndef _LUC_APP_RENDER_COORDINATOR_HPP_
+#define _LUC_APP_RENDER_COORDINATOR_HPP_
+
+#include <boost/asio.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+namespace Luc {
+
+/*
+ * Splits a frame into square chunks and hands them out to workers, render
+ * servers of render_server.hpp, one chunk per worker at a time, so faster
+ * workers take more of them. A worker whose connection fails, or that
+ * answers with an error, is dropped and its chunk goes to another. Once
+ * no chunk is left to hand out, a chunk that takes much longer than the
+ * average is handed out a second time, and the first copy to arrive is
+ * used, so one slow worker does not hold up the frame.
+ *
+ * Every worker needs the scene file at the same path.
+ */
+class RenderCoordinator
+{
+public:
+
+    RenderCoordinator();
+    ~RenderCoordinator();
+
+    /// Adds a worker, listening at a port of a host.
+    void add_worker( const std::string& host, unsigned short port );
+    size_t num_workers() const { return m_workers.size(); }
+
+    /// Side length of the chunks, in pixels.
+    void set_chunk_size( size_t size ) { m_chunk_size = size; }
+
+    /*
+     * Renders a frame on the workers, all of which are tried again for
+     * every frame.
+     * @param job A job line of render_server.hpp, without size or region.
+     * @param buffer[out] The RGBA image, bottom row first, like raytrace.
+     * @return false if every worker failed before the frame was done.
+     */
+    bool render( const std::string& job, size_t width, size_t height, unsigned char* buffer );
+
+    /*
+     * Prints how long the last frame took, what each worker did, and the
+     * scaling efficiency: the time the workers spent tracing the chunks
+     * that were used, over the time of the frame times the workers.
+     */
+    void print_report( std::ostream& out ) const;
+
+private:
+
+    typedef boost::shared_ptr< boost::asio::ip::tcp::socket > SocketPtr;
+
+    struct Worker
+    {
+        std::string host;
+        unsigned short port;
+        bool alive;
+        // chunks used in the image, and the pixels of them
+        size_t chunks;
+        size_t pixels;
+        // chunks traced again by another worker first, which are wasted
+        size_t wasted;
+        // milliseconds from sending chunks to receiving them, and the
+        // part of that the worker reported tracing the used ones
+        unsigned int busy_time;
+        unsigned int render_time;
+        // connection of the chunk in flight, closed once the frame is done
+        SocketPtr socket;
+    };
+
+    struct Chunk
+    {
+        // the rectangle, from the top left corner of the image
+        size_t x, y, width, height;
+        bool done;
+        // workers tracing it, two once it is handed out again
+        size_t in_flight;
+        unsigned int issued_at;
+    };
+
+    // traces the chunks a worker is handed, until none are left
+    void run_worker( size_t worker );
+    /*
+     * Picks the next chunk to trace, waiting while every chunk left is in
+     * flight and not yet slow, or returns false once the frame is done.
+     */
+    bool acquire_chunk( size_t* chunk );
+    // has a worker trace a chunk into pixels, top row first
+    bool trace_chunk( size_t worker, const Chunk& chunk, std::vector< unsigned char >* pixels,
+                      unsigned int* render_time );
+
+    std::vector< Worker > m_workers;
+    size_t m_chunk_size;
+
+    // the frame being rendered
+    std::string m_job;
+    size_t m_width, m_height;
+    unsigned char* m_buffer;
+    std::vector< Chunk > m_chunks;
+    size_t m_next_chunk;
+    size_t m_chunks_done;
+    size_t m_reissued;
+    bool m_finished;
+    // sum of the milliseconds of the chunks done, from sending to receiving
+    unsigned int m_chunk_time;
+    unsigned int m_frame_time;
+
+    boost::asio::io_service m_io_service;
+    boost::mutex m_mutex;
+    boost::condition_variable m_changed;
+};
+
+} /* Luc */
+
+#endif /* _LUC_APP_RENDER_COORDINATOR_HPP_ */
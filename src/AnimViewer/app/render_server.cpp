@@ -0,0 +1,501 @@
+/**
+ * @file render_server.cpp
+ * @brief Long running render service, which keeps scenes and their
+ *  acceleration structures loaded between jobs.
+ */
+#include "lucPCH.h"
+#include "render_server.hpp"
+#include "raytracer.hpp"
+#include "options.hpp"
+#include "scene/scene.hpp"
+#include "scene/mesh.hpp"
+#include "scene/material.hpp"
+#include "scene/occlusion_baker.hpp"
+#include "scene/image/imageio.hpp"
+#include "files/fileutils.h"
+#include "math/mathUtils.h"
+
+#include <SDL/SDL.h>
+#include <boost/thread/thread.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+
+namespace Luc {
+
+// longest job line a client may send
+static const size_t MAX_REQUEST_SIZE = 4096;
+// largest side of an image, so a typo cannot exhaust the memory
+static const size_t MAX_IMAGE_SIZE = 16384;
+// most eye rays per pixel along each side, and path traced samples
+static const unsigned int MAX_PIXEL_SAMPLES = 16;
+static const unsigned int MAX_SAMPLES = 65536;
+// seconds traced between sending the finished tiles of a Whitted image
+static const real_t TILE_SEND_INTERVAL = 0.1f;
+
+// the servers of a process share the mesh and bvh caches, so they load
+// their scenes one at a time
+static boost::mutex scene_load_mutex;
+
+bool load_scene_data( Scene* scene, size_t num_threads )
+{
+    try {
+        Material* const* materials = scene->get_materials();
+        for ( size_t i = 0; i < scene->num_materials(); ++i ) {
+            if ( !materials[i]->load() ) {
+                std::cout << "Error loading texture.\n";
+                return false;
+            }
+        }
+
+        Mesh* const* meshes = scene->get_meshes();
+        for ( size_t i = 0; i < scene->num_meshes(); ++i ) {
+            if ( !meshes[i]->load() ) {
+                std::cout << "Error loading mesh.\n";
+                return false;
+            }
+        }
+
+        // the triangles are occluded by the meshes too
+        bake_triangle_occlusion( scene, scene->occlusion, num_threads );
+
+    } catch ( std::bad_alloc const& ) {
+        std::cout << "Out of memory error while initializing scene.\n";
+        return false;
+    }
+    return true;
+}
+
+namespace {
+
+bool parse_size( const std::string& str, size_t limit, size_t* value )
+{
+    char* end;
+    long result = strtol( str.c_str(), &end, 10 );
+    if ( end == str.c_str() || *end != '\0' || result < 0 || static_cast< size_t >( result ) > limit )
+        return false;
+    *value = static_cast< size_t >( result );
+    return true;
+}
+
+// writes a line to a client, false if it is gone
+bool send_line( boost::asio::ip::tcp::socket& socket, const std::string& line )
+{
+    boost::system::error_code error;
+    boost::asio::write( socket, boost::asio::buffer( line + "\n" ), error );
+    return !error;
+}
+
+uint64_t hash_file_stamp( const std::string& filename, uint64_t hash )
+{
+    uint64_t stamp[2] = { 0, 0 };
+    GetFileStamp( filename, stamp[0], stamp[1] );
+    return Math::FNV1aHash64( stamp, sizeof stamp, hash );
+}
+
+// the stamps of the scene file and of the mesh and texture files it reads,
+// so that an edit of any of them reloads the scene
+uint64_t hash_scene_files( const Scene& scene )
+{
+    uint64_t key = hash_file_stamp( scene.get_filename(), Math::FNV64_OFFSET_BASIS );
+    Mesh* const* meshes = scene.get_meshes();
+    for ( size_t i = 0; i < scene.num_meshes(); ++i )
+        key = hash_file_stamp( meshes[i]->filename, key );
+    Material* const* materials = scene.get_materials();
+    for ( size_t i = 0; i < scene.num_materials(); ++i ) {
+        if ( !materials[i]->texture_filename.empty() )
+            key = hash_file_stamp( materials[i]->texture_filename, key );
+    }
+    return key;
+}
+
+} // namespace
+
+RenderServer::RenderServer( const Options& opt, size_t max_scenes )
+    : m_options( opt ), m_max_scenes( std::max< size_t >( 1, max_scenes ) ), m_num_threads( -1 ),
+      m_tile_size( 0 ), m_use_count( 0 ), m_acceptor( m_io_service ), m_next_job_id( 1 ) { }
+
+RenderServer::~RenderServer() { }
+
+bool RenderServer::parse_job( const std::string& line, size_t default_width, size_t default_height,
+                              Job* job, std::string* error )
+{
+    job->width = default_width;
+    job->height = default_height;
+    job->samples = 0;
+    job->pixel_samples = 1;
+    job->priority = 0;
+    job->has_camera = false;
+    job->fov = 0;
+    job->has_region = false;
+    job->raw = false;
+
+    std::istringstream stream( line );
+    std::string pair;
+    while ( stream >> pair ) {
+        size_t equals = pair.find( '=' );
+        if ( equals == std::string::npos ) {
+            *error = "expected key=value instead of '" + pair + "'";
+            return false;
+        }
+        std::string key = pair.substr( 0, equals );
+        std::string value = pair.substr( equals + 1 );
+        size_t number = 0;
+        bool ok = true;
+        if ( key == "scene" ) {
+            job->scene_filename = value;
+            ok = !value.empty();
+        } else if ( key == "width" ) {
+            ok = parse_size( value, MAX_IMAGE_SIZE, &job->width ) && job->width > 0;
+        } else if ( key == "height" ) {
+            ok = parse_size( value, MAX_IMAGE_SIZE, &job->height ) && job->height > 0;
+        } else if ( key == "samples" ) {
+            ok = parse_size( value, MAX_SAMPLES, &number );
+            job->samples = static_cast< unsigned int >( number );
+        } else if ( key == "aa" ) {
+            ok = parse_size( value, MAX_PIXEL_SAMPLES, &number ) && number > 0;
+            job->pixel_samples = static_cast< unsigned int >( number );
+        } else if ( key == "priority" ) {
+            char* end;
+            job->priority = static_cast< int >( strtol( value.c_str(), &end, 10 ) );
+            ok = end != value.c_str() && *end == '\0';
+        } else if ( key == "camera" ) {
+            ok = 6 == sscanf( value.c_str(), "%f,%f,%f,%f,%f,%f", &job->camera_position.x,
+                              &job->camera_position.y, &job->camera_position.z, &job->camera_target.x,
+                              &job->camera_target.y, &job->camera_target.z ) &&
+                 job->camera_position != job->camera_target;
+            job->has_camera = true;
+        } else if ( key == "region" ) {
+            unsigned int x, y, w, h;
+            ok = 4 == sscanf( value.c_str(), "%u,%u,%u,%u", &x, &y, &w, &h ) && w > 0 && h > 0;
+            job->region_x = x;
+            job->region_y = y;
+            job->region_width = w;
+            job->region_height = h;
+            job->has_region = true;
+        } else if ( key == "format" ) {
+            ok = value == "png" || value == "raw";
+            job->raw = value == "raw";
+        } else if ( key == "fov" ) {
+            job->fov = static_cast< real_t >( atof( value.c_str() ) );
+            ok = job->fov > 0 && job->fov < 180;
+        } else {
+            *error = "unknown key " + key;
+            return false;
+        }
+        if ( !ok ) {
+            *error = "invalid value '" + value + "' of " + key;
+            return false;
+        }
+    }
+
+    if ( job->scene_filename.empty() ) {
+        *error = "no scene";
+        return false;
+    }
+    if ( job->has_region && ( job->region_x + job->region_width > job->width ||
+                              job->region_y + job->region_height > job->height ) ) {
+        *error = "region outside of the image";
+        return false;
+    }
+    return true;
+}
+
+bool RenderServer::listen( unsigned short port )
+{
+    using boost::asio::ip::tcp;
+
+    // only local clients, the protocol has no authentication
+    boost::system::error_code error;
+    tcp::endpoint endpoint( boost::asio::ip::address_v4::loopback(), port );
+    m_acceptor.open( endpoint.protocol(), error );
+    if ( !error )
+        m_acceptor.set_option( tcp::acceptor::reuse_address( true ), error );
+    if ( !error )
+        m_acceptor.bind( endpoint, error );
+    if ( !error )
+        m_acceptor.listen( boost::asio::socket_base::max_connections, error );
+    if ( error ) {
+        std::cout << "Cannot listen on port " << port << ": " << error.message() << ".\n";
+        m_acceptor.close( error );
+        return false;
+    }
+    std::cout << "Listening for render jobs on port " << get_port() << ".\n";
+    return true;
+}
+
+unsigned short RenderServer::get_port() const
+{
+    boost::system::error_code error;
+    return m_acceptor.local_endpoint( error ).port();
+}
+
+bool RenderServer::serve()
+{
+    using boost::asio::ip::tcp;
+
+    boost::thread renderer( &RenderServer::render_jobs, this );
+    renderer.detach();
+
+    while ( true ) {
+        SocketPtr socket( new tcp::socket( m_io_service ) );
+        boost::system::error_code error;
+        m_acceptor.accept( *socket, error );
+        if ( error ) {
+            std::cout << "Cannot accept connection: " << error.message() << ".\n";
+            return false;
+        }
+        // a slow client must not hold up the others
+        boost::thread connection( &RenderServer::handle_connection, this, socket );
+        connection.detach();
+    }
+}
+
+bool RenderServer::run( unsigned short port )
+{
+    return listen( port ) && serve();
+}
+
+void RenderServer::handle_connection( SocketPtr socket )
+{
+    boost::asio::streambuf request( MAX_REQUEST_SIZE );
+    boost::system::error_code error;
+    boost::asio::read_until( *socket, request, '\n', error );
+    if ( error && 0 == request.size() )
+        return;
+
+    std::istream stream( &request );
+    std::string line;
+    std::getline( stream, line );
+    if ( !line.empty() && '\r' == line[line.size() - 1] )
+        line.erase( line.size() - 1 );
+
+    Job job;
+    std::string message;
+    if ( !parse_job( line, m_options.width, m_options.height, &job, &message ) ) {
+        send_line( *socket, "ERROR " + message );
+        return;
+    }
+    job.socket = socket;
+
+    boost::mutex::scoped_lock lock( m_queue_mutex );
+    job.id = m_next_job_id++;
+    size_t position = 0;
+    for ( size_t i = 0; i < m_queue.size(); ++i ) {
+        if ( m_queue[i].priority >= job.priority )
+            position++;
+    }
+    // answered before the render thread can see the job, so its lines
+    // never mix with the tiles
+    std::ostringstream accepted;
+    accepted << "ACCEPTED " << job.id << " " << position;
+    if ( !send_line( *socket, accepted.str() ) )
+        return;
+    m_queue.push_back( job );
+    m_job_queued.notify_one();
+}
+
+void RenderServer::render_jobs()
+{
+    while ( true ) {
+        Job job;
+        {
+            boost::mutex::scoped_lock lock( m_queue_mutex );
+            while ( m_queue.empty() )
+                m_job_queued.wait( lock );
+
+            // the highest priority, and of those the oldest
+            size_t next = 0;
+            for ( size_t i = 1; i < m_queue.size(); ++i ) {
+                if ( m_queue[i].priority > m_queue[next].priority ||
+                     ( m_queue[i].priority == m_queue[next].priority && m_queue[i].id < m_queue[next].id ) )
+                    next = i;
+            }
+            job = m_queue[next];
+            m_queue.erase( m_queue.begin() + next );
+        }
+
+        render_job( job );
+        boost::system::error_code error;
+        job.socket->shutdown( boost::asio::ip::tcp::socket::shutdown_both, error );
+        job.socket->close( error );
+    }
+}
+
+RenderServer::CachedScene* RenderServer::get_scene( const std::string& filename )
+{
+    uint64_t file_size = 0, file_time = 0;
+    if ( !GetFileStamp( filename, file_size, file_time ) )
+        return 0;
+
+    m_use_count++;
+    for ( size_t i = 0; i < m_scenes.size(); ++i ) {
+        CachedScene& cached = m_scenes[i];
+        if ( cached.filename != filename )
+            continue;
+        if ( cached.files_key == hash_scene_files( *cached.scene ) ) {
+            cached.last_used = m_use_count;
+            return &cached;
+        }
+        // it or one of its files was edited since it was loaded
+        m_scenes.erase( m_scenes.begin() + i );
+        break;
+    }
+
+    // make room by dropping the scene unused for the longest
+    while ( m_scenes.size() >= m_max_scenes ) {
+        size_t oldest = 0;
+        for ( size_t i = 1; i < m_scenes.size(); ++i ) {
+            if ( m_scenes[i].last_used < m_scenes[oldest].last_used )
+                oldest = i;
+        }
+        std::cout << "Unloading scene " << m_scenes[oldest].filename << ".\n";
+        m_scenes.erase( m_scenes.begin() + oldest );
+    }
+
+    CachedScene cached;
+    cached.filename = filename;
+    cached.scene.reset( new Scene() );
+    cached.raytracer.reset( new Raytracer() );
+    cached.initialized = false;
+    cached.last_used = m_use_count;
+
+    Raytracer& raytracer = *cached.raytracer;
+    apply_raytracer_options( m_options, &raytracer );
+    // nothing would save the pixel costs of a job
+    raytracer.set_cost_recording( false );
+    if ( m_num_threads >= 0 )
+        raytracer.set_num_threads( m_num_threads );
+    if ( m_tile_size > 0 )
+        raytracer.set_tile_size( m_tile_size );
+    raytracer.set_verbose( false );
+
+    std::cout << "Loading scene " << filename << ".\n";
+    boost::mutex::scoped_lock lock( scene_load_mutex );
+    if ( !cached.scene->load( filename.c_str() ) ||
+         !load_scene_data( cached.scene.get(), raytracer.get_thread_count() ) )
+        return 0;
+    cached.files_key = hash_scene_files( *cached.scene );
+
+    m_scenes.push_back( cached );
+    return &m_scenes.back();
+}
+
+void RenderServer::render_job( const Job& job )
+{
+    unsigned int start_time = SDL_GetTicks();
+    CachedScene* cached = get_scene( job.scene_filename );
+    if ( !cached ) {
+        send_line( *job.socket, "ERROR cannot load scene " + job.scene_filename );
+        return;
+    }
+
+    Camera camera = cached->scene->camera;
+    if ( job.has_camera ) {
+        camera.SetPosition( job.camera_position );
+        camera.LookAt( job.camera_target );
+    }
+    if ( job.fov > 0 )
+        camera.SetFOV( job.fov * PI / 180.0f );
+    camera.SetAspectRatio( real_t( job.width ) / real_t( job.height ) );
+
+    Raytracer& raytracer = *cached->raytracer;
+    raytracer.set_path_tracing( job.samples > 0 );
+    raytracer.set_pixel_samples( job.pixel_samples );
+    if ( !cached->initialized ) {
+        // builds the acceleration structure, which later jobs reuse
+        boost::mutex::scoped_lock lock( scene_load_mutex );
+        if ( !raytracer.initialize( cached->scene.get(), job.width, job.height, camera ) ) {
+            send_line( *job.socket, "ERROR raytracer initialization failed" );
+            return;
+        }
+        cached->initialized = true;
+    } else {
+        raytracer.set_resolution( job.width, job.height );
+        raytracer.update_camera( camera );
+    }
+    // the raytracer counts rows from the bottom
+    if ( job.has_region ) {
+        raytracer.set_region( job.region_x, job.height - job.region_y - job.region_height,
+                              job.region_width, job.region_height );
+    } else {
+        raytracer.clear_region();
+    }
+
+    // only the region is written, so the rest may be left from other jobs
+    std::vector< unsigned char >& buffer = m_buffer;
+    buffer.resize( 4 * job.width * job.height );
+    size_t num_tiles = raytracer.num_tiles();
+    size_t tiles_sent = 0;
+    if ( job.samples > 0 ) {
+        // without a time limit, every call traces one sample per pixel
+        while ( raytracer.num_passes() < job.samples )
+            raytracer.raytrace( &buffer[0], 0 );
+    } else if ( raytracer.is_denoising() ) {
+        while ( !raytracer.raytrace( &buffer[0], 0 ) ) { }
+    } else {
+        // the tiles before the next one are final, so send them while
+        // tracing the rest
+        real_t interval = TILE_SEND_INTERVAL;
+        bool done = false;
+        while ( !done ) {
+            done = raytracer.raytrace( &buffer[0], &interval );
+            for ( ; tiles_sent < raytracer.num_tiles_done(); ++tiles_sent ) {
+                if ( !send_tile( job, raytracer, buffer, tiles_sent ) ) {
+                    std::cout << "Job " << job.id << " dropped by its client.\n";
+                    return;
+                }
+            }
+        }
+    }
+
+    for ( ; tiles_sent < num_tiles; ++tiles_sent ) {
+        if ( !send_tile( job, raytracer, buffer, tiles_sent ) ) {
+            std::cout << "Job " << job.id << " dropped by its client.\n";
+            return;
+        }
+    }
+
+    unsigned int elapsed = SDL_GetTicks() - start_time;
+    std::ostringstream done;
+    done << "DONE " << elapsed;
+    send_line( *job.socket, done.str() );
+    std::cout << "Rendered job " << job.id << " of " << job.scene_filename << " in "
+              << elapsed << " milliseconds.\n";
+}
+
+bool RenderServer::send_tile( const Job& job, const Raytracer& raytracer,
+                              const std::vector< unsigned char >& buffer, size_t tile )
+{
+    size_t x, y, width, height;
+    raytracer.get_tile_bounds( tile, &x, &y, &width, &height );
+
+    // the rows of the tile, bottom first like the image, or top first
+    // for raw tiles, like the rows of a png
+    std::vector< unsigned char > pixels( 4 * width * height );
+    for ( size_t row = 0; row < height; ++row ) {
+        const unsigned char* source = &buffer[4 * ( ( y + row ) * job.width + x )];
+        size_t target_row = job.raw ? height - 1 - row : row;
+        std::copy( source, source + 4 * width, &pixels[4 * target_row * width] );
+    }
+    std::vector< unsigned char > png;
+    if ( !job.raw &&
+         !imageio_encode_png( &pixels[0], static_cast< int >( width ), static_cast< int >( height ), &png ) )
+        return false;
+    const std::vector< unsigned char >& data = job.raw ? pixels : png;
+
+    std::ostringstream header;
+    header << "TILE " << x << " " << job.height - y - height << " " << width << " " << height
+           << " " << data.size() << "\n";
+    std::string header_line = header.str();
+    std::vector< boost::asio::const_buffer > message;
+    message.push_back( boost::asio::buffer( header_line ) );
+    message.push_back( boost::asio::buffer( data ) );
+    boost::system::error_code error;
+    boost::asio::write( *job.socket, message, error );
+    return !error;
+}
+
+} /* Luc */
@@ -0,0 +1,170 @@
+/**
+ * @file render_server.hpp
+ * @brief Long running render service, which keeps scenes and their
+ *  acceleration structures loaded between jobs.
+ */
+
+#ifndef _LUC_APP_RENDER_SERVER_HPP_
+#define _LUC_APP_RENDER_SERVER_HPP_
+
+#include "math/camera.hpp"
+
+#include <boost/asio.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <string>
+#include <vector>
+
+class Options;
+
+namespace Luc {
+
+class Scene;
+class Raytracer;
+
+/*
+ * Loads the textures and meshes of a scene, and bakes the occlusion of
+ * its triangles, without creating any gl data.
+ */
+bool load_scene_data( Scene* scene, size_t num_threads );
+
+/*
+ * Renders jobs sent to a port of localhost, one at a time, most urgent
+ * first. A loaded scene, its textures and its acceleration structure stay
+ * in memory for the next job of the same scene file, until it or a mesh
+ * or texture it reads changes, or the least recently used scenes make
+ * room for others.
+ *
+ * A job is one line of key=value pairs, of which only scene is needed:
+ *
+ *   scene=PATH width=W height=H samples=N aa=N priority=P
+ *   camera=X,Y,Z,TX,TY,TZ fov=DEGREES region=X,Y,W,H format=png|raw
+ *
+ * samples path traces that many samples per pixel instead of a Whitted
+ * image, aa traces n by n eye rays per pixel of a Whitted image, and jobs
+ * of higher priority go first. region renders only that rectangle of the
+ * image, and format=raw sends the tiles as RGBA pixels, top row first,
+ * instead of PNGs. The server answers with lines:
+ *
+ *   ACCEPTED id position    the job is queued behind position others
+ *   TILE x y w h bytes      followed by the tile, of that many bytes
+ *   DONE milliseconds       every tile is sent, and the connection closed
+ *   ERROR message           the job failed, and the connection closed
+ *
+ * Tile and region positions count from the top left corner of the image,
+ * and a region is cut into tiles like an image. The tiles
+ * of a Whitted image are sent as they are traced, the others once the
+ * whole image is, since every pass or the denoiser changes them all.
+ */
+class RenderServer
+{
+public:
+
+    /*
+     * Takes the raytracer settings from the options, and keeps at most
+     * max_scenes scenes loaded.
+     */
+    RenderServer( const Options& opt, size_t max_scenes );
+    ~RenderServer();
+
+    /// Tracing threads of each job, 0 for one per core, instead of the option.
+    void set_num_threads( size_t num_threads ) { m_num_threads = static_cast< int >( num_threads ); }
+    /// Side length of the tiles, in pixels, 0 for the default.
+    void set_tile_size( size_t size ) { m_tile_size = size; }
+
+    /*
+     * Listens on a port of localhost, or on any free one for port 0.
+     * @return false if the port cannot be listened on.
+     */
+    bool listen( unsigned short port );
+    /// The port listened on.
+    unsigned short get_port() const;
+    /*
+     * Accepts jobs until it fails, after listen. Call it on a thread of its
+     * own to run several servers in one process, which is how the
+     * distributed renderer tests without other processes.
+     */
+    bool serve();
+    /// listen and serve.
+    bool run( unsigned short port );
+
+    typedef boost::shared_ptr< boost::asio::ip::tcp::socket > SocketPtr;
+
+    // a parsed job line, and the connection to answer on
+    struct Job
+    {
+        size_t id;
+        int priority;
+        std::string scene_filename;
+        size_t width, height;
+        unsigned int samples;
+        unsigned int pixel_samples;
+        bool has_camera;
+        Vector3 camera_position, camera_target;
+        // vertical field of view in degrees, 0 to keep the scene's
+        real_t fov;
+        // the rectangle rendered, from the top left corner, if has_region
+        bool has_region;
+        size_t region_x, region_y, region_width, region_height;
+        // RGBA tiles instead of PNGs
+        bool raw;
+        SocketPtr socket;
+    };
+
+    /*
+     * Reads the key=value pairs of a job line, or returns false with the
+     * reason in error.
+     */
+    static bool parse_job( const std::string& line, size_t default_width, size_t default_height,
+                           Job* job, std::string* error );
+
+private:
+
+    // a loaded scene, and the raytracer with its acceleration structure
+    struct CachedScene
+    {
+        std::string filename;
+        // stamps of the scene file and the mesh and texture files it read
+        uint64_t files_key;
+        boost::shared_ptr< Scene > scene;
+        boost::shared_ptr< Raytracer > raytracer;
+        bool initialized;
+        size_t last_used;
+    };
+
+    // reads the job of a connection and queues it
+    void handle_connection( SocketPtr socket );
+    // renders the queued jobs, forever
+    void render_jobs();
+    void render_job( const Job& job );
+    // the cached scene of a file, loaded if it is not, or if it or one of
+    // its files changed since
+    CachedScene* get_scene( const std::string& filename );
+    // sends a tile of the image as a png, false if the client is gone
+    bool send_tile( const Job& job, const Raytracer& raytracer,
+                    const std::vector< unsigned char >& buffer, size_t tile );
+
+    const Options& m_options;
+    size_t m_max_scenes;
+    // -1 to take it from the options
+    int m_num_threads;
+    size_t m_tile_size;
+
+    // used only by the render thread
+    std::vector< CachedScene > m_scenes;
+    size_t m_use_count;
+    std::vector< unsigned char > m_buffer;
+
+    boost::asio::io_service m_io_service;
+    boost::asio::ip::tcp::acceptor m_acceptor;
+
+    boost::mutex m_queue_mutex;
+    boost::condition_variable m_job_queued;
+    std::vector< Job > m_queue;
+    size_t m_next_job_id;
+};
+
+} /* Luc */
+
+#endif /* _LUC_APP_RENDER_SERVER_HPP_ */
@@ -0,0 +1,91 @@
+/**
+ * @file resolution_scaler.cpp
+ * @brief Internal resolution of the live raytraced view, sized to the frame time.
+ */
+#include "lucPCH.h"
+#include "resolution_scaler.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace Luc {
+
+// smallest share of the full width and height, before the first frame too
+static const real_t MIN_SCALE = 0.125f;
+static const real_t INITIAL_SCALE = 0.25f;
+// weight of the newest frame in the smoothed rate
+static const real_t RATE_SMOOTHING = 0.5f;
+// frames are timed to the millisecond, so shorter ones count as this long
+static const real_t MIN_FRAME_TIME = 0.001f;
+
+ResolutionScaler::ResolutionScaler()
+    : m_target_time( 0 ), m_full_width( 0 ), m_full_height( 0 ), m_pixel_rate( 0 ),
+      m_scale( INITIAL_SCALE ) { }
+
+void ResolutionScaler::reset( real_t target_time, size_t full_width, size_t full_height )
+{
+    m_target_time = target_time;
+    m_full_width = full_width;
+    m_full_height = full_height;
+    m_pixel_rate = 0;
+    m_scale = INITIAL_SCALE;
+}
+
+void ResolutionScaler::get_size( size_t* width, size_t* height ) const
+{
+    *width = std::max< size_t >( 1, static_cast< size_t >( m_full_width * m_scale + 0.5f ) );
+    *height = std::max< size_t >( 1, static_cast< size_t >( m_full_height * m_scale + 0.5f ) );
+    *width = std::min( *width, m_full_width );
+    *height = std::min( *height, m_full_height );
+}
+
+void ResolutionScaler::report( size_t pixels, real_t seconds )
+{
+    real_t rate = pixels / std::max( seconds, MIN_FRAME_TIME );
+    if ( m_pixel_rate <= 0 )
+        m_pixel_rate = rate;
+    else
+        m_pixel_rate += RATE_SMOOTHING * ( rate - m_pixel_rate );
+
+    // the pixels of a frame grow with the square of the scale
+    real_t full_pixels = static_cast< real_t >( m_full_width * m_full_height );
+    if ( full_pixels <= 0 )
+        return;
+    real_t scale = sqrt( m_pixel_rate * m_target_time / full_pixels );
+    m_scale = std::min< real_t >( 1, std::max( MIN_SCALE, scale ) );
+}
+
+void resize_image( const unsigned char* source, size_t source_width, size_t source_height,
+                   unsigned char* target, size_t target_width, size_t target_height )
+{
+    // pixel centers line up at the borders of both images
+    real_t scale_x = real_t( source_width ) / target_width;
+    real_t scale_y = real_t( source_height ) / target_height;
+
+    for ( size_t y = 0; y < target_height; ++y ) {
+        real_t sy = std::max< real_t >( 0, ( y + 0.5f ) * scale_y - 0.5f );
+        size_t y0 = std::min( static_cast< size_t >( sy ), source_height - 1 );
+        size_t y1 = std::min( y0 + 1, source_height - 1 );
+        real_t fy = sy - y0;
+
+        for ( size_t x = 0; x < target_width; ++x ) {
+            real_t sx = std::max< real_t >( 0, ( x + 0.5f ) * scale_x - 0.5f );
+            size_t x0 = std::min( static_cast< size_t >( sx ), source_width - 1 );
+            size_t x1 = std::min( x0 + 1, source_width - 1 );
+            real_t fx = sx - x0;
+
+            const unsigned char* p00 = &source[4 * ( y0 * source_width + x0 )];
+            const unsigned char* p01 = &source[4 * ( y0 * source_width + x1 )];
+            const unsigned char* p10 = &source[4 * ( y1 * source_width + x0 )];
+            const unsigned char* p11 = &source[4 * ( y1 * source_width + x1 )];
+            unsigned char* out = &target[4 * ( y * target_width + x )];
+            for ( size_t c = 0; c < 4; ++c ) {
+                real_t top = p00[c] + fx * ( p01[c] - p00[c] );
+                real_t bottom = p10[c] + fx * ( p11[c] - p10[c] );
+                out[c] = static_cast< unsigned char >( top + fy * ( bottom - top ) + 0.5f );
+            }
+        }
+    }
+}
+
+} /* Luc */
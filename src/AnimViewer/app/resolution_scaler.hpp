@@ -0,0 +1,58 @@
+/**
+ * @file resolution_scaler.hpp
+ * @brief Internal resolution of the live raytraced view, sized to the frame time.
+ */
+
+#ifndef _LUC_APP_RESOLUTION_SCALER_HPP_
+#define _LUC_APP_RESOLUTION_SCALER_HPP_
+
+#include "math/math.hpp"
+
+namespace Luc {
+
+/*
+ * Picks the size of the next frame of the live view from the pixels per
+ * second of the frames traced so far, so a frame takes about the target
+ * time. The rate changes with what the camera sees, so it is smoothed
+ * over a few frames, and the size follows it both down and up.
+ */
+class ResolutionScaler
+{
+public:
+
+    ResolutionScaler();
+
+    /*
+     * Drops the measured rate, and aims at frames of this many seconds,
+     * of at most the full size.
+     */
+    void reset( real_t target_time, size_t full_width, size_t full_height );
+
+    /// Size of the next frame, a share of the full size with the same aspect.
+    void get_size( size_t* width, size_t* height ) const;
+
+    /// Reports that a frame of this many pixels took this many seconds.
+    void report( size_t pixels, real_t seconds );
+
+    /// Share of the full width and height of the next frame.
+    real_t get_scale() const { return m_scale; }
+
+private:
+
+    real_t m_target_time;
+    size_t m_full_width, m_full_height;
+    // smoothed pixels per second, 0 before the first frame
+    real_t m_pixel_rate;
+    real_t m_scale;
+};
+
+/*
+ * Scales an RGBA image up, or down, to another size with bilinear
+ * filtering, for showing a frame of the live view over the whole window.
+ */
+void resize_image( const unsigned char* source, size_t source_width, size_t source_height,
+                   unsigned char* target, size_t target_width, size_t target_height );
+
+} /* Luc */
+
+#endif /* _LUC_APP_RESOLUTION_SCALER_HPP_ */
@@ -0,0 +1,406 @@
+/**
+ * @file benchmark_main.cpp
+ * @brief Benchmark of the raytracer, which renders procedurally generated
+ *  scenes of several sizes on several thread counts, and writes the rays
+ *  per second, build times and memory of each as JSON.
+ */
+
+#include "lucPCH.h"
+#include "app/raytracer.hpp"
+#include "app/options.hpp"
+#include "app/render_server.hpp"
+#include "files/fileutils.h"
+#include "platform/memory.h"
+#include "platform/timer.h"
+#include "scene/scene.hpp"
+#include "scene/scene_generator.hpp"
+#include "scene/bvh_cache.hpp"
+#include "scene/paged_file.hpp"
+#include "scene/tessellation_cache.hpp"
+
+#include <SDL/SDL.h>
+#include <boost/thread/thread.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// SDL renames main for its window setup, which a benchmark has none of
+#ifdef main
+#undef main
+#endif
+
+namespace {
+
+// bump whenever the layout of the JSON output changes
+const int BENCHMARK_VERSION = 1;
+
+// a few sizes of every type, from seconds to minutes per scene on one core
+const char DEFAULT_SCENES[] =
+    "spheres:1000,spheres:10000,spheres:100000,"
+    "mesh:10000,mesh:100000,mesh:1000000,"
+    "lights:1,lights:8,lights:64,"
+    "glass:16,glass:256,glass:4096,"
+    "instances:100,instances:1000,instances:10000";
+
+struct BenchmarkScene
+{
+    Luc::GeneratedSceneType type;
+    size_t size;
+};
+
+struct BenchmarkSettings
+{
+    std::vector< BenchmarkScene > scenes;
+    std::vector< size_t > threads;
+    int width, height;
+    // path trace this many samples per pixel, 0 for a Whitted image
+    int samples;
+    // renders of each scene and thread count, of which the fastest counts
+    int repeat;
+    // directory the scenes are generated in
+    std::string directory;
+    std::string output_filename;
+    // acceleration structure to use instead of the scene's
+    bool has_acceleration;
+    Luc::AccelerationType acceleration;
+};
+
+// the fastest render of a scene on a number of threads
+struct BenchmarkRun
+{
+    size_t threads;
+    Luc::FrameStats stats;
+};
+
+void print_usage()
+{
+    std::cout <<
+        "usage: animviewer-benchmark [options]\n"
+        "  -scenes LIST         scenes to render, as TYPE:SIZE separated by commas, where\n"
+        "                       TYPE is spheres, mesh (SIZE triangles), lights, glass or\n"
+        "                       instances; a suite of every type by default\n"
+        "  -threads LIST        thread counts to render every scene with, separated by\n"
+        "                       commas; 1, 2, 4 and so on up to one per core by default\n"
+        "  -w WIDTH -h HEIGHT   size of the images, 320x240 by default\n"
+        "  -samples N           path trace N samples per pixel, instead of a Whitted image\n"
+        "  -repeat N            render every scene N times per thread count, keeping the\n"
+        "                       fastest, 3 by default\n"
+        "  -accel NAME          list, bvh or grid, instead of the scenes' structure\n"
+        "  -dir DIR             directory to generate the scenes in, created if missing,\n"
+        "                       scenes/generated by default\n"
+        "  -o FILE              JSON file to write the results to, benchmark.json by default\n";
+}
+
+bool parse_int( const char* str, int* value )
+{
+    char* end;
+    long result = strtol( str, &end, 10 );
+    if ( end == str || *end != '\0' )
+        return false;
+    *value = static_cast< int >( result );
+    return true;
+}
+
+bool parse_scenes( const std::string& list, std::vector< BenchmarkScene >* scenes )
+{
+    scenes->clear();
+    std::stringstream stream( list );
+    std::string item;
+    while ( getline( stream, item, ',' ) ) {
+        size_t colon = item.find( ':' );
+        int size;
+        BenchmarkScene scene;
+        if ( std::string::npos == colon ||
+             !Luc::parse_generated_scene_type( item.substr( 0, colon ).c_str(), &scene.type ) ||
+             !parse_int( item.substr( colon + 1 ).c_str(), &size ) || size <= 0 )
+            return false;
+        scene.size = static_cast< size_t >( size );
+        scenes->push_back( scene );
+    }
+    return !scenes->empty();
+}
+
+bool parse_threads( const std::string& list, std::vector< size_t >* threads )
+{
+    threads->clear();
+    std::stringstream stream( list );
+    std::string item;
+    while ( getline( stream, item, ',' ) ) {
+        int count;
+        if ( !parse_int( item.c_str(), &count ) || count <= 0 )
+            return false;
+        threads->push_back( static_cast< size_t >( count ) );
+    }
+    return !threads->empty();
+}
+
+bool parse_arguments( int argc, char* argv[], BenchmarkSettings* settings )
+{
+    for ( int i = 1; i < argc; ++i ) {
+        std::string arg = argv[i];
+
+        if ( arg[0] != '-' ) {
+            std::cout << "Unknown argument " << arg << ".\n";
+            return false;
+        }
+
+        // every option takes a value
+        if ( i + 1 >= argc ) {
+            std::cout << "Missing value of option " << arg << ".\n";
+            return false;
+        }
+        const char* value = argv[++i];
+        bool ok = true;
+        if ( arg == "-scenes" ) {
+            ok = parse_scenes( value, &settings->scenes );
+        } else if ( arg == "-threads" ) {
+            ok = parse_threads( value, &settings->threads );
+        } else if ( arg == "-w" ) {
+            ok = parse_int( value, &settings->width ) && settings->width > 0;
+        } else if ( arg == "-h" ) {
+            ok = parse_int( value, &settings->height ) && settings->height > 0;
+        } else if ( arg == "-samples" ) {
+            ok = parse_int( value, &settings->samples ) && settings->samples >= 0;
+        } else if ( arg == "-repeat" ) {
+            ok = parse_int( value, &settings->repeat ) && settings->repeat > 0;
+        } else if ( arg == "-accel" ) {
+            ok = Luc::Acceleration::parse_type( value, &settings->acceleration );
+            settings->has_acceleration = true;
+        } else if ( arg == "-dir" ) {
+            settings->directory = value;
+        } else if ( arg == "-o" ) {
+            settings->output_filename = value;
+        } else {
+            std::cout << "Unknown option " << arg << ".\n";
+            return false;
+        }
+
+        if ( !ok ) {
+            std::cout << "Invalid value '" << value << "' of option " << arg << ".\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+double to_milliseconds( uint64_t nanoseconds )
+{
+    return static_cast< double >( nanoseconds ) / 1000000.0;
+}
+
+// a string as JSON, with its quotes and backslashes escaped
+void write_json_string( std::ostream& out, const std::string& str )
+{
+    out << '"';
+    for ( size_t i = 0; i < str.size(); ++i ) {
+        if ( '"' == str[i] || '\\' == str[i] )
+            out << '\\';
+        out << str[i];
+    }
+    out << '"';
+}
+
+// megabytes of a byte count, or null if the system does not tell
+void write_json_megabytes( std::ostream& out, bool known, size_t bytes )
+{
+    if ( known )
+        out << static_cast< double >( bytes ) / ( 1024.0 * 1024.0 );
+    else
+        out << "null";
+}
+
+// memory gained since start, 0 if the process has given some back
+size_t memory_increase( size_t start, size_t now )
+{
+    return now > start ? now - start : 0;
+}
+
+// traces an image, a Whitted one or the given path traced samples
+void trace_image( Luc::Raytracer* raytracer, int samples, unsigned char* buffer )
+{
+    raytracer->restart();
+    if ( samples > 0 ) {
+        while ( raytracer->num_passes() < static_cast< unsigned int >( samples ) )
+            raytracer->raytrace( buffer, 0 );
+    } else {
+        while ( !raytracer->raytrace( buffer, 0 ) ) { }
+    }
+}
+
+/*
+ * Generates, loads and renders a scene on every thread count, printing a
+ * line per thread count, and writes its JSON object to out.
+ */
+bool benchmark_scene( const BenchmarkSettings& settings, const BenchmarkScene& benchmark,
+                      std::ostream& out )
+{
+    const char* name = Luc::get_generated_scene_name( benchmark.type );
+    std::string filename;
+    if ( !Luc::generate_scene( benchmark.type, benchmark.size, settings.directory, &filename ) )
+        return false;
+
+    // memory is counted from here, as the process peak and whatever earlier
+    // scenes left with the allocator would otherwise be charged to this one
+    size_t start_memory, unused;
+    bool has_memory = Luc::GetMemoryUsage( &start_memory, &unused );
+
+    // loading includes building the hierarchies of the meshes
+    uint64_t load_start_time = Luc::GetTimeNanoseconds();
+    Luc::Scene scene;
+    if ( !scene.load( filename.c_str() ) ) {
+        std::cout << "Error loading scene " << filename << ".\n";
+        return false;
+    }
+    if ( settings.has_acceleration )
+        scene.acceleration.type = settings.acceleration;
+    if ( !Luc::load_scene_data( &scene, std::max( 1u, boost::thread::hardware_concurrency() ) ) )
+        return false;
+    uint64_t load_time = Luc::GetTimeNanoseconds() - load_start_time;
+
+    Luc::Raytracer raytracer;
+    raytracer.set_verbose( false );
+    raytracer.set_path_tracing( settings.samples > 0 );
+    Luc::Camera camera = scene.camera;
+    camera.SetAspectRatio( Luc::real_t( settings.width ) / Luc::real_t( settings.height ) );
+    if ( !raytracer.initialize( &scene, settings.width, settings.height, camera ) ) {
+        std::cout << "Raytracer initialization failed.\n";
+        return false;
+    }
+    size_t memory;
+    has_memory = has_memory && Luc::GetMemoryUsage( &memory, &unused );
+
+    std::vector< unsigned char > buffer( 4 * settings.width * settings.height );
+    std::vector< BenchmarkRun > runs;
+    for ( size_t i = 0; i < settings.threads.size(); ++i ) {
+        raytracer.set_num_threads( settings.threads[i] );
+        BenchmarkRun run;
+        run.threads = settings.threads[i];
+        for ( int pass = 0; pass < settings.repeat; ++pass ) {
+            trace_image( &raytracer, settings.samples, &buffer[0] );
+            if ( 0 == pass || raytracer.get_stats().get_time() < run.stats.get_time() )
+                run.stats = raytracer.get_stats();
+        }
+        runs.push_back( run );
+
+        double speedup = static_cast< double >( runs[0].stats.get_time() ) /
+                         static_cast< double >( std::max< uint64_t >( 1, run.stats.get_time() ) );
+        printf( "%-10s %9u %8u %12.0f %10.1f %10.1f %8.2f\n", name, (unsigned int)benchmark.size,
+                (unsigned int)run.threads, run.stats.get_rays_per_second(),
+                to_milliseconds( run.stats.get_time() ), to_milliseconds( raytracer.get_build_time() ),
+                speedup );
+    }
+    // again after tracing, as the images and tracing threads take memory too
+    size_t traced_memory;
+    has_memory = has_memory && Luc::GetMemoryUsage( &traced_memory, &unused );
+
+    out << "{\"scene\": \"" << name << "\", \"size\": " << benchmark.size << ", \"file\": ";
+    write_json_string( out, filename );
+    out << ", \"geometries\": " << scene.num_geometries()
+        << ", \"lights\": " << scene.num_lights() + scene.num_area_lights()
+        << ", \"load_ms\": " << to_milliseconds( load_time )
+        << ", \"build_ms\": " << to_milliseconds( raytracer.get_build_time() ) << ", \"memory_increase_mb\": ";
+    write_json_megabytes( out, has_memory, memory_increase( start_memory, memory ) );
+    out << ", \"traced_memory_increase_mb\": ";
+    write_json_megabytes( out, has_memory, memory_increase( start_memory, traced_memory ) );
+    out << ",\n     \"runs\": [";
+    for ( size_t i = 0; i < runs.size(); ++i ) {
+        double speedup = static_cast< double >( runs[0].stats.get_time() ) /
+                         static_cast< double >( std::max< uint64_t >( 1, runs[i].stats.get_time() ) );
+        out << ( i > 0 ? ",\n       " : "\n       " ) << "{\"threads\": " << runs[i].threads
+            << ", \"speedup\": " << speedup << ", \"stats\": ";
+        runs[i].stats.write_json( out );
+        out << "}";
+    }
+    out << "]}";
+    return true;
+}
+
+} // namespace
+
+int main( int argc, char* argv[] )
+{
+    // configure.txt sets the root folder and the caches
+    Options opt;
+
+    BenchmarkSettings settings;
+    parse_scenes( DEFAULT_SCENES, &settings.scenes );
+    // doubling up to one thread per core
+    size_t cores = std::max( 1u, boost::thread::hardware_concurrency() );
+    for ( size_t count = 1; count < cores; count *= 2 )
+        settings.threads.push_back( count );
+    settings.threads.push_back( cores );
+    settings.width = 320;
+    settings.height = 240;
+    settings.samples = 0;
+    settings.repeat = 3;
+    settings.directory = "scenes/generated";
+    settings.output_filename = "benchmark.json";
+    settings.has_acceleration = false;
+    settings.acceleration = Luc::ACCELERATION_BVH;
+    if ( !parse_arguments( argc, argv, &settings ) ) {
+        print_usage();
+        return 1;
+    }
+
+    if ( !Luc::MakeDirectories( settings.directory ) ) {
+        std::cout << "Error creating directory '" << settings.directory << "'.\n";
+        return 1;
+    }
+
+    // only the timer, which needs neither a display nor a gpu
+    if ( SDL_Init( SDL_INIT_TIMER ) < 0 ) {
+        std::cout << "Unable to initialize SDL timer: " << SDL_GetError() << ".\n";
+        return 1;
+    }
+
+    // the hierarchies are built every time, so their build is timed
+    Luc::BvhCacheSingleton::Instance().set_enabled( false );
+    Luc::PageCacheSingleton::Instance().set_budget( static_cast<size_t>( opt.mPageBudgetMB ) * 1024 * 1024 );
+    Luc::TessellationCacheSingleton::Instance().set_budget( static_cast<size_t>( opt.mTessellationBudgetMB ) * 1024 * 1024 );
+
+    std::ofstream out( settings.output_filename.c_str() );
+    if ( !out ) {
+        std::cout << "Error opening '" << settings.output_filename << "'.\n";
+        SDL_Quit();
+        return 1;
+    }
+    out << "{\"version\": " << BENCHMARK_VERSION << ", \"time\": " << static_cast< long >( time( 0 ) )
+        << ", \"hardware_threads\": " << cores << ", \"width\": " << settings.width
+        << ", \"height\": " << settings.height << ", \"samples\": " << settings.samples
+        << ", \"repeat\": " << settings.repeat << ",\n \"scenes\": [";
+
+    printf( "%-10s %9s %8s %12s %10s %10s %8s\n", "scene", "size", "threads", "rays/s", "ms",
+            "build ms", "speedup" );
+    bool ok = true;
+    bool first = true;
+    for ( size_t i = 0; i < settings.scenes.size(); ++i ) {
+        // a failed scene leaves no entry, the others still run
+        std::stringstream scene_json;
+        if ( !benchmark_scene( settings, settings.scenes[i], scene_json ) ) {
+            ok = false;
+            continue;
+        }
+        out << ( first ? "\n  " : ",\n  " ) << scene_json.str();
+        out.flush();
+        first = false;
+    }
+    out << "]}\n";
+    out.close();
+
+    if ( !out ) {
+        std::cout << "Error writing results to '" << settings.output_filename << "'.\n";
+        ok = false;
+    } else {
+        std::cout << "Saved benchmark results to '" << settings.output_filename << "'.\n";
+    }
+
+    SDL_Quit();
+    return ok ? 0 : 1;
+}
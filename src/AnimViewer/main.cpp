@@ -9,6 +9,9 @@
 
 #include "lucPCH.h"
 #include "app/AnimViewerApplication.hpp"
+#include "scene/bvh_cache.hpp"
+#include "scene/paged_file.hpp"
+#include "scene/tessellation_cache.hpp"
 
 #include <iostream>
 #include <cstring>
@@ -17,6 +20,12 @@ int main( int argc, char* argv[] )
 {
     Options opt;
 
+    Luc::BvhCache& bvh_cache = Luc::BvhCacheSingleton::Instance();
+    bvh_cache.set_enabled( opt.mUseBvhCache );
+    bvh_cache.set_directory( opt.mBvhCacheDir );
+    Luc::PageCacheSingleton::Instance().set_budget( static_cast<size_t>( opt.mPageBudgetMB ) * 1024 * 1024 );
+    Luc::TessellationCacheSingleton::Instance().set_budget( static_cast<size_t>( opt.mTessellationBudgetMB ) * 1024 * 1024 );
+
     AnimationViewerApplication app( opt );
 
     // load the given scene
@@ -0,0 +1,473 @@
+/**
+ * @file render_main.cpp
+ * @brief Batch renderer, which raytraces scenes to PNG files without a
+ *  window, for machines with no display and no GPU.
+ */
+
+#include "lucPCH.h"
+#include "app/raytracer.hpp"
+#include "app/options.hpp"
+#include "app/render_server.hpp"
+#include "app/render_coordinator.hpp"
+#include "scene/scene.hpp"
+#include "scene/bvh_cache.hpp"
+#include "scene/paged_file.hpp"
+#include "scene/tessellation_cache.hpp"
+#include "scene/image/imageio.hpp"
+
+#include <SDL/SDL.h>
+#include <boost/thread/thread.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// SDL renames main for its window setup, which a batch render has none of
+#ifdef main
+#undef main
+#endif
+
+namespace {
+
+/*
+ * What to render, from the command line. Anything it leaves out comes
+ * from configure.txt, as in the viewer.
+ */
+struct RenderSettings
+{
+    std::string scene_filename;
+    std::string output_filename;
+    int width, height;
+    int threads;
+    int tile_size;
+    // path traced samples per pixel, 0 for a Whitted image
+    int samples;
+    bool has_camera;
+    Luc::Vector3 camera_position, camera_target;
+    // vertical field of view in degrees, 0 to keep the scene's
+    float fov;
+    int first_frame, last_frame;
+    bool has_frames;
+    // port to serve render jobs on, 0 to render once and exit
+    int serve_port;
+    // scenes the server keeps loaded
+    int cache_size;
+    // render servers to split the frames over, empty to trace them here
+    std::string workers;
+    // side length of the chunks handed to the workers
+    int chunk_size;
+    // ray stream to record the rays of the frames to, empty for none
+    std::string capture_filename;
+    // name of the pixel cost maps of the frames, empty for none
+    std::string cost_map;
+    // JSON file to write the ray statistics of the frames to, empty for none
+    std::string stats_filename;
+};
+
+void print_usage()
+{
+    std::cout <<
+        "usage: animviewer-render [options] [scene]\n"
+        "  -o FILE              PNG file to write, render.png by default\n"
+        "  -w WIDTH -h HEIGHT   size of the image\n"
+        "  -threads N           tracing threads, 0 for one per core\n"
+        "  -tile N              side length of the tiles, in pixels\n"
+        "  -samples N           path trace N samples per pixel, instead of a Whitted image\n"
+        "  -camera X,Y,Z,TX,TY,TZ  camera position, and the point it looks at\n"
+        "  -fov DEGREES         vertical field of view of the camera\n"
+        "  -frames FIRST-LAST   render a range of frames, replacing %d, or %04d and the\n"
+        "                       like, in the scene and output names with the frame number\n"
+        "  -serve PORT          serve render jobs on a port of localhost, see render_server.hpp\n"
+        "  -cache N             scenes the server keeps loaded, 4 by default\n"
+        "  -workers LIST        split the frames over render servers, given as a list of\n"
+        "                       [HOST:]PORT, or loopback:N for N servers in this process\n"
+        "  -chunk N             side length of the chunks handed to the workers\n"
+        "  -capture FILE        record the rays of the frame, or of its first path traced\n"
+        "                       pass, for animviewer-replay; %d is replaced as in -frames\n"
+        "  -costs NAME          save what each pixel cost as NAME_time.png and the like,\n"
+        "                       and NAME.cost; %d is replaced as in -frames\n"
+        "  -stats FILE          write the rays, intersection tests and time of the frame\n"
+        "                       as JSON; %d is replaced as in -frames\n"
+        "Without a scene, renders input_scene of configure.txt.\n";
+}
+
+bool parse_int( const char* str, int* value )
+{
+    char* end;
+    long result = strtol( str, &end, 10 );
+    if ( end == str || *end != '\0' )
+        return false;
+    *value = static_cast< int >( result );
+    return true;
+}
+
+bool parse_arguments( int argc, char* argv[], RenderSettings* settings )
+{
+    for ( int i = 1; i < argc; ++i ) {
+        std::string arg = argv[i];
+        if ( arg[0] != '-' ) {
+            settings->scene_filename = arg;
+            continue;
+        }
+
+        // every option takes a value
+        if ( i + 1 >= argc ) {
+            std::cout << "Missing value of option " << arg << ".\n";
+            return false;
+        }
+        const char* value = argv[++i];
+        bool ok = true;
+        if ( arg == "-o" ) {
+            settings->output_filename = value;
+        } else if ( arg == "-w" ) {
+            ok = parse_int( value, &settings->width ) && settings->width > 0;
+        } else if ( arg == "-h" ) {
+            ok = parse_int( value, &settings->height ) && settings->height > 0;
+        } else if ( arg == "-threads" ) {
+            ok = parse_int( value, &settings->threads ) && settings->threads >= 0;
+        } else if ( arg == "-tile" ) {
+            ok = parse_int( value, &settings->tile_size ) && settings->tile_size > 0;
+        } else if ( arg == "-samples" ) {
+            ok = parse_int( value, &settings->samples ) && settings->samples >= 0;
+        } else if ( arg == "-camera" ) {
+            Luc::Vector3& p = settings->camera_position;
+            Luc::Vector3& t = settings->camera_target;
+            ok = 6 == sscanf( value, "%f,%f,%f,%f,%f,%f", &p.x, &p.y, &p.z, &t.x, &t.y, &t.z ) &&
+                 p != t;
+            settings->has_camera = true;
+        } else if ( arg == "-fov" ) {
+            settings->fov = static_cast< float >( atof( value ) );
+            ok = settings->fov > 0 && settings->fov < 180;
+        } else if ( arg == "-frames" ) {
+            ok = 2 == sscanf( value, "%d-%d", &settings->first_frame, &settings->last_frame ) &&
+                 settings->first_frame <= settings->last_frame;
+            settings->has_frames = true;
+        } else if ( arg == "-serve" ) {
+            ok = parse_int( value, &settings->serve_port ) &&
+                 settings->serve_port > 0 && settings->serve_port < 65536;
+        } else if ( arg == "-cache" ) {
+            ok = parse_int( value, &settings->cache_size ) && settings->cache_size > 0;
+        } else if ( arg == "-workers" ) {
+            settings->workers = value;
+        } else if ( arg == "-chunk" ) {
+            ok = parse_int( value, &settings->chunk_size ) && settings->chunk_size > 0;
+        } else if ( arg == "-capture" ) {
+            settings->capture_filename = value;
+        } else if ( arg == "-costs" ) {
+            settings->cost_map = value;
+        } else if ( arg == "-stats" ) {
+            settings->stats_filename = value;
+        } else {
+            std::cout << "Unknown option " << arg << ".\n";
+            return false;
+        }
+
+        if ( !ok ) {
+            std::cout << "Invalid value '" << value << "' of option " << arg << ".\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+// position of a %d, with an optional zero padded width, in a name
+bool find_frame_pattern( const std::string& name, size_t* begin, size_t* end, int* digits )
+{
+    for ( size_t i = name.find( '%' ); i != std::string::npos; i = name.find( '%', i + 1 ) ) {
+        size_t j = i + 1;
+        *digits = 0;
+        while ( j < name.size() && name[j] >= '0' && name[j] <= '9' )
+            *digits = *digits * 10 + ( name[j++] - '0' );
+        if ( j < name.size() && name[j] == 'd' ) {
+            *begin = i;
+            *end = j + 1;
+            return true;
+        }
+    }
+    return false;
+}
+
+// the name with the frame number in place of its %d, if it has one
+std::string format_frame( const std::string& name, int frame )
+{
+    size_t begin, end;
+    int digits;
+    if ( !find_frame_pattern( name, &begin, &end, &digits ) )
+        return name;
+
+    char number[32];
+    sprintf( number, "%0*d", std::min( digits, 16 ), frame );
+    return name.substr( 0, begin ) + number + name.substr( end );
+}
+
+/*
+ * Adds the workers of a list to a coordinator, starting the servers of a
+ * loopback:N in this process. Those serve until the process exits, so
+ * they are never deleted.
+ */
+bool add_workers( const Options& opt, const RenderSettings& settings,
+                  Luc::RenderCoordinator* coordinator )
+{
+    int count = 0;
+    if ( 1 == sscanf( settings.workers.c_str(), "loopback:%d", &count ) ) {
+        if ( count <= 0 )
+            return false;
+        for ( int i = 0; i < count; ++i ) {
+            Luc::RenderServer* server = new Luc::RenderServer( opt, 1 );
+            if ( settings.threads >= 0 )
+                server->set_num_threads( settings.threads );
+            if ( settings.tile_size > 0 )
+                server->set_tile_size( settings.tile_size );
+            if ( !server->listen( 0 ) ) {
+                delete server;
+                return false;
+            }
+            boost::thread serve_thread( &Luc::RenderServer::serve, server );
+            serve_thread.detach();
+            coordinator->add_worker( "127.0.0.1", server->get_port() );
+        }
+        return true;
+    }
+
+    std::istringstream list( settings.workers );
+    std::string worker;
+    while ( std::getline( list, worker, ',' ) ) {
+        size_t colon = worker.rfind( ':' );
+        std::string host = colon == std::string::npos ? "127.0.0.1" : worker.substr( 0, colon );
+        int port;
+        if ( !parse_int( worker.substr( colon + 1 ).c_str(), &port ) || port <= 0 || port >= 65536 )
+            return false;
+        coordinator->add_worker( host, static_cast< unsigned short >( port ) );
+    }
+    return coordinator->num_workers() > 0;
+}
+
+// the job of a frame, for the render servers
+std::string get_frame_job( const RenderSettings& settings, const std::string& scene_filename )
+{
+    std::ostringstream job;
+    job << "scene=" << scene_filename << " samples=" << settings.samples;
+    if ( settings.has_camera ) {
+        const Luc::Vector3& p = settings.camera_position;
+        const Luc::Vector3& t = settings.camera_target;
+        job << " camera=" << p.x << "," << p.y << "," << p.z << "," << t.x << "," << t.y << "," << t.z;
+    }
+    if ( settings.fov > 0 )
+        job << " fov=" << settings.fov;
+    return job.str();
+}
+
+// traces a frame in this process
+bool trace_frame( const Options& opt, const RenderSettings& settings,
+                  const std::string& scene_filename, const std::string& capture_filename,
+                  const std::string& cost_map, const std::string& stats_filename,
+                  unsigned char* buffer )
+{
+    Luc::Raytracer raytracer;
+    apply_raytracer_options( opt, &raytracer );
+    if ( settings.threads >= 0 )
+        raytracer.set_num_threads( settings.threads );
+    if ( settings.tile_size > 0 )
+        raytracer.set_tile_size( settings.tile_size );
+    raytracer.set_path_tracing( settings.samples > 0 );
+    if ( !capture_filename.empty() )
+        raytracer.capture_rays( capture_filename );
+    raytracer.set_cost_recording( !cost_map.empty() );
+
+    Luc::Scene scene;
+    if ( !scene.load( scene_filename.c_str() ) ) {
+        std::cout << "Error loading scene " << scene_filename << ".\n";
+        return false;
+    }
+    if ( !Luc::load_scene_data( &scene, raytracer.get_thread_count() ) )
+        return false;
+
+    Luc::Camera camera = scene.camera;
+    if ( settings.has_camera ) {
+        camera.SetPosition( settings.camera_position );
+        camera.LookAt( settings.camera_target );
+    }
+    if ( settings.fov > 0 )
+        camera.SetFOV( settings.fov * PI / 180.0f );
+    camera.SetAspectRatio( Luc::real_t( settings.width ) / Luc::real_t( settings.height ) );
+
+    if ( !raytracer.initialize( &scene, settings.width, settings.height, camera ) ) {
+        std::cout << "Raytracer initialization failed.\n";
+        return false;
+    }
+
+    if ( settings.samples > 0 ) {
+        // without a time limit, every call traces one sample per pixel
+        while ( raytracer.num_passes() < static_cast< unsigned int >( settings.samples ) )
+            raytracer.raytrace( buffer, 0 );
+    } else {
+        while ( !raytracer.raytrace( buffer, 0 ) ) { }
+    }
+
+    if ( !cost_map.empty() )
+        raytracer.get_cost_map().save( cost_map );
+
+    // the raytracer prints the statistics itself
+    const Luc::FrameStats& stats = raytracer.get_stats();
+    if ( !stats_filename.empty() ) {
+        std::ofstream out( stats_filename.c_str() );
+        stats.write_json( out );
+        out << "\n";
+        if ( !out ) {
+            std::cout << "Error saving statistics to '" << stats_filename << "'.\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+bool render_frame( const Options& opt, const RenderSettings& settings, int frame,
+                   Luc::RenderCoordinator* coordinator )
+{
+    std::string scene_filename = settings.scene_filename;
+    std::string output_filename = settings.output_filename;
+    std::string capture_filename = settings.capture_filename;
+    std::string cost_map = settings.cost_map;
+    std::string stats_filename = settings.stats_filename;
+    if ( settings.has_frames ) {
+        scene_filename = format_frame( scene_filename, frame );
+        output_filename = format_frame( output_filename, frame );
+        capture_filename = format_frame( capture_filename, frame );
+        cost_map = format_frame( cost_map, frame );
+        stats_filename = format_frame( stats_filename, frame );
+    }
+
+    unsigned int start_time = SDL_GetTicks();
+    std::vector< unsigned char > buffer( 4 * settings.width * settings.height );
+    if ( coordinator ) {
+        bool rendered = coordinator->render( get_frame_job( settings, scene_filename ),
+                                             settings.width, settings.height, &buffer[0] );
+        coordinator->print_report( std::cout );
+        if ( !rendered ) {
+            std::cout << "Every worker failed before the frame was done.\n";
+            return false;
+        }
+    } else if ( !trace_frame( opt, settings, scene_filename, capture_filename, cost_map, stats_filename,
+                              &buffer[0] ) ) {
+        return false;
+    }
+
+    if ( !Luc::imageio_save_image( output_filename.c_str(), &buffer[0], settings.width, settings.height ) ) {
+        std::cout << "Error saving raytraced image to '" << output_filename << "'.\n";
+        return false;
+    }
+    std::cout << "Saved raytraced image to '" << output_filename << "' in "
+              << SDL_GetTicks() - start_time << " milliseconds.\n";
+    return true;
+}
+
+} // namespace
+
+int main( int argc, char* argv[] )
+{
+    // configure.txt sets the root folder and the defaults of every option
+    Options opt;
+
+    RenderSettings settings;
+    settings.scene_filename = opt.input_filename;
+    settings.output_filename = opt.output_filename.empty() ? "render.png" : opt.output_filename;
+    settings.width = opt.width;
+    settings.height = opt.height;
+    settings.threads = -1;
+    settings.tile_size = 0;
+    settings.samples = 0;
+    settings.has_camera = false;
+    settings.fov = 0;
+    settings.first_frame = settings.last_frame = 0;
+    settings.has_frames = false;
+    settings.serve_port = 0;
+    settings.cache_size = 4;
+    settings.chunk_size = 0;
+    settings.cost_map = opt.mCostMap;
+    if ( !parse_arguments( argc, argv, &settings ) ) {
+        print_usage();
+        return 1;
+    }
+    if ( ( settings.scene_filename.empty() && 0 == settings.serve_port ) ||
+         settings.width <= 0 || settings.height <= 0 ) {
+        print_usage();
+        return 1;
+    }
+
+    // every frame of a range needs a file of its own
+    size_t begin, end;
+    int digits;
+    if ( settings.has_frames && settings.first_frame != settings.last_frame &&
+         !find_frame_pattern( settings.output_filename, &begin, &end, &digits ) ) {
+        std::cout << "The output name of a frame range needs a %d for the frame number.\n";
+        return 1;
+    }
+    if ( !settings.capture_filename.empty() && !settings.workers.empty() ) {
+        std::cout << "Rays can only be captured without workers.\n";
+        return 1;
+    }
+    if ( !settings.cost_map.empty() && !settings.workers.empty() ) {
+        std::cout << "Pixel costs are only saved without workers.\n";
+        settings.cost_map.clear();
+    }
+    if ( !settings.stats_filename.empty() && !settings.workers.empty() ) {
+        std::cout << "Ray statistics are only saved without workers.\n";
+        settings.stats_filename.clear();
+    }
+
+    // only the timer, which needs neither a display nor a gpu
+    if ( SDL_Init( SDL_INIT_TIMER ) < 0 ) {
+        std::cout << "Unable to initialize SDL timer: " << SDL_GetError() << ".\n";
+        return 1;
+    }
+
+    Luc::BvhCache& bvh_cache = Luc::BvhCacheSingleton::Instance();
+    bvh_cache.set_enabled( opt.mUseBvhCache );
+    bvh_cache.set_directory( opt.mBvhCacheDir );
+    Luc::PageCacheSingleton::Instance().set_budget( static_cast<size_t>( opt.mPageBudgetMB ) * 1024 * 1024 );
+    Luc::TessellationCacheSingleton::Instance().set_budget( static_cast<size_t>( opt.mTessellationBudgetMB ) * 1024 * 1024 );
+
+    if ( settings.serve_port > 0 ) {
+        // jobs come with their own scene, size and camera
+        Luc::RenderServer server( opt, settings.cache_size );
+        if ( settings.threads >= 0 )
+            server.set_num_threads( settings.threads );
+        if ( settings.tile_size > 0 )
+            server.set_tile_size( settings.tile_size );
+        bool served = server.run( static_cast< unsigned short >( settings.serve_port ) );
+        SDL_Quit();
+        return served ? 0 : 1;
+    }
+
+    Luc::RenderCoordinator coordinator;
+    if ( !settings.workers.empty() ) {
+        if ( !add_workers( opt, settings, &coordinator ) ) {
+            std::cout << "Invalid workers '" << settings.workers << "'.\n";
+            SDL_Quit();
+            return 1;
+        }
+        if ( settings.chunk_size > 0 )
+            coordinator.set_chunk_size( settings.chunk_size );
+    }
+
+    int failed = 0;
+    for ( int frame = settings.first_frame; frame <= settings.last_frame; ++frame ) {
+        if ( settings.has_frames )
+            std::cout << "Rendering frame " << frame << ".\n";
+        if ( !render_frame( opt, settings, frame, settings.workers.empty() ? 0 : &coordinator ) )
+            failed++;
+    }
+
+    SDL_Quit();
+    if ( failed > 0 ) {
+        std::cout << failed << " of " << settings.last_frame - settings.first_frame + 1
+                  << " frames failed.\n";
+        return 1;
+    }
+    return 0;
+}
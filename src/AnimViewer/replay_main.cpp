@@ -0,0 +1,266 @@
+/**
+ * @file replay_main.cpp
+ * @brief Replays a ray stream recorded by the raytracer against its scene,
+ *  timing the acceleration structure alone, without shading.
+ */
+
+#include "lucPCH.h"
+#include "app/options.hpp"
+#include "app/render_server.hpp"
+#include "app/hit_vertex_infor.hpp"
+#include "scene/scene.hpp"
+#include "scene/acceleration.hpp"
+#include "scene/ray_stream.hpp"
+#include "scene/bvh_cache.hpp"
+#include "scene/paged_file.hpp"
+#include "scene/tessellation_cache.hpp"
+
+#include <SDL/SDL.h>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// SDL renames main for its window setup, which a replay has none of
+#ifdef main
+#undef main
+#endif
+
+namespace {
+
+struct ReplaySettings
+{
+    std::string stream_filename;
+    // the scene of the stream, unless given
+    std::string scene_filename;
+    int threads;
+    // times every ray is traced, to time short streams
+    int repeat;
+    // acceleration structure to use instead of the scene's
+    bool has_acceleration;
+    Luc::AccelerationType acceleration;
+};
+
+/*
+ * What the rays of a range did. The checksum adds up the bits of the hit
+ * distances, so it is the same whatever the order the rays are traced
+ * in, and differs if any ray hits something else.
+ */
+struct ReplayResult
+{
+    uint64_t hits;
+    uint64_t checksum;
+};
+
+void print_usage()
+{
+    std::cout <<
+        "usage: animviewer-replay [options] stream [scene]\n"
+        "  -threads N           tracing threads, 0 for one per core\n"
+        "  -repeat N            trace every ray N times\n"
+        "  -accel NAME          list, bvh or grid, instead of the scene's structure\n"
+        "Without a scene, loads the scene the stream was recorded in.\n";
+}
+
+bool parse_int( const char* str, int* value )
+{
+    char* end;
+    long result = strtol( str, &end, 10 );
+    if ( end == str || *end != '\0' )
+        return false;
+    *value = static_cast< int >( result );
+    return true;
+}
+
+bool parse_arguments( int argc, char* argv[], ReplaySettings* settings )
+{
+    for ( int i = 1; i < argc; ++i ) {
+        std::string arg = argv[i];
+        if ( arg[0] != '-' ) {
+            if ( settings->stream_filename.empty() )
+                settings->stream_filename = arg;
+            else
+                settings->scene_filename = arg;
+            continue;
+        }
+
+        // every option takes a value
+        if ( i + 1 >= argc ) {
+            std::cout << "Missing value of option " << arg << ".\n";
+            return false;
+        }
+        const char* value = argv[++i];
+        bool ok = true;
+        if ( arg == "-threads" ) {
+            ok = parse_int( value, &settings->threads ) && settings->threads >= 0;
+        } else if ( arg == "-repeat" ) {
+            ok = parse_int( value, &settings->repeat ) && settings->repeat > 0;
+        } else if ( arg == "-accel" ) {
+            ok = Luc::Acceleration::parse_type( value, &settings->acceleration );
+            settings->has_acceleration = true;
+        } else {
+            std::cout << "Unknown option " << arg << ".\n";
+            return false;
+        }
+
+        if ( !ok ) {
+            std::cout << "Invalid value '" << value << "' of option " << arg << ".\n";
+            return false;
+        }
+    }
+    return !settings->stream_filename.empty();
+}
+
+// traces every step-th ray of a list, starting at first
+void trace_rays( const Luc::Acceleration* acceleration, const std::vector< Luc::RayRecord >* rays,
+                 const std::vector< size_t >* indices, size_t first, size_t step, int repeat,
+                 ReplayResult* result )
+{
+    // the differentials only change what is computed at a hit
+    Luc::RayDifferential differential;
+    differential.dpdx = differential.dpdy = Luc::Vector3::Zero;
+    differential.dddx = differential.dddy = Luc::Vector3::Zero;
+
+    result->hits = 0;
+    result->checksum = 0;
+    for ( int pass = 0; pass < repeat; ++pass ) {
+        for ( size_t i = first; i < indices->size(); i += step ) {
+            const Luc::RayRecord& record = ( *rays )[( *indices )[i]];
+            Luc::Vector3 origin( record.origin[0], record.origin[1], record.origin[2] );
+            Luc::Vector3 direction( record.direction[0], record.direction[1], record.direction[2] );
+            Luc::Ray ray = ( record.flags & Luc::RayRecord::HAS_DIFFERENTIAL ) ?
+                Luc::Ray( origin, direction, differential ) : Luc::Ray( origin, direction );
+            ray.SetUseProxy( 0 != ( record.flags & Luc::RayRecord::USE_PROXY ) );
+
+            Luc::HitVertexInfor hit_vertex;
+            Luc::real_t t;
+            if ( acceleration->intersect( ray, record.t_min, record.t_max, t, hit_vertex ) && 0 == pass ) {
+                uint32_t bits;
+                memcpy( &bits, &t, sizeof bits );
+                result->hits++;
+                result->checksum += bits;
+            }
+        }
+    }
+}
+
+} // namespace
+
+int main( int argc, char* argv[] )
+{
+    // configure.txt sets the root folder and the caches
+    Options opt;
+
+    ReplaySettings settings;
+    settings.threads = opt.mThreads;
+    settings.repeat = 1;
+    settings.has_acceleration = false;
+    settings.acceleration = Luc::ACCELERATION_BVH;
+    if ( !parse_arguments( argc, argv, &settings ) ) {
+        print_usage();
+        return 1;
+    }
+
+    std::string recorded_scene;
+    std::vector< Luc::RayRecord > rays;
+    if ( !Luc::read_ray_stream( settings.stream_filename, &recorded_scene, &rays ) )
+        return 1;
+    if ( settings.scene_filename.empty() )
+        settings.scene_filename = recorded_scene;
+
+    // only the timer, which needs neither a display nor a gpu
+    if ( SDL_Init( SDL_INIT_TIMER ) < 0 ) {
+        std::cout << "Unable to initialize SDL timer: " << SDL_GetError() << ".\n";
+        return 1;
+    }
+
+    Luc::BvhCache& bvh_cache = Luc::BvhCacheSingleton::Instance();
+    bvh_cache.set_enabled( opt.mUseBvhCache );
+    bvh_cache.set_directory( opt.mBvhCacheDir );
+    Luc::PageCacheSingleton::Instance().set_budget( static_cast<size_t>( opt.mPageBudgetMB ) * 1024 * 1024 );
+    Luc::TessellationCacheSingleton::Instance().set_budget( static_cast<size_t>( opt.mTessellationBudgetMB ) * 1024 * 1024 );
+
+    size_t num_threads = settings.threads > 0 ? settings.threads : boost::thread::hardware_concurrency();
+    if ( 0 == num_threads )
+        num_threads = 1;
+
+    Luc::Scene scene;
+    if ( !scene.load( settings.scene_filename.c_str() ) ) {
+        std::cout << "Error loading scene " << settings.scene_filename << ".\n";
+        SDL_Quit();
+        return 1;
+    }
+    if ( !Luc::load_scene_data( &scene, num_threads ) ) {
+        SDL_Quit();
+        return 1;
+    }
+
+    // as the raytracer builds it in initialize
+    Luc::Geometry* const* geometries = scene.get_geometries();
+    size_t geometry_count = scene.num_geometries();
+    for ( size_t i = 0; i < geometry_count; ++i )
+        geometries[i]->build_inverse_transformation_matrix();
+    Luc::AccelerationSettings acceleration_settings = scene.acceleration;
+    if ( settings.has_acceleration )
+        acceleration_settings.type = settings.acceleration;
+    unsigned int build_start_time = SDL_GetTicks();
+    boost::scoped_ptr< Luc::Acceleration > acceleration( Luc::Acceleration::create( acceleration_settings ) );
+    acceleration->build( geometries, geometry_count );
+    printf( "Built %s acceleration structure in %u milliseconds.\n",
+            acceleration->get_name(), SDL_GetTicks() - build_start_time );
+
+    // the rays of a type together, in the order they were recorded
+    std::vector< size_t > indices[Luc::NUM_RAY_TYPES];
+    for ( size_t i = 0; i < rays.size(); ++i ) {
+        if ( rays[i].type < Luc::NUM_RAY_TYPES )
+            indices[rays[i].type].push_back( i );
+    }
+
+    printf( "Replaying %u rays of '%s' on %u threads, %d times.\n", (unsigned int)rays.size(),
+            settings.scene_filename.c_str(), (unsigned int)num_threads, settings.repeat );
+    printf( "%-10s %10s %10s %12s %10s  %s\n", "type", "rays", "hits", "rays/s", "ms", "checksum" );
+
+    uint64_t total_rays = 0, total_hits = 0, total_checksum = 0;
+    unsigned int total_time = 0;
+    for ( int type = 0; type < Luc::NUM_RAY_TYPES; ++type ) {
+        if ( indices[type].empty() )
+            continue;
+
+        // threads take every num_threads-th ray, so each gets a share of every part of the image
+        std::vector< ReplayResult > results( num_threads );
+        unsigned int start_time = SDL_GetTicks();
+        boost::thread_group threads;
+        for ( size_t i = 0; i < num_threads; ++i )
+            threads.add_thread( new boost::thread( &trace_rays, acceleration.get(), &rays, &indices[type],
+                                                   i, num_threads, settings.repeat, &results[i] ) );
+        threads.join_all();
+        unsigned int elapsed = SDL_GetTicks() - start_time;
+
+        uint64_t hits = 0, checksum = 0;
+        for ( size_t i = 0; i < num_threads; ++i ) {
+            hits += results[i].hits;
+            checksum += results[i].checksum;
+        }
+        double traced = double( indices[type].size() ) * settings.repeat;
+        printf( "%-10s %10u %10u %12.0f %10u  %016llx\n",
+                Luc::get_ray_type_name( static_cast< Luc::RayType >( type ) ),
+                (unsigned int)indices[type].size(), (unsigned int)hits,
+                elapsed > 0 ? 1000.0 * traced / elapsed : 0.0, elapsed, (unsigned long long)checksum );
+
+        total_rays += indices[type].size();
+        total_hits += hits;
+        total_checksum += checksum;
+        total_time += elapsed;
+    }
+    printf( "%-10s %10u %10u %12.0f %10u  %016llx\n", "total", (unsigned int)total_rays,
+            (unsigned int)total_hits,
+            total_time > 0 ? 1000.0 * double( total_rays ) * settings.repeat / total_time : 0.0,
+            total_time, (unsigned long long)total_checksum );
+
+    SDL_Quit();
+    return 0;
+}
@@ -2,6 +2,16 @@
 #include "files/fileutils.h"
 #include "platform/path.h"
 
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#ifdef _MSC_VER
+#include <windows.h>
+#include <direct.h>
+#else
+#include <cstdio>
+#endif
+
 namespace Luc
 {
 bool ParseFilePath(const std::string& filepath, std::string& dir, std::string& filename)
@@ -39,5 +49,53 @@ std::string& ConvertToAbsolutePath( const std::string& filepath, std::string& fu
     return fullpath;
 }
 
+bool GetFileStamp( const std::string& filepath, uint64_t& size, uint64_t& modifiedTime )
+{
+#ifdef _MSC_VER
+    // 64 bit variant, plain _stat fails on files over 2GB
+    struct _stat64 info;
+    if (0 != _stat64(filepath.c_str(), &info))
+        return false;
+#else
+    struct stat info;
+    if (0 != stat(filepath.c_str(), &info))
+        return false;
+#endif
+    size = static_cast<uint64_t>(info.st_size);
+    modifiedTime = static_cast<uint64_t>(info.st_mtime);
+    return true;
+}
+
+bool ReplaceExistingFile(const std::string& source, const std::string& target)
+{
+#ifdef _MSC_VER
+    // rename fails on Windows when the target exists
+    return 0 != ::MoveFileExA(source.c_str(), target.c_str(), MOVEFILE_REPLACE_EXISTING);
+#else
+    // POSIX rename replaces the target atomically
+    return 0 == rename(source.c_str(), target.c_str());
+#endif
+}
+
+static bool MakeDirectory(const std::string& path)
+{
+#ifdef _MSC_VER
+    int result = _mkdir(path.c_str());
+#else
+    int result = mkdir(path.c_str(), 0755);
+#endif
+    return 0 == result || EEXIST == errno;
+}
+
+bool MakeDirectories(const std::string& path)
+{
+    // each parent first, skipping a leading separator or drive
+    for (size_t pos = path.find_first_of("/\\", 1); std::string::npos != pos; pos = path.find_first_of("/\\", pos + 1))
+    {
+        if (':' != path[pos - 1] && !MakeDirectory(path.substr(0, pos)))
+            return false;
+    }
+    return path.empty() || MakeDirectory(path);
 }
 
+}
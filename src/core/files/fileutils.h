@@ -25,6 +25,33 @@ namespace Luc
     //! 
     std::string& ConvertToAbsolutePath(const std::string& filepath, std::string& fullpath);
 
+    //!
+    //! Query size and last modification time of a file.
+    //! @param[in]  filepath
+    //! @param[out] size            File size in bytes.
+    //! @param[out] modifiedTime    Last modification time, seconds since epoch.
+    //! @return false if the file does not exist.
+    //! 
+    bool GetFileStamp(const std::string& filepath, uint64_t& size, uint64_t& modifiedTime);
+
+    //!
+    //! Moves a file over another in one step, replacing it if it exists.
+    //! Readers see either the old or the new file, and a crash during the
+    //! move never leaves neither, so files written to a temporary path first
+    //! are published with this.
+    //! @param[in]  source
+    //! @param[in]  target
+    //! @return false if the file could not be moved; source is left as is.
+    //! 
+    bool ReplaceExistingFile(const std::string& source, const std::string& target);
+
+    //!
+    //! Creates a directory along with any missing parent directories.
+    //! @param[in]  path    Directories separated by '/' or '\\'.
+    //! @return false if a directory could not be created; true if it exists.
+    //! 
+    bool MakeDirectories(const std::string& path);
+
 }
 
 #endif // CORE_FILES_FILESUTILS_H
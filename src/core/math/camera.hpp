@@ -10,6 +10,7 @@
 
 #include "math/vector.hpp"
 #include "math/quaternion.hpp"
+#include "math/matrix.hpp"
 
 namespace Luc {
 
@@ -61,6 +62,24 @@ public:
     // rotates camera about its Y axis
     void Yaw( real_t radians )  {Rotate( mOrientation * Vector3::UnitY, radians );}
 
+    // turns camera to look at a point, keeping its up direction if it can
+    void LookAt( const Vector3& target )
+    {
+        Vector3 back = normalize( mPosition - target );
+        Vector3 up = GetUp();
+        if ( length( cross( up, back ) ) < 1e-4f )
+            up = fabs( back.y ) < 0.99f ? Vector3::UnitY : Vector3::UnitZ;
+        Vector3 right = normalize( cross( up, back ) );
+        up = cross( back, right );
+
+        // the camera looks down its -z axis, with y up
+        Matrix4 rotation( right.x, right.y, right.z, 0,
+                          up.x,    up.y,    up.z,    0,
+                          back.x,  back.y,  back.z,  0,
+                          0,       0,       0,       1 );
+        mOrientation = normalize( Quaternion( rotation ) );
+    }
+
 private:
     // rotates camera about the given axis
     void Rotate( const Vector3& axis, real_t radians ) {mOrientation = normalize( Quaternion( axis, radians ) * mOrientation );}
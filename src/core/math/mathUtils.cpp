@@ -47,6 +47,21 @@ namespace Math
         return hash; 
     }
 
+    //64-bit FNV-1a hash
+    //The byte-wise variant of FNV above, xor first and multiply after, which
+    //has better avalanche on the low bits. Used for content hashes of binary
+    //data such as mesh vertices, where the 32-bit string hashes collide too often.
+    uint64_t FNV1aHash64(const void* data, size_t size, uint64_t hash)
+    {
+        const unsigned char* pByte = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size; ++i)
+        {
+            hash ^= pByte[i];
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+
 
     //Additive hash
     uint32_t ADDHash( const char *pName)
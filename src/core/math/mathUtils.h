@@ -8,6 +8,15 @@ namespace Math
 {
 uint32_t ELFHash(const char *pName);
 
+// 64-bit FNV-1a offset basis, the seed of an empty FNV1aHash64 chain.
+const uint64_t FNV64_OFFSET_BASIS = 14695981039346656037ULL;
+
+//!
+//! 64-bit FNV-1a hash of a block of memory. Chain calls by passing the
+//! previous result as hash to digest several blocks into one key.
+//!
+uint64_t FNV1aHash64(const void* data, size_t size, uint64_t hash = FNV64_OFFSET_BASIS);
+
 inline uint32_t HashString(const char *pName)  { return ELFHash(pName); };
 }
 }
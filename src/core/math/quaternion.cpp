@@ -66,12 +66,17 @@ Quaternion::Quaternion( const Matrix4& mat )
         size_t j = next[i];
         size_t k = next[j];
 
+        // the largest of x, y and z is i, the others follow it in turn
+        real_t q[3];
         root = sqrt( mat._m[i][i] - mat._m[j][j] - mat._m[k][k] + 1.0f );
-        x = 0.5f * root;
+        q[i] = 0.5f * root;
         root = 0.5f / root;
         w = ( mat._m[k][j] - mat._m[j][k] ) * root;
-        y = ( mat._m[j][i] + mat._m[i][j] ) * root;
-        z = ( mat._m[k][i] + mat._m[i][k] ) * root;
+        q[j] = ( mat._m[j][i] + mat._m[i][j] ) * root;
+        q[k] = ( mat._m[k][i] + mat._m[i][k] ) * root;
+        x = q[0];
+        y = q[1];
+        z = q[2];
     }
 }
 
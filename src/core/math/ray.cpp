@@ -4,12 +4,31 @@
 #include <assert.h>
 namespace Luc {
 
+const char* get_ray_type_name( RayType type )
+{
+    static const char* const NAMES[NUM_RAY_TYPES] = {
+        "eye", "shadow", "reflected", "refracted", "diffuse", "photon"
+    };
+    return type < NUM_RAY_TYPES ? NAMES[type] : "unknown";
+}
 
 Ray::Ray( const Vector3& pnt, const Vector3& dir ) 
 {
     assert( 0!=dir.x || 0!=dir.y || 0!=dir.z );
     m_pnt = pnt;
     m_dir = dir;
+    m_bUseProxy = false;
+    m_bHasDifferential = false;
+}
+
+Ray::Ray( const Vector3& pnt, const Vector3& dir, const RayDifferential& differential )
+{
+    assert( 0!=dir.x || 0!=dir.y || 0!=dir.z );
+    m_pnt = pnt;
+    m_dir = dir;
+    m_bUseProxy = false;
+    m_bHasDifferential = true;
+    m_differential = differential;
 }
 
 Ray::Ray( const Ray& line )
@@ -17,6 +36,10 @@ Ray::Ray( const Ray& line )
     assert( 0!=line.m_dir.x || 0!=line.m_dir.y || 0!=line.m_dir.z );
     m_pnt = line.m_pnt;
     m_dir = line.m_dir;
+    m_bUseProxy = line.m_bUseProxy;
+    m_bHasDifferential = line.m_bHasDifferential;
+    if ( m_bHasDifferential )
+        m_differential = line.m_differential;
 }
 
 }
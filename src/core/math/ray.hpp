@@ -6,20 +6,60 @@
 
 namespace Luc {
 
+/// What a ray is traced for.
+enum RayType
+{
+    RAY_EYE,        // from the camera, including the denoiser's guide rays
+    RAY_SHADOW,     // toward a light
+    RAY_REFLECTED,  // off a mirror or dielectric
+    RAY_REFRACTED,  // into or out of a dielectric
+    RAY_DIFFUSE,    // indirect light, a diffuse bounce or an irradiance cache sample
+    RAY_PHOTON,     // shot from a light for caustics
+    NUM_RAY_TYPES
+};
+
+/// Name of a ray type, for statistics.
+const char* get_ray_type_name( RayType type );
+
+/*
+ * How a ray changes from one pixel to the next, in x and y (Igehy, "Tracing
+ * Ray Differentials"). The surface a ray hits uses it to tell how much of
+ * its texture one pixel covers.
+ */
+struct RayDifferential
+{
+    // change of the start point per pixel
+    Vector3 dpdx, dpdy;
+    // change of the direction per pixel
+    Vector3 dddx, dddy;
+};
 
 class Ray
 {
 public:
     Ray(const Vector3 & pnt, const Vector3 & dir);
+    Ray(const Vector3 & pnt, const Vector3 & dir, const RayDifferential& differential);
     Ray(const Ray& line);
     ~Ray() {};
 
     Vector3 Point()  const { return m_pnt; };
     Vector3 Direction() const { return m_dir; };
 
+    bool HasDifferential() const { return m_bHasDifferential; };
+    const RayDifferential& Differential() const { return m_differential; };
+
+    // rays whose detail is lost anyway, such as shadow rays and late
+    // bounces, may hit the simplified proxies of meshes instead
+    bool UseProxy() const { return m_bUseProxy; };
+    void SetUseProxy(bool use_proxy) { m_bUseProxy = use_proxy; };
+
 private:
     Vector3 m_pnt;
     Vector3 m_dir;
+
+    bool m_bUseProxy;
+    bool m_bHasDifferential;
+    RayDifferential m_differential;
 };
 
 }
@@ -0,0 +1,210 @@
+/**
+ * @file sampler.cpp
+ * @brief Random and low-discrepancy sample sequences for Monte Carlo rendering.
+ */
+#include "lucPCH.h"
+#include "math/sampler.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace Luc {
+
+// bases of the Halton dimensions
+static const uint32_t PRIMES[] = {
+      2,   3,   5,   7,  11,  13,  17,  19,  23,  29,  31,  37,  41,  43,  47,  53,
+     59,  61,  67,  71,  73,  79,  83,  89,  97, 101, 103, 107, 109, 113, 127, 131,
+    137, 139, 149, 151, 157, 163, 167, 173, 179, 181, 191, 193, 197, 199, 211, 223,
+    227, 229, 233, 239, 241, 251, 257, 263, 269, 271, 277, 281, 283, 293, 307, 311
+};
+static const uint32_t NUM_PRIMES = sizeof( PRIMES ) / sizeof( PRIMES[0] );
+
+// largest float below 1, so scaled integers never round up to 1
+static const real_t ONE_MINUS_EPSILON = 0.99999994f;
+
+// integer hash with good avalanche (Wellons, "lowbias32")
+static uint32_t mix_bits( uint32_t x )
+{
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+static uint32_t hash_combine( uint32_t seed, uint32_t value )
+{
+    return mix_bits( seed ^ ( value + 0x9e3779b9U + ( seed << 6 ) + ( seed >> 2 ) ) );
+}
+
+static real_t to_real( uint32_t bits )
+{
+    return ( bits >> 8 ) * ( 1.0f / 16777216.0f );
+}
+
+static uint32_t reverse_bits( uint32_t x )
+{
+    x = ( ( x >> 1 ) & 0x55555555U ) | ( ( x & 0x55555555U ) << 1 );
+    x = ( ( x >> 2 ) & 0x33333333U ) | ( ( x & 0x33333333U ) << 2 );
+    x = ( ( x >> 4 ) & 0x0f0f0f0fU ) | ( ( x & 0x0f0f0f0fU ) << 4 );
+    x = ( ( x >> 8 ) & 0x00ff00ffU ) | ( ( x & 0x00ff00ffU ) << 8 );
+    return ( x >> 16 ) | ( x << 16 );
+}
+
+// a random permutation of the bits of x where each bit only depends on the lower ones
+static uint32_t laine_karras_permutation( uint32_t x, uint32_t seed )
+{
+    x += seed;
+    x ^= x * 0x6c50b47cU;
+    x ^= x * 0xb82f1e52U;
+    x ^= x * 0xc7afe638U;
+    x ^= x * 0x8d22f6e6U;
+    return x;
+}
+
+// Owen scrambling, where each bit only depends on the higher ones
+static uint32_t nested_uniform_scramble( uint32_t x, uint32_t seed )
+{
+    return reverse_bits( laine_karras_permutation( reverse_bits( x ), seed ) );
+}
+
+// the first dimension of the Sobol sequence, the base 2 radical inverse
+static uint32_t sobol_dimension_0( uint32_t index )
+{
+    return reverse_bits( index );
+}
+
+// the second dimension of the Sobol sequence, from the polynomial x + 1
+static uint32_t sobol_dimension_1( uint32_t index )
+{
+    uint32_t result = 0;
+    for ( uint32_t v = 1U << 31; index; index >>= 1, v ^= v >> 1 ) {
+        if ( index & 1 )
+            result ^= v;
+    }
+    return result;
+}
+
+Vector2 sample_02_sequence( uint32_t index, uint32_t seed )
+{
+    uint32_t x = nested_uniform_scramble( sobol_dimension_0( index ), hash_combine( seed, 0 ) );
+    uint32_t y = nested_uniform_scramble( sobol_dimension_1( index ), hash_combine( seed, 1 ) );
+    return Vector2( to_real( x ), to_real( y ) );
+}
+
+Sampler::~Sampler() { }
+
+Sampler* Sampler::create( SamplerType type, uint32_t seed )
+{
+    switch ( type ) {
+    case SAMPLER_RANDOM:
+        return new RandomSampler( seed );
+    case SAMPLER_HALTON:
+        return new HaltonSampler( seed );
+    case SAMPLER_SOBOL:
+    default:
+        return new SobolSampler( seed );
+    }
+}
+
+bool Sampler::parse_type( const char* name, SamplerType* type )
+{
+    if ( 0 == strcmp( name, "random" ) ) {
+        *type = SAMPLER_RANDOM;
+    } else if ( 0 == strcmp( name, "halton" ) ) {
+        *type = SAMPLER_HALTON;
+    } else if ( 0 == strcmp( name, "sobol" ) ) {
+        *type = SAMPLER_SOBOL;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+RandomSampler::RandomSampler( uint32_t seed ) : m_seed( seed ), m_rng( 0, 0 ) { }
+
+void RandomSampler::start_sample( uint32_t pixel, uint32_t index )
+{
+    m_rng = Pcg32( pixel ^ ( static_cast< uint64_t >( m_seed ) << 32 ), index );
+}
+
+real_t RandomSampler::next_1d()
+{
+    return m_rng.next_real();
+}
+
+Vector2 RandomSampler::next_2d()
+{
+    real_t x = m_rng.next_real();
+    real_t y = m_rng.next_real();
+    return Vector2( x, y );
+}
+
+HaltonSampler::HaltonSampler( uint32_t seed )
+    : m_seed( seed ), m_pixel_seed( 0 ), m_index( 0 ), m_dimension( 0 ), m_rng( 0, 0 ) { }
+
+void HaltonSampler::start_sample( uint32_t pixel, uint32_t index )
+{
+    m_pixel_seed = hash_combine( m_seed, pixel );
+    m_index = index;
+    m_dimension = 0;
+    m_rng = Pcg32( pixel ^ ( static_cast< uint64_t >( m_seed ) << 32 ), index );
+}
+
+real_t HaltonSampler::next_1d()
+{
+    uint32_t dimension = m_dimension++;
+    if ( dimension >= NUM_PRIMES )
+        return m_rng.next_real();
+
+    // radical inverse, with every digit shifted by its own random amount;
+    // the digits past the last nonzero one are shifted too, down to the
+    // precision of a float
+    uint32_t base = PRIMES[dimension];
+    uint32_t dimension_seed = hash_combine( m_pixel_seed, dimension );
+    real_t inv_base = 1.0f / base;
+    real_t factor = inv_base;
+    real_t value = 0;
+    uint32_t index = m_index;
+    for ( uint32_t digit_position = 0; factor > 1e-7f; ++digit_position ) {
+        uint32_t digit = index % base;
+        index /= base;
+        uint32_t shift = hash_combine( dimension_seed, digit_position ) % base;
+        value += ( ( digit + shift ) % base ) * factor;
+        factor *= inv_base;
+    }
+    return std::min( value, ONE_MINUS_EPSILON );
+}
+
+Vector2 HaltonSampler::next_2d()
+{
+    real_t x = next_1d();
+    real_t y = next_1d();
+    return Vector2( x, y );
+}
+
+SobolSampler::SobolSampler( uint32_t seed )
+    : m_seed( seed ), m_pixel_seed( 0 ), m_index( 0 ), m_dimension( 0 ) { }
+
+void SobolSampler::start_sample( uint32_t pixel, uint32_t index )
+{
+    m_pixel_seed = hash_combine( m_seed, pixel );
+    m_index = index;
+    m_dimension = 0;
+}
+
+real_t SobolSampler::next_1d()
+{
+    uint32_t seed = hash_combine( m_pixel_seed, m_dimension++ );
+    uint32_t index = nested_uniform_scramble( m_index, seed );
+    return to_real( nested_uniform_scramble( sobol_dimension_0( index ), mix_bits( seed ) ) );
+}
+
+Vector2 SobolSampler::next_2d()
+{
+    uint32_t seed = hash_combine( m_pixel_seed, m_dimension++ );
+    return sample_02_sequence( nested_uniform_scramble( m_index, seed ), seed );
+}
+
+} /* Luc */
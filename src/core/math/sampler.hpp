@@ -0,0 +1,173 @@
+/**
+ * @file sampler.hpp
+ * @brief Random and low-discrepancy sample sequences for Monte Carlo rendering.
+ */
+
+#ifndef _LUC_MATH_SAMPLER_HPP_
+#define _LUC_MATH_SAMPLER_HPP_
+
+#include "math/vector.hpp"
+
+namespace Luc {
+
+/*
+ * PCG32 random number generator (O'Neill). Cheap to seed, so every pixel of
+ * every pass can get its own stream, which keeps an image independent of
+ * the thread that traced it.
+ */
+struct Pcg32
+{
+    uint64_t state;
+    uint64_t increment;
+
+    Pcg32( uint64_t seed, uint64_t stream )
+        : state( 0 ), increment( ( stream << 1 ) | 1 )
+    {
+        next();
+        state += seed;
+        next();
+    }
+
+    uint32_t next()
+    {
+        uint64_t old = state;
+        state = old * 6364136223846793005ULL + increment;
+        uint32_t shifted = static_cast< uint32_t >( ( ( old >> 18 ) ^ old ) >> 27 );
+        uint32_t rotation = static_cast< uint32_t >( old >> 59 );
+        return ( shifted >> rotation ) | ( shifted << ( ( 32 - rotation ) & 31 ) );
+    }
+
+    /// Uniform number in [0, 1).
+    real_t next_real()
+    {
+        return ( next() >> 8 ) * ( 1.0f / 16777216.0f );
+    }
+};
+
+enum SamplerType
+{
+    // independent PCG32 numbers, for comparison
+    SAMPLER_RANDOM,
+    // Halton sequence with per pixel random digit scrambling
+    SAMPLER_HALTON,
+    // Owen scrambled Sobol (0,2)-sequence, shuffled per pair of dimensions
+    SAMPLER_SOBOL
+};
+
+/*
+ * Point 'index' of the Sobol (0,2)-sequence, Owen scrambled by a seed. Any
+ * prefix of a power of two length is stratified in both dimensions, so a
+ * set of points can be drawn a batch at a time.
+ */
+Vector2 sample_02_sequence( uint32_t index, uint32_t seed );
+
+/*
+ * The values of one sample vector of a pixel, consumed one dimension after
+ * the other. A tracer that asks for the dimensions in the same order at
+ * every sample gets values stratified over the samples of a pixel, so its
+ * estimates converge faster than with independent random numbers.
+ *
+ * A sample is fully determined by its pixel and index, not by the samples
+ * drawn before it. A sampler holds the state of its current sample, so
+ * every tracing thread needs one of its own.
+ */
+class Sampler
+{
+public:
+
+    virtual ~Sampler();
+
+    /// Starts a sample vector of a pixel, rewinding to its first dimension.
+    virtual void start_sample( uint32_t pixel, uint32_t index ) = 0;
+
+    /// The next dimension of the sample, in [0, 1).
+    virtual real_t next_1d() = 0;
+
+    /// The next two dimensions of the sample, stratified together.
+    virtual Vector2 next_2d() = 0;
+
+    /// Name of the sampler, for statistics.
+    virtual const char* get_name() const = 0;
+
+    /// Creates a sampler of a type, with a seed that decorrelates renders.
+    static Sampler* create( SamplerType type, uint32_t seed = 0 );
+
+    /// Parses "random", "halton" or "sobol".
+    static bool parse_type( const char* name, SamplerType* type );
+};
+
+/*
+ * Independent random numbers from a PCG32 stream per sample.
+ */
+class RandomSampler : public Sampler
+{
+public:
+
+    explicit RandomSampler( uint32_t seed );
+
+    virtual void start_sample( uint32_t pixel, uint32_t index );
+    virtual real_t next_1d();
+    virtual Vector2 next_2d();
+    virtual const char* get_name() const { return "random"; }
+
+private:
+
+    uint32_t m_seed;
+    Pcg32    m_rng;
+};
+
+/*
+ * The Halton sequence, the radical inverse of the sample index in the n-th
+ * prime base for dimension n. The digits are shifted by random amounts per
+ * pixel and dimension, which breaks up the correlation of the higher
+ * dimensions. Past the last tabulated prime, dimensions are random.
+ */
+class HaltonSampler : public Sampler
+{
+public:
+
+    explicit HaltonSampler( uint32_t seed );
+
+    virtual void start_sample( uint32_t pixel, uint32_t index );
+    virtual real_t next_1d();
+    virtual Vector2 next_2d();
+    virtual const char* get_name() const { return "halton"; }
+
+private:
+
+    uint32_t m_seed;
+    uint32_t m_pixel_seed;
+    uint32_t m_index;
+    uint32_t m_dimension;
+    Pcg32    m_rng;
+};
+
+/*
+ * The first two dimensions of the Sobol sequence, reused for every pair of
+ * dimensions with the sample index shuffled and the values Owen scrambled
+ * by hashes of the pixel and dimension (Burley, "Practical Hash-based Owen
+ * Scrambling"). Every 2D projection keeps its stratification, and there is
+ * no limit on the number of dimensions.
+ */
+class SobolSampler : public Sampler
+{
+public:
+
+    explicit SobolSampler( uint32_t seed );
+
+    virtual void start_sample( uint32_t pixel, uint32_t index );
+    virtual real_t next_1d();
+    virtual Vector2 next_2d();
+    virtual const char* get_name() const { return "sobol"; }
+
+private:
+
+    uint32_t m_seed;
+    uint32_t m_pixel_seed;
+    uint32_t m_index;
+    uint32_t m_dimension;
+};
+
+} /* Luc */
+
+#endif /* _LUC_MATH_SAMPLER_HPP_ */
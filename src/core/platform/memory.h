@@ -0,0 +1,15 @@
+#ifndef CORE_PLATFORM_MEMORY_H
+#define CORE_PLATFORM_MEMORY_H
+
+namespace Luc
+{
+    //!
+    //! Memory the process has resident, as the system counts it.
+    //! @param[out] current         Bytes resident now.
+    //! @param[out] peak            Most bytes resident at once so far.
+    //! @return                     false if the system does not tell.
+    //!
+    bool GetMemoryUsage(size_t* current, size_t* peak);
+}
+
+#endif // CORE_PLATFORM_MEMORY_H
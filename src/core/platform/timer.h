@@ -0,0 +1,14 @@
+#ifndef CORE_PLATFORM_TIMER_H
+#define CORE_PLATFORM_TIMER_H
+
+namespace Luc
+{
+    //!
+    //! Time of a monotonic, high resolution clock, for timing short spans
+    //! such as a single pixel. Only differences of it mean anything.
+    //! @return                     Nanoseconds since an arbitrary start.
+    //!
+    uint64_t GetTimeNanoseconds();
+}
+
+#endif // CORE_PLATFORM_TIMER_H
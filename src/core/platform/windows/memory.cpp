@@ -0,0 +1,19 @@
+#include "lucPCH.h"
+#include "platform/memory.h"
+#include <windows.h>
+#include <psapi.h>
+
+namespace Luc {
+
+bool GetMemoryUsage(size_t* current, size_t* peak)
+{
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!::GetProcessMemoryInfo(::GetCurrentProcess(), &counters, sizeof(counters)))
+        return false;
+
+    *current = counters.WorkingSetSize;
+    *peak = counters.PeakWorkingSetSize;
+    return true;
+}
+
+}
@@ -0,0 +1,23 @@
+#include "lucPCH.h"
+#include "platform/timer.h"
+#include <windows.h>
+
+namespace Luc {
+
+uint64_t GetTimeNanoseconds()
+{
+    // the frequency is fixed at boot, so it is read once
+    static LARGE_INTEGER frequency = { 0 };
+    if (0 == frequency.QuadPart)
+        ::QueryPerformanceFrequency(&frequency);
+
+    LARGE_INTEGER counter;
+    ::QueryPerformanceCounter(&counter);
+
+    // whole seconds and the rest apart, so the product does not overflow
+    uint64_t ticks = static_cast<uint64_t>(counter.QuadPart);
+    uint64_t rate = static_cast<uint64_t>(frequency.QuadPart);
+    return ticks / rate * 1000000000 + ticks % rate * 1000000000 / rate;
+}
+
+}
@@ -0,0 +1,75 @@
+/**
+ * @file acceleration.cpp
+ * @brief Interface of the spatial structures used to find ray hits in a scene.
+ */
+#include "lucPCH.h"
+#include "scene/acceleration.hpp"
+#include "scene/scene_bvh.hpp"
+#include "scene/uniform_grid.hpp"
+#include "scene/scene.hpp"
+
+#include <cstring>
+
+namespace Luc {
+
+AccelerationSettings::AccelerationSettings()
+    : type( ACCELERATION_BVH ), grid_density( 4 ) { }
+
+Acceleration::~Acceleration() { }
+
+Acceleration* Acceleration::create( const AccelerationSettings& settings )
+{
+    switch ( settings.type )
+    {
+    case ACCELERATION_LIST:
+        return new GeometryList();
+    case ACCELERATION_GRID:
+        return new UniformGrid( settings.grid_density );
+    case ACCELERATION_BVH:
+    default:
+        return new SceneBvh();
+    }
+}
+
+bool Acceleration::parse_type( const char* name, AccelerationType* type )
+{
+    if ( 0 == strcmp( name, "list" ) ) {
+        *type = ACCELERATION_LIST;
+    } else if ( 0 == strcmp( name, "bvh" ) ) {
+        *type = ACCELERATION_BVH;
+    } else if ( 0 == strcmp( name, "grid" ) ) {
+        *type = ACCELERATION_GRID;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+GeometryList::GeometryList() { }
+
+GeometryList::~GeometryList() { }
+
+void GeometryList::build( Geometry* const* geometries, size_t count )
+{
+    m_geometries.assign( geometries, geometries + count );
+}
+
+bool GeometryList::intersect( const Ray& ray, real_t tMin, real_t tMax,
+                              real_t& t, HitVertexInfor& hit_vertex ) const
+{
+    bool hit = false;
+    for ( size_t i = 0; i < m_geometries.size(); ++i ) {
+        float cur_t;
+        HitVertexInfor cur_hit_vertex;
+        // shrink the range to the closest hit so far
+        if ( m_geometries[i]->ray_casting( ray, tMin, tMax, cur_t, cur_hit_vertex ) && cur_t < tMax ) {
+            tMax = cur_t;
+            t = cur_t;
+            hit_vertex = cur_hit_vertex;
+            hit = true;
+        }
+    }
+    return hit;
+}
+
+} /* Luc */
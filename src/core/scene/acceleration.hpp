@@ -0,0 +1,96 @@
+/**
+ * @file acceleration.hpp
+ * @brief Interface of the spatial structures used to find ray hits in a scene.
+ */
+
+#ifndef _LUC_SCENE_ACCELERATION_HPP_
+#define _LUC_SCENE_ACCELERATION_HPP_
+
+#include "math/ray.hpp"
+
+namespace Luc {
+
+class Geometry;
+struct HitVertexInfor;
+
+enum AccelerationType
+{
+    // test every geometry, for debugging and comparison
+    ACCELERATION_LIST,
+    // bounding volume hierarchy over the geometries
+    ACCELERATION_BVH,
+    // uniform grid traversed with a 3D-DDA
+    ACCELERATION_GRID
+};
+
+/*
+ * Per scene choice of acceleration structure, read from the scene file.
+ */
+struct AccelerationSettings
+{
+    AccelerationSettings();
+
+    AccelerationType type;
+    // grid cells per geometry, the grid resolution grows with its cube root
+    real_t grid_density;
+};
+
+/*
+ * A spatial structure over the geometries of a scene that finds the closest
+ * geometry hit by a ray. The geometries must have built their
+ * transformation matrices before build is called.
+ */
+class Acceleration
+{
+public:
+
+    virtual ~Acceleration();
+
+    /*
+     * Builds the structure over the geometries, replacing any previous build.
+     * The geometries must outlive the structure.
+     */
+    virtual void build( Geometry* const* geometries, size_t count ) = 0;
+
+    /*
+     * Finds the closest geometry hit by a ray between tMin and tMax.
+     * @param t[out]            Distance of the hit along the ray.
+     * @param hit_vertex[out]   Information of the hit point.
+     * @return true if any geometry is hit.
+     */
+    virtual bool intersect( const Ray& ray, real_t tMin, real_t tMax,
+                            real_t& t, HitVertexInfor& hit_vertex ) const = 0;
+
+    /// Name of the structure, for statistics.
+    virtual const char* get_name() const = 0;
+
+    /// Creates the structure chosen by the settings.
+    static Acceleration* create( const AccelerationSettings& settings );
+
+    /// Parses "list", "bvh" or "grid".
+    static bool parse_type( const char* name, AccelerationType* type );
+};
+
+/*
+ * Tests every geometry against every ray.
+ */
+class GeometryList : public Acceleration
+{
+public:
+
+    GeometryList();
+    virtual ~GeometryList();
+
+    virtual void build( Geometry* const* geometries, size_t count );
+    virtual bool intersect( const Ray& ray, real_t tMin, real_t tMax,
+                            real_t& t, HitVertexInfor& hit_vertex ) const;
+    virtual const char* get_name() const { return "list"; }
+
+private:
+
+    std::vector< Geometry* > m_geometries;
+};
+
+} /* Luc */
+
+#endif /* _LUC_SCENE_ACCELERATION_HPP_ */
@@ -45,6 +45,36 @@ public:
         right_top_back_vertex    = vmax(right_top_back_vertex   , vertex);
     }
 
+    /*
+     * enlarge this bounding box so that it also contains another box.
+     * \@param box A bounding box which need to be filtered.
+     */
+    void merge(const BoundingBox& box)
+    {
+        left_bottom_front_vertex = vmin(left_bottom_front_vertex, box.left_bottom_front_vertex);
+        right_top_back_vertex    = vmax(right_top_back_vertex   , box.right_top_back_vertex);
+    }
+
+    /*
+     * center of this bounding box.
+     */
+    Vector3 get_center() const
+    {
+        return (left_bottom_front_vertex + right_top_back_vertex) * 0.5f;
+    }
+
+    /*
+     * surface area of this bounding box, used by the SAH cost of the BVH
+     * builder. An empty box has zero area.
+     */
+    float surface_area() const
+    {
+        Vector3 extent = right_top_back_vertex - left_bottom_front_vertex;
+        if (extent.x < 0 || extent.y < 0 || extent.z < 0)
+            return 0;
+        return 2 * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+    }
+
     /*
      * Get eight corner vertices of this bounding box
      */
@@ -62,7 +92,7 @@ public:
                         left_bottom_front_vertex.z );
     }
 
-    Vector3 get_left_bottom_front_corner()
+    Vector3 get_left_bottom_front_corner() const
     {
         return left_bottom_front_vertex;
     }
@@ -81,7 +111,7 @@ public:
                         right_top_back_vertex.z );
     }
 
-    Vector3 get_right_top_back_corner()
+    Vector3 get_right_top_back_corner() const
     {
         return right_top_back_vertex;
     }
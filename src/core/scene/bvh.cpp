@@ -0,0 +1,269 @@
+/**
+ * @file bvh.cpp
+ * @brief Bounding volume hierarchy over an array of primitive bounding boxes.
+ */
+#include "lucPCH.h"
+#include "scene/bvh.hpp"
+
+#include <algorithm>
+#include <float.h>
+
+namespace Luc {
+
+// the largest primitive count a leaf can hold, see BvhNode::count
+static const size_t MAX_LEAF_COUNT = 0xFFFF;
+// the most buckets the binned SAH may use
+static const size_t MAX_BINS = 64;
+// below this depth switch from SAH to median splits, which are balanced
+// and so cannot overflow the traversal stack
+static const size_t MEDIAN_SPLIT_DEPTH = Bvh::STACK_SIZE - 32;
+
+BvhBuildSettings::BvhBuildSettings()
+    : max_leaf_size( 4 ), num_bins( 16 ), traversal_cost( 1.0f ) { }
+
+namespace {
+
+struct BuildContext
+{
+    const BoundingBox*      prim_bounds;
+    std::vector< Vector3 >  centroids;
+    std::vector< uint32_t >* indices;
+    std::vector< BvhNode >* nodes;
+    BvhBuildSettings        settings;
+};
+
+// maps a centroid to its SAH bucket
+struct BinMapping
+{
+    size_t axis;
+    float  min;
+    float  scale;
+    size_t num_bins;
+
+    size_t operator()( const Vector3& centroid ) const
+    {
+        size_t bin = static_cast< size_t >( ( centroid[axis] - min ) * scale );
+        return bin < num_bins ? bin : num_bins - 1;
+    }
+};
+
+struct IsLeftOfSplit
+{
+    const Vector3* centroids;
+    BinMapping     mapping;
+    size_t         split_bin;
+
+    bool operator()( uint32_t prim ) const
+    {
+        return mapping( centroids[prim] ) <= split_bin;
+    }
+};
+
+struct CentroidLess
+{
+    const Vector3* centroids;
+    size_t         axis;
+
+    bool operator()( uint32_t lhs, uint32_t rhs ) const
+    {
+        return centroids[lhs][axis] < centroids[rhs][axis];
+    }
+};
+
+void set_node_bounds( BvhNode& node, const BoundingBox& box )
+{
+    Vector3 min = box.get_left_bottom_front_corner();
+    Vector3 max = box.get_right_top_back_corner();
+    for ( size_t i = 0; i < 3; ++i ) {
+        node.bounds_min[i] = min[i];
+        node.bounds_max[i] = max[i];
+    }
+}
+
+uint32_t make_leaf( BuildContext& ctx, uint32_t node_index, size_t begin, size_t end )
+{
+    BvhNode& node = ( *ctx.nodes )[node_index];
+    node.offset = static_cast< uint32_t >( begin );
+    node.count  = static_cast< uint16_t >( end - begin );
+    node.axis   = 0;
+    return node_index;
+}
+
+uint32_t build_recursive( BuildContext& ctx, size_t begin, size_t end, size_t depth )
+{
+    std::vector< uint32_t >& indices = *ctx.indices;
+    const BvhBuildSettings& settings = ctx.settings;
+
+    uint32_t node_index = static_cast< uint32_t >( ctx.nodes->size() );
+    ctx.nodes->push_back( BvhNode() );
+
+    BoundingBox bounds;
+    BoundingBox centroid_bounds;
+    for ( size_t i = begin; i < end; ++i ) {
+        bounds.merge( ctx.prim_bounds[indices[i]] );
+        centroid_bounds.filter_vertex( ctx.centroids[indices[i]] );
+    }
+    set_node_bounds( ( *ctx.nodes )[node_index], bounds );
+
+    size_t count = end - begin;
+    if ( count <= settings.max_leaf_size )
+        return make_leaf( ctx, node_index, begin, end );
+
+    // split along the axis of the largest centroid extent
+    Vector3 cmin = centroid_bounds.get_left_bottom_front_corner();
+    Vector3 extent = centroid_bounds.get_right_top_back_corner() - cmin;
+    size_t axis = 0;
+    if ( extent.y > extent[axis] ) axis = 1;
+    if ( extent.z > extent[axis] ) axis = 2;
+
+    size_t mid = begin;
+    if ( extent[axis] <= 0 ) {
+        // all centroids coincide, no split can separate them
+        if ( count <= MAX_LEAF_COUNT )
+            return make_leaf( ctx, node_index, begin, end );
+        mid = begin + count / 2;
+    } else if ( depth >= MEDIAN_SPLIT_DEPTH ) {
+        mid = begin + count / 2;
+        CentroidLess less = { &ctx.centroids[0], axis };
+        std::nth_element( indices.begin() + begin, indices.begin() + mid,
+                          indices.begin() + end, less );
+    } else {
+        // binned SAH
+        size_t num_bins = std::min< size_t >( std::max< size_t >( settings.num_bins, 2 ), MAX_BINS );
+        BinMapping mapping = { axis, cmin[axis], num_bins / extent[axis], num_bins };
+
+        BoundingBox bin_bounds[MAX_BINS];
+        size_t bin_count[MAX_BINS] = { 0 };
+        for ( size_t i = begin; i < end; ++i ) {
+            size_t bin = mapping( ctx.centroids[indices[i]] );
+            bin_bounds[bin].merge( ctx.prim_bounds[indices[i]] );
+            bin_count[bin]++;
+        }
+
+        // sweep from the right to get the cost of every right side
+        float right_area[MAX_BINS];
+        size_t right_count[MAX_BINS];
+        BoundingBox right_bounds;
+        size_t right_total = 0;
+        for ( size_t i = num_bins - 1; i > 0; --i ) {
+            right_bounds.merge( bin_bounds[i] );
+            right_total += bin_count[i];
+            right_area[i] = right_bounds.surface_area();
+            right_count[i] = right_total;
+        }
+
+        // sweep from the left and keep the cheapest split
+        float parent_area = bounds.surface_area();
+        float best_cost = FLT_MAX;
+        size_t best_split = 0;
+        BoundingBox left_bounds;
+        size_t left_total = 0;
+        for ( size_t i = 0; i < num_bins - 1; ++i ) {
+            left_bounds.merge( bin_bounds[i] );
+            left_total += bin_count[i];
+            if ( 0 == left_total || 0 == right_count[i + 1] )
+                continue;
+            float cost = left_bounds.surface_area() * left_total +
+                         right_area[i + 1] * right_count[i + 1];
+            if ( cost < best_cost ) {
+                best_cost = cost;
+                best_split = i;
+            }
+        }
+        best_cost = parent_area > 0 ? settings.traversal_cost + best_cost / parent_area
+                                    : FLT_MAX;
+
+        // a leaf is cheaper than any split
+        if ( best_cost >= count && count <= MAX_LEAF_COUNT )
+            return make_leaf( ctx, node_index, begin, end );
+
+        IsLeftOfSplit is_left = { &ctx.centroids[0], mapping, best_split };
+        mid = std::partition( indices.begin() + begin, indices.begin() + end, is_left ) -
+              indices.begin();
+        if ( mid == begin || mid == end ) {
+            mid = begin + count / 2;
+            CentroidLess less = { &ctx.centroids[0], axis };
+            std::nth_element( indices.begin() + begin, indices.begin() + mid,
+                              indices.begin() + end, less );
+        }
+    }
+
+    build_recursive( ctx, begin, mid, depth + 1 );
+    uint32_t second_child = build_recursive( ctx, mid, end, depth + 1 );
+
+    BvhNode& node = ( *ctx.nodes )[node_index];
+    node.offset = second_child;
+    node.count  = 0;
+    node.axis   = static_cast< uint16_t >( axis );
+    return node_index;
+}
+
+} // namespace
+
+Bvh::Bvh()
+    : m_nodes( 0 ), m_num_nodes( 0 ), m_indices( 0 ), m_num_indices( 0 ) { }
+
+Bvh::~Bvh() { }
+
+void Bvh::clear()
+{
+    m_node_list.clear();
+    m_index_list.clear();
+    m_external_storage.reset();
+    m_nodes = 0;
+    m_num_nodes = 0;
+    m_indices = 0;
+    m_num_indices = 0;
+}
+
+void Bvh::build( const BoundingBox* prim_bounds, size_t count, const BvhBuildSettings& settings )
+{
+    clear();
+    if ( 0 == count )
+        return;
+
+    BuildContext ctx;
+    ctx.prim_bounds = prim_bounds;
+    ctx.indices = &m_index_list;
+    ctx.nodes = &m_node_list;
+    ctx.settings = settings;
+
+    ctx.centroids.resize( count );
+    m_index_list.resize( count );
+    for ( size_t i = 0; i < count; ++i ) {
+        ctx.centroids[i] = prim_bounds[i].get_center();
+        m_index_list[i] = static_cast< uint32_t >( i );
+    }
+
+    m_node_list.reserve( 2 * count / std::max< size_t >( settings.max_leaf_size, 1 ) + 1 );
+    build_recursive( ctx, 0, count, 0 );
+
+    m_nodes = &m_node_list[0];
+    m_num_nodes = m_node_list.size();
+    m_indices = &m_index_list[0];
+    m_num_indices = m_index_list.size();
+}
+
+void Bvh::set_external( const BvhNode* nodes, size_t num_nodes,
+                        const uint32_t* indices, size_t num_indices,
+                        boost::shared_ptr<void> storage )
+{
+    clear();
+    m_external_storage = storage;
+    m_nodes = nodes;
+    m_num_nodes = num_nodes;
+    m_indices = indices;
+    m_num_indices = num_indices;
+}
+
+BoundingBox Bvh::get_bounds() const
+{
+    BoundingBox box;
+    if ( !empty() ) {
+        box.filter_vertex( Vector3( m_nodes[0].bounds_min ) );
+        box.filter_vertex( Vector3( m_nodes[0].bounds_max ) );
+    }
+    return box;
+}
+
+} /* Luc */
@@ -0,0 +1,231 @@
+/**
+ * @file bvh.hpp
+ * @brief Bounding volume hierarchy over an array of primitive bounding boxes.
+ */
+
+#ifndef _LUC_SCENE_BVH_HPP_
+#define _LUC_SCENE_BVH_HPP_
+
+#include "math/ray.hpp"
+#include "scene/bounding_box.hpp"
+#include "scene/trace_counters.hpp"
+
+#include <vector>
+
+namespace Luc {
+
+/*
+ * A node of the hierarchy. The layout is plain old data of 32 bytes so that
+ * an array of nodes can be written to disk and memory-mapped back as is.
+ *
+ * Nodes are stored depth first: the first child of an interior node is the
+ * node right after it, the second child is at 'offset'. A leaf references
+ * 'count' entries of the primitive index array, starting at 'offset'.
+ */
+struct BvhNode
+{
+    float    bounds_min[3];
+    float    bounds_max[3];
+    uint32_t offset;
+    uint16_t count;     // 0 for interior nodes
+    uint16_t axis;      // split axis of interior nodes
+};
+
+/*
+ * Settings of the builder. They are part of the cache key of a hierarchy,
+ * so every field must be a plain number.
+ */
+struct BvhBuildSettings
+{
+    BvhBuildSettings();
+
+    // never split a node holding fewer primitives than this
+    uint32_t max_leaf_size;
+    // number of buckets of the binned SAH
+    uint32_t num_bins;
+    // SAH cost of visiting one interior node, relative to one primitive test
+    float    traversal_cost;
+};
+
+/*
+ * A bounding volume hierarchy. It only knows primitive bounds and indices;
+ * the caller supplies the primitive intersection test during traversal.
+ *
+ * The arrays are either owned by the hierarchy (after build) or borrowed
+ * from external storage such as a memory-mapped cache file (after
+ * set_external), in which case 'storage' keeps that storage alive.
+ */
+class Bvh
+{
+public:
+
+    // maximum depth of the traversal stack
+    static const size_t STACK_SIZE = 64;
+
+    Bvh();
+    ~Bvh();
+
+    /*
+     * Builds the hierarchy with the binned surface area heuristic.
+     * @param prim_bounds   Bounding box of each primitive.
+     * @param count         Number of primitives.
+     * @param settings      Builder settings.
+     */
+    void build(const BoundingBox* prim_bounds, size_t count, const BvhBuildSettings& settings);
+
+    /*
+     * Uses node and index arrays which live outside the hierarchy.
+     * @param storage   Owner of the arrays, released with the hierarchy.
+     */
+    void set_external(const BvhNode* nodes, size_t num_nodes,
+                      const uint32_t* indices, size_t num_indices,
+                      boost::shared_ptr<void> storage);
+
+    /// Drops all nodes.
+    void clear();
+
+    bool empty() const { return 0 == m_num_nodes; }
+
+    const BvhNode*  get_nodes() const   { return m_nodes; }
+    size_t          num_nodes() const   { return m_num_nodes; }
+    const uint32_t* get_indices() const { return m_indices; }
+    size_t          num_indices() const { return m_num_indices; }
+
+    /// Bounding box of the root node.
+    BoundingBox get_bounds() const;
+
+    /*
+     * Finds the closest primitive hit by a ray.
+     *
+     * The intersector is called as
+     *     bool intersector(uint32_t primitive, real_t tMin, real_t& tMax)
+     * and must return true and shrink tMax to the hit distance if the
+     * primitive is hit closer than tMax.
+     *
+     * @return true if any primitive was hit.
+     */
+    template< typename Intersector >
+    bool intersect(const Ray& ray, real_t tMin, real_t tMax, Intersector& intersector) const;
+
+private:
+
+    const BvhNode*  m_nodes;
+    size_t          m_num_nodes;
+    const uint32_t* m_indices;
+    size_t          m_num_indices;
+
+    // storage used after build
+    std::vector< BvhNode >  m_node_list;
+    std::vector< uint32_t > m_index_list;
+
+    // storage used after set_external
+    boost::shared_ptr<void> m_external_storage;
+
+    // prevent copy/assignment
+    Bvh( const Bvh& );
+    Bvh& operator=( const Bvh& );
+};
+
+/*
+ * Traverses a hierarchy stored in any random access node and index storage,
+ * which lets hierarchies that are not resident in memory share the loop.
+ *
+ * 'nodes[i]' must yield the BvhNode at index i, and 'indices[i]' the
+ * primitive of entry i of the index array. See Bvh::intersect for the
+ * intersector.
+ */
+template< typename NodeArray, typename IndexArray, typename Intersector >
+bool traverse_bvh(const NodeArray& nodes, const IndexArray& indices,
+                  const Ray& ray, real_t tMin, real_t tMax, Intersector& intersector);
+
+// slab test of a ray against a node
+inline bool intersect_bvh_node(const BvhNode& node, const Vector3& origin,
+                               const Vector3& inv_dir, real_t tMin, real_t tMax)
+{
+    for (size_t axis = 0; axis < 3; ++axis)
+    {
+        real_t t0 = (node.bounds_min[axis] - origin[axis]) * inv_dir[axis];
+        real_t t1 = (node.bounds_max[axis] - origin[axis]) * inv_dir[axis];
+        if (t0 > t1)
+            std::swap(t0, t1);
+        tMin = t0 > tMin ? t0 : tMin;
+        tMax = t1 < tMax ? t1 : tMax;
+        if (tMin > tMax)
+            return false;
+    }
+    return true;
+}
+
+template< typename NodeArray, typename IndexArray, typename Intersector >
+bool traverse_bvh(const NodeArray& nodes, const IndexArray& indices,
+                  const Ray& ray, real_t tMin, real_t tMax, Intersector& intersector)
+{
+    Vector3 origin    = ray.Point();
+    Vector3 direction = ray.Direction();
+    Vector3 inv_dir(1 / direction.x, 1 / direction.y, 1 / direction.z);
+    bool dir_is_neg[3] = { inv_dir.x < 0, inv_dir.y < 0, inv_dir.z < 0 };
+
+    uint32_t stack[Bvh::STACK_SIZE];
+    size_t   stack_top = 0;
+    uint32_t current   = 0;
+    bool     hit       = false;
+    uint32_t tested    = 0;
+
+    while (true)
+    {
+        const BvhNode& node = nodes[current];
+        ++tested;
+        if (intersect_bvh_node(node, origin, inv_dir, tMin, tMax))
+        {
+            if (node.count > 0)
+            {
+                for (uint32_t i = 0; i < node.count; ++i)
+                {
+                    if (intersector(indices[node.offset + i], tMin, tMax))
+                        hit = true;
+                }
+                if (0 == stack_top)
+                    break;
+                current = stack[--stack_top];
+            }
+            else
+            {
+                // visit the near child first, so tMax shrinks early
+                assert(stack_top < Bvh::STACK_SIZE);
+                if (dir_is_neg[node.axis])
+                {
+                    stack[stack_top++] = current + 1;
+                    current = node.offset;
+                }
+                else
+                {
+                    stack[stack_top++] = node.offset;
+                    current = current + 1;
+                }
+            }
+        }
+        else
+        {
+            if (0 == stack_top)
+                break;
+            current = stack[--stack_top];
+        }
+    }
+
+    TraceCounters* counters = get_trace_counters();
+    if (counters)
+        counters->boxes += tested;
+    return hit;
+}
+
+template< typename Intersector >
+bool Bvh::intersect(const Ray& ray, real_t tMin, real_t tMax, Intersector& intersector) const
+{
+    if (empty())
+        return false;
+    return traverse_bvh(m_nodes, m_indices, ray, tMin, tMax, intersector);
+}
+
+} /* Luc */
+
+#endif /* _LUC_SCENE_BVH_HPP_ */
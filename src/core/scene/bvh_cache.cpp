@@ -0,0 +1,159 @@
+/**
+ * @file bvh_cache.cpp
+ * @brief Persistent on-disk cache of mesh hierarchies.
+ */
+#include "lucPCH.h"
+#include "scene/bvh_cache.hpp"
+#include "files/fileutils.h"
+#include "math/mathUtils.h"
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <cstdio>
+#include <iostream>
+
+namespace Luc {
+
+namespace bip = boost::interprocess;
+
+// bump whenever BvhNode or the builder changes in a way the settings do not show
+static const uint32_t BVH_CACHE_VERSION = 1;
+static const char BVH_CACHE_MAGIC[8] = { 'L', 'U', 'C', 'B', 'V', 'H', 0, 0 };
+
+/*
+ * Header of a cache file, followed by the node array and the index array.
+ * 64 bytes, so the node array that follows stays 32-byte aligned.
+ */
+struct BvhCacheHeader
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t node_size;
+    uint64_t key;
+    uint64_t num_nodes;
+    uint64_t num_indices;
+    uint8_t  reserved[24];
+};
+
+uint64_t hash_bvh_settings( const BvhBuildSettings& settings, uint64_t hash )
+{
+    hash = Math::FNV1aHash64( &BVH_CACHE_VERSION, sizeof BVH_CACHE_VERSION, hash );
+    hash = Math::FNV1aHash64( &settings.max_leaf_size, sizeof settings.max_leaf_size, hash );
+    hash = Math::FNV1aHash64( &settings.num_bins, sizeof settings.num_bins, hash );
+    hash = Math::FNV1aHash64( &settings.traversal_cost, sizeof settings.traversal_cost, hash );
+    return hash;
+}
+
+BvhCache::BvhCache()
+    : m_enabled( true ), m_hits( 0 ), m_misses( 0 ) { }
+
+BvhCache::~BvhCache() { }
+
+std::string BvhCache::get_cache_path( const std::string& source, uint64_t key ) const
+{
+    if ( m_directory.empty() )
+        return source + ".bvh";
+
+    char name[32];
+    sprintf( name, "%08x%08x.bvh", (unsigned int)( key >> 32 ), (unsigned int)( key & 0xFFFFFFFF ) );
+    return m_directory + "/" + name;
+}
+
+bool BvhCache::load( const std::string& source, uint64_t key, Bvh* bvh )
+{
+    assert( bvh );
+    if ( !m_enabled )
+        return false;
+
+    std::string path = get_cache_path( source, key );
+
+    // check for the file first, a missing file is the common miss
+    FILE* fp = fopen( path.c_str(), "rb" );
+    if ( !fp ) {
+        m_misses++;
+        return false;
+    }
+    fclose( fp );
+
+    try {
+        bip::file_mapping mapping( path.c_str(), bip::read_only );
+        boost::shared_ptr< bip::mapped_region > region(
+            new bip::mapped_region( mapping, bip::read_only ) );
+
+        const char* data = static_cast< const char* >( region->get_address() );
+        size_t size = region->get_size();
+
+        if ( size < sizeof( BvhCacheHeader ) ) {
+            m_misses++;
+            return false;
+        }
+
+        const BvhCacheHeader* header = reinterpret_cast< const BvhCacheHeader* >( data );
+        if ( 0 != memcmp( header->magic, BVH_CACHE_MAGIC, sizeof BVH_CACHE_MAGIC ) ||
+             header->version != BVH_CACHE_VERSION ||
+             header->node_size != sizeof( BvhNode ) ||
+             header->key != key ||
+             size != sizeof( BvhCacheHeader ) +
+                     header->num_nodes * sizeof( BvhNode ) +
+                     header->num_indices * sizeof( uint32_t ) ) {
+            std::cout << "Ignoring stale BVH cache file '" << path << "'.\n";
+            m_misses++;
+            return false;
+        }
+
+        const BvhNode* nodes = reinterpret_cast< const BvhNode* >( data + sizeof( BvhCacheHeader ) );
+        const uint32_t* indices = reinterpret_cast< const uint32_t* >( nodes + header->num_nodes );
+        bvh->set_external( nodes, static_cast< size_t >( header->num_nodes ),
+                           indices, static_cast< size_t >( header->num_indices ),
+                           region );
+    } catch ( bip::interprocess_exception const& e ) {
+        std::cout << "Error mapping BVH cache file '" << path << "': " << e.what() << "\n";
+        m_misses++;
+        return false;
+    }
+
+    m_hits++;
+    std::cout << "Mapped BVH of '" << source << "' from '" << path << "'.\n";
+    return true;
+}
+
+bool BvhCache::save( const std::string& source, uint64_t key, const Bvh& bvh )
+{
+    if ( !m_enabled || bvh.empty() )
+        return false;
+
+    std::string path = get_cache_path( source, key );
+    std::string tmp_path = path + ".tmp";
+
+    FILE* fp = fopen( tmp_path.c_str(), "wb" );
+    if ( !fp ) {
+        std::cout << "Cannot write BVH cache file '" << tmp_path << "'.\n";
+        return false;
+    }
+
+    BvhCacheHeader header;
+    memset( &header, 0, sizeof header );
+    memcpy( header.magic, BVH_CACHE_MAGIC, sizeof BVH_CACHE_MAGIC );
+    header.version = BVH_CACHE_VERSION;
+    header.node_size = sizeof( BvhNode );
+    header.key = key;
+    header.num_nodes = bvh.num_nodes();
+    header.num_indices = bvh.num_indices();
+
+    bool ok = fwrite( &header, sizeof header, 1, fp ) == 1 &&
+              fwrite( bvh.get_nodes(), sizeof( BvhNode ), bvh.num_nodes(), fp ) == bvh.num_nodes() &&
+              fwrite( bvh.get_indices(), sizeof( uint32_t ), bvh.num_indices(), fp ) == bvh.num_indices();
+    ok = ( 0 == fclose( fp ) ) && ok;
+
+    ok = ok && ReplaceExistingFile( tmp_path, path );
+    if ( !ok ) {
+        std::cout << "Error writing BVH cache file '" << path << "'.\n";
+        remove( tmp_path.c_str() );
+        return false;
+    }
+
+    std::cout << "Saved BVH of '" << source << "' to '" << path << "'.\n";
+    return true;
+}
+
+} /* Luc */
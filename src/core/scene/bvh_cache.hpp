@@ -0,0 +1,75 @@
+/**
+ * @file bvh_cache.hpp
+ * @brief Persistent on-disk cache of mesh hierarchies.
+ */
+
+#ifndef _LUC_SCENE_BVH_CACHE_HPP_
+#define _LUC_SCENE_BVH_CACHE_HPP_
+
+#include "scene/bvh.hpp"
+
+namespace Luc {
+
+/*
+ * Stores built hierarchies on disk, keyed by a content hash of the geometry
+ * they were built from and the builder settings, and memory-maps them back
+ * on the next load instead of rebuilding.
+ *
+ * A cache file lives next to its source file ("models/cube.obj.bvh") unless
+ * a cache directory is set, in which case it is named after the key
+ * ("<directory>/0123456789abcdef.bvh"). A file whose header does not match
+ * the expected key is ignored and overwritten.
+ */
+class BvhCache
+{
+public:
+
+    BvhCache();
+    ~BvhCache();
+
+    void set_enabled( bool enabled )    { m_enabled = enabled; }
+    bool is_enabled() const             { return m_enabled; }
+
+    /// Empty directory means store cache files next to their source.
+    void set_directory( const std::string& directory ) { m_directory = directory; }
+    const std::string& get_directory() const { return m_directory; }
+
+    /*
+     * Maps the cached hierarchy of a source file.
+     * @param source    File the geometry was loaded from.
+     * @param key       Content hash, see hash_bvh_settings.
+     * @param bvh[out]  Receives the mapped nodes and indices on success.
+     * @return true on a cache hit.
+     */
+    bool load( const std::string& source, uint64_t key, Bvh* bvh );
+
+    /*
+     * Writes a hierarchy to the cache.
+     * @return true on success.
+     */
+    bool save( const std::string& source, uint64_t key, const Bvh& bvh );
+
+    size_t num_hits() const     { return m_hits; }
+    size_t num_misses() const   { return m_misses; }
+
+private:
+
+    std::string get_cache_path( const std::string& source, uint64_t key ) const;
+
+    bool        m_enabled;
+    std::string m_directory;
+    size_t      m_hits;
+    size_t      m_misses;
+};
+
+typedef Loki::SingletonHolder<BvhCache> BvhCacheSingleton;
+
+/*
+ * Folds the builder settings and the cache format version into a content
+ * hash, so a change of either invalidates existing cache files.
+ */
+uint64_t hash_bvh_settings( const BvhBuildSettings& settings, uint64_t hash );
+
+} /* Luc */
+
+#endif /* _LUC_SCENE_BVH_CACHE_HPP_ */
@@ -31,6 +31,7 @@
 #include <iostream>
 #include <png.h>
 #include <cassert>
+#include <vector>
 
 namespace Luc {
 
@@ -198,6 +199,58 @@ static bool _save_image_RGBA_png(const char *fileName, unsigned char *buffer,
     return true;
 }
 
+// Appends what libpng writes to the vector of the io pointer.
+static void _write_png_to_vector(png_structp png_ptr, png_bytep data, png_size_t length)
+{
+    std::vector<unsigned char> *png = (std::vector<unsigned char> *) png_get_io_ptr(png_ptr);
+    png->insert(png->end(), data, data + length);
+}
+
+static void _flush_png_to_vector(png_structp)
+{
+}
+
+static bool _encode_image_RGBA_png(const unsigned char *buffer, int width,
+  int height, std::vector<unsigned char> *png)
+{
+    png->clear();
+
+    png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, 0, 0,
+      0);
+    if (!png_ptr)
+        return false;
+    png_infop info_ptr = png_create_info_struct(png_ptr);
+    if (!info_ptr) {
+        png_destroy_write_struct(&png_ptr, (png_infopp) 0);
+        return false;
+    }
+
+    // the row pointers are allocated before the setjmp, so a longjmp
+    // back to it cannot leak them
+    std::vector<png_bytep> row_pointers(height);
+    for (int y = 0 ; y < height ; y++)
+        row_pointers[y] = (png_byte *) (buffer + (height - 1 - y) * width * 4);
+
+    if (setjmp(png_ptr->jmpbuf)) {
+        png_destroy_write_struct(&png_ptr, &info_ptr);
+        png->clear();
+        return false;
+    }
+
+    // write to memory instead of a file
+    png_set_write_fn(png_ptr, png, _write_png_to_vector, _flush_png_to_vector);
+
+    png_set_IHDR(png_ptr, info_ptr, width, height, 8, PNG_COLOR_TYPE_RGB_ALPHA,
+      PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    png_write_info(png_ptr, info_ptr);
+    if (height > 0)
+        png_write_image(png_ptr, &row_pointers[0]);
+    png_write_end(png_ptr, info_ptr);
+
+    png_destroy_write_struct(&png_ptr, &info_ptr);
+    return true;
+}
+
 // ***** external functions ***** //
 
 // Sets the width and height to the appropriate values and mallocs
@@ -225,6 +278,15 @@ bool imageio_save_image( const char *fileName, unsigned char *buffer,
         return false;
 }
 
+// Encodes an image given by buffer with the specified width and height
+// as a png file in memory, returns true on success, false otherwise.
+// The image format is RGBA, bottom row first, as for saving.
+bool imageio_encode_png( const unsigned char *buffer, int width, int height,
+                         std::vector<unsigned char> *png )
+{
+    return _encode_image_RGBA_png(buffer, width, height, png);
+}
+
 // Wraps the general functionality of saving an image and writes the current
 // frame buffer to a specified file name.  Also returns true on succces,
 // false otherwise.
@@ -28,6 +28,7 @@
 #define _462_APPLICATION_IMAGEIO_HPP_
 
 #include <cstdlib>
+#include <vector>
 
 namespace Luc {
 
@@ -43,6 +44,12 @@ unsigned char* imageio_load_image( const char* filename, int *width, int *height
 // The image format is RGBA.
 bool imageio_save_image( const char* filename, unsigned char* buffer, int width, int height );
 
+// Encodes an image given by buffer with the specified width and height
+// as a png file in memory, for sending it somewhere instead of saving it.
+// Returns true on success, false otherwise. The image format is RGBA.
+bool imageio_encode_png( const unsigned char* buffer, int width, int height,
+                         std::vector<unsigned char>* png );
+
 // Writes the current opengl frame buffer to a specified file name.
 // Returns true on succces, false otherwise.
 bool imageio_save_screenshot( const char* filename, int width, int height );
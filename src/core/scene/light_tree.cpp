@@ -0,0 +1,195 @@
+/**
+ * @file light_tree.cpp
+ * @brief Hierarchy over the lights of a scene, for sampling one of many.
+ */
+#include "lucPCH.h"
+#include "scene/light_tree.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace Luc {
+
+namespace {
+
+struct CenterLess
+{
+    const Vector3* centers;
+    size_t axis;
+
+    bool operator()( uint32_t a, uint32_t b ) const
+    {
+        return centers[a][axis] < centers[b][axis];
+    }
+};
+
+real_t luminance( const Color3& c )
+{
+    return 0.2126f * c.r + 0.7152f * c.g + 0.0722f * c.b;
+}
+
+} // namespace
+
+LightTree::LightTree() : m_num_lights( 0 ) { }
+
+LightTree::~LightTree() { }
+
+void LightTree::build( const Scene* scene )
+{
+    size_t num_point_lights = scene->num_lights();
+    size_t num_area_lights = scene->num_area_lights();
+    m_num_lights = num_point_lights + num_area_lights;
+
+    std::vector< LightInfo > lights( m_num_lights );
+    const PointLight* point_lights = scene->get_lights();
+    for ( size_t i = 0; i < num_point_lights; ++i ) {
+        LightInfo& info = lights[i];
+        info.bounds.filter_vertex( point_lights[i].position );
+        info.intensity = luminance( point_lights[i].color );
+        info.attenuation = point_lights[i].attenuation;
+    }
+    const AreaLight* area_lights = scene->get_area_lights();
+    for ( size_t i = 0; i < num_area_lights; ++i ) {
+        const AreaLight& light = area_lights[i];
+        LightInfo& info = lights[num_point_lights + i];
+        if ( AreaLight::SPHERE == light.shape ) {
+            Vector3 radius( light.radius, light.radius, light.radius );
+            info.bounds.filter_vertex( light.position - radius );
+            info.bounds.filter_vertex( light.position + radius );
+        } else {
+            for ( int j = 0; j < 4; ++j ) {
+                info.bounds.filter_vertex( light.position +
+                                           light.axis_x * ( ( j & 1 ) ? 0.5f : -0.5f ) +
+                                           light.axis_z * ( ( j & 2 ) ? 0.5f : -0.5f ) );
+            }
+        }
+        info.intensity = luminance( light.color );
+        info.attenuation = light.attenuation;
+    }
+    std::vector< Vector3 > centers( m_num_lights );
+    std::vector< uint32_t > order( m_num_lights );
+    for ( size_t i = 0; i < m_num_lights; ++i ) {
+        centers[i] = lights[i].bounds.get_center();
+        order[i] = static_cast< uint32_t >( i );
+    }
+
+    m_nodes.clear();
+    if ( m_num_lights > 0 ) {
+        m_nodes.reserve( 2 * m_num_lights - 1 );
+        build_node( lights, centers, order, 0, m_num_lights );
+    }
+}
+
+uint32_t LightTree::build_node( const std::vector< LightInfo >& lights, const std::vector< Vector3 >& centers,
+                                std::vector< uint32_t >& order, size_t begin, size_t end )
+{
+    uint32_t node_index = static_cast< uint32_t >( m_nodes.size() );
+    m_nodes.push_back( Node() );
+
+    if ( end - begin == 1 ) {
+        const LightInfo& info = lights[order[begin]];
+        Node& leaf = m_nodes[node_index];
+        leaf.bounds = info.bounds;
+        leaf.intensity = info.intensity;
+        leaf.attenuation = info.attenuation;
+        leaf.light = static_cast< int32_t >( order[begin] );
+        leaf.right = 0;
+        return node_index;
+    }
+
+    // split at the median along the axis of the largest center extent
+    BoundingBox center_bounds;
+    for ( size_t i = begin; i < end; ++i ) {
+        center_bounds.filter_vertex( centers[order[i]] );
+    }
+    Vector3 extent = center_bounds.get_right_top_back_corner() - center_bounds.get_left_bottom_front_corner();
+    CenterLess less = { &centers[0], 0 };
+    if ( extent.y > extent[less.axis] ) less.axis = 1;
+    if ( extent.z > extent[less.axis] ) less.axis = 2;
+    size_t mid = begin + ( end - begin ) / 2;
+    std::nth_element( order.begin() + begin, order.begin() + mid, order.begin() + end, less );
+
+    build_node( lights, centers, order, begin, mid );
+    uint32_t right = build_node( lights, centers, order, mid, end );
+
+    // children may have moved the nodes
+    Node& node = m_nodes[node_index];
+    const Node& a = m_nodes[node_index + 1];
+    const Node& b = m_nodes[right];
+    node.bounds = a.bounds;
+    node.bounds.merge( b.bounds );
+    node.intensity = a.intensity + b.intensity;
+    node.attenuation.constant  = std::min( a.attenuation.constant,  b.attenuation.constant );
+    node.attenuation.linear    = std::min( a.attenuation.linear,    b.attenuation.linear );
+    node.attenuation.quadratic = std::min( a.attenuation.quadratic, b.attenuation.quadratic );
+    node.light = -1;
+    node.right = right;
+    return node_index;
+}
+
+real_t LightTree::importance( const Node& node, const Vector3& position, const Vector3& normal ) const
+{
+    Vector3 center = node.bounds.get_center();
+    real_t radius = 0.5f * length( node.bounds.get_right_top_back_corner() -
+                                   node.bounds.get_left_bottom_front_corner() );
+    Vector3 to_center = center - position;
+    real_t distance = length( to_center );
+
+    // a point inside the bounds could be lit from any direction
+    real_t cos_bound = 1;
+    if ( distance > radius ) {
+        // smallest angle between the normal and a direction into the
+        // sphere around the bounds
+        real_t cos_center = std::max< real_t >( -1, std::min< real_t >( 1, dot( normal, to_center ) / distance ) );
+        real_t angle = acos( cos_center ) - asin( radius / distance );
+        if ( angle >= PI / 2 )
+            return 0;
+        cos_bound = angle > 0 ? cos( angle ) : 1;
+    }
+
+    // the distance to the closest point of the bounds, as the lights may
+    // be anywhere in them
+    Vector3 closest = vmax( node.bounds.get_left_bottom_front_corner(),
+                            vmin( position, node.bounds.get_right_top_back_corner() ) );
+    distance = length( closest - position );
+    real_t attenuation = node.attenuation.constant +
+                         distance * node.attenuation.linear +
+                         distance * distance * node.attenuation.quadratic;
+    return node.intensity * cos_bound / std::max( attenuation, 1e-6f );
+}
+
+bool LightTree::sample( const Vector3& position, const Vector3& normal, real_t u,
+                        size_t* light, real_t* probability ) const
+{
+    if ( m_nodes.empty() )
+        return false;
+
+    real_t p = 1;
+    uint32_t index = 0;
+    while ( m_nodes[index].light < 0 ) {
+        uint32_t left = index + 1;
+        uint32_t right = m_nodes[index].right;
+        real_t w_left = importance( m_nodes[left], position, normal );
+        real_t w_right = importance( m_nodes[right], position, normal );
+        if ( w_left + w_right <= 0 )
+            return false;
+
+        // reuse the sample for the next level, rescaled to [0, 1)
+        real_t p_left = w_left / ( w_left + w_right );
+        if ( u < p_left ) {
+            u = std::min( u / p_left, 0.99999994f );
+            p *= p_left;
+            index = left;
+        } else {
+            u = std::min( ( u - p_left ) / ( 1 - p_left ), 0.99999994f );
+            p *= 1 - p_left;
+            index = right;
+        }
+    }
+
+    *light = static_cast< size_t >( m_nodes[index].light );
+    *probability = p;
+    return p > 0;
+}
+
+} /* Luc */
@@ -0,0 +1,93 @@
+/**
+ * @file light_tree.hpp
+ * @brief Hierarchy over the lights of a scene, for sampling one of many.
+ */
+
+#ifndef _LUC_SCENE_LIGHT_TREE_HPP_
+#define _LUC_SCENE_LIGHT_TREE_HPP_
+
+#include "scene/scene.hpp"
+#include "scene/bounding_box.hpp"
+
+#include <vector>
+
+namespace Luc {
+
+/*
+ * A binary tree over every light of a scene, each node bounding the
+ * position, brightness and attenuation of the lights below it (Conty and
+ * Kulla, "Importance Sampling of Many Lights with Adaptive Tree Splitting",
+ * without the orientation cones).
+ *
+ * Picking a light walks down from the root, choosing between the two
+ * children in proportion to how much light each could send to the shaded
+ * point. That takes time logarithmic in the number of lights, and mostly
+ * picks the lights that matter, so a few shadow rays per point stand in
+ * for one per light.
+ *
+ * Lights are numbered as the point lights of the scene, followed by its
+ * area lights.
+ */
+class LightTree
+{
+public:
+
+    LightTree();
+    ~LightTree();
+
+    /// Rebuilds the tree over the current lights of a scene.
+    void build( const Scene* scene );
+
+    /// Number of lights in the tree.
+    size_t num_lights() const { return m_num_lights; }
+
+    /*
+     * Picks a light for a point, with a probability that follows the
+     * estimated light it receives from each one.
+     *
+     * @param[in]  position     The shaded point.
+     * @param[in]  normal       Normal of the shaded side of the surface.
+     * @param[in]  u            Sample in [0, 1) choosing the light.
+     * @param[out] light        The light, numbered as described above.
+     * @param[out] probability  Chance of picking that light.
+     * @return false if no light can reach the point.
+     */
+    bool sample( const Vector3& position, const Vector3& normal, real_t u,
+                 size_t* light, real_t* probability ) const;
+
+private:
+
+    struct Node
+    {
+        BoundingBox bounds;
+        // sum of the luminance of the lights' colors
+        real_t intensity;
+        // smallest coefficients of the lights, for the least attenuation
+        PointLight::Attenuation attenuation;
+        // the light of a leaf, or -1 for an inner node
+        int32_t light;
+        // children of an inner node, the first one right after it
+        uint32_t right;
+    };
+
+    struct LightInfo
+    {
+        BoundingBox bounds;
+        real_t intensity;
+        PointLight::Attenuation attenuation;
+    };
+
+    // builds the subtree over lights order[begin, end), returning its root
+    uint32_t build_node( const std::vector< LightInfo >& lights, const std::vector< Vector3 >& centers,
+                         std::vector< uint32_t >& order, size_t begin, size_t end );
+
+    // upper estimate of the light a node sends to a point
+    real_t importance( const Node& node, const Vector3& position, const Vector3& normal ) const;
+
+    std::vector< Node > m_nodes;
+    size_t m_num_lights;
+};
+
+} /* Luc */
+
+#endif /* _LUC_SCENE_LIGHT_TREE_HPP_ */
@@ -8,6 +8,8 @@
 #include "scene/material.hpp"
 #include "scene/image/imageio.hpp"
 
+#include <algorithm>
+
 namespace Luc {
 
 Material::Material():
@@ -40,6 +42,7 @@ bool Material::load()
         free( tex_data );
         tex_data = 0;
     }
+    tex_levels.clear();
 
     // if no texture, nothing to do
     if ( texture_filename.empty() )
@@ -54,10 +57,45 @@ bool Material::load()
         return false;
     }
 
+    build_texture_levels();
     std::cout << "Finished loading texture" << std::endl;
     return true;
 }
 
+void Material::build_texture_levels()
+{
+    int width = tex_width;
+    int height = tex_height;
+    const unsigned char* source = tex_data;
+
+    while ( width > 1 || height > 1 ) {
+        TextureLevel level;
+        level.width = std::max( 1, width / 2 );
+        level.height = std::max( 1, height / 2 );
+        level.data.resize( 4 * level.width * level.height );
+
+        // average each 2x2 block, repeating the last row or column of odd sizes
+        for ( int y = 0; y < level.height; ++y ) {
+            int y0 = std::min( 2 * y, height - 1 );
+            int y1 = std::min( 2 * y + 1, height - 1 );
+            for ( int x = 0; x < level.width; ++x ) {
+                int x0 = std::min( 2 * x, width - 1 );
+                int x1 = std::min( 2 * x + 1, width - 1 );
+                for ( int c = 0; c < 4; ++c ) {
+                    int sum = source[4 * ( x0 + y0 * width ) + c] + source[4 * ( x1 + y0 * width ) + c]
+                            + source[4 * ( x0 + y1 * width ) + c] + source[4 * ( x1 + y1 * width ) + c];
+                    level.data[4 * ( x + y * level.width ) + c] = static_cast< unsigned char >( ( sum + 2 ) / 4 );
+                }
+            }
+        }
+
+        tex_levels.push_back( level );
+        width = level.width;
+        height = level.height;
+        source = &tex_levels.back().data[0];
+    }
+}
+
 const unsigned char* Material::get_texture_data() const
 {
     return tex_data;
@@ -75,6 +113,32 @@ Color3 Material::get_texture_pixel( int x, int y ) const
     return tex_data ? Color3( tex_data + 4 * (x + y * tex_width) ) : Color3::White;
 }
 
+int Material::get_texture_levels() const
+{
+    return tex_data ? 1 + static_cast< int >( tex_levels.size() ) : 0;
+}
+
+void Material::get_texture_level_size( int level, int* width, int* height ) const
+{
+    assert( width && height );
+    assert( 0 <= level && level < get_texture_levels() );
+    if ( 0 == level ) {
+        *width = tex_width;
+        *height = tex_height;
+    } else {
+        *width = tex_levels[level - 1].width;
+        *height = tex_levels[level - 1].height;
+    }
+}
+
+Color3 Material::get_texture_pixel( int x, int y, int level ) const
+{
+    if ( 0 == level )
+        return get_texture_pixel( x, y );
+    const TextureLevel& texture_level = tex_levels[level - 1];
+    return Color3( &texture_level.data[4 * (x + y * texture_level.width)] );
+}
+
 bool Material::create_gl_data()
 {
     // if no texture, nothing to do
@@ -12,6 +12,8 @@
 #include "math/vector.hpp"
 #include "application/opengl.hpp"
 
+#include <vector>
+
 namespace Luc {
 
 class Material
@@ -64,6 +66,18 @@ public:
      */
     Color3 get_texture_pixel( int x, int y ) const;
 
+    /// Number of mip levels of the texture, 0 if there is no texture.
+    int get_texture_levels() const;
+
+    /// Dimensions of a mip level, level 0 being the texture itself.
+    void get_texture_level_size( int level, int* width, int* height ) const;
+
+    /**
+     * returns the color of the (x,y) pixel of a mip level, where x and y
+     * range over the dimensions of that level.
+     */
+    Color3 get_texture_pixel( int x, int y, int level ) const;
+
     /// Creates opengl data for rendering
     bool create_gl_data();
 
@@ -82,6 +96,18 @@ private:
     // raw texture data
     unsigned char* tex_data;
 
+    // box filtered levels of the texture, each half the size of the one
+    // before, starting from level 1
+    struct TextureLevel
+    {
+        int width, height;
+        std::vector< unsigned char > data;
+    };
+    std::vector< TextureLevel > tex_levels;
+
+    // computes tex_levels from tex_data
+    void build_texture_levels();
+
     // opengl descriptor of the texture
     GLuint tex_handle;
 
@@ -7,12 +7,22 @@
  */
 #include "lucPCH.h"
 #include "scene/mesh.hpp"
+#include "scene/bvh_cache.hpp"
+#include "scene/mesh_simplifier.hpp"
+#include "scene/out_of_core_mesh.hpp"
+#include "scene/pn_surface.hpp"
+#include "app/raycasting.hpp"
+#include "files/fileutils.h"
+#include "math/mathUtils.h"
 #include "application/opengl.hpp"
+#include <boost/thread/thread.hpp>
+#include <SDL/SDL_timer.h>
 #include <iostream>
 #include <cstring>
 #include <fstream>
 #include <sstream>
 #include <map>
+#include <time.h>
 
 namespace Luc {
 
@@ -48,10 +58,74 @@ enum ObjFormat
     VERTEX_UV_NORMAL = 1 << 3
 };
 
+/*
+ * Keeps the closest triangle hit during hierarchy traversal. The source
+ * yields triangle vertex positions, either from resident arrays or paged in.
+ */
+template< typename TriangleSource >
+struct ClosestTriangleIntersector
+{
+    ClosestTriangleIntersector( const Ray& ray, const TriangleSource& source, MeshHit* hit )
+        : ray( ray ), source( source ), hit( hit ) { }
+
+    bool operator()( uint32_t index, real_t tMin, real_t& tMax )
+    {
+        Vector3 pos[3];
+        source.get_positions( index, pos );
+
+        float t, beta, gamma;
+        if ( !ray_casting_triangle( ray, pos[0], pos[1], pos[2], tMin, tMax, t, beta, gamma ) )
+            return false;
+        if ( t <= tMin || t >= tMax )
+            return false;
+
+        tMax          = t;
+        hit->t        = t;
+        hit->triangle = index;
+        hit->beta     = beta;
+        hit->gamma    = gamma;
+        return true;
+    }
+
+    const Ray&            ray;
+    const TriangleSource& source;
+    MeshHit*              hit;
+};
+
+struct ResidentTriangles
+{
+    const MeshTriangle* triangles;
+    const MeshVertex*   vertices;
+
+    void get_positions( uint32_t index, Vector3 pos[3] ) const
+    {
+        const MeshTriangle& tri = triangles[index];
+        for ( size_t j = 0; j < 3; ++j )
+            pos[j] = vertices[tri.vertices[j]].position;
+    }
+};
+
+struct PagedTriangles
+{
+    OutOfCoreMesh::Reader* reader;
+
+    void get_positions( uint32_t index, Vector3 pos[3] ) const
+    {
+        MeshTriangle tri = reader->get_triangle( index );
+        for ( size_t j = 0; j < 3; ++j )
+            pos[j] = reader->get_vertex( tri.vertices[j] ).position;
+    }
+};
+
 Mesh::Mesh()
 {
     has_tcoords = false;
     has_normals = false;
+    out_of_core = false;
+    optimize = true;
+    subdivision_level = 0;
+    proxy_ratio = 0;
+    proxy_error = 0;
 }
 
 Mesh::~Mesh() { }
@@ -60,6 +134,21 @@ bool Mesh::load()
 {
     std::cout << "Loading mesh from '" << filename << "'..." << std::endl;
 
+    ooc_mesh.reset();
+    proxy.reset();
+    proxy_error = 0;
+    surface.reset();
+    occlusion.clear();
+    if ( subdivision_level > 0 && out_of_core ) {
+        // patches are tessellated from the resident control mesh
+        std::cout << "Subdivided mesh '" << filename << "' is kept resident.\n";
+        out_of_core = false;
+    }
+    if ( out_of_core && load_out_of_core() ) {
+        std::cout << "Successfully loaded mesh '" << filename << "'.\n";
+        return true;
+    }
+
     std::string line;
     std::ifstream file( filename.c_str() );
 
@@ -298,10 +387,282 @@ bool Mesh::load()
         triangles.push_back( tri );
     }
 
+    if ( optimize ) {
+        MeshOptimizeStats stats;
+        optimize_mesh( vertices, triangles, optimize_settings, &stats );
+        std::cout << "Optimized mesh '" << filename << "': welded " << stats.welded_vertices
+                  << " vertices, removed " << stats.removed_triangles << " degenerate triangles, "
+                  << "simulated cache misses " << stats.cache_misses_before << " -> "
+                  << stats.cache_misses_after << ".\n";
+    }
+
+    // the rays need the normals as much as the gl data, and a render
+    // without a window never creates that
+    if ( !has_normals && !triangles.empty() ) {
+        compute_normals();
+        has_normals = true;
+    }
+
+    if ( subdivision_level > 0 && !triangles.empty() ) {
+        // the patches are fitted to the vertex normals
+        surface.reset( new PnTriangleSurface() );
+        surface->build( &vertices[0], &triangles[0], triangles.size(), subdivision_level );
+        std::cout << "Subdividing mesh '" << filename << "' into " << surface->num_patches()
+                  << " patches at level " << surface->get_level() << ".\n";
+    } else {
+        build_bvh();
+        if ( proxy_ratio > 0 )
+            build_proxy();
+    }
+
+    // out-of-core meshes do not keep their vertices to carry it
+    if ( occlusion_settings.samples > 0 && !out_of_core )
+        bake_occlusion();
+
+    if ( out_of_core )
+        convert_out_of_core();
+
     std::cout << "Successfully loaded mesh '" << filename << "'.\n";
     return true;
 }
 
+uint64_t Mesh::get_out_of_core_key() const
+{
+    // the file holds the optimized triangles and their hierarchy, so a
+    // change of the settings of either rebuilds it
+    uint64_t key = hash_bvh_settings( bvh_settings, Math::FNV64_OFFSET_BASIS );
+    key = Math::FNV1aHash64( &optimize, sizeof optimize, key );
+    if ( optimize )
+        key = hash_optimize_settings( optimize_settings, key );
+    return key;
+}
+
+bool Mesh::load_out_of_core()
+{
+    uint64_t source_size, source_time;
+    if ( !GetFileStamp( filename, source_size, source_time ) )
+        return false;
+
+    std::string path = filename + ".ooc";
+    boost::scoped_ptr< OutOfCoreMesh > mesh( new OutOfCoreMesh() );
+    if ( !mesh->open( path, source_size, source_time, get_out_of_core_key() ) )
+        return false;
+
+    triangles.clear();
+    vertices.clear();
+    bvh.clear();
+    has_normals = mesh->has_normals();
+    has_tcoords = mesh->has_tcoords();
+    ooc_mesh.swap( mesh );
+
+    std::cout << "Paging mesh '" << filename << "' from '" << path << "' ("
+              << ooc_mesh->num_triangles() << " triangles).\n";
+    return true;
+}
+
+bool Mesh::convert_out_of_core()
+{
+    uint64_t source_size, source_time;
+    if ( triangles.empty() || !GetFileStamp( filename, source_size, source_time ) )
+        return false;
+
+    // the file holds final normals, so nothing has to touch the vertices later
+    if ( !has_normals ) {
+        compute_normals();
+        has_normals = true;
+    }
+
+    std::string path = filename + ".ooc";
+    if ( !OutOfCoreMesh::write( path, source_size, source_time, get_out_of_core_key(),
+                                &vertices[0], vertices.size(), &triangles[0], triangles.size(),
+                                bvh, has_normals, has_tcoords ) ) {
+        std::cout << "Keeping mesh '" << filename << "' resident.\n";
+        return false;
+    }
+
+    if ( !load_out_of_core() ) {
+        std::cout << "Error reopening '" << path << "', keeping mesh '" << filename << "' resident.\n";
+        return false;
+    }
+
+    // release the resident copy, swap since clear keeps the capacity
+    MeshTriangleList().swap( triangles );
+    MeshVertexList().swap( vertices );
+    return true;
+}
+
+void Mesh::build_bvh()
+{
+    bvh.clear();
+    if ( triangles.empty() )
+        return;
+
+    BvhCache& cache = BvhCacheSingleton::Instance();
+    uint64_t key = hash_bvh_settings( bvh_settings, compute_content_hash() );
+    if ( cache.load( filename, key, &bvh ) ) {
+        if ( bvh.num_indices() == triangles.size() )
+            return;
+        std::cout << "BVH cache of '" << filename << "' does not match the mesh, rebuilding.\n";
+    }
+
+    std::vector< BoundingBox > bounds( triangles.size() );
+    for ( size_t i = 0; i < triangles.size(); ++i ) {
+        for ( size_t j = 0; j < 3; ++j ) {
+            bounds[i].filter_vertex( vertices[triangles[i].vertices[j]].position );
+        }
+    }
+
+    // wall clock, as clock counts the processor time of every thread
+    unsigned int start_time = SDL_GetTicks();
+    bvh.build( &bounds[0], bounds.size(), bvh_settings );
+    std::cout << "Built BVH of '" << filename << "' (" << bvh.num_nodes() << " nodes) in "
+              << SDL_GetTicks() - start_time << " milliseconds.\n";
+
+    cache.save( filename, key, bvh );
+}
+
+void Mesh::bake_occlusion()
+{
+    occlusion.clear();
+    if ( vertices.empty() )
+        return;
+
+    // the rays leave along the vertex normals, which the key covers too
+    if ( !has_normals ) {
+        compute_normals();
+        has_normals = true;
+    }
+    uint64_t key = compute_content_hash();
+    for ( size_t i = 0; i < vertices.size(); ++i ) {
+        key = Math::FNV1aHash64( &vertices[i].normal, sizeof vertices[i].normal, key );
+    }
+    key = hash_occlusion_settings( occlusion_settings, key );
+    if ( load_occlusion( filename, key, vertices.size(), &occlusion ) )
+        return;
+
+    size_t num_threads = std::max< size_t >( 1, boost::thread::hardware_concurrency() );
+    bake_mesh_occlusion( *this, occlusion_settings, num_threads, &occlusion );
+    save_occlusion( filename, key, occlusion );
+}
+
+void Mesh::build_proxy()
+{
+    // the proxy averages the vertex normals, which must exist first
+    if ( !has_normals ) {
+        compute_normals();
+        has_normals = true;
+    }
+
+    unsigned int start_time = SDL_GetTicks();
+    size_t target = static_cast< size_t >( proxy_ratio * triangles.size() );
+    boost::scoped_ptr< Mesh > mesh( new Mesh() );
+    real_t error = simplify_mesh( vertices, triangles, target, &mesh->vertices, &mesh->triangles );
+    if ( mesh->triangles.empty() || mesh->triangles.size() >= triangles.size() ) {
+        std::cout << "Mesh '" << filename << "' does not simplify, tracing it without a proxy.\n";
+        return;
+    }
+
+    // its hierarchy is cached next to the mesh like any other
+    mesh->filename = filename + ".proxy";
+    mesh->has_normals = true;
+    mesh->has_tcoords = has_tcoords;
+    mesh->build_bvh();
+    std::cout << "Simplified mesh '" << filename << "' from " << triangles.size() << " to "
+              << mesh->triangles.size() << " triangles for secondary rays in "
+              << SDL_GetTicks() - start_time << " milliseconds, error " << error << ".\n";
+    proxy.swap( mesh );
+    proxy_error = error;
+}
+
+const Bvh& Mesh::get_bvh() const
+{
+    return bvh;
+}
+
+bool Mesh::intersect( const Ray& ray, real_t tMin, real_t tMax, MeshHit* hit ) const
+{
+    if ( surface )
+        return surface->intersect( ray, tMin, tMax, hit );
+
+    if ( ooc_mesh ) {
+        // the traversal and the triangle tests share the pinned pages
+        OutOfCoreMesh::Reader reader( ooc_mesh.get() );
+        PagedTriangles source = { &reader };
+        ClosestTriangleIntersector< PagedTriangles > intersector( ray, source, hit );
+        return ooc_mesh->intersect( reader, ray, tMin, tMax, intersector );
+    }
+
+    ResidentTriangles source = { get_triangles(), get_vertices() };
+    ClosestTriangleIntersector< ResidentTriangles > intersector( ray, source, hit );
+    return bvh.intersect( ray, tMin, tMax, intersector );
+}
+
+MeshVertex Mesh::get_hit_vertex( const Ray& ray, const MeshHit& hit ) const
+{
+    if ( surface ) {
+        MeshVertex vertex = surface->evaluate( hit.triangle, hit.beta, hit.gamma );
+        // the curved patch lies off its tessellation, keep the point that was hit
+        vertex.position = ray.Point() + hit.t * ray.Direction();
+        return vertex;
+    }
+
+    MeshTriangle triangle = get_triangle( hit.triangle );
+    MeshVertex v0 = get_vertex( triangle.vertices[0] );
+    MeshVertex v1 = get_vertex( triangle.vertices[1] );
+    MeshVertex v2 = get_vertex( triangle.vertices[2] );
+
+    MeshVertex vertex;
+    vertex.position    = barycentric_interpolation( v0.position, v1.position, v2.position, hit.beta, hit.gamma );
+    vertex.normal      = barycentric_interpolation( v0.normal, v1.normal, v2.normal, hit.beta, hit.gamma );
+    vertex.tex_coord.x = barycentric_interpolation( v0.tex_coord.x, v1.tex_coord.x, v2.tex_coord.x, hit.beta, hit.gamma );
+    vertex.tex_coord.y = barycentric_interpolation( v0.tex_coord.y, v1.tex_coord.y, v2.tex_coord.y, hit.beta, hit.gamma );
+    return vertex;
+}
+
+real_t Mesh::get_hit_occlusion( const MeshHit& hit ) const
+{
+    if ( occlusion.empty() )
+        return 1;
+
+    const MeshTriangle& triangle = triangles[hit.triangle];
+    return barycentric_interpolation( occlusion[triangle.vertices[0]], occlusion[triangle.vertices[1]],
+                                      occlusion[triangle.vertices[2]], hit.beta, hit.gamma );
+}
+
+MeshHitDifferential Mesh::get_hit_differential( const MeshHit& hit, const Vector3& dpdx,
+                                                const Vector3& dpdy ) const
+{
+    MeshTriangle triangle = get_triangle( hit.triangle );
+    MeshVertex v0 = get_vertex( triangle.vertices[0] );
+    MeshVertex v1 = get_vertex( triangle.vertices[1] );
+    MeshVertex v2 = get_vertex( triangle.vertices[2] );
+
+    Vector3 e1 = v1.position - v0.position;
+    Vector3 e2 = v2.position - v0.position;
+    float dbdx, dgdx, dbdy, dgdy;
+    barycentric_differentials( e1, e2, dpdx, dbdx, dgdx );
+    barycentric_differentials( e1, e2, dpdy, dbdy, dgdy );
+
+    MeshHitDifferential differential;
+    differential.dtdx = dbdx * ( v1.tex_coord - v0.tex_coord ) + dgdx * ( v2.tex_coord - v0.tex_coord );
+    differential.dtdy = dbdy * ( v1.tex_coord - v0.tex_coord ) + dgdy * ( v2.tex_coord - v0.tex_coord );
+    differential.dndx = dbdx * ( v1.normal - v0.normal ) + dgdx * ( v2.normal - v0.normal );
+    differential.dndy = dbdy * ( v1.normal - v0.normal ) + dgdy * ( v2.normal - v0.normal );
+    return differential;
+}
+
+uint64_t Mesh::compute_content_hash() const
+{
+    uint64_t hash = Math::FNV64_OFFSET_BASIS;
+    for ( size_t i = 0; i < vertices.size(); ++i ) {
+        hash = Math::FNV1aHash64( vertices[i].position.m_data, sizeof vertices[i].position.m_data, hash );
+    }
+    if ( !triangles.empty() ) {
+        hash = Math::FNV1aHash64( &triangles[0], triangles.size() * sizeof triangles[0], hash );
+    }
+    return hash;
+}
+
 const MeshTriangle* Mesh::get_triangles() const
 {
     return triangles.empty() ? NULL : &triangles[0];
@@ -309,7 +670,7 @@ const MeshTriangle* Mesh::get_triangles() const
 
 size_t Mesh::num_triangles() const
 {
-    return triangles.size();
+    return ooc_mesh ? ooc_mesh->num_triangles() : triangles.size();
 }
 
 const MeshVertex* Mesh::get_vertices() const
@@ -319,7 +680,43 @@ const MeshVertex* Mesh::get_vertices() const
 
 size_t Mesh::num_vertices() const
 {
-    return vertices.size();
+    return ooc_mesh ? ooc_mesh->num_vertices() : vertices.size();
+}
+
+MeshTriangle Mesh::get_triangle( size_t index ) const
+{
+    return ooc_mesh ? ooc_mesh->get_triangle( index ) : triangles[index];
+}
+
+MeshVertex Mesh::get_vertex( size_t index ) const
+{
+    return ooc_mesh ? ooc_mesh->get_vertex( index ) : vertices[index];
+}
+
+bool Mesh::is_out_of_core() const
+{
+    return ooc_mesh.get() != 0;
+}
+
+bool Mesh::is_subdivided() const
+{
+    return surface.get() != 0;
+}
+
+BoundingBox Mesh::get_bounds() const
+{
+    if ( ooc_mesh )
+        return ooc_mesh->get_bounds();
+    if ( surface )
+        return surface->get_bounds();
+    if ( !bvh.empty() )
+        return bvh.get_bounds();
+
+    BoundingBox box;
+    for ( size_t i = 0; i < vertices.size(); ++i ) {
+        box.filter_vertex( vertices[i].position );
+    }
+    return box;
 }
 
 bool Mesh::are_normals_valid() const
@@ -335,8 +732,43 @@ bool Mesh::are_tex_coords_valid() const
 // number of floats per vertex
 #define VERTEX_SIZE 8
 
+void Mesh::compute_normals()
+{
+    // first zero out
+    for ( size_t i = 0; i < vertices.size(); ++i ) {
+        vertices[i].normal = Vector3::Zero;
+    }
+
+    // then sum in all triangle normals
+    for ( size_t i = 0; i < triangles.size(); ++i ) {
+        Vector3 pos[3];
+        for ( size_t j = 0; j < 3; ++j ) {
+            pos[j] = vertices[triangles[i].vertices[j]].position;
+        }
+        Vector3 normal = normalize( cross( pos[1] - pos[0], pos[2] - pos[0] ) );
+        for ( size_t j = 0; j < 3; ++j ) {
+            vertices[triangles[i].vertices[j]].normal += normal;
+        }
+    }
+
+    // then normalize
+    for ( size_t i = 0; i < vertices.size(); ++i ) {
+        vertices[i].normal = normalize( vertices[i].normal );
+    }
+}
+
 bool Mesh::create_gl_data()
 {
+    // out-of-core meshes are drawn as their bounding box, see render
+    if ( ooc_mesh ) {
+        return true;
+    }
+
+    // subdivided meshes draw their patches from the tessellation cache
+    if ( surface ) {
+        return true;
+    }
+
     // if no vertices, nothing to do
     if ( vertices.empty() || triangles.empty() ) {
         return false;
@@ -344,28 +776,7 @@ bool Mesh::create_gl_data()
 
     // compute normals if needed
     if ( !has_normals ) {
-        // first zero out
-        for ( size_t i = 0; i < vertices.size(); ++i ) {
-            vertices[i].normal = Vector3::Zero;
-        }
-
-        // then sum in all triangle normals
-        for ( size_t i = 0; i < triangles.size(); ++i ) {
-            Vector3 pos[3];
-            for ( size_t j = 0; j < 3; ++j ) {
-                pos[j] = vertices[triangles[i].vertices[j]].position;
-            }
-            Vector3 normal = normalize( cross( pos[1] - pos[0], pos[2] - pos[0] ) );
-            for ( size_t j = 0; j < 3; ++j ) {
-                vertices[triangles[i].vertices[j]].normal += normal;
-            }
-        }
-
-        // then normalize
-        for ( size_t i = 0; i < vertices.size(); ++i ) {
-            vertices[i].normal = normalize( vertices[i].normal );
-        }
-
+        compute_normals();
         has_normals = true;
     }
 
@@ -391,11 +802,55 @@ bool Mesh::create_gl_data()
     return true;
 }
 
-void Mesh::render() const
+void Mesh::render( const Color3* ambient ) const
 {
+    // paging the whole mesh in every frame would defeat the budget, so
+    // out-of-core meshes are drawn as a box proxy
+    if ( ooc_mesh ) {
+        BoundingBox box = ooc_mesh->get_bounds();
+        Vector3 lo = box.get_left_bottom_front_corner();
+        Vector3 hi = box.get_right_top_back_corner();
+        glBegin( GL_LINES );
+        for ( int i = 0; i < 4; ++i ) {
+            real_t a0 = ( i & 1 ) ? hi.x : lo.x, a1 = ( i & 2 ) ? hi.y : lo.y;
+            real_t b0 = ( i & 1 ) ? hi.y : lo.y, b1 = ( i & 2 ) ? hi.z : lo.z;
+            real_t c0 = ( i & 1 ) ? hi.x : lo.x, c1 = ( i & 2 ) ? hi.z : lo.z;
+            // edges along z, x and y
+            glVertex3f( a0, a1, lo.z ); glVertex3f( a0, a1, hi.z );
+            glVertex3f( lo.x, b0, b1 ); glVertex3f( hi.x, b0, b1 );
+            glVertex3f( c0, lo.y, c1 ); glVertex3f( c0, hi.y, c1 );
+        }
+        glEnd();
+        return;
+    }
+
+    if ( surface ) {
+        surface->render();
+        return;
+    }
+
     assert( index_data.size() > 0 );
     glInterleavedArrays( GL_T2F_N3F_V3F, VERTEX_SIZE * sizeof vertex_data[0], &vertex_data[0] );
+
+    // the ambient color, darkened by the baked occlusion of each vertex
+    std::vector< float > colors;
+    if ( ambient && !occlusion.empty() ) {
+        colors.resize( 3 * occlusion.size() );
+        for ( size_t i = 0; i < occlusion.size(); ++i ) {
+            ( *ambient * occlusion[i] ).to_array( &colors[3 * i] );
+        }
+        glEnableClientState( GL_COLOR_ARRAY );
+        glColorPointer( 3, GL_FLOAT, 0, &colors[0] );
+        glColorMaterial( GL_FRONT_AND_BACK, GL_AMBIENT );
+        glEnable( GL_COLOR_MATERIAL );
+    }
+
     glDrawElements( GL_TRIANGLES, static_cast<int>(index_data.size()), GL_UNSIGNED_INT, &index_data[0] );
+
+    if ( !colors.empty() ) {
+        glDisable( GL_COLOR_MATERIAL );
+        glDisableClientState( GL_COLOR_ARRAY );
+    }
 }
 
 } /* Luc */
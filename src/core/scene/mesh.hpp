@@ -9,8 +9,13 @@
 #ifndef _462_SCENE_MESH_HPP_
 #define _462_SCENE_MESH_HPP_
 
+#include "math/color.hpp"
 #include "math/vector.hpp"
+#include "scene/bvh.hpp"
+#include "scene/mesh_optimizer.hpp"
+#include "scene/occlusion_baker.hpp"
 
+#include <boost/scoped_ptr.hpp>
 #include <vector>
 #include <cassert>
 
@@ -29,6 +34,28 @@ struct MeshTriangle
     unsigned int vertices[3];
 };
 
+struct MeshHit
+{
+    // distance along the ray
+    real_t t;
+    // index of the triangle hit
+    size_t triangle;
+    // barycentric coordinates of the hit point
+    real_t beta;
+    real_t gamma;
+};
+
+struct MeshHitDifferential
+{
+    // change of the texture coordinates per pixel
+    Vector2 dtdx, dtdy;
+    // change of the normal per pixel
+    Vector3 dndx, dndy;
+};
+
+class OutOfCoreMesh;
+class PnTriangleSurface;
+
 /**
  * A mesh of triangles.
  */
@@ -45,15 +72,67 @@ public:
      */
     bool load();
 
-    /// Get a pointer to the triangles.
+    /// Get a pointer to the triangles, NULL for out-of-core meshes.
     const MeshTriangle* get_triangles() const;
     /// The number of elements in the triangle array.
     size_t num_triangles() const;
-    /// Get a pointer to the vertices.
+    /// Get a pointer to the vertices, NULL for out-of-core meshes.
     const MeshVertex* get_vertices() const;
     /// The number of elements in the vertex array.
     size_t num_vertices() const;
 
+    /// Get a triangle, resident or not.
+    MeshTriangle get_triangle( size_t index ) const;
+    /// Get a vertex, resident or not.
+    MeshVertex get_vertex( size_t index ) const;
+
+    /// True if the mesh data is paged in from disk instead of resident.
+    bool is_out_of_core() const;
+
+    /// True if the triangles are the control mesh of a curved surface.
+    bool is_subdivided() const;
+
+    /// Bounding box of the mesh, in the mesh's local space.
+    BoundingBox get_bounds() const;
+
+    /// The hierarchy over the triangles, in the mesh's local space.
+    /// Empty for out-of-core meshes, which page their hierarchy in.
+    const Bvh& get_bvh() const;
+
+    /**
+     * Finds the closest triangle hit by a ray in the mesh's local space.
+     * @return True if a triangle is hit between tMin and tMax.
+     */
+    bool intersect( const Ray& ray, real_t tMin, real_t tMax, MeshHit* hit ) const;
+
+    /// Position, normal and texture coordinate of a hit found by intersect.
+    MeshVertex get_hit_vertex( const Ray& ray, const MeshHit& hit ) const;
+
+    /// Baked ambient occlusion at a hit found by intersect, 1 if not baked.
+    real_t get_hit_occlusion( const MeshHit& hit ) const;
+
+    /// True if the vertices carry baked ambient occlusion.
+    bool has_occlusion() const { return !occlusion.empty(); }
+
+    /// The simplified copy for secondary rays, NULL if there is none.
+    const Mesh* get_proxy() const { return proxy.get(); }
+    /// The farthest the proxy strays from the mesh, in the mesh's local space.
+    real_t get_proxy_error() const { return proxy_error; }
+
+    /**
+     * Change of the texture coordinates and normal at a hit, from the change
+     * of the hit position, all in the mesh's local space. Curved surfaces
+     * use the flat triangle of their patch, close enough for filtering.
+     */
+    MeshHitDifferential get_hit_differential( const MeshHit& hit, const Vector3& dpdx,
+                                              const Vector3& dpdy ) const;
+
+    /**
+     * Hash of the vertex positions and triangle indices, the part of the
+     * mesh that the hierarchy depends on.
+     */
+    uint64_t compute_content_hash() const;
+
     /// Returns true if the loaded model contained normal data.
     bool are_normals_valid() const;
     /// Returns true if the loaded model contained texture coordinate data.
@@ -61,11 +140,27 @@ public:
 
     // scene loader stores the filename of the mesh here
     std::string filename;
+    // scene loader sets this for meshes to be paged in from disk
+    bool out_of_core;
+    // scene loader sets these, see optimize_mesh
+    bool optimize;
+    MeshOptimizeSettings optimize_settings;
+    // scene loader sets this to draw and trace the mesh as a smooth surface
+    // tessellated on demand, see PnTriangleSurface; 0 keeps the triangles
+    unsigned int subdivision_level;
+    // scene loader sets this to bake the ambient occlusion of resident meshes
+    OcclusionSettings occlusion_settings;
+    // scene loader sets this to build a proxy with about this share of the
+    // triangles, see simplify_mesh; 0 builds none
+    real_t proxy_ratio;
 
     /// Creates opengl data for rendering and computes normals if needed
     bool create_gl_data();
-    /// Renders the mesh using opengl.
-    void render() const;
+    /**
+     * Renders the mesh using opengl. With baked occlusion, the ambient color
+     * of the material is given, and is darkened at every vertex.
+     */
+    void render( const Color3* ambient = 0 ) const;
 
 private:
 
@@ -89,6 +184,37 @@ private:
     // the index data used for GL rendering
     IndexList index_data;
 
+    // baked ambient occlusion of each vertex, empty if not baked
+    std::vector< float > occlusion;
+
+    // builder settings and hierarchy of the triangles
+    BvhBuildSettings bvh_settings;
+    Bvh bvh;
+
+    // maps the hierarchy from the cache, or builds and caches it
+    void build_bvh();
+    // computes vertex normals from the triangles
+    void compute_normals();
+    // reads the baked occlusion from the cache, or bakes and caches it
+    void bake_occlusion();
+    // simplifies the triangles into the proxy
+    void build_proxy();
+
+    // hash of the settings the out-of-core file is built with
+    uint64_t get_out_of_core_key() const;
+    // opens the out-of-core file of the mesh if it is up to date
+    bool load_out_of_core();
+    // writes the loaded mesh to its out-of-core file and switches to it
+    bool convert_out_of_core();
+
+    // paged mesh data, set while out of core
+    boost::scoped_ptr< OutOfCoreMesh > ooc_mesh;
+    // curved surface over the triangles, set while subdivided
+    boost::scoped_ptr< PnTriangleSurface > surface;
+    // coarse copy traced by secondary rays, and how far it strays
+    boost::scoped_ptr< Mesh > proxy;
+    real_t proxy_error;
+
     // prevent copy/assignment
     Mesh( const Mesh& );
     Mesh& operator=( const Mesh& );
@@ -0,0 +1,330 @@
+/**
+ * @file mesh_optimizer.cpp
+ * @brief Post-load cleanup and memory reordering of meshes for raytracing.
+ */
+#include "lucPCH.h"
+#include "scene/mesh_optimizer.hpp"
+#include "scene/mesh.hpp"
+#include "math/mathUtils.h"
+
+#include <algorithm>
+#include <float.h>
+
+namespace Luc {
+
+// welded vertices must also agree on these, so seams stay intact
+static const real_t NORMAL_TOLERANCE = 1e-3f;
+static const real_t TEXCOORD_TOLERANCE = 1e-5f;
+// a triangle whose edges are more parallel than this sine is degenerate
+static const real_t DEGENERATE_SINE = 1e-7f;
+// bits of the Morton code per axis
+static const uint32_t MORTON_BITS = 10;
+
+MeshOptimizeSettings::MeshOptimizeSettings()
+    : weld_tolerance( 1e-6f ), reorder( true ) { }
+
+uint64_t hash_optimize_settings( const MeshOptimizeSettings& settings, uint64_t hash )
+{
+    hash = Math::FNV1aHash64( &settings.weld_tolerance, sizeof settings.weld_tolerance, hash );
+    hash = Math::FNV1aHash64( &settings.reorder, sizeof settings.reorder, hash );
+    return hash;
+}
+
+namespace {
+
+/*
+ * A set associative data cache with LRU replacement, counting the misses
+ * of a stream of memory accesses. Sized like a typical L1 cache.
+ */
+class CacheSimulator
+{
+public:
+
+    static const size_t LINE_SIZE = 64;
+    static const size_t NUM_WAYS = 8;
+    static const size_t NUM_SETS = 32 * 1024 / ( LINE_SIZE * NUM_WAYS );
+
+    CacheSimulator() : m_time( 0 ), m_misses( 0 )
+    {
+        for ( size_t i = 0; i < NUM_SETS * NUM_WAYS; ++i ) {
+            m_tags[i] = ~uint64_t( 0 );
+            m_last_use[i] = 0;
+        }
+    }
+
+    void access( uint64_t address, size_t size )
+    {
+        for ( uint64_t line = address / LINE_SIZE; line <= ( address + size - 1 ) / LINE_SIZE; ++line )
+            access_line( line );
+    }
+
+    size_t num_misses() const { return m_misses; }
+
+private:
+
+    void access_line( uint64_t line )
+    {
+        size_t set = static_cast< size_t >( line % NUM_SETS ) * NUM_WAYS;
+        size_t victim = set;
+        m_time++;
+        for ( size_t way = set; way < set + NUM_WAYS; ++way ) {
+            if ( m_tags[way] == line ) {
+                m_last_use[way] = m_time;
+                return;
+            }
+            if ( m_last_use[way] < m_last_use[victim] )
+                victim = way;
+        }
+        m_misses++;
+        m_tags[victim] = line;
+        m_last_use[victim] = m_time;
+    }
+
+    uint64_t m_tags[NUM_SETS * NUM_WAYS];
+    uint64_t m_last_use[NUM_SETS * NUM_WAYS];
+    uint64_t m_time;
+    size_t   m_misses;
+};
+
+// spreads the low 10 bits of a value to every third bit
+uint32_t expand_bits( uint32_t v )
+{
+    v = ( v * 0x00010001u ) & 0xFF0000FFu;
+    v = ( v * 0x00000101u ) & 0x0F00F00Fu;
+    v = ( v * 0x00000011u ) & 0xC30C30C3u;
+    v = ( v * 0x00000005u ) & 0x49249249u;
+    return v;
+}
+
+uint32_t morton_code( const Vector3& point, const Vector3& min, const Vector3& inv_extent )
+{
+    static const real_t scale = real_t( ( 1 << MORTON_BITS ) - 1 );
+    uint32_t code = 0;
+    for ( size_t axis = 0; axis < 3; ++axis ) {
+        real_t t = ( point[axis] - min[axis] ) * inv_extent[axis];
+        t = std::max( real_t( 0 ), std::min( t, real_t( 1 ) ) );
+        code |= expand_bits( static_cast< uint32_t >( t * scale ) ) << axis;
+    }
+    return code;
+}
+
+typedef std::pair< uint64_t, uint32_t > KeyIndex;
+
+/*
+ * Triangles sorted along a Morton curve through their centroids, the order
+ * in which traversal tends to visit them.
+ */
+void sort_spatially( const std::vector< MeshVertex >& vertices,
+                     const std::vector< MeshTriangle >& triangles,
+                     std::vector< uint32_t >* order )
+{
+    BoundingBox box;
+    for ( size_t i = 0; i < vertices.size(); ++i )
+        box.filter_vertex( vertices[i].position );
+    Vector3 min = box.get_left_bottom_front_corner();
+    Vector3 extent = box.get_right_top_back_corner() - min;
+    Vector3 inv_extent( extent.x > 0 ? 1 / extent.x : 0,
+                        extent.y > 0 ? 1 / extent.y : 0,
+                        extent.z > 0 ? 1 / extent.z : 0 );
+
+    std::vector< KeyIndex > keys( triangles.size() );
+    for ( size_t i = 0; i < triangles.size(); ++i ) {
+        const MeshTriangle& tri = triangles[i];
+        Vector3 centroid = ( vertices[tri.vertices[0]].position +
+                             vertices[tri.vertices[1]].position +
+                             vertices[tri.vertices[2]].position ) / 3;
+        keys[i] = KeyIndex( morton_code( centroid, min, inv_extent ), static_cast< uint32_t >( i ) );
+    }
+    std::sort( keys.begin(), keys.end() );
+
+    order->resize( keys.size() );
+    for ( size_t i = 0; i < keys.size(); ++i )
+        ( *order )[i] = keys[i].second;
+}
+
+/*
+ * Cache misses of visiting triangles in the given order and fetching
+ * their vertices, with both arrays laid out as they are.
+ */
+size_t count_cache_misses( const std::vector< MeshTriangle >& triangles,
+                           const std::vector< uint32_t >& visit_order )
+{
+    // place the arrays apart, as separate allocations would be
+    static const uint64_t VERTEX_BASE = uint64_t( 1 ) << 40;
+
+    CacheSimulator cache;
+    for ( size_t i = 0; i < visit_order.size(); ++i ) {
+        const MeshTriangle& tri = triangles[visit_order[i]];
+        cache.access( uint64_t( visit_order[i] ) * sizeof( MeshTriangle ), sizeof( MeshTriangle ) );
+        for ( size_t j = 0; j < 3; ++j )
+            cache.access( VERTEX_BASE + uint64_t( tri.vertices[j] ) * sizeof( MeshVertex ), sizeof( MeshVertex ) );
+    }
+    return cache.num_misses();
+}
+
+bool attributes_match( const MeshVertex& a, const MeshVertex& b, real_t tolerance2 )
+{
+    return squared_distance( a.position, b.position ) <= tolerance2 &&
+           squared_distance( a.normal, b.normal ) <= NORMAL_TOLERANCE * NORMAL_TOLERANCE &&
+           squared_distance( a.tex_coord, b.tex_coord ) <= TEXCOORD_TOLERANCE * TEXCOORD_TOLERANCE;
+}
+
+/*
+ * Merges vertices with matching attributes. Vertices are bucketed into
+ * cells as large as the tolerance, so candidates lie in neighboring cells.
+ */
+size_t weld_vertices( std::vector< MeshVertex >& vertices,
+                      std::vector< MeshTriangle >& triangles,
+                      real_t relative_tolerance )
+{
+    static const int CELL_BITS = 21;
+    static const int MAX_CELL = ( 1 << CELL_BITS ) - 1;
+
+    BoundingBox box;
+    for ( size_t i = 0; i < vertices.size(); ++i )
+        box.filter_vertex( vertices[i].position );
+    Vector3 min = box.get_left_bottom_front_corner();
+    real_t diagonal = length( box.get_right_top_back_corner() - min );
+    real_t tolerance = relative_tolerance * diagonal;
+    // cells must not outnumber what a key can address
+    real_t cell_size = std::max( tolerance, std::max( diagonal / MAX_CELL, FLT_MIN ) );
+
+    std::vector< int > cells( vertices.size() * 3 );
+    std::vector< KeyIndex > keys( vertices.size() );
+    for ( size_t i = 0; i < vertices.size(); ++i ) {
+        uint64_t key = 0;
+        for ( size_t axis = 0; axis < 3; ++axis ) {
+            int cell = static_cast< int >( ( vertices[i].position[axis] - min[axis] ) / cell_size );
+            cell = std::max( 0, std::min( cell, MAX_CELL ) );
+            cells[3 * i + axis] = cell;
+            key |= uint64_t( cell ) << ( CELL_BITS * axis );
+        }
+        keys[i] = KeyIndex( key, static_cast< uint32_t >( i ) );
+    }
+    std::sort( keys.begin(), keys.end() );
+
+    // the first vertex of each cluster absorbs the later ones
+    static const uint32_t UNMAPPED = ~0u;
+    std::vector< uint32_t > remap( vertices.size(), UNMAPPED );
+    std::vector< MeshVertex > welded;
+    welded.reserve( vertices.size() );
+    real_t tolerance2 = tolerance * tolerance;
+
+    for ( size_t i = 0; i < vertices.size(); ++i ) {
+        if ( UNMAPPED != remap[i] )
+            continue;
+        uint32_t target = static_cast< uint32_t >( welded.size() );
+        remap[i] = target;
+        welded.push_back( vertices[i] );
+
+        for ( int dz = -1; dz <= 1; ++dz ) {
+            for ( int dy = -1; dy <= 1; ++dy ) {
+                for ( int dx = -1; dx <= 1; ++dx ) {
+                    int cell[3] = { cells[3 * i] + dx, cells[3 * i + 1] + dy, cells[3 * i + 2] + dz };
+                    if ( cell[0] < 0 || cell[1] < 0 || cell[2] < 0 ||
+                         cell[0] > MAX_CELL || cell[1] > MAX_CELL || cell[2] > MAX_CELL )
+                        continue;
+                    uint64_t key = uint64_t( cell[0] ) |
+                                   uint64_t( cell[1] ) << CELL_BITS |
+                                   uint64_t( cell[2] ) << ( 2 * CELL_BITS );
+                    std::vector< KeyIndex >::const_iterator it =
+                        std::lower_bound( keys.begin(), keys.end(), KeyIndex( key, 0 ) );
+                    for ( ; it != keys.end() && it->first == key; ++it ) {
+                        uint32_t j = it->second;
+                        if ( UNMAPPED == remap[j] && attributes_match( vertices[i], vertices[j], tolerance2 ) )
+                            remap[j] = target;
+                    }
+                }
+            }
+        }
+    }
+
+    for ( size_t i = 0; i < triangles.size(); ++i ) {
+        for ( size_t j = 0; j < 3; ++j )
+            triangles[i].vertices[j] = remap[triangles[i].vertices[j]];
+    }
+    size_t num_welded = vertices.size() - welded.size();
+    vertices.swap( welded );
+    return num_welded;
+}
+
+bool is_degenerate( const std::vector< MeshVertex >& vertices, const MeshTriangle& tri )
+{
+    if ( tri.vertices[0] == tri.vertices[1] ||
+         tri.vertices[1] == tri.vertices[2] ||
+         tri.vertices[2] == tri.vertices[0] )
+        return true;
+
+    Vector3 e1 = vertices[tri.vertices[1]].position - vertices[tri.vertices[0]].position;
+    Vector3 e2 = vertices[tri.vertices[2]].position - vertices[tri.vertices[0]].position;
+    // |e1 x e2| = |e1| |e2| sin, compared squared to avoid square roots
+    real_t limit = DEGENERATE_SINE * DEGENERATE_SINE * squared_length( e1 ) * squared_length( e2 );
+    return squared_length( cross( e1, e2 ) ) <= limit;
+}
+
+} // namespace
+
+void optimize_mesh( std::vector< MeshVertex >& vertices,
+                    std::vector< MeshTriangle >& triangles,
+                    const MeshOptimizeSettings& settings,
+                    MeshOptimizeStats* stats )
+{
+    MeshOptimizeStats result = { 0, 0, 0, 0 };
+    if ( vertices.empty() || triangles.empty() ) {
+        if ( stats )
+            *stats = result;
+        return;
+    }
+
+    size_t num_triangles = triangles.size();
+    std::vector< uint32_t > order;
+    sort_spatially( vertices, triangles, &order );
+    result.cache_misses_before = count_cache_misses( triangles, order );
+
+    result.welded_vertices = weld_vertices( vertices, triangles, settings.weld_tolerance );
+
+    std::vector< MeshTriangle > kept;
+    kept.reserve( triangles.size() );
+    for ( size_t i = 0; i < triangles.size(); ++i ) {
+        if ( !is_degenerate( vertices, triangles[i] ) )
+            kept.push_back( triangles[i] );
+    }
+    triangles.swap( kept );
+    result.removed_triangles = num_triangles - triangles.size();
+
+    if ( settings.reorder && !triangles.empty() ) {
+        sort_spatially( vertices, triangles, &order );
+
+        // triangles in curve order, vertices in order of first use;
+        // vertices no triangle uses any more are dropped here
+        static const uint32_t UNUSED = ~0u;
+        std::vector< uint32_t > vertex_map( vertices.size(), UNUSED );
+        std::vector< MeshVertex > sorted_vertices;
+        std::vector< MeshTriangle > sorted_triangles( triangles.size() );
+        sorted_vertices.reserve( vertices.size() );
+        for ( size_t i = 0; i < order.size(); ++i ) {
+            const MeshTriangle& tri = triangles[order[i]];
+            for ( size_t j = 0; j < 3; ++j ) {
+                uint32_t& mapped = vertex_map[tri.vertices[j]];
+                if ( UNUSED == mapped ) {
+                    mapped = static_cast< uint32_t >( sorted_vertices.size() );
+                    sorted_vertices.push_back( vertices[tri.vertices[j]] );
+                }
+                sorted_triangles[i].vertices[j] = mapped;
+            }
+        }
+        vertices.swap( sorted_vertices );
+        triangles.swap( sorted_triangles );
+
+        for ( size_t i = 0; i < order.size(); ++i )
+            order[i] = static_cast< uint32_t >( i );
+    } else {
+        sort_spatially( vertices, triangles, &order );
+    }
+    result.cache_misses_after = count_cache_misses( triangles, order );
+
+    if ( stats )
+        *stats = result;
+}
+
+} /* Luc */
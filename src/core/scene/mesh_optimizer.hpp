@@ -0,0 +1,58 @@
+/**
+ * @file mesh_optimizer.hpp
+ * @brief Post-load cleanup and memory reordering of meshes for raytracing.
+ */
+
+#ifndef _LUC_SCENE_MESH_OPTIMIZER_HPP_
+#define _LUC_SCENE_MESH_OPTIMIZER_HPP_
+
+#include "math/math.hpp"
+
+#include <vector>
+
+namespace Luc {
+
+struct MeshVertex;
+struct MeshTriangle;
+
+struct MeshOptimizeSettings
+{
+    MeshOptimizeSettings();
+
+    // vertices closer than this, relative to the mesh's bounding box
+    // diagonal, and with matching normals and texture coordinates are welded
+    real_t weld_tolerance;
+    // reorder triangles and vertices along a Morton curve
+    bool reorder;
+};
+
+struct MeshOptimizeStats
+{
+    size_t welded_vertices;
+    size_t removed_triangles;
+    // misses of a simulated data cache while visiting the triangles in
+    // spatial order, as traversal does, before and after the pass
+    size_t cache_misses_before;
+    size_t cache_misses_after;
+};
+
+/*
+ * Welds vertices, drops degenerate triangles, and sorts triangles along a
+ * Morton curve through their centroids, with vertices renumbered in order
+ * of first use. Triangles close in space then lie close in memory, and so
+ * do the vertices they reference.
+ */
+void optimize_mesh( std::vector< MeshVertex >& vertices,
+                    std::vector< MeshTriangle >& triangles,
+                    const MeshOptimizeSettings& settings,
+                    MeshOptimizeStats* stats );
+
+/*
+ * Folds the settings into a hash, for files that hold optimized meshes and
+ * go stale when the settings change.
+ */
+uint64_t hash_optimize_settings( const MeshOptimizeSettings& settings, uint64_t hash );
+
+} /* Luc */
+
+#endif /* _LUC_SCENE_MESH_OPTIMIZER_HPP_ */
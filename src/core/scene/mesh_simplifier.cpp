@@ -0,0 +1,224 @@
+/**
+ * @file mesh_simplifier.cpp
+ * @brief Coarse copies of meshes, traced by rays that do not need the detail.
+ */
+#include "lucPCH.h"
+#include "scene/mesh_simplifier.hpp"
+#include "scene/mesh.hpp"
+
+#include <algorithm>
+
+namespace Luc {
+
+// finest grid tried, in cells along the longest side of the mesh
+static const uint32_t MAX_GRID_RESOLUTION = 1 << 20;
+// bisection steps between the last two grids of the coarse search
+static const int GRID_SEARCH_STEPS = 8;
+
+namespace {
+
+struct KeyLess
+{
+    const uint64_t* keys;
+
+    bool operator()( uint32_t a, uint32_t b ) const
+    {
+        return keys[a] < keys[b];
+    }
+};
+
+// orders triangles by their vertices in ascending order, so copies with any
+// winding end up next to each other
+struct CornersLess
+{
+    const MeshTriangle* corners;
+
+    bool operator()( uint32_t a, uint32_t b ) const
+    {
+        const unsigned int* x = corners[a].vertices;
+        const unsigned int* y = corners[b].vertices;
+        if ( x[0] != y[0] ) return x[0] < y[0];
+        if ( x[1] != y[1] ) return x[1] < y[1];
+        return x[2] < y[2];
+    }
+};
+
+/*
+ * The vertices grouped into the cells of one grid, and the triangles that
+ * survive between the groups.
+ */
+struct Clustering
+{
+    // group of each vertex, numbered in order of the cells
+    std::vector< uint32_t > cluster;
+    size_t num_clusters;
+    // surviving triangles, over groups
+    std::vector< MeshTriangle > triangles;
+};
+
+void cluster_vertices( const std::vector< MeshVertex >& vertices,
+                       const std::vector< MeshTriangle >& triangles,
+                       const BoundingBox& bounds, uint32_t resolution, Clustering* clustering )
+{
+    Vector3 lo = bounds.get_left_bottom_front_corner();
+    Vector3 extent = bounds.get_right_top_back_corner() - lo;
+    real_t cell_size = std::max( extent.x, std::max( extent.y, extent.z ) ) / resolution;
+    real_t inv_cell_size = cell_size > 0 ? 1 / cell_size : 0;
+
+    // cell of every vertex, 21 bits per axis
+    std::vector< uint64_t > keys( vertices.size() );
+    std::vector< uint32_t > order( vertices.size() );
+    for ( size_t i = 0; i < vertices.size(); ++i ) {
+        Vector3 cell = ( vertices[i].position - lo ) * inv_cell_size;
+        uint64_t x = std::min< uint64_t >( static_cast< uint64_t >( cell.x ), resolution );
+        uint64_t y = std::min< uint64_t >( static_cast< uint64_t >( cell.y ), resolution );
+        uint64_t z = std::min< uint64_t >( static_cast< uint64_t >( cell.z ), resolution );
+        keys[i] = ( x << 42 ) | ( y << 21 ) | z;
+        order[i] = static_cast< uint32_t >( i );
+    }
+    KeyLess key_less = { &keys[0] };
+    std::sort( order.begin(), order.end(), key_less );
+
+    clustering->cluster.resize( vertices.size() );
+    clustering->num_clusters = 0;
+    for ( size_t i = 0; i < order.size(); ++i ) {
+        if ( i > 0 && keys[order[i]] != keys[order[i - 1]] )
+            clustering->num_clusters++;
+        clustering->cluster[order[i]] = static_cast< uint32_t >( clustering->num_clusters );
+    }
+    clustering->num_clusters++;
+
+    // drop the triangles that collapsed to an edge or a point
+    std::vector< MeshTriangle >& result = clustering->triangles;
+    std::vector< MeshTriangle > corners;
+    result.clear();
+    for ( size_t i = 0; i < triangles.size(); ++i ) {
+        MeshTriangle triangle;
+        for ( size_t j = 0; j < 3; ++j ) {
+            triangle.vertices[j] = clustering->cluster[triangles[i].vertices[j]];
+        }
+        const unsigned int* v = triangle.vertices;
+        if ( v[0] == v[1] || v[1] == v[2] || v[2] == v[0] )
+            continue;
+        result.push_back( triangle );
+
+        MeshTriangle sorted = triangle;
+        std::sort( sorted.vertices, sorted.vertices + 3 );
+        corners.push_back( sorted );
+    }
+
+    // and all but the first of the triangles over the same groups
+    std::vector< uint32_t > triangle_order( result.size() );
+    for ( size_t i = 0; i < triangle_order.size(); ++i ) {
+        triangle_order[i] = static_cast< uint32_t >( i );
+    }
+    if ( result.empty() )
+        return;
+    CornersLess corners_less = { &corners[0] };
+    std::sort( triangle_order.begin(), triangle_order.end(), corners_less );
+    std::vector< bool > keep( result.size(), true );
+    for ( size_t i = 1; i < triangle_order.size(); ++i ) {
+        if ( !corners_less( triangle_order[i - 1], triangle_order[i] ) )
+            keep[triangle_order[i]] = false;
+    }
+    size_t count = 0;
+    for ( size_t i = 0; i < result.size(); ++i ) {
+        if ( keep[i] )
+            result[count++] = result[i];
+    }
+    result.resize( count );
+}
+
+} // namespace
+
+real_t simplify_mesh( const std::vector< MeshVertex >& vertices,
+                      const std::vector< MeshTriangle >& triangles,
+                      size_t target_triangles,
+                      std::vector< MeshVertex >* out_vertices,
+                      std::vector< MeshTriangle >* out_triangles )
+{
+    out_vertices->clear();
+    out_triangles->clear();
+    if ( vertices.empty() || triangles.empty() )
+        return 0;
+
+    BoundingBox bounds;
+    for ( size_t i = 0; i < vertices.size(); ++i ) {
+        bounds.filter_vertex( vertices[i].position );
+    }
+
+    // double the grid until it keeps too many triangles, then bisect
+    // between the last two for the finest that does not
+    Clustering clustering, best;
+    uint32_t coarse = 1, fine = 1;
+    cluster_vertices( vertices, triangles, bounds, coarse, &best );
+    while ( best.triangles.size() <= target_triangles && fine < MAX_GRID_RESOLUTION ) {
+        fine *= 2;
+        cluster_vertices( vertices, triangles, bounds, fine, &clustering );
+        if ( clustering.triangles.size() > target_triangles )
+            break;
+        coarse = fine;
+        std::swap( best.cluster, clustering.cluster );
+        std::swap( best.triangles, clustering.triangles );
+        best.num_clusters = clustering.num_clusters;
+    }
+    for ( int step = 0; step < GRID_SEARCH_STEPS && fine - coarse > 1; ++step ) {
+        uint32_t mid = coarse + ( fine - coarse ) / 2;
+        cluster_vertices( vertices, triangles, bounds, mid, &clustering );
+        if ( clustering.triangles.size() > target_triangles ) {
+            fine = mid;
+            continue;
+        }
+        coarse = mid;
+        std::swap( best.cluster, clustering.cluster );
+        std::swap( best.triangles, clustering.triangles );
+        best.num_clusters = clustering.num_clusters;
+    }
+
+    // every group becomes the average of its vertices
+    std::vector< MeshVertex > sums( best.num_clusters );
+    std::vector< uint32_t > counts( best.num_clusters, 0 );
+    for ( size_t i = 0; i < best.num_clusters; ++i ) {
+        sums[i].position = Vector3::Zero;
+        sums[i].normal = Vector3::Zero;
+        sums[i].tex_coord = Vector2::Zero;
+    }
+    for ( size_t i = 0; i < vertices.size(); ++i ) {
+        MeshVertex& sum = sums[best.cluster[i]];
+        sum.position += vertices[i].position;
+        sum.normal += vertices[i].normal;
+        sum.tex_coord += vertices[i].tex_coord;
+        counts[best.cluster[i]]++;
+    }
+
+    // keep only the groups some triangle uses
+    std::vector< uint32_t > remap( best.num_clusters, ~0u );
+    for ( size_t i = 0; i < best.triangles.size(); ++i ) {
+        MeshTriangle triangle = best.triangles[i];
+        for ( size_t j = 0; j < 3; ++j ) {
+            uint32_t& index = remap[triangle.vertices[j]];
+            if ( ~0u == index ) {
+                index = static_cast< uint32_t >( out_vertices->size() );
+                MeshVertex vertex = sums[triangle.vertices[j]];
+                real_t inv_count = real_t( 1 ) / counts[triangle.vertices[j]];
+                vertex.position *= inv_count;
+                vertex.tex_coord *= inv_count;
+                real_t normal_length = length( vertex.normal );
+                vertex.normal = normal_length > 0 ? vertex.normal / normal_length : Vector3::UnitZ;
+                out_vertices->push_back( vertex );
+            }
+            triangle.vertices[j] = index;
+        }
+        out_triangles->push_back( triangle );
+    }
+
+    real_t error = 0;
+    for ( size_t i = 0; i < vertices.size(); ++i ) {
+        uint32_t index = remap[best.cluster[i]];
+        if ( ~0u != index )
+            error = std::max( error, length( vertices[i].position - ( *out_vertices )[index].position ) );
+    }
+    return error;
+}
+
+} /* Luc */
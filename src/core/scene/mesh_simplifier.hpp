@@ -0,0 +1,42 @@
+/**
+ * @file mesh_simplifier.hpp
+ * @brief Coarse copies of meshes, traced by rays that do not need the detail.
+ */
+
+#ifndef _LUC_SCENE_MESH_SIMPLIFIER_HPP_
+#define _LUC_SCENE_MESH_SIMPLIFIER_HPP_
+
+#include "math/math.hpp"
+
+#include <vector>
+
+namespace Luc {
+
+struct MeshVertex;
+struct MeshTriangle;
+
+/*
+ * Simplifies a mesh by vertex clustering (Rossignac and Borrel, "Multi-
+ * resolution 3D approximations for rendering complex scenes"): the vertices
+ * in each cell of a uniform grid merge into their average, and triangles
+ * that collapse, or become copies of others, are dropped. The grid is the
+ * finest whose result has at most target_triangles triangles.
+ *
+ * It keeps neither topology nor texture seams, which is fine for what only
+ * reflections, refractions and shadows see. Every grid it tries costs a
+ * sort of the vertices.
+ *
+ * @param target_triangles  Most triangles of the result.
+ * @param out_vertices[out] Vertices of the result, with normalized normals.
+ * @param out_triangles[out] Triangles of the result.
+ * @return The farthest any vertex moved, in the units of the mesh.
+ */
+real_t simplify_mesh( const std::vector< MeshVertex >& vertices,
+                      const std::vector< MeshTriangle >& triangles,
+                      size_t target_triangles,
+                      std::vector< MeshVertex >* out_vertices,
+                      std::vector< MeshTriangle >* out_triangles );
+
+} /* Luc */
+
+#endif /* _LUC_SCENE_MESH_SIMPLIFIER_HPP_ */
@@ -9,9 +9,12 @@
 #include "app/raycasting.hpp"
 #include "scene/model.hpp"
 #include "scene/material.hpp"
+#include "scene/trace_counters.hpp"
 #include "math/ray.hpp"
 
 #include <GL/gl.h>
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <cstring>
 #include <fstream>
@@ -29,7 +32,7 @@ void Model::render() const
         return;
     if ( material )
         material->set_gl_state();
-    mesh->render();
+    mesh->render( material ? &material->ambient : 0 );
     if ( material )
         material->reset_gl_state();
 }
@@ -45,6 +48,9 @@ bool Model::ray_casting(const Ray&      line,
     if (m_bounding_box.IsEmpty())
         build_bounding_box();
 
+    TraceCounters* counters = get_trace_counters();
+    if (counters)
+        counters->boxes++;
     if (!m_bounding_box.ray_casting(line, tMin, tMax, t))
         return false;
 
@@ -54,69 +60,86 @@ bool Model::ray_casting(const Ray&      line,
     Ray local_ray( (m_invTransformMat * linePosV4).xyz(),
                    (m_invTransformMatWithoutTranslation * lineDirV4).xyz() );
 
-    const MeshTriangle* triangles = mesh->get_triangles();
-    const MeshVertex*   vertices  = mesh->get_vertices();
-    float closest_t = tMax+1;
-    size_t closest_triangle_index = 0;
-    float closest_triangle_beta  = 0;
-    float closest_triangle_gamma = 0;
-
-    // find closest hit point
-    for (size_t i=0; i<mesh->num_triangles(); i++)
+    // rays that allow it trace the proxy, past the distance it strays from
+    // the mesh, so they do not hit it where they leave the mesh's surface
+    const Mesh* traced = mesh;
+    real_t t_start = tMin;
+    if (line.UseProxy() && mesh->get_proxy())
     {
-        Vector3 p0 = vertices[triangles[i].vertices[0]].position;
-        Vector3 p1 = vertices[triangles[i].vertices[1]].position;
-        Vector3 p2 = vertices[triangles[i].vertices[2]].position;
-        float current_t = 0;
-        float beta, gamma;
-        if (ray_casting_triangle(local_ray, p0, p1, p2, tMin, tMax, current_t, beta, gamma))
-            if (current_t > tMin && current_t < tMax)
-            {
-                if (closest_t>current_t)
-                {
-                    closest_t =  current_t;
-                    closest_triangle_beta  = beta;
-                    closest_triangle_gamma = gamma;
-                    closest_triangle_index = i;
-                }
-            }
+        traced = mesh->get_proxy();
+        real_t max_scale = std::max(fabs(scale.x), std::max(fabs(scale.y), fabs(scale.z)));
+        t_start = std::max(tMin, mesh->get_proxy_error() * max_scale);
+        if (t_start >= tMax)
+            return false;
     }
-    if (closest_t > tMax)
+
+    // find closest hit point
+    MeshHit hit;
+    if (!traced->intersect(local_ray, t_start, tMax, &hit))
         return false;
 
-    t = closest_t;
+    t = hit.t;
 
     // compute mesh_vertex normal and materials
     hit_vertex.ambient = material->ambient;
     hit_vertex.diffuse = material->diffuse;
     hit_vertex.refractive_index = material->refractive_index;
     hit_vertex.specular = material->specular;
+    hit_vertex.occlusion = traced->get_hit_occlusion(hit);
 
-    // normal and position
-    MeshVertex v0 = vertices[triangles[closest_triangle_index].vertices[0]];
-    MeshVertex v1 = vertices[triangles[closest_triangle_index].vertices[1]];
-    MeshVertex v2 = vertices[triangles[closest_triangle_index].vertices[2]];
-
-    hit_vertex.normal  = barycentric_interpolation(v0.normal, v1.normal, v2.normal, closest_triangle_beta, closest_triangle_gamma);
-    hit_vertex.position = barycentric_interpolation(v0.position, v1.position, v2.position, closest_triangle_beta, closest_triangle_gamma);
+    // normal, position and texture coordinates
+    MeshVertex vertex = traced->get_hit_vertex(local_ray, hit);
 
     // transform to global coordinates
-    hit_vertex.position = (m_transformatMat * Vector4(hit_vertex.position, 1)).xyz();
-    hit_vertex.normal   = normalize(m_normalMatrix * hit_vertex.normal);
+    hit_vertex.position = (m_transformatMat * Vector4(vertex.position, 1)).xyz();
+    hit_vertex.normal   = normalize(m_normalMatrix * vertex.normal);
 
-    // texture color
-    Vector2 tex_coord;
-    tex_coord.x = barycentric_interpolation(v0.tex_coord.x, v1.tex_coord.x, v2.tex_coord.x, closest_triangle_beta, closest_triangle_gamma);
-    tex_coord.y = barycentric_interpolation(v0.tex_coord.y, v1.tex_coord.y, v2.tex_coord.y, closest_triangle_beta, closest_triangle_gamma);
+    hit_vertex.has_differential = line.HasDifferential();
+    if (!hit_vertex.has_differential)
+    {
+        // texture color
+        hit_vertex.tex_color = interpolate_texture_color(vertex.tex_coord, material);
+        return true;
+    }
+
+    // footprint of the pixel on the mesh, then in the mesh's coordinates
+    transfer_ray_differential(line, t, hit_vertex.normal, hit_vertex.dpdx, hit_vertex.dpdy);
+    Vector3 dpdx = (m_invTransformMatWithoutTranslation * Vector4(hit_vertex.dpdx, 1)).xyz();
+    Vector3 dpdy = (m_invTransformMatWithoutTranslation * Vector4(hit_vertex.dpdy, 1)).xyz();
+    MeshHitDifferential differential = traced->get_hit_differential(hit, dpdx, dpdy);
+    hit_vertex.dndx = m_normalMatrix * differential.dndx;
+    hit_vertex.dndy = m_normalMatrix * differential.dndy;
 
-    hit_vertex.tex_color = interpolate_texture_color(tex_coord, material);
+    // texture color, filtered over the footprint
+    hit_vertex.tex_color = interpolate_texture_color(vertex.tex_coord, material,
+                                                     differential.dtdx, differential.dtdy);
 
     return true;
 }
 
+BoundingBox Model::get_world_bounds()
+{
+    if (m_bounding_box.IsEmpty())
+        build_bounding_box();
+    return m_bounding_box;
+}
+
+bool Model::is_refractive() const
+{
+    return material && material->refractive_index != 0;
+}
+
 void Model::build_bounding_box()
 {
     std::cout << "Start build bounding box..." << std::endl;
+    if (mesh->is_out_of_core() || mesh->is_subdivided())
+    {
+        // transform the corners of the local box instead of paging in every
+        // vertex, or because a curved surface bulges past its vertices
+        m_bounding_box = transform_bounds(mesh->get_bounds());
+        std::cout << "finished building bounding box" << std::endl;
+        return;
+    }
     size_t num_vert = mesh->num_vertices();
     const MeshVertex* mVeretx = mesh->get_vertices();
     for (size_t i=0; i<num_vert; ++i)
@@ -40,6 +40,10 @@ public:
                              float&          t, 
                              HitVertexInfor& hit_vertex) ;
 
+    virtual BoundingBox get_world_bounds();
+
+    virtual bool is_refractive() const;
+
     /* build bounding box for this model.
      * This method only exist in Model, not in Sphere or Triangle, since they 
      * are too simple that need not to use bounding box to be optimized.
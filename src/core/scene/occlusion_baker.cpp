@@ -0,0 +1,314 @@
+/**
+ * @file occlusion_baker.cpp
+ * @brief Ambient occlusion baked into the vertices of meshes and triangles.
+ */
+#include "lucPCH.h"
+#include "scene/occlusion_baker.hpp"
+#include "scene/mesh.hpp"
+#include "scene/scene.hpp"
+#include "scene/triangle.hpp"
+#include "files/fileutils.h"
+#include "math/mathUtils.h"
+#include "math/ray.hpp"
+#include "math/sampler.hpp"
+
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <SDL/SDL_timer.h>
+
+namespace Luc {
+
+// bump whenever the baking changes in a way the settings do not show
+static const uint32_t OCCLUSION_CACHE_VERSION = 1;
+static const char OCCLUSION_CACHE_MAGIC[8] = { 'L', 'U', 'C', 'A', 'O', 0, 0, 0 };
+// vertices handed to a thread at a time
+static const size_t OCCLUSION_CHUNK_SIZE = 256;
+
+/*
+ * Header of a cache file, followed by one float per vertex.
+ */
+struct OcclusionCacheHeader
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t value_size;
+    uint64_t key;
+    uint64_t num_vertices;
+};
+
+namespace {
+
+// the vertices of a mesh, against the mesh itself in its local space
+struct MeshSource
+{
+    const Mesh* mesh;
+
+    void get_vertex( size_t index, Vector3* position, Vector3* normal ) const
+    {
+        MeshVertex vertex = mesh->get_vertex( index );
+        *position = vertex.position;
+        *normal = vertex.normal;
+    }
+
+    bool is_occluded( const Ray& ray, real_t t_min, real_t t_max ) const
+    {
+        MeshHit hit;
+        return mesh->intersect( ray, t_min, t_max, &hit );
+    }
+};
+
+// the three vertices of every triangle, against the whole scene
+struct TriangleSource
+{
+    const Triangle* const* triangles;
+    const Acceleration* acceleration;
+
+    void get_vertex( size_t index, Vector3* position, Vector3* normal ) const
+    {
+        const Triangle* triangle = triangles[index / 3];
+        const Triangle::Vertex& vertex = triangle->vertices[index % 3];
+        *position = ( triangle->m_transformatMat * Vector4( vertex.position, 1 ) ).xyz();
+        *normal = triangle->m_normalMatrix * vertex.normal;
+    }
+
+    bool is_occluded( const Ray& ray, real_t t_min, real_t t_max ) const
+    {
+        real_t t;
+        HitVertexInfor hit_vertex;
+        return acceleration->intersect( ray, t_min, t_max, t, hit_vertex );
+    }
+};
+
+// the vertices of one bake, handed out a chunk at a time
+template< class Source >
+struct OcclusionBake
+{
+    Source source;
+    size_t num_vertices;
+    unsigned int samples;
+    // rays start this far off the surface, and count hits up to distance
+    real_t epsilon;
+    real_t distance;
+    float* occlusion;
+
+    boost::mutex mutex;
+    size_t next_vertex;
+
+    bool acquire( size_t* begin, size_t* end )
+    {
+        boost::mutex::scoped_lock lock( mutex );
+        if ( next_vertex >= num_vertices )
+            return false;
+        *begin = next_vertex;
+        next_vertex = std::min( next_vertex + OCCLUSION_CHUNK_SIZE, num_vertices );
+        *end = next_vertex;
+        return true;
+    }
+
+    void bake_vertex( size_t index )
+    {
+        Vector3 position, normal;
+        source.get_vertex( index, &position, &normal );
+        real_t normal_length = length( normal );
+        if ( normal_length <= 0 ) {
+            occlusion[index] = 1;
+            return;
+        }
+        normal = normal / normal_length;
+        Vector3 tangent = fabs( normal.x ) > 0.5f ? Vector3::UnitY : Vector3::UnitX;
+        tangent = normalize( cross( tangent, normal ) );
+        Vector3 bitangent = cross( normal, tangent );
+        Vector3 origin = position + normal * epsilon;
+
+        // cosine distributed rays, stratified by the (0,2)-sequence
+        uint32_t seed = static_cast< uint32_t >( index ) * 0x9E3779B9u;
+        unsigned int open = 0;
+        for ( unsigned int i = 0; i < samples; ++i ) {
+            Vector2 u = sample_02_sequence( i, seed );
+            real_t r = sqrt( u.x );
+            real_t phi = 2 * PI * u.y;
+            Vector3 direction = tangent * ( r * cos( phi ) ) + bitangent * ( r * sin( phi ) ) +
+                                normal * sqrt( std::max< real_t >( 0, 1 - u.x ) );
+            if ( !source.is_occluded( Ray( origin, direction ), epsilon, distance ) )
+                open++;
+        }
+        occlusion[index] = static_cast< float >( open ) / samples;
+    }
+};
+
+template< class Source >
+struct OcclusionWorker
+{
+    OcclusionBake< Source >* bake;
+
+    void operator()() const
+    {
+        size_t begin, end;
+        while ( bake->acquire( &begin, &end ) ) {
+            for ( size_t i = begin; i < end; ++i ) {
+                bake->bake_vertex( i );
+            }
+        }
+    }
+};
+
+template< class Source >
+void run_bake( OcclusionBake< Source >& bake, size_t num_threads )
+{
+    bake.next_vertex = 0;
+    OcclusionWorker< Source > worker = { &bake };
+    boost::thread_group threads;
+    for ( size_t i = 1; i < num_threads; ++i )
+        threads.create_thread( worker );
+    worker();
+    threads.join_all();
+}
+
+real_t get_diagonal( const BoundingBox& bounds )
+{
+    return length( bounds.get_right_top_back_corner() - bounds.get_left_bottom_front_corner() );
+}
+
+} // namespace
+
+OcclusionSettings::OcclusionSettings() : samples( 0 ), distance( 0 ) { }
+
+uint64_t hash_occlusion_settings( const OcclusionSettings& settings, uint64_t hash )
+{
+    hash = Math::FNV1aHash64( &OCCLUSION_CACHE_VERSION, sizeof OCCLUSION_CACHE_VERSION, hash );
+    hash = Math::FNV1aHash64( &settings.samples, sizeof settings.samples, hash );
+    hash = Math::FNV1aHash64( &settings.distance, sizeof settings.distance, hash );
+    return hash;
+}
+
+void bake_mesh_occlusion( const Mesh& mesh, const OcclusionSettings& settings, size_t num_threads,
+                          std::vector< float >* occlusion )
+{
+    occlusion->assign( mesh.num_vertices(), 1.0f );
+    if ( 0 == settings.samples || occlusion->empty() )
+        return;
+
+    real_t size = get_diagonal( mesh.get_bounds() );
+    OcclusionBake< MeshSource > bake;
+    bake.source.mesh = &mesh;
+    bake.num_vertices = occlusion->size();
+    bake.samples = settings.samples;
+    bake.epsilon = std::max( size * 1e-5f, 1e-6f );
+    bake.distance = settings.distance > 0 ? settings.distance : 0.25f * size;
+    bake.occlusion = &( *occlusion )[0];
+
+    unsigned int start_time = SDL_GetTicks();
+    run_bake( bake, num_threads );
+    std::cout << "Baked ambient occlusion of '" << mesh.filename << "' (" << occlusion->size()
+              << " vertices) in " << SDL_GetTicks() - start_time << " milliseconds.\n";
+}
+
+void bake_triangle_occlusion( Scene* scene, const OcclusionSettings& settings, size_t num_threads )
+{
+    Geometry* const* geometries = scene->get_geometries();
+    size_t geometry_count = scene->num_geometries();
+    std::vector< Triangle* > triangles;
+    BoundingBox scene_bounds;
+    for ( size_t i = 0; i < geometry_count; ++i ) {
+        geometries[i]->build_inverse_transformation_matrix();
+        scene_bounds.merge( geometries[i]->get_world_bounds() );
+        if ( Triangle* triangle = dynamic_cast< Triangle* >( geometries[i] ) )
+            triangles.push_back( triangle );
+    }
+    if ( 0 == settings.samples || triangles.empty() )
+        return;
+
+    boost::scoped_ptr< Acceleration > acceleration( Acceleration::create( scene->acceleration ) );
+    acceleration->build( geometries, geometry_count );
+
+    real_t size = get_diagonal( scene_bounds );
+    std::vector< float > occlusion( 3 * triangles.size() );
+    OcclusionBake< TriangleSource > bake;
+    bake.source.triangles = &triangles[0];
+    bake.source.acceleration = acceleration.get();
+    bake.num_vertices = occlusion.size();
+    bake.samples = settings.samples;
+    bake.epsilon = std::max( size * 1e-5f, 1e-6f );
+    bake.distance = settings.distance > 0 ? settings.distance : 0.25f * size;
+    bake.occlusion = &occlusion[0];
+
+    unsigned int start_time = SDL_GetTicks();
+    run_bake( bake, num_threads );
+    for ( size_t i = 0; i < occlusion.size(); ++i ) {
+        triangles[i / 3]->vertices[i % 3].occlusion = occlusion[i];
+    }
+    std::cout << "Baked ambient occlusion of " << triangles.size() << " triangles in "
+              << SDL_GetTicks() - start_time << " milliseconds.\n";
+}
+
+bool load_occlusion( const std::string& source, uint64_t key, size_t num_vertices,
+                     std::vector< float >* occlusion )
+{
+    std::string path = source + ".ao";
+    FILE* fp = fopen( path.c_str(), "rb" );
+    if ( !fp )
+        return false;
+
+    OcclusionCacheHeader header;
+    bool ok = fread( &header, sizeof header, 1, fp ) == 1 &&
+              0 == memcmp( header.magic, OCCLUSION_CACHE_MAGIC, sizeof OCCLUSION_CACHE_MAGIC ) &&
+              header.version == OCCLUSION_CACHE_VERSION &&
+              header.value_size == sizeof( float ) &&
+              header.key == key &&
+              header.num_vertices == num_vertices;
+    if ( ok ) {
+        occlusion->resize( num_vertices );
+        ok = 0 == num_vertices || fread( &( *occlusion )[0], sizeof( float ), num_vertices, fp ) == num_vertices;
+    }
+    fclose( fp );
+
+    if ( !ok ) {
+        std::cout << "Ignoring stale ambient occlusion cache file '" << path << "'.\n";
+        occlusion->clear();
+        return false;
+    }
+    std::cout << "Read ambient occlusion of '" << source << "' from '" << path << "'.\n";
+    return true;
+}
+
+bool save_occlusion( const std::string& source, uint64_t key, const std::vector< float >& occlusion )
+{
+    std::string path = source + ".ao";
+    std::string tmp_path = path + ".tmp";
+
+    FILE* fp = fopen( tmp_path.c_str(), "wb" );
+    if ( !fp ) {
+        std::cout << "Cannot write ambient occlusion cache file '" << tmp_path << "'.\n";
+        return false;
+    }
+
+    OcclusionCacheHeader header;
+    memset( &header, 0, sizeof header );
+    memcpy( header.magic, OCCLUSION_CACHE_MAGIC, sizeof OCCLUSION_CACHE_MAGIC );
+    header.version = OCCLUSION_CACHE_VERSION;
+    header.value_size = sizeof( float );
+    header.key = key;
+    header.num_vertices = occlusion.size();
+
+    bool ok = fwrite( &header, sizeof header, 1, fp ) == 1 &&
+              ( occlusion.empty() ||
+                fwrite( &occlusion[0], sizeof( float ), occlusion.size(), fp ) == occlusion.size() );
+    ok = ( 0 == fclose( fp ) ) && ok;
+
+    ok = ok && ReplaceExistingFile( tmp_path, path );
+    if ( !ok ) {
+        std::cout << "Error writing ambient occlusion cache file '" << path << "'.\n";
+        remove( tmp_path.c_str() );
+        return false;
+    }
+
+    std::cout << "Saved ambient occlusion of '" << source << "' to '" << path << "'.\n";
+    return true;
+}
+
+} /* Luc */
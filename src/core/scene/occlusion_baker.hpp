@@ -0,0 +1,80 @@
+/**
+ * @file occlusion_baker.hpp
+ * @brief Ambient occlusion baked into the vertices of meshes and triangles.
+ */
+
+#ifndef _LUC_SCENE_OCCLUSION_BAKER_HPP_
+#define _LUC_SCENE_OCCLUSION_BAKER_HPP_
+
+#include "math/vector.hpp"
+
+#include <string>
+#include <vector>
+
+namespace Luc {
+
+class Mesh;
+class Scene;
+
+struct OcclusionSettings
+{
+    OcclusionSettings();
+
+    // rays per vertex, 0 to bake nothing
+    unsigned int samples;
+    // occluders farther than this do not count, in the units of what is
+    // baked, or 0 for a quarter of its size
+    real_t distance;
+};
+
+/*
+ * Ambient occlusion is the share of the hemisphere over a point that is
+ * open, weighted by the cosine: 1 in the open, 0 fully enclosed. It only
+ * depends on geometry, so it is baked once, per vertex, from cosine
+ * distributed rays on every core, and then darkens the ambient light of
+ * both the OpenGL view and the raytracer for as long as the scene runs.
+ *
+ * Meshes are baked alone in their local space, so the occlusion goes along
+ * with every model of them, and stays valid while the models move. It is
+ * cached next to the mesh file ("models/cube.obj.ao"), keyed by a content
+ * hash of the mesh and the settings. The triangles of a scene never move,
+ * and are baked in world space against everything in the scene.
+ */
+
+/*
+ * Bakes the occlusion of the vertices of a resident mesh, with the rays
+ * spread over the threads.
+ * @param occlusion[out]    One value per vertex.
+ */
+void bake_mesh_occlusion( const Mesh& mesh, const OcclusionSettings& settings, size_t num_threads,
+                          std::vector< float >* occlusion );
+
+/*
+ * Bakes the occlusion of the vertices of every triangle of a scene, after
+ * its meshes are loaded.
+ */
+void bake_triangle_occlusion( Scene* scene, const OcclusionSettings& settings, size_t num_threads );
+
+/*
+ * Reads the cached occlusion of a mesh file.
+ * @param key       Content hash, see hash_occlusion_settings.
+ * @return true on a cache hit with num_vertices values.
+ */
+bool load_occlusion( const std::string& source, uint64_t key, size_t num_vertices,
+                     std::vector< float >* occlusion );
+
+/*
+ * Writes the occlusion of a mesh file to the cache.
+ * @return true on success.
+ */
+bool save_occlusion( const std::string& source, uint64_t key, const std::vector< float >& occlusion );
+
+/*
+ * Folds the settings and the cache format version into a content hash, so
+ * a change of either invalidates existing cache files.
+ */
+uint64_t hash_occlusion_settings( const OcclusionSettings& settings, uint64_t hash );
+
+} /* Luc */
+
+#endif /* _LUC_SCENE_OCCLUSION_BAKER_HPP_ */
@@ -0,0 +1,215 @@
+/**
+ * @file out_of_core_mesh.cpp
+ * @brief Mesh data and hierarchy paged in from disk on demand.
+ */
+#include "lucPCH.h"
+#include "scene/out_of_core_mesh.hpp"
+#include "files/fileutils.h"
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+namespace Luc {
+
+// bump whenever the layout of the file changes
+static const uint32_t OOC_MESH_VERSION = 2;
+static const char OOC_MESH_MAGIC[8] = { 'L', 'U', 'C', 'O', 'O', 'C', 0, 0 };
+
+enum OutOfCoreMeshFlags
+{
+    OOC_HAS_NORMALS = 1 << 0,
+    OOC_HAS_TCOORDS = 1 << 1
+};
+
+/*
+ * Header of an out-of-core mesh file, followed by the node, triangle and
+ * vertex arrays. 64 bytes, so the node array stays 32-byte aligned.
+ */
+struct OutOfCoreMeshHeader
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint64_t source_size;
+    uint64_t source_time;
+    uint64_t num_nodes;
+    uint64_t num_triangles;
+    uint64_t num_vertices;
+    uint64_t settings_key;
+};
+
+OutOfCoreMesh::OutOfCoreMesh()
+    : m_num_vertices( 0 ), m_num_triangles( 0 ), m_num_nodes( 0 ),
+      m_vertex_offset( 0 ), m_triangle_offset( 0 ), m_node_offset( 0 ),
+      m_has_normals( false ), m_has_tcoords( false ) { }
+
+OutOfCoreMesh::~OutOfCoreMesh() { }
+
+bool OutOfCoreMesh::write( const std::string& path, uint64_t source_size, uint64_t source_time,
+                           uint64_t settings_key, const MeshVertex* vertices, size_t num_vertices,
+                           const MeshTriangle* triangles, size_t num_triangles,
+                           const Bvh& bvh, bool has_normals, bool has_tcoords )
+{
+    assert( bvh.num_indices() == num_triangles );
+
+    // triangles in leaf order, vertices renumbered by first use
+    static const unsigned int UNUSED = ~0u;
+    std::vector< unsigned int > vertex_map( num_vertices, UNUSED );
+    std::vector< unsigned int > vertex_order;
+    std::vector< MeshTriangle > ordered_triangles( num_triangles );
+    vertex_order.reserve( num_vertices );
+
+    const uint32_t* indices = bvh.get_indices();
+    for ( size_t i = 0; i < num_triangles; ++i ) {
+        const MeshTriangle& tri = triangles[indices[i]];
+        for ( size_t j = 0; j < 3; ++j ) {
+            unsigned int& mapped = vertex_map[tri.vertices[j]];
+            if ( UNUSED == mapped ) {
+                mapped = static_cast< unsigned int >( vertex_order.size() );
+                vertex_order.push_back( tri.vertices[j] );
+            }
+            ordered_triangles[i].vertices[j] = mapped;
+        }
+    }
+
+    std::string tmp_path = path + ".tmp";
+    FILE* fp = fopen( tmp_path.c_str(), "wb" );
+    if ( !fp ) {
+        std::cout << "Cannot write out-of-core mesh file '" << tmp_path << "'.\n";
+        return false;
+    }
+
+    OutOfCoreMeshHeader header;
+    memset( &header, 0, sizeof header );
+    memcpy( header.magic, OOC_MESH_MAGIC, sizeof OOC_MESH_MAGIC );
+    header.version = OOC_MESH_VERSION;
+    header.flags = ( has_normals ? OOC_HAS_NORMALS : 0 ) | ( has_tcoords ? OOC_HAS_TCOORDS : 0 );
+    header.source_size = source_size;
+    header.source_time = source_time;
+    header.num_nodes = bvh.num_nodes();
+    header.num_triangles = num_triangles;
+    header.num_vertices = vertex_order.size();
+    header.settings_key = settings_key;
+
+    bool ok = fwrite( &header, sizeof header, 1, fp ) == 1 &&
+              fwrite( bvh.get_nodes(), sizeof( BvhNode ), bvh.num_nodes(), fp ) == bvh.num_nodes() &&
+              fwrite( &ordered_triangles[0], sizeof( MeshTriangle ), num_triangles, fp ) == num_triangles;
+    for ( size_t i = 0; ok && i < vertex_order.size(); ++i ) {
+        ok = fwrite( &vertices[vertex_order[i]], sizeof( MeshVertex ), 1, fp ) == 1;
+    }
+    ok = ( 0 == fclose( fp ) ) && ok;
+
+    ok = ok && ReplaceExistingFile( tmp_path, path );
+    if ( !ok ) {
+        std::cout << "Error writing out-of-core mesh file '" << path << "'.\n";
+        remove( tmp_path.c_str() );
+        return false;
+    }
+    return true;
+}
+
+bool OutOfCoreMesh::open( const std::string& path, uint64_t source_size, uint64_t source_time,
+                          uint64_t settings_key )
+{
+    close();
+
+    FILE* fp = fopen( path.c_str(), "rb" );
+    if ( !fp )
+        return false;
+    fclose( fp );
+
+    if ( !m_file.open( path ) )
+        return false;
+
+    OutOfCoreMeshHeader header;
+    if ( m_file.size() < sizeof header ) {
+        m_file.close();
+        return false;
+    }
+    m_file.read( 0, sizeof header, &header );
+
+    uint64_t expected_size = sizeof header +
+                             header.num_nodes * sizeof( BvhNode ) +
+                             header.num_triangles * sizeof( MeshTriangle ) +
+                             header.num_vertices * sizeof( MeshVertex );
+    if ( 0 != memcmp( header.magic, OOC_MESH_MAGIC, sizeof OOC_MESH_MAGIC ) ||
+         header.version != OOC_MESH_VERSION ||
+         header.source_size != source_size ||
+         header.source_time != source_time ||
+         header.settings_key != settings_key ||
+         m_file.size() != expected_size ) {
+        std::cout << "Ignoring stale out-of-core mesh file '" << path << "'.\n";
+        m_file.close();
+        return false;
+    }
+
+    m_num_nodes = static_cast< size_t >( header.num_nodes );
+    m_num_triangles = static_cast< size_t >( header.num_triangles );
+    m_num_vertices = static_cast< size_t >( header.num_vertices );
+    m_node_offset = sizeof header;
+    m_triangle_offset = m_node_offset + header.num_nodes * sizeof( BvhNode );
+    m_vertex_offset = m_triangle_offset + header.num_triangles * sizeof( MeshTriangle );
+    m_has_normals = 0 != ( header.flags & OOC_HAS_NORMALS );
+    m_has_tcoords = 0 != ( header.flags & OOC_HAS_TCOORDS );
+    return true;
+}
+
+void OutOfCoreMesh::close()
+{
+    m_file.close();
+    m_num_vertices = 0;
+    m_num_triangles = 0;
+    m_num_nodes = 0;
+}
+
+MeshVertex OutOfCoreMesh::Reader::get_vertex( size_t index )
+{
+    assert( index < m_mesh->m_num_vertices );
+    return m_mesh->m_file.read< MeshVertex >( m_mesh->m_vertex_offset + index * sizeof( MeshVertex ),
+                                              m_vertices );
+}
+
+MeshTriangle OutOfCoreMesh::Reader::get_triangle( size_t index )
+{
+    assert( index < m_mesh->m_num_triangles );
+    return m_mesh->m_file.read< MeshTriangle >( m_mesh->m_triangle_offset + index * sizeof( MeshTriangle ),
+                                                m_triangles );
+}
+
+BvhNode OutOfCoreMesh::Reader::get_node( size_t index )
+{
+    assert( index < m_mesh->m_num_nodes );
+    return m_mesh->m_file.read< BvhNode >( m_mesh->m_node_offset + index * sizeof( BvhNode ), m_nodes );
+}
+
+MeshVertex OutOfCoreMesh::get_vertex( size_t index ) const
+{
+    assert( index < m_num_vertices );
+    return m_file.read< MeshVertex >( m_vertex_offset + index * sizeof( MeshVertex ) );
+}
+
+MeshTriangle OutOfCoreMesh::get_triangle( size_t index ) const
+{
+    assert( index < m_num_triangles );
+    return m_file.read< MeshTriangle >( m_triangle_offset + index * sizeof( MeshTriangle ) );
+}
+
+BvhNode OutOfCoreMesh::get_node( size_t index ) const
+{
+    assert( index < m_num_nodes );
+    return m_file.read< BvhNode >( m_node_offset + index * sizeof( BvhNode ) );
+}
+
+BoundingBox OutOfCoreMesh::get_bounds() const
+{
+    BoundingBox box;
+    if ( m_num_nodes > 0 ) {
+        BvhNode root = get_node( 0 );
+        box.filter_vertex( Vector3( root.bounds_min ) );
+        box.filter_vertex( Vector3( root.bounds_max ) );
+    }
+    return box;
+}
+
+} /* Luc */
@@ -0,0 +1,136 @@
+/**
+ * @file out_of_core_mesh.hpp
+ * @brief Mesh data and hierarchy paged in from disk on demand.
+ */
+
+#ifndef _LUC_SCENE_OUT_OF_CORE_MESH_HPP_
+#define _LUC_SCENE_OUT_OF_CORE_MESH_HPP_
+
+#include "scene/mesh.hpp"
+#include "scene/paged_file.hpp"
+
+namespace Luc {
+
+/*
+ * A mesh whose vertices, triangles and hierarchy stay in a file and are
+ * paged in through the page cache as traversal touches them.
+ *
+ * The file is laid out for locality: the nodes come first, so the top of the
+ * tree that every ray visits shares a few pages; the triangles follow in the
+ * order of the hierarchy's leaves, so one leaf is one contiguous read; and
+ * the vertices are ordered by first use of those triangles. A leaf's 'offset'
+ * therefore indexes the triangle array directly and no index array is kept.
+ */
+class OutOfCoreMesh
+{
+public:
+
+    /*
+     * Reads a mesh through one pinned page per array, so the many small
+     * reads of a traversal only go through the page cache when they move to
+     * another page. Each traversing thread keeps its own reader.
+     */
+    class Reader
+    {
+    public:
+        explicit Reader( const OutOfCoreMesh* mesh ) : m_mesh( mesh ) { }
+
+        MeshVertex get_vertex( size_t index );
+        MeshTriangle get_triangle( size_t index );
+        BvhNode get_node( size_t index );
+
+    private:
+        const OutOfCoreMesh* m_mesh;
+        PagedFile::PageRef   m_vertices;
+        PagedFile::PageRef   m_triangles;
+        PagedFile::PageRef   m_nodes;
+    };
+
+    OutOfCoreMesh();
+    ~OutOfCoreMesh();
+
+    /*
+     * Writes a loaded mesh and its hierarchy to a file.
+     * @param source_size, source_time  Stamp of the source file, checked by open.
+     * @param settings_key  Hash of the settings the mesh and hierarchy were
+     *                      built with, checked by open.
+     * @return true on success.
+     */
+    static bool write( const std::string& path, uint64_t source_size, uint64_t source_time,
+                       uint64_t settings_key, const MeshVertex* vertices, size_t num_vertices,
+                       const MeshTriangle* triangles, size_t num_triangles,
+                       const Bvh& bvh, bool has_normals, bool has_tcoords );
+
+    /*
+     * Opens a file written by write.
+     * @return false if there is no such file, or it was written from a
+     *  different version of the source file or with different settings.
+     */
+    bool open( const std::string& path, uint64_t source_size, uint64_t source_time,
+               uint64_t settings_key );
+    void close();
+
+    bool is_open() const { return m_file.is_open(); }
+
+    size_t num_vertices() const     { return m_num_vertices; }
+    size_t num_triangles() const    { return m_num_triangles; }
+    size_t num_nodes() const        { return m_num_nodes; }
+    bool has_normals() const        { return m_has_normals; }
+    bool has_tcoords() const        { return m_has_tcoords; }
+
+    /// Single reads, see Reader for reading many.
+    MeshVertex get_vertex( size_t index ) const;
+    MeshTriangle get_triangle( size_t index ) const;
+    BvhNode get_node( size_t index ) const;
+
+    /// Bounding box of the whole mesh.
+    BoundingBox get_bounds() const;
+
+    /*
+     * Finds the closest triangle hit by a ray, see Bvh::intersect. The
+     * nodes are read through reader, which the intersector can share.
+     */
+    template< typename Intersector >
+    bool intersect( Reader& reader, const Ray& ray, real_t tMin, real_t tMax,
+                    Intersector& intersector ) const
+    {
+        if ( 0 == m_num_nodes )
+            return false;
+        NodeReader nodes = { &reader };
+        IdentityIndices indices;
+        return traverse_bvh( nodes, indices, ray, tMin, tMax, intersector );
+    }
+
+private:
+
+    struct NodeReader
+    {
+        Reader* reader;
+        BvhNode operator[]( uint32_t index ) const { return reader->get_node( index ); }
+    };
+
+    // triangles are stored in leaf order
+    struct IdentityIndices
+    {
+        uint32_t operator[]( uint32_t index ) const { return index; }
+    };
+
+    PagedFile m_file;
+
+    size_t   m_num_vertices;
+    size_t   m_num_triangles;
+    size_t   m_num_nodes;
+    uint64_t m_vertex_offset;
+    uint64_t m_triangle_offset;
+    uint64_t m_node_offset;
+    bool     m_has_normals;
+    bool     m_has_tcoords;
+
+    // prevent copy/assignment
+    OutOfCoreMesh( const OutOfCoreMesh& );
+    OutOfCoreMesh& operator=( const OutOfCoreMesh& );
+};
+
+} /* Luc */
+
+#endif /* _LUC_SCENE_OUT_OF_CORE_MESH_HPP_ */
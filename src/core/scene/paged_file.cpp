@@ -0,0 +1,216 @@
+/**
+ * @file paged_file.cpp
+ * @brief Read-only files mapped page by page under a shared memory budget.
+ */
+#include "lucPCH.h"
+#include "scene/paged_file.hpp"
+#include "files/fileutils.h"
+
+#include <cstring>
+#include <iostream>
+
+namespace Luc {
+
+namespace bip = boost::interprocess;
+
+PageCache::PageCache()
+    : m_budget( DEFAULT_BUDGET ), m_resident( 0 ),
+      m_faults( 0 ), m_hits( 0 ), m_evictions( 0 ) { }
+
+PageCache::~PageCache() { }
+
+void PageCache::set_budget( size_t bytes )
+{
+    RegionList evicted;
+    boost::mutex::scoped_lock lock( m_mutex );
+    // a budget below one page would unmap every page right after mapping it
+    m_budget = bytes > PAGE_SIZE ? bytes : PAGE_SIZE;
+    evict_to( m_budget, evicted );
+}
+
+size_t PageCache::resident_bytes() const
+{
+    boost::mutex::scoped_lock lock( m_mutex );
+    return m_resident;
+}
+
+size_t PageCache::num_faults() const
+{
+    boost::mutex::scoped_lock lock( m_mutex );
+    return m_faults;
+}
+
+size_t PageCache::num_hits() const
+{
+    boost::mutex::scoped_lock lock( m_mutex );
+    return m_hits;
+}
+
+size_t PageCache::num_evictions() const
+{
+    boost::mutex::scoped_lock lock( m_mutex );
+    return m_evictions;
+}
+
+void PageCache::reset_stats()
+{
+    boost::mutex::scoped_lock lock( m_mutex );
+    m_faults = 0;
+    m_hits = 0;
+    m_evictions = 0;
+}
+
+void PageCache::print_stats( std::ostream& os ) const
+{
+    boost::mutex::scoped_lock lock( m_mutex );
+    size_t accesses = m_faults + m_hits;
+    os << "Page cache: " << m_resident / 1024 << " of " << m_budget / 1024 << " KB resident, "
+       << m_faults << " faults, " << m_hits << " hits, " << m_evictions << " evictions";
+    if ( accesses > 0 )
+        os << " (" << 100.0 * m_faults / accesses << "% fault rate)";
+    os << ".\n";
+}
+
+PageCache::RegionPtr PageCache::acquire( const PagedFile* file, size_t page )
+{
+    {
+        boost::mutex::scoped_lock lock( m_mutex );
+        PagedFile::PageSlot& slot = file->m_pages[page];
+        if ( slot.region ) {
+            m_hits++;
+            // move to the front of the LRU list
+            m_lru.splice( m_lru.begin(), m_lru, slot.lru );
+            return slot.region;
+        }
+    }
+
+    uint64_t offset = static_cast< uint64_t >( page ) * PAGE_SIZE;
+    size_t size = static_cast< size_t >( std::min< uint64_t >( PAGE_SIZE, file->m_size - offset ) );
+
+    // map without the lock, so other readers are not held up by the system
+    // call; mapping does not touch the file, the page is read on first access
+    RegionPtr region( new bip::mapped_region( file->m_mapping, bip::read_only,
+                                              static_cast< bip::offset_t >( offset ), size ) );
+    // declared before the lock, so evicted pages are unmapped after it is released
+    RegionList evicted;
+
+    boost::mutex::scoped_lock lock( m_mutex );
+    PagedFile::PageSlot& slot = file->m_pages[page];
+    if ( slot.region ) {
+        // another thread mapped the page meanwhile, use its mapping
+        m_hits++;
+        m_lru.splice( m_lru.begin(), m_lru, slot.lru );
+        return slot.region;
+    }
+
+    m_faults++;
+    // make room first, so the budget holds once the page is mapped
+    evict_to( m_budget > size ? m_budget - size : 0, evicted );
+
+    slot.region = region;
+    PageKey key = { file, page };
+    m_lru.push_front( key );
+    slot.lru = m_lru.begin();
+    m_resident += size;
+    return region;
+}
+
+void PageCache::release( const PagedFile* file )
+{
+    RegionList released;
+    boost::mutex::scoped_lock lock( m_mutex );
+    for ( size_t i = 0; i < file->m_pages.size(); ++i ) {
+        PagedFile::PageSlot& slot = file->m_pages[i];
+        if ( slot.region ) {
+            m_resident -= slot.region->get_size();
+            m_lru.erase( slot.lru );
+            released.push_back( slot.region );
+            slot.region.reset();
+        }
+    }
+}
+
+void PageCache::evict_to( size_t bytes, RegionList& evicted )
+{
+    while ( m_resident > bytes && !m_lru.empty() ) {
+        PageKey key = m_lru.back();
+        m_lru.pop_back();
+
+        PagedFile::PageSlot& slot = key.file->m_pages[key.page];
+        m_resident -= slot.region->get_size();
+        // readers still holding the page keep it mapped until they are done
+        evicted.push_back( slot.region );
+        slot.region.reset();
+        m_evictions++;
+    }
+}
+
+PagedFile::PagedFile() : m_size( 0 ) { }
+
+PagedFile::~PagedFile()
+{
+    close();
+}
+
+bool PagedFile::open( const std::string& path )
+{
+    close();
+
+    uint64_t size, modified_time;
+    if ( !GetFileStamp( path, size, modified_time ) || 0 == size ) {
+        std::cout << "Error opening file '" << path << "' for paging.\n";
+        return false;
+    }
+
+    try {
+        bip::file_mapping mapping( path.c_str(), bip::read_only );
+        m_mapping.swap( mapping );
+    } catch ( bip::interprocess_exception const& e ) {
+        std::cout << "Error opening file '" << path << "' for paging: " << e.what() << "\n";
+        return false;
+    }
+
+    m_size = size;
+    m_pages.resize( static_cast< size_t >( ( size + PageCache::PAGE_SIZE - 1 ) / PageCache::PAGE_SIZE ) );
+    return true;
+}
+
+void PagedFile::close()
+{
+    if ( !is_open() )
+        return;
+
+    PageCacheSingleton::Instance().release( this );
+    m_pages.clear();
+    bip::file_mapping empty;
+    m_mapping.swap( empty );
+    m_size = 0;
+}
+
+void PagedFile::pin_page( size_t page, PageRef& ref ) const
+{
+    // if the previous page was evicted meanwhile, letting go of it here
+    // unmaps it outside the cache lock
+    ref.m_region = PageCacheSingleton::Instance().acquire( this, page );
+    ref.m_file = this;
+    ref.m_page = page;
+    ref.m_data = static_cast< const char* >( ref.m_region->get_address() );
+}
+
+void PagedFile::read( uint64_t offset, size_t size, void* dst, PageRef& ref ) const
+{
+    assert( offset + size <= m_size );
+
+    char* out = static_cast< char* >( dst );
+    while ( size > 0 ) {
+        size_t page_offset = static_cast< size_t >( offset % PageCache::PAGE_SIZE );
+        size_t count = std::min( size, PageCache::PAGE_SIZE - page_offset );
+        memcpy( out, pin( offset, ref ), count );
+
+        out += count;
+        offset += count;
+        size -= count;
+    }
+}
+
+} /* Luc */
@@ -0,0 +1,210 @@
+/**
+ * @file paged_file.hpp
+ * @brief Read-only files mapped page by page under a shared memory budget.
+ */
+
+#ifndef _LUC_SCENE_PAGED_FILE_HPP_
+#define _LUC_SCENE_PAGED_FILE_HPP_
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <list>
+#include <vector>
+#include <iosfwd>
+
+namespace Luc {
+
+class PagedFile;
+
+/*
+ * Owns the pages mapped by all paged files and keeps their total size under
+ * a budget, unmapping the least recently used pages first.
+ *
+ * A page that is being read is pinned by a shared pointer, so eviction never
+ * unmaps memory under a reader; it is unmapped when the reader lets go. The
+ * resident set can therefore briefly exceed the budget by the pages pinned
+ * by the reading threads.
+ */
+class PageCache
+{
+public:
+
+    // default resident set budget
+    static const size_t DEFAULT_BUDGET = 256 * 1024 * 1024;
+    // size of a page, a multiple of the mapping granularity of all platforms
+    static const size_t PAGE_SIZE = 256 * 1024;
+
+    PageCache();
+    ~PageCache();
+
+    /// Sets the resident set budget in bytes, evicting pages if needed.
+    void set_budget( size_t bytes );
+    size_t get_budget() const { return m_budget; }
+
+    /// Bytes of all pages mapped at the moment.
+    size_t resident_bytes() const;
+
+    /// Number of pins that had to map the page.
+    size_t num_faults() const;
+    /// Number of pins served by an already mapped page.
+    size_t num_hits() const;
+    /// Number of pages unmapped to stay within the budget.
+    size_t num_evictions() const;
+
+    void reset_stats();
+    void print_stats( std::ostream& os ) const;
+
+private:
+
+    friend class PagedFile;
+
+    typedef boost::shared_ptr< boost::interprocess::mapped_region > RegionPtr;
+
+    struct PageKey
+    {
+        const PagedFile* file;
+        size_t           page;
+    };
+    typedef std::list< PageKey > PageList;
+    typedef std::vector< RegionPtr > RegionList;
+
+    // returns the mapped page, mapping it on a fault
+    RegionPtr acquire( const PagedFile* file, size_t page );
+    // unmaps every page of a file that is being closed
+    void release( const PagedFile* file );
+    // must be called with the mutex held, the evicted pages are handed out
+    // so they can be unmapped after it is released
+    void evict_to( size_t bytes, RegionList& evicted );
+
+    mutable boost::mutex m_mutex;
+
+    size_t   m_budget;
+    size_t   m_resident;
+    // most recently used page first
+    PageList m_lru;
+
+    size_t m_faults;
+    size_t m_hits;
+    size_t m_evictions;
+
+    // prevent copy/assignment
+    PageCache( const PageCache& );
+    PageCache& operator=( const PageCache& );
+};
+
+typedef Loki::SingletonHolder<PageCache> PageCacheSingleton;
+
+/*
+ * A read-only file whose contents are mapped on demand, one page at a time,
+ * through the page cache. Only the pages touched by reads are resident, so
+ * the file can be far larger than the address space budget.
+ */
+class PagedFile
+{
+public:
+
+    /*
+     * Pins one page of a paged file. Reads through the same reference use
+     * the pinned page without going through the page cache while they stay
+     * on it, so a reader that walks a file mostly page by page only takes
+     * the cache lock when it moves on. A reference belongs to one thread.
+     */
+    class PageRef
+    {
+    public:
+        PageRef() : m_file( 0 ), m_page( 0 ), m_data( 0 ) { }
+
+    private:
+        friend class PagedFile;
+
+        PageCache::RegionPtr m_region;
+        const PagedFile*     m_file;
+        size_t               m_page;
+        const char*          m_data;
+    };
+
+    PagedFile();
+    ~PagedFile();
+
+    /*
+     * Opens a file for paged reading.
+     * @return true on success.
+     */
+    bool open( const std::string& path );
+    void close();
+
+    bool is_open() const { return m_size > 0; }
+    uint64_t size() const { return m_size; }
+
+    /*
+     * Returns the address of a byte of the file, pinning the page it lies
+     * on in ref unless ref already holds that page. The bytes from there to
+     * the end of the page stay readable until ref moves to another page.
+     */
+    const char* pin( uint64_t offset, PageRef& ref ) const
+    {
+        assert( offset < m_size );
+        size_t page = static_cast< size_t >( offset / PageCache::PAGE_SIZE );
+        if ( ref.m_file != this || ref.m_page != page || !ref.m_data )
+            pin_page( page, ref );
+        return ref.m_data + static_cast< size_t >( offset % PageCache::PAGE_SIZE );
+    }
+
+    /*
+     * Copies bytes from the file through a page reference, faulting in the
+     * pages they span. ref is left pinning the last of them.
+     * The range must lie within the file.
+     */
+    void read( uint64_t offset, size_t size, void* dst, PageRef& ref ) const;
+
+    /// Copies bytes from the file, pinning their pages only while copying.
+    void read( uint64_t offset, size_t size, void* dst ) const
+    {
+        PageRef ref;
+        read( offset, size, dst, ref );
+    }
+
+    /// Reads one plain old data record.
+    template< typename T >
+    T read( uint64_t offset, PageRef& ref ) const
+    {
+        T value;
+        read( offset, sizeof( T ), &value, ref );
+        return value;
+    }
+
+    template< typename T >
+    T read( uint64_t offset ) const
+    {
+        PageRef ref;
+        return read< T >( offset, ref );
+    }
+
+private:
+
+    friend class PageCache;
+
+    void pin_page( size_t page, PageRef& ref ) const;
+
+    struct PageSlot
+    {
+        PageCache::RegionPtr         region;
+        PageCache::PageList::iterator lru;
+    };
+    typedef std::vector< PageSlot > PageSlotList;
+
+    boost::interprocess::file_mapping m_mapping;
+    uint64_t m_size;
+    // guarded by the page cache mutex
+    mutable PageSlotList m_pages;
+
+    // prevent copy/assignment
+    PagedFile( const PagedFile& );
+    PagedFile& operator=( const PagedFile& );
+};
+
+} /* Luc */
+
+#endif /* _LUC_SCENE_PAGED_FILE_HPP_ */
@@ -0,0 +1,271 @@
+/**
+ * @file pn_surface.cpp
+ * @brief Smooth surface over a triangle mesh, tessellated patch by patch on demand.
+ */
+#include "lucPCH.h"
+#include "scene/pn_surface.hpp"
+#include "app/raycasting.hpp"
+
+#include <algorithm>
+
+namespace Luc {
+
+// patches with fewer triangles are tested one by one instead of through a hierarchy
+static const size_t MIN_PATCH_BVH_TRIANGLES = 16;
+
+// normalize, keeping a fallback for vectors that cancel out
+static Vector3 safe_normalize( const Vector3& v, const Vector3& fallback )
+{
+    real_t len = length( v );
+    return len > 0 ? v / len : fallback;
+}
+
+// edge control point next to p0 on the edge towards p1, projected into the tangent plane of p0
+static Vector3 pn_edge_point( const Vector3& p0, const Vector3& n0, const Vector3& p1 )
+{
+    real_t w = dot( p1 - p0, n0 );
+    return ( 2 * p0 + p1 - w * n0 ) / 3;
+}
+
+// normal control point of an edge, the normal mirrored at the edge's midplane
+static Vector3 pn_edge_normal( const Vector3& p0, const Vector3& n0, const Vector3& p1, const Vector3& n1 )
+{
+    Vector3 edge = p1 - p0;
+    real_t len2 = dot( edge, edge );
+    real_t v = len2 > 0 ? 2 * dot( edge, n0 + n1 ) / len2 : 0;
+    return safe_normalize( n0 + n1 - v * edge, n0 );
+}
+
+/*
+ * Keeps the closest hit on the triangles of one tessellated patch, with the
+ * hit mapped onto the domain of the patch.
+ */
+struct PatchTriangleIntersector
+{
+    PatchTriangleIntersector( const Ray& ray, const TessellatedPatch& patch, size_t index, MeshHit* hit )
+        : ray( ray ), patch( patch ), index( index ), hit( hit ) { }
+
+    bool operator()( uint32_t triangle, real_t tMin, real_t& tMax )
+    {
+        const MeshTriangle& tri = patch.triangles[triangle];
+        const MeshVertex& v0 = patch.vertices[tri.vertices[0]];
+        const MeshVertex& v1 = patch.vertices[tri.vertices[1]];
+        const MeshVertex& v2 = patch.vertices[tri.vertices[2]];
+
+        float t, beta, gamma;
+        if ( !ray_casting_triangle( ray, v0.position, v1.position, v2.position, tMin, tMax, t, beta, gamma ) )
+            return false;
+        if ( t <= tMin || t >= tMax )
+            return false;
+
+        const Vector2& d0 = patch.domain[tri.vertices[0]];
+        const Vector2& d1 = patch.domain[tri.vertices[1]];
+        const Vector2& d2 = patch.domain[tri.vertices[2]];
+
+        tMax          = t;
+        hit->t        = t;
+        hit->triangle = index;
+        hit->beta     = barycentric_interpolation( d0.x, d1.x, d2.x, beta, gamma );
+        hit->gamma    = barycentric_interpolation( d0.y, d1.y, d2.y, beta, gamma );
+        return true;
+    }
+
+    const Ray&              ray;
+    const TessellatedPatch& patch;
+    size_t                  index;
+    MeshHit*                hit;
+};
+
+/*
+ * Tessellates each patch whose bounds the ray reaches and keeps the closest
+ * hit on its triangles.
+ */
+struct PatchIntersector
+{
+    PatchIntersector( const Ray& ray, const PnTriangleSurface* surface, MeshHit* hit )
+        : ray( ray ), surface( surface ), hit( hit ) { }
+
+    bool operator()( uint32_t index, real_t tMin, real_t& tMax )
+    {
+        // hold the patch, so eviction by another thread cannot free it under us;
+        // tracing threads hold it in their recent patches
+        TessellatedPatchPtr held;
+        const TessellatedPatch* patch;
+        RecentPatches* recent = get_recent_patches();
+        if ( recent ) {
+            patch = &recent->get( surface, index );
+        } else {
+            held = TessellationCacheSingleton::Instance().get( surface, index );
+            patch = held.get();
+        }
+        PatchTriangleIntersector intersector( ray, *patch, index, hit );
+
+        bool found = false;
+        if ( !patch->bvh.empty() ) {
+            found = patch->bvh.intersect( ray, tMin, tMax, intersector );
+        } else {
+            for ( uint32_t i = 0; i < patch->triangles.size(); ++i ) {
+                if ( intersector( i, tMin, tMax ) )
+                    found = true;
+            }
+        }
+        if ( found )
+            tMax = hit->t;
+        return found;
+    }
+
+    const Ray&               ray;
+    const PnTriangleSurface* surface;
+    MeshHit*                 hit;
+};
+
+PnTriangleSurface::PnTriangleSurface() : m_level( 0 ) { }
+
+PnTriangleSurface::~PnTriangleSurface()
+{
+    TessellationCacheSingleton::Instance().release( this );
+}
+
+void PnTriangleSurface::build( const MeshVertex* vertices, const MeshTriangle* triangles,
+                               size_t num_triangles, unsigned int level )
+{
+    // patches of a previous build are stale
+    TessellationCacheSingleton::Instance().release( this );
+
+    m_level = std::min( level, MAX_LEVEL );
+    m_patches.resize( num_triangles );
+
+    std::vector< BoundingBox > bounds( num_triangles );
+    for ( size_t i = 0; i < num_triangles; ++i ) {
+        Vector3 p[3], n[3];
+        PnPatch& patch = m_patches[i];
+        for ( size_t j = 0; j < 3; ++j ) {
+            const MeshVertex& v = vertices[triangles[i].vertices[j]];
+            p[j] = v.position;
+            n[j] = safe_normalize( v.normal, Vector3::UnitY );
+            patch.tex_coord[j] = v.tex_coord;
+        }
+
+        Vector3* b = patch.position;
+        b[0] = p[0];
+        b[1] = p[1];
+        b[2] = p[2];
+        b[3] = pn_edge_point( p[0], n[0], p[1] );
+        b[4] = pn_edge_point( p[1], n[1], p[0] );
+        b[5] = pn_edge_point( p[1], n[1], p[2] );
+        b[6] = pn_edge_point( p[2], n[2], p[1] );
+        b[7] = pn_edge_point( p[2], n[2], p[0] );
+        b[8] = pn_edge_point( p[0], n[0], p[2] );
+        // the center point lifts the patch off the flat triangle
+        Vector3 e = ( b[3] + b[4] + b[5] + b[6] + b[7] + b[8] ) / 6;
+        Vector3 c = ( p[0] + p[1] + p[2] ) / 3;
+        b[9] = e + ( e - c ) / 2;
+
+        patch.normal[0] = n[0];
+        patch.normal[1] = n[1];
+        patch.normal[2] = n[2];
+        patch.normal[3] = pn_edge_normal( p[0], n[0], p[1], n[1] );
+        patch.normal[4] = pn_edge_normal( p[1], n[1], p[2], n[2] );
+        patch.normal[5] = pn_edge_normal( p[2], n[2], p[0], n[0] );
+
+        // a Bezier patch lies within the hull of its control points
+        for ( size_t j = 0; j < 10; ++j ) {
+            bounds[i].filter_vertex( b[j] );
+        }
+    }
+
+    m_bvh.clear();
+    if ( num_triangles > 0 )
+        m_bvh.build( &bounds[0], num_triangles, BvhBuildSettings() );
+}
+
+BoundingBox PnTriangleSurface::get_bounds() const
+{
+    return m_bvh.get_bounds();
+}
+
+bool PnTriangleSurface::intersect( const Ray& ray, real_t tMin, real_t tMax, MeshHit* hit ) const
+{
+    PatchIntersector intersector( ray, this, hit );
+    return m_bvh.intersect( ray, tMin, tMax, intersector );
+}
+
+MeshVertex PnTriangleSurface::evaluate( size_t index, real_t beta, real_t gamma ) const
+{
+    const PnPatch& patch = m_patches[index];
+    const Vector3* b = patch.position;
+    const Vector3* n = patch.normal;
+    real_t u = beta;
+    real_t v = gamma;
+    real_t w = 1 - u - v;
+
+    MeshVertex vertex;
+    vertex.position = b[0] * ( w * w * w ) + b[1] * ( u * u * u ) + b[2] * ( v * v * v )
+                    + b[3] * ( 3 * w * w * u ) + b[4] * ( 3 * w * u * u )
+                    + b[5] * ( 3 * u * u * v ) + b[6] * ( 3 * u * v * v )
+                    + b[7] * ( 3 * w * v * v ) + b[8] * ( 3 * w * w * v )
+                    + b[9] * ( 6 * w * u * v );
+    vertex.normal = n[0] * ( w * w ) + n[1] * ( u * u ) + n[2] * ( v * v )
+                  + n[3] * ( w * u ) + n[4] * ( u * v ) + n[5] * ( w * v );
+    vertex.normal = safe_normalize( vertex.normal, n[0] );
+    vertex.tex_coord.x = barycentric_interpolation( patch.tex_coord[0].x, patch.tex_coord[1].x,
+                                                    patch.tex_coord[2].x, beta, gamma );
+    vertex.tex_coord.y = barycentric_interpolation( patch.tex_coord[0].y, patch.tex_coord[1].y,
+                                                    patch.tex_coord[2].y, beta, gamma );
+    return vertex;
+}
+
+void PnTriangleSurface::tessellate( size_t index, TessellatedPatch* patch ) const
+{
+    unsigned int segments = 1u << m_level;
+
+    // rows of constant gamma, each one vertex shorter than the previous
+    patch->vertices.reserve( ( segments + 1 ) * ( segments + 2 ) / 2 );
+    patch->domain.reserve( patch->vertices.capacity() );
+    std::vector< unsigned int > row_start( segments + 1 );
+    for ( unsigned int i = 0; i <= segments; ++i ) {
+        row_start[i] = static_cast< unsigned int >( patch->vertices.size() );
+        for ( unsigned int j = 0; j <= segments - i; ++j ) {
+            real_t beta = real_t( j ) / segments;
+            real_t gamma = real_t( i ) / segments;
+            patch->vertices.push_back( evaluate( index, beta, gamma ) );
+            patch->domain.push_back( Vector2( beta, gamma ) );
+        }
+    }
+
+    // same winding as the control triangle
+    patch->triangles.reserve( segments * segments );
+    for ( unsigned int i = 0; i < segments; ++i ) {
+        for ( unsigned int j = 0; j < segments - i; ++j ) {
+            unsigned int v00 = row_start[i] + j;
+            unsigned int v10 = v00 + 1;
+            unsigned int v01 = row_start[i + 1] + j;
+            MeshTriangle lower = { { v00, v10, v01 } };
+            patch->triangles.push_back( lower );
+            if ( j + 1 < segments - i ) {
+                MeshTriangle upper = { { v10, v01 + 1, v01 } };
+                patch->triangles.push_back( upper );
+            }
+        }
+    }
+
+    if ( patch->triangles.size() >= MIN_PATCH_BVH_TRIANGLES ) {
+        std::vector< BoundingBox > bounds( patch->triangles.size() );
+        for ( size_t i = 0; i < patch->triangles.size(); ++i ) {
+            for ( size_t j = 0; j < 3; ++j ) {
+                bounds[i].filter_vertex( patch->vertices[patch->triangles[i].vertices[j]].position );
+            }
+        }
+        patch->bvh.build( &bounds[0], bounds.size(), BvhBuildSettings() );
+    }
+}
+
+void PnTriangleSurface::render() const
+{
+    TessellationCache& cache = TessellationCacheSingleton::Instance();
+    for ( size_t i = 0; i < m_patches.size(); ++i ) {
+        cache.get( this, i )->render();
+    }
+}
+
+} /* Luc */
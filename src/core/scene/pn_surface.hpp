@@ -0,0 +1,85 @@
+/**
+ * @file pn_surface.hpp
+ * @brief Smooth surface over a triangle mesh, tessellated patch by patch on demand.
+ */
+
+#ifndef _LUC_SCENE_PN_SURFACE_HPP_
+#define _LUC_SCENE_PN_SURFACE_HPP_
+
+#include "scene/tessellation_cache.hpp"
+
+namespace Luc {
+
+/*
+ * Replaces each triangle of a control mesh by a curved point-normal (PN)
+ * triangle (Vlachos et al.), a cubic Bezier patch fitted to the positions
+ * and normals of the triangle's vertices, with quadratically varying
+ * normals. Neighbouring patches meet without cracks where they share
+ * vertex normals.
+ *
+ * Only the control points live with the surface. A patch is tessellated
+ * through the tessellation cache the first time a ray reaches its bounds
+ * or it is drawn, so large control meshes cost little until they are seen.
+ */
+class PnTriangleSurface : public Tessellator
+{
+public:
+
+    // finest level, a patch then has 4^MAX_LEVEL triangles
+    static const unsigned int MAX_LEVEL = 6;
+
+    PnTriangleSurface();
+    virtual ~PnTriangleSurface();
+
+    /*
+     * Computes the patches of a control mesh whose vertices have normals.
+     * @param level     Each patch edge is split into 2^level segments.
+     */
+    void build( const MeshVertex* vertices, const MeshTriangle* triangles,
+                size_t num_triangles, unsigned int level );
+
+    size_t num_patches() const { return m_patches.size(); }
+    unsigned int get_level() const { return m_level; }
+
+    /// Bounds of the control points of all patches, which enclose the surface.
+    BoundingBox get_bounds() const;
+
+    /*
+     * Finds the closest hit on the tessellated surface. The hit refers to
+     * a control triangle, with its barycentric coordinates on that patch.
+     */
+    bool intersect( const Ray& ray, real_t tMin, real_t tMax, MeshHit* hit ) const;
+
+    /// Position, normal and texture coordinate of the surface at a point of a patch.
+    MeshVertex evaluate( size_t patch, real_t beta, real_t gamma ) const;
+
+    virtual void tessellate( size_t index, TessellatedPatch* patch ) const;
+
+    /// Draws every patch using opengl.
+    void render() const;
+
+private:
+
+    struct PnPatch
+    {
+        // b300, b030, b003, b210, b120, b021, b012, b102, b201, b111
+        Vector3 position[10];
+        // n200, n020, n002, n110, n011, n101
+        Vector3 normal[6];
+        Vector2 tex_coord[3];
+    };
+    typedef std::vector< PnPatch > PnPatchList;
+
+    PnPatchList  m_patches;
+    unsigned int m_level;
+    // hierarchy over the control point bounds of the patches
+    Bvh          m_bvh;
+
+    // prevent copy/assignment
+    PnTriangleSurface( const PnTriangleSurface& );
+    PnTriangleSurface& operator=( const PnTriangleSurface& );
+};
+
+} /* Luc */
+
+#endif /* _LUC_SCENE_PN_SURFACE_HPP_ */
@@ -0,0 +1,160 @@
+/**
+ * @file ray_stream.cpp
+ * @brief Files of the rays traced for a frame, for replaying them against
+ *  the scene without the rest of the renderer.
+ */
+#include "lucPCH.h"
+#include "scene/ray_stream.hpp"
+#include "files/fileutils.h"
+
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+
+namespace Luc {
+
+// bump whenever the record layout changes
+static const uint32_t RAY_STREAM_VERSION = 2;
+static const char RAY_STREAM_MAGIC[8] = { 'L', 'U', 'C', 'R', 'A', 'Y', 'S', 0 };
+// records buffered before they are written
+static const size_t RAY_STREAM_BUFFER_SIZE = 16384;
+// longest scene file name read from a stream
+static const uint32_t MAX_SCENE_NAME_LENGTH = 4096;
+
+struct RayStreamHeader
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t count;
+    uint32_t scene_name_length;
+    uint32_t reserved;
+};
+
+RayStreamWriter::RayStreamWriter()
+    : m_file( 0 ), m_failed( false ), m_count( 0 ), m_count_offset( 0 ) { }
+
+RayStreamWriter::~RayStreamWriter()
+{
+    close();
+}
+
+bool RayStreamWriter::open( const std::string& path, const std::string& scene_filename )
+{
+    close();
+
+    // written under another name until it is complete
+    m_path = path;
+    m_tmp_path = path + ".tmp";
+    m_file = fopen( m_tmp_path.c_str(), "wb" );
+    if ( !m_file ) {
+        std::cout << "Cannot write ray stream '" << m_tmp_path << "'.\n";
+        return false;
+    }
+
+    RayStreamHeader header;
+    memset( &header, 0, sizeof header );
+    memcpy( header.magic, RAY_STREAM_MAGIC, sizeof RAY_STREAM_MAGIC );
+    header.version = RAY_STREAM_VERSION;
+    header.record_size = sizeof( RayRecord );
+    header.scene_name_length = static_cast< uint32_t >( scene_filename.size() );
+    m_count_offset = offsetof( RayStreamHeader, count );
+    m_failed = fwrite( &header, sizeof header, 1, m_file ) != 1 ||
+               fwrite( scene_filename.data(), 1, scene_filename.size(), m_file ) != scene_filename.size();
+    m_count = 0;
+    m_buffer.clear();
+    m_buffer.reserve( RAY_STREAM_BUFFER_SIZE );
+    return !m_failed;
+}
+
+void RayStreamWriter::record( RayType type, const Vector3& origin, const Vector3& direction,
+                              real_t t_min, real_t t_max, bool use_proxy, bool has_differential )
+{
+    RayRecord record;
+    record.origin[0] = origin.x;
+    record.origin[1] = origin.y;
+    record.origin[2] = origin.z;
+    record.direction[0] = direction.x;
+    record.direction[1] = direction.y;
+    record.direction[2] = direction.z;
+    record.t_min = t_min;
+    record.t_max = t_max;
+    record.type = static_cast< uint8_t >( type );
+    record.flags = ( use_proxy ? RayRecord::USE_PROXY : 0 ) |
+                   ( has_differential ? RayRecord::HAS_DIFFERENTIAL : 0 );
+    record.reserved = 0;
+
+    boost::mutex::scoped_lock lock( m_mutex );
+    if ( !m_file )
+        return;
+    m_buffer.push_back( record );
+    m_count++;
+    if ( m_buffer.size() >= RAY_STREAM_BUFFER_SIZE )
+        flush();
+}
+
+void RayStreamWriter::flush()
+{
+    if ( !m_buffer.empty() && fwrite( &m_buffer[0], sizeof( RayRecord ), m_buffer.size(), m_file ) != m_buffer.size() )
+        m_failed = true;
+    m_buffer.clear();
+}
+
+bool RayStreamWriter::close()
+{
+    boost::mutex::scoped_lock lock( m_mutex );
+    if ( !m_file )
+        return false;
+
+    flush();
+    bool ok = !m_failed &&
+              0 == fseek( m_file, m_count_offset, SEEK_SET ) &&
+              fwrite( &m_count, sizeof m_count, 1, m_file ) == 1;
+    ok = ( 0 == fclose( m_file ) ) && ok;
+    m_file = 0;
+
+    ok = ok && ReplaceExistingFile( m_tmp_path, m_path );
+    if ( !ok ) {
+        std::cout << "Error writing ray stream '" << m_path << "'.\n";
+        remove( m_tmp_path.c_str() );
+    }
+    return ok;
+}
+
+bool read_ray_stream( const std::string& path, std::string* scene_filename,
+                      std::vector< RayRecord >* rays )
+{
+    FILE* fp = fopen( path.c_str(), "rb" );
+    if ( !fp ) {
+        std::cout << "Cannot open ray stream '" << path << "'.\n";
+        return false;
+    }
+
+    RayStreamHeader header;
+    bool ok = fread( &header, sizeof header, 1, fp ) == 1 &&
+              0 == memcmp( header.magic, RAY_STREAM_MAGIC, sizeof RAY_STREAM_MAGIC ) &&
+              header.version == RAY_STREAM_VERSION &&
+              header.record_size == sizeof( RayRecord ) &&
+              header.scene_name_length <= MAX_SCENE_NAME_LENGTH;
+    if ( ok ) {
+        std::vector< char > name( header.scene_name_length + 1, 0 );
+        ok = fread( &name[0], 1, header.scene_name_length, fp ) == header.scene_name_length;
+        scene_filename->assign( &name[0], header.scene_name_length );
+    }
+    if ( ok ) {
+        try {
+            rays->resize( static_cast< size_t >( header.count ) );
+        } catch ( std::bad_alloc const& ) {
+            ok = false;
+        }
+        ok = ok && ( rays->empty() ||
+                     fread( &( *rays )[0], sizeof( RayRecord ), rays->size(), fp ) == rays->size() );
+    }
+    fclose( fp );
+
+    if ( !ok )
+        std::cout << "Invalid ray stream '" << path << "'.\n";
+    return ok;
+}
+
+} /* Luc */
@@ -0,0 +1,95 @@
+/**
+ * @file ray_stream.hpp
+ * @brief Files of the rays traced for a frame, for replaying them against
+ *  the scene without the rest of the renderer.
+ */
+
+#ifndef _LUC_SCENE_RAY_STREAM_HPP_
+#define _LUC_SCENE_RAY_STREAM_HPP_
+
+#include "math/ray.hpp"
+
+#include <boost/thread/mutex.hpp>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace Luc {
+
+/*
+ * A ray as stored in a stream, 36 bytes. The differentials of the ray are
+ * left out, only whether it had any, since they change what is computed
+ * at a hit but not which geometry is hit.
+ */
+struct RayRecord
+{
+    enum Flags
+    {
+        USE_PROXY = 1,
+        HAS_DIFFERENTIAL = 2
+    };
+
+    float origin[3];
+    float direction[3];
+    float t_min, t_max;
+    uint8_t type;
+    uint8_t flags;
+    uint16_t reserved;
+};
+
+/*
+ * Writes rays to a stream file, from any number of threads at once. The
+ * order of the rays of different threads is that in which they were
+ * traced. The file appears under its name only once it is closed, so a
+ * partial stream is never replayed.
+ *
+ * A stream starts with a header of the magic "LUCRAYS", a version, the
+ * record size, the number of rays and the name of the scene file, and the
+ * records follow.
+ */
+class RayStreamWriter
+{
+public:
+
+    RayStreamWriter();
+    ~RayStreamWriter();
+
+    /// Starts a stream of rays traced in a scene file.
+    bool open( const std::string& path, const std::string& scene_filename );
+    /// Finishes the stream, returning false if any of it could not be written.
+    bool close();
+    bool is_open() const { return 0 != m_file; }
+
+    void record( RayType type, const Vector3& origin, const Vector3& direction,
+                 real_t t_min, real_t t_max, bool use_proxy, bool has_differential );
+
+    /// Rays recorded since open.
+    uint64_t num_rays() const { return m_count; }
+
+private:
+
+    // writes the buffered records, with the mutex held
+    void flush();
+
+    std::string m_path;
+    std::string m_tmp_path;
+    FILE* m_file;
+    bool m_failed;
+    uint64_t m_count;
+    // offset of the ray count in the header, written once it is known
+    long m_count_offset;
+    std::vector< RayRecord > m_buffer;
+    boost::mutex m_mutex;
+};
+
+/*
+ * Reads a whole stream.
+ * @param scene_filename[out] The scene the rays were traced in.
+ * @param rays[out] The rays, in the order they were written.
+ */
+bool read_ray_stream( const std::string& path, std::string* scene_filename,
+                      std::vector< RayRecord >* rays );
+
+} /* Luc */
+
+#endif /* _LUC_SCENE_RAY_STREAM_HPP_ */
@@ -21,6 +21,11 @@ Geometry::Geometry():
 
 Geometry::~Geometry() { }
 
+bool Geometry::is_refractive() const
+{
+    return false;
+}
+
 /**
  * build the inverse transformation matrix, used for ray tracing.
  */
@@ -45,6 +50,19 @@ void Geometry::build_inverse_transformation_matrix()
     transpose(&m_normalMatrix, simple_inverse_transformation_matrix);
 }
 
+BoundingBox Geometry::transform_bounds(const BoundingBox& local_box) const
+{
+    BoundingBox box;
+    Vector3 lo = local_box.get_left_bottom_front_corner();
+    Vector3 hi = local_box.get_right_top_back_corner();
+    for (int i=0; i<8; ++i)
+    {
+        Vector3 corner((i & 1) ? hi.x : lo.x, (i & 2) ? hi.y : lo.y, (i & 4) ? hi.z : lo.z);
+        box.filter_vertex((m_transformatMat * Vector4(corner, 1)).xyz());
+    }
+    return box;
+}
+
 
 
 PointLight::PointLight():
@@ -56,6 +74,61 @@ PointLight::PointLight():
     attenuation.quadratic = 0;
 }
 
+AreaLight::AreaLight():
+    shape( SPHERE ),
+    position( Vector3::Zero ),
+    orientation( Quaternion::Identity ),
+    color( Color3::White ),
+    radius( 1 ),
+    width( 1 ),
+    height( 1 )
+{
+    attenuation.constant = 1;
+    attenuation.linear = 0;
+    attenuation.quadratic = 0;
+    update_frame();
+}
+
+void AreaLight::update_frame()
+{
+    axis_x = orientation * Vector3::UnitX * width;
+    axis_z = orientation * Vector3::UnitZ * height;
+    normal = normalize( orientation * -Vector3::UnitY );
+}
+
+Color3 AreaLight::sample( const Vector3& from, const Vector2& u, Vector3* light_point ) const
+{
+    real_t falloff = 1;
+    if ( SPHERE == shape ) {
+        // the disc through the center facing 'from', which is what the
+        // sphere covers as seen from far enough
+        Vector3 w = from - position;
+        real_t distance = length( w );
+        w = distance > 0 ? w / distance : Vector3::UnitY;
+        Vector3 tangent = fabs( w.x ) > 0.5f ? Vector3::UnitY : Vector3::UnitX;
+        tangent = normalize( cross( tangent, w ) );
+        Vector3 bitangent = cross( w, tangent );
+        real_t r = radius * sqrt( u.x );
+        real_t phi = 2 * PI * u.y;
+        *light_point = position + tangent * ( r * cos( phi ) ) + bitangent * ( r * sin( phi ) );
+    } else {
+        *light_point = position + axis_x * ( u.x - 0.5f ) + axis_z * ( u.y - 0.5f );
+        // the rectangle shines like a point light straight ahead, falling
+        // off with the cosine to the side, and not at all to its back
+        Vector3 to = from - *light_point;
+        real_t distance = length( to );
+        falloff = distance > 0 ? dot( normal, to ) / distance : 0;
+        if ( falloff <= 0 )
+            return Color3::Black;
+    }
+
+    real_t distance = length( from - *light_point );
+    real_t attenuation_factor = 1 / ( attenuation.constant +
+                                      distance * attenuation.linear +
+                                      distance * distance * attenuation.quadratic );
+    return color * ( attenuation_factor * falloff );
+}
+
 
 Scene::Scene()
 {
@@ -87,6 +160,16 @@ size_t Scene::num_lights() const
     return point_lights.size();
 }
 
+const AreaLight* Scene::get_area_lights() const
+{
+    return area_lights.empty() ? NULL : &area_lights[0];
+}
+
+size_t Scene::num_area_lights() const
+{
+    return area_lights.size();
+}
+
 Material* const* Scene::get_materials() const
 {
     return materials.empty() ? NULL : &materials[0];
@@ -123,12 +206,15 @@ void Scene::reset()
     materials.clear();
     meshes.clear();
     point_lights.clear();
+    area_lights.clear();
 
     camera = Camera();
 
     background_color = Color3::Black;
     ambient_light = Color3::Black;
     refractive_index = 1.0;
+    acceleration = AccelerationSettings();
+    occlusion = OcclusionSettings();
 }
 
 void Scene::add_geometry( Geometry* g )
@@ -151,6 +237,12 @@ void Scene::add_light( const PointLight& l )
     point_lights.push_back( l );
 }
 
+void Scene::add_area_light( const AreaLight& l )
+{
+    area_lights.push_back( l );
+    area_lights.back().update_frame();
+}
+
 bool Scene::load( const char* filename )
 {
     m_filename = filename;
@@ -16,6 +16,9 @@
 #include "math/camera.hpp"
 #include "scene/material.hpp"
 #include "scene/mesh.hpp"
+#include "scene/bounding_box.hpp"
+#include "scene/acceleration.hpp"
+#include "scene/occlusion_baker.hpp"
 
 namespace Luc {
 
@@ -72,11 +75,29 @@ public:
                              float&          t, 
                              HitVertexInfor& hit_vertex) = 0;
 
+    /**
+     * Bounding box of this geometry in world coordinates, used to build the
+     * scene's acceleration structure. Requires the transformation matrices.
+     */
+    virtual BoundingBox get_world_bounds() = 0;
+
+    /**
+     * Whether rays refract through this geometry, which is where the
+     * photons of caustics are shot.
+     */
+    virtual bool is_refractive() const;
+
     /**
      * build the inverse transformation matrix, used for ray tracing.
      */
     void build_inverse_transformation_matrix();
 
+    /**
+     * Transform the corners of a box in geometry's coordinates to world
+     * coordinates, and return the box around them.
+     */
+    BoundingBox transform_bounds(const BoundingBox& local_box) const;
+
     // inverse transformation matrix
     Matrix4 m_invTransformMat;  
     // inverse transformation matrix, used for ray's direction
@@ -110,7 +131,7 @@ struct PointLight
     // attenuation
     Attenuation attenuation;
 
-    inline Color3 get_attenuation_color(float distance) 
+    inline Color3 get_attenuation_color(float distance) const
     {
         float attenuation_factor = 1 / (attenuation.constant + 
                                         distance * attenuation.linear + 
@@ -119,6 +140,59 @@ struct PointLight
     }
 };
 
+/**
+ * A light with an extent, which casts soft shadows. It is as bright as a
+ * point light of its color at its center, spread over its surface, and
+ * like point lights it is never seen by the rays themselves.
+ */
+struct AreaLight
+{
+    enum Shape
+    {
+        // a ball of the given radius around the position
+        SPHERE,
+        // a width x height rectangle centered at the position, in the local
+        // xz plane, shining down its local -y axis from its front side
+        RECTANGLE
+    };
+
+    AreaLight();
+
+    Shape shape;
+    // The center of the light, relative to world origin.
+    Vector3 position;
+    // The world orientation of a rectangle light.
+    Quaternion orientation;
+    // The color of the light (both diffuse and specular)
+    Color3 color;
+    // attenuation, by the distance to each point of the light
+    PointLight::Attenuation attenuation;
+    // size of a sphere light
+    real_t radius;
+    // size of a rectangle light
+    real_t width, height;
+
+    /**
+     * World axes of a rectangle light, scaled by its size, and the normal
+     * of its front side. Built from the orientation by update_frame.
+     */
+    Vector3 axis_x, axis_z, normal;
+
+    void update_frame();
+
+    /**
+     * Picks a point of the light seen from a point, and the color it
+     * sends there. Sphere lights are sampled over the disc they cover,
+     * rectangles over their area, with u mapped uniformly on either.
+     *
+     * @param[in]  from         The lit point.
+     * @param[in]  u            Sample in [0, 1)^2.
+     * @param[out] light_point  The point on the light.
+     * @return Light arriving at 'from', black from behind a rectangle.
+     */
+    Color3 sample( const Vector3& from, const Vector2& u, Vector3* light_point ) const;
+};
+
 /**
  * The container class for information used to render a scene composed of
  * Geometries.
@@ -135,6 +209,10 @@ public:
     Color3 ambient_light;
     /// the refraction index of air
     real_t refractive_index;
+    /// the acceleration structure used to raytrace the scene
+    AccelerationSettings acceleration;
+    /// the ambient occlusion baked into meshes and triangles, none by default
+    OcclusionSettings occlusion;
 
     /// Creates a new empty scene.
     Scene();
@@ -147,6 +225,8 @@ public:
     size_t num_geometries() const;
     const PointLight* get_lights() const;
     size_t num_lights() const;
+    const AreaLight* get_area_lights() const;
+    size_t num_area_lights() const;
     Material* const* get_materials() const;
     size_t num_materials() const;
     Mesh* const* get_meshes() const;
@@ -161,19 +241,25 @@ public:
     void add_material( Material* m );
     void add_mesh( Mesh* m );
     void add_light( const PointLight& l );
+    void add_area_light( const AreaLight& l );
 
     bool load(const char* filename);
     bool reload() { reset(); return load(m_filename.c_str()); };
+    /// The file the scene was loaded from.
+    const std::string& get_filename() const { return m_filename; }
 
 private:
 
     typedef std::vector< PointLight > PointLightList;
+    typedef std::vector< AreaLight  > AreaLightList;
     typedef std::vector< Material*  > MaterialList;
     typedef std::vector< Mesh*      > MeshList;
     typedef std::vector< Geometry*  > GeometryList;
 
     // list of all lights in the scene
     PointLightList point_lights;
+    // lights with an extent, sampled with several shadow rays
+    AreaLightList area_lights;
     // all materials used by geometries
     MaterialList materials;
     // all meshes used by models
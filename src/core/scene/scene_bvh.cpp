@@ -0,0 +1,71 @@
+/**
+ * @file scene_bvh.cpp
+ * @brief Bounding volume hierarchy over the geometries of a scene.
+ */
+#include "lucPCH.h"
+#include "scene/scene_bvh.hpp"
+#include "scene/scene.hpp"
+
+namespace Luc {
+
+namespace {
+
+/*
+ * Keeps the closest geometry hit during hierarchy traversal.
+ */
+struct ClosestGeometryIntersector
+{
+    ClosestGeometryIntersector( const Ray& ray, Geometry* const* geometries,
+                                real_t& t, HitVertexInfor& hit_vertex )
+        : ray( ray ), geometries( geometries ), t( t ), hit_vertex( hit_vertex ) { }
+
+    bool operator()( uint32_t index, real_t tMin, real_t& tMax )
+    {
+        float cur_t;
+        HitVertexInfor cur_hit_vertex;
+        if ( !geometries[index]->ray_casting( ray, tMin, tMax, cur_t, cur_hit_vertex ) || cur_t >= tMax )
+            return false;
+
+        tMax = cur_t;
+        t = cur_t;
+        hit_vertex = cur_hit_vertex;
+        return true;
+    }
+
+    const Ray&        ray;
+    Geometry* const*  geometries;
+    real_t&           t;
+    HitVertexInfor&   hit_vertex;
+};
+
+} // namespace
+
+SceneBvh::SceneBvh() { }
+
+SceneBvh::~SceneBvh() { }
+
+void SceneBvh::build( Geometry* const* geometries, size_t count )
+{
+    m_geometries.assign( geometries, geometries + count );
+
+    std::vector< BoundingBox > bounds( count );
+    for ( size_t i = 0; i < count; ++i ) {
+        bounds[i] = geometries[i]->get_world_bounds();
+    }
+
+    // few geometries per scene, so let a leaf hold just one
+    BvhBuildSettings settings;
+    settings.max_leaf_size = 1;
+    m_bvh.build( bounds.empty() ? NULL : &bounds[0], count, settings );
+}
+
+bool SceneBvh::intersect( const Ray& ray, real_t tMin, real_t tMax,
+                          real_t& t, HitVertexInfor& hit_vertex ) const
+{
+    if ( m_geometries.empty() )
+        return false;
+    ClosestGeometryIntersector intersector( ray, &m_geometries[0], t, hit_vertex );
+    return m_bvh.intersect( ray, tMin, tMax, intersector );
+}
+
+} /* Luc */
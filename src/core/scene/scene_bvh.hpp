@@ -0,0 +1,38 @@
+/**
+ * @file scene_bvh.hpp
+ * @brief Bounding volume hierarchy over the geometries of a scene.
+ */
+
+#ifndef _LUC_SCENE_SCENE_BVH_HPP_
+#define _LUC_SCENE_SCENE_BVH_HPP_
+
+#include "scene/acceleration.hpp"
+#include "scene/bvh.hpp"
+
+namespace Luc {
+
+/*
+ * Hierarchy over the world bounds of the geometries. Models hold their own
+ * hierarchy over their triangles, so this one only separates geometries.
+ */
+class SceneBvh : public Acceleration
+{
+public:
+
+    SceneBvh();
+    virtual ~SceneBvh();
+
+    virtual void build( Geometry* const* geometries, size_t count );
+    virtual bool intersect( const Ray& ray, real_t tMin, real_t tMax,
+                            real_t& t, HitVertexInfor& hit_vertex ) const;
+    virtual const char* get_name() const { return "bvh"; }
+
+private:
+
+    std::vector< Geometry* > m_geometries;
+    Bvh m_bvh;
+};
+
+} /* Luc */
+
+#endif /* _LUC_SCENE_SCENE_BVH_HPP_ */
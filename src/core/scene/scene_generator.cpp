@@ -0,0 +1,381 @@
+/**
+ * @file scene_generator.cpp
+ * @brief Procedurally generated scenes of a given size, written as scene
+ *  and OBJ files, for benchmarking the raytracer.
+ */
+#include "lucPCH.h"
+#include "scene/scene_generator.hpp"
+#include "math/math.hpp"
+#include "math/sampler.hpp"
+#include "math/vector.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+namespace Luc {
+
+static const char* const SCENE_NAMES[NUM_GENERATED_SCENE_TYPES] = {
+    "spheres", "mesh", "lights", "glass", "instances"
+};
+
+// distance between the centers of neighbouring spheres and instances
+static const real_t OBJECT_SPACING = 2;
+// half the side of the height field
+static const real_t HEIGHT_FIELD_EXTENT = 10;
+// spheres lit by the lights of a lights scene
+static const size_t LIT_SPHERES = 64;
+// columns and rows of the rock mesh, which has 2 * u * (v - 1) triangles
+static const size_t ROCK_COLUMNS = 32;
+static const size_t ROCK_ROWS = 16;
+
+struct SceneMaterial
+{
+    const char* name;
+    real_t diffuse[3];
+    real_t specular;
+    real_t refractive_index;
+};
+
+// every scene has all of these, the glass ones come first
+static const SceneMaterial MATERIALS[] = {
+    { "glass",  { 0.0f, 0.0f, 0.0f }, 1.0f, 1.5f },
+    { "tinted", { 0.1f, 0.2f, 0.15f }, 0.9f, 1.33f },
+    { "red",    { 0.8f, 0.2f, 0.15f }, 0.1f, 0 },
+    { "green",  { 0.2f, 0.7f, 0.25f }, 0.1f, 0 },
+    { "blue",   { 0.2f, 0.3f, 0.8f }, 0.3f, 0 },
+    { "white",  { 0.8f, 0.8f, 0.8f }, 0.0f, 0 },
+    { "floor",  { 0.5f, 0.5f, 0.5f }, 0.2f, 0 },
+};
+static const size_t NUM_MATERIALS = sizeof MATERIALS / sizeof MATERIALS[0];
+static const size_t NUM_GLASS_MATERIALS = 2;
+// the opaque materials of the objects, not the floor
+static const size_t NUM_OPAQUE_MATERIALS = NUM_MATERIALS - NUM_GLASS_MATERIALS - 1;
+
+static real_t height_field( real_t x, real_t z, real_t* dx, real_t* dz )
+{
+    *dx = 0.6f * cos( 0.5f * x ) * cos( 0.4f * z ) + 0.51f * cos( 1.7f * x + 0.5f ) * sin( 1.3f * z ) +
+          0.5f * cos( 5.0f * x ) * cos( 4.6f * z );
+    *dz = -0.48f * sin( 0.5f * x ) * sin( 0.4f * z ) + 0.39f * sin( 1.7f * x + 0.5f ) * cos( 1.3f * z ) -
+          0.46f * sin( 5.0f * x ) * sin( 4.6f * z );
+    return 1.2f * sin( 0.5f * x ) * cos( 0.4f * z ) + 0.3f * sin( 1.7f * x + 0.5f ) * sin( 1.3f * z ) +
+           0.1f * sin( 5.0f * x ) * cos( 4.6f * z );
+}
+
+// the bumps of the rock, by the angles around and down from its top
+static real_t rock_radius( real_t around, real_t down )
+{
+    return 1 + 0.15f * sin( 3 * around ) * sin( 4 * down ) + 0.05f * cos( 7 * around + 2 * down );
+}
+
+static bool write_height_field( const std::string& filename, size_t num_triangles )
+{
+    FILE* fp = fopen( filename.c_str(), "w" );
+    if ( !fp )
+        return false;
+
+    // quads along each side, two triangles each
+    size_t quads = std::max< size_t >( 1, static_cast< size_t >( sqrt( num_triangles / 2.0 ) + 0.5 ) );
+    real_t step = 2 * HEIGHT_FIELD_EXTENT / quads;
+    for ( size_t j = 0; j <= quads; ++j ) {
+        for ( size_t i = 0; i <= quads; ++i ) {
+            real_t x = -HEIGHT_FIELD_EXTENT + i * step;
+            real_t z = -HEIGHT_FIELD_EXTENT + j * step;
+            real_t dx, dz;
+            real_t y = height_field( x, z, &dx, &dz );
+            Vector3 normal = normalize( Vector3( -dx, 1, -dz ) );
+            fprintf( fp, "v %g %g %g\nvn %g %g %g\nvt %g %g\n", x, y, z, normal.x, normal.y, normal.z,
+                     real_t( i ) / quads, real_t( j ) / quads );
+        }
+    }
+    for ( size_t j = 0; j < quads; ++j ) {
+        for ( size_t i = 0; i < quads; ++i ) {
+            // obj indices start at 1
+            unsigned int a = static_cast< unsigned int >( j * ( quads + 1 ) + i + 1 );
+            unsigned int b = a + 1;
+            unsigned int c = a + static_cast< unsigned int >( quads + 1 );
+            unsigned int d = c + 1;
+            fprintf( fp, "f %u/%u/%u %u/%u/%u %u/%u/%u\nf %u/%u/%u %u/%u/%u %u/%u/%u\n",
+                     a, a, a, c, c, c, b, b, b, b, b, b, c, c, c, d, d, d );
+        }
+    }
+    return 0 == fclose( fp );
+}
+
+static bool write_rock( const std::string& filename )
+{
+    FILE* fp = fopen( filename.c_str(), "w" );
+    if ( !fp )
+        return false;
+
+    // the poles, and rings of vertices between them
+    fprintf( fp, "v 0 %g 0\nvn 0 1 0\nvt 0.5 0\n", rock_radius( 0, 0 ) );
+    for ( size_t j = 1; j < ROCK_ROWS; ++j ) {
+        real_t down = PI * j / ROCK_ROWS;
+        for ( size_t i = 0; i < ROCK_COLUMNS; ++i ) {
+            real_t around = 2 * PI * i / ROCK_COLUMNS;
+            Vector3 direction( sin( down ) * cos( around ), cos( down ), sin( down ) * sin( around ) );
+            Vector3 position = direction * rock_radius( around, down );
+            fprintf( fp, "v %g %g %g\nvn %g %g %g\nvt %g %g\n", position.x, position.y, position.z,
+                     direction.x, direction.y, direction.z, real_t( i ) / ROCK_COLUMNS, real_t( j ) / ROCK_ROWS );
+        }
+    }
+    fprintf( fp, "v 0 %g 0\nvn 0 -1 0\nvt 0.5 1\n", -rock_radius( 0, PI ) );
+
+    unsigned int top = 1;
+    unsigned int bottom = static_cast< unsigned int >( 2 + ( ROCK_ROWS - 1 ) * ROCK_COLUMNS );
+    for ( size_t j = 1; j < ROCK_ROWS; ++j ) {
+        for ( size_t i = 0; i < ROCK_COLUMNS; ++i ) {
+            size_t next = ( i + 1 ) % ROCK_COLUMNS;
+            unsigned int a = static_cast< unsigned int >( 2 + ( j - 1 ) * ROCK_COLUMNS + i );
+            unsigned int b = static_cast< unsigned int >( 2 + ( j - 1 ) * ROCK_COLUMNS + next );
+            if ( 1 == j )
+                fprintf( fp, "f %u/%u/%u %u/%u/%u %u/%u/%u\n", top, top, top, b, b, b, a, a, a );
+            if ( ROCK_ROWS - 1 == j ) {
+                fprintf( fp, "f %u/%u/%u %u/%u/%u %u/%u/%u\n", a, a, a, b, b, b, bottom, bottom, bottom );
+            } else {
+                unsigned int c = a + static_cast< unsigned int >( ROCK_COLUMNS );
+                unsigned int d = b + static_cast< unsigned int >( ROCK_COLUMNS );
+                fprintf( fp, "f %u/%u/%u %u/%u/%u %u/%u/%u\nf %u/%u/%u %u/%u/%u %u/%u/%u\n",
+                         a, a, a, b, b, b, c, c, c, b, b, b, d, d, d, c, c, c );
+            }
+        }
+    }
+    return 0 == fclose( fp );
+}
+
+/*
+ * The camera, the materials and the settings every scene shares, for
+ * content within extent of the origin on the xz plane.
+ */
+static void write_header( FILE* fp, real_t extent )
+{
+    // looking down at the origin, from far enough back to see the corners
+    real_t y = 0.9f * extent + 2;
+    real_t z = 1.7f * extent + 3;
+    fprintf( fp,
+             "<scene>\n"
+             "    <camera>\n"
+             "        <fov v=\"0.785\"/>\n"
+             "        <near_clip v=\"0.01\"/>\n"
+             "        <far_clip v=\"%g\"/>\n"
+             "        <position x=\"0\" y=\"%g\" z=\"%g\"/>\n"
+             "        <orientation a=\"%g\" x=\"1\" y=\"0\" z=\"0\"/>\n"
+             "    </camera>\n"
+             "    <background_color r=\"0.4\" g=\"0.45\" b=\"0.5\"/>\n"
+             "    <refractive_index v=\"1.0\"/>\n"
+             "    <ambient_light r=\"0.2\" g=\"0.2\" b=\"0.2\"/>\n",
+             10 * ( extent + 10 ), y, z, -atan2( y, z ) );
+
+    for ( size_t i = 0; i < NUM_MATERIALS; ++i ) {
+        const SceneMaterial& m = MATERIALS[i];
+        fprintf( fp,
+                 "    <material name=\"%s\">\n"
+                 "        <ambient r=\"%g\" g=\"%g\" b=\"%g\"/>\n"
+                 "        <diffuse r=\"%g\" g=\"%g\" b=\"%g\"/>\n"
+                 "        <specular r=\"%g\" g=\"%g\" b=\"%g\"/>\n"
+                 "        <refractive_index v=\"%g\"/>\n"
+                 "    </material>\n",
+                 m.name, m.diffuse[0], m.diffuse[1], m.diffuse[2], m.diffuse[0], m.diffuse[1],
+                 m.diffuse[2], m.specular, m.specular, m.specular, m.refractive_index );
+    }
+}
+
+// a square of two triangles at height 0, reaching past the objects
+static void write_floor( FILE* fp, real_t extent )
+{
+    static const real_t CORNERS[4][2] = { { -1, -1 }, { -1, 1 }, { 1, 1 }, { 1, -1 } };
+    real_t size = 2 * extent + 20;
+    for ( size_t i = 0; i < 4; ++i ) {
+        fprintf( fp,
+                 "    <vertex name=\"f%u\" material=\"floor\">\n"
+                 "        <position x=\"%g\" y=\"0\" z=\"%g\"/>\n"
+                 "        <normal x=\"0\" y=\"1\" z=\"0\"/>\n"
+                 "        <tex_coord u=\"%g\" v=\"%g\"/>\n"
+                 "    </vertex>\n",
+                 (unsigned int)( i + 1 ), CORNERS[i][0] * size, CORNERS[i][1] * size,
+                 ( CORNERS[i][0] + 1 ) / 2, ( CORNERS[i][1] + 1 ) / 2 );
+    }
+    fprintf( fp,
+             "    <triangle material=\"floor\">\n"
+             "        <position x=\"0\" y=\"0\" z=\"0\"/>\n"
+             "        <vertex name=\"f1\"/><vertex name=\"f2\"/><vertex name=\"f3\"/>\n"
+             "    </triangle>\n"
+             "    <triangle material=\"floor\">\n"
+             "        <position x=\"0\" y=\"0\" z=\"0\"/>\n"
+             "        <vertex name=\"f3\"/><vertex name=\"f4\"/><vertex name=\"f1\"/>\n"
+             "    </triangle>\n" );
+}
+
+static void write_point_light( FILE* fp, const Vector3& position, real_t brightness )
+{
+    fprintf( fp,
+             "    <point_light>\n"
+             "        <position x=\"%g\" y=\"%g\" z=\"%g\"/>\n"
+             "        <color r=\"%g\" g=\"%g\" b=\"%g\"/>\n"
+             "    </point_light>\n",
+             position.x, position.y, position.z, brightness, brightness, 0.9f * brightness );
+}
+
+// a key light and a fill light above content within extent of the origin
+static void write_lights( FILE* fp, real_t extent )
+{
+    write_point_light( fp, Vector3( -0.5f * extent - 2, extent + 6, 0.6f * extent + 2 ), 0.7f );
+    write_point_light( fp, Vector3( 0.7f * extent + 2, 0.8f * extent + 4, -0.3f * extent ), 0.3f );
+}
+
+/*
+ * Spheres in the cells of a square grid around the origin, each somewhere
+ * in its cell. If glass_every is not 0, all but every glass_every-th one
+ * are glass, otherwise all are opaque.
+ */
+static void write_spheres( FILE* fp, size_t count, size_t glass_every, Pcg32& rng )
+{
+    size_t columns = std::max< size_t >( 1, static_cast< size_t >( ceil( sqrt( double( count ) ) ) ) );
+    real_t start = -0.5f * OBJECT_SPACING * columns;
+    for ( size_t i = 0; i < count; ++i ) {
+        real_t radius = 0.3f + 0.5f * rng.next_real();
+        real_t slack = 0.5f * OBJECT_SPACING - radius;
+        real_t x = start + OBJECT_SPACING * ( i % columns + 0.5f ) + slack * ( 2 * rng.next_real() - 1 );
+        real_t z = start + OBJECT_SPACING * ( i / columns + 0.5f ) + slack * ( 2 * rng.next_real() - 1 );
+        const char* material = glass_every > 0 && 0 != i % glass_every ?
+            MATERIALS[rng.next() % NUM_GLASS_MATERIALS].name :
+            MATERIALS[NUM_GLASS_MATERIALS + rng.next() % NUM_OPAQUE_MATERIALS].name;
+        fprintf( fp,
+                 "    <sphere material=\"%s\">\n"
+                 "        <position x=\"%g\" y=\"%g\" z=\"%g\"/>\n"
+                 "        <radius v=\"%g\"/>\n"
+                 "    </sphere>\n",
+                 material, x, radius, z, radius );
+    }
+}
+
+// half the side of the grid write_spheres and the instances fill
+static real_t get_grid_extent( size_t count )
+{
+    return 0.5f * OBJECT_SPACING * ceil( sqrt( double( std::max< size_t >( 1, count ) ) ) );
+}
+
+const char* get_generated_scene_name( GeneratedSceneType type )
+{
+    return type < NUM_GENERATED_SCENE_TYPES ? SCENE_NAMES[type] : "unknown";
+}
+
+bool parse_generated_scene_type( const char* name, GeneratedSceneType* type )
+{
+    for ( size_t i = 0; i < NUM_GENERATED_SCENE_TYPES; ++i ) {
+        if ( 0 == strcmp( name, SCENE_NAMES[i] ) ) {
+            *type = static_cast< GeneratedSceneType >( i );
+            return true;
+        }
+    }
+    return false;
+}
+
+bool generate_scene( GeneratedSceneType type, size_t size, const std::string& directory,
+                     std::string* filename )
+{
+    std::string prefix = directory.empty() ? std::string() : directory + "/";
+    char name[64];
+    sprintf( name, "%s_%u", get_generated_scene_name( type ), (unsigned int)size );
+    *filename = prefix + name + ".scene";
+
+    // the meshes first, the scene refers to them
+    std::string mesh_filename;
+    if ( GENERATED_MESH == type ) {
+        mesh_filename = prefix + name + ".obj";
+        if ( !write_height_field( mesh_filename, size ) ) {
+            std::cout << "Error writing mesh '" << mesh_filename << "'.\n";
+            return false;
+        }
+    } else if ( GENERATED_INSTANCES == type ) {
+        mesh_filename = prefix + "rock.obj";
+        if ( !write_rock( mesh_filename ) ) {
+            std::cout << "Error writing mesh '" << mesh_filename << "'.\n";
+            return false;
+        }
+    }
+
+    FILE* fp = fopen( filename->c_str(), "w" );
+    if ( !fp ) {
+        std::cout << "Error writing scene '" << *filename << "'.\n";
+        return false;
+    }
+
+    // the same scene for the same type and size
+    Pcg32 rng( size, type );
+    switch ( type ) {
+    case GENERATED_SPHERES:
+    case GENERATED_GLASS: {
+        real_t extent = get_grid_extent( size );
+        write_header( fp, extent );
+        write_floor( fp, extent );
+        write_lights( fp, extent );
+        // a quarter of the spheres of a glass scene are opaque
+        write_spheres( fp, size, GENERATED_GLASS == type ? 4 : 0, rng );
+        break;
+    }
+    case GENERATED_MESH:
+        write_header( fp, HEIGHT_FIELD_EXTENT );
+        write_lights( fp, HEIGHT_FIELD_EXTENT );
+        fprintf( fp,
+                 "    <mesh name=\"terrain\" filename=\"%s\"/>\n"
+                 "    <model material=\"white\" mesh=\"terrain\">\n"
+                 "        <position x=\"0\" y=\"0\" z=\"0\"/>\n"
+                 "    </model>\n",
+                 mesh_filename.c_str() );
+        break;
+    case GENERATED_LIGHTS: {
+        real_t extent = get_grid_extent( LIT_SPHERES );
+        write_header( fp, extent );
+        write_floor( fp, extent );
+        write_spheres( fp, LIT_SPHERES, 0, rng );
+        // together about as bright as the lights of the other scenes
+        for ( size_t i = 0; i < size; ++i ) {
+            Vector3 position( ( 2 * rng.next_real() - 1 ) * ( extent + 2 ), 3 + 0.5f * extent * rng.next_real(),
+                              ( 2 * rng.next_real() - 1 ) * ( extent + 2 ) );
+            write_point_light( fp, position, 1.2f / size );
+        }
+        break;
+    }
+    case GENERATED_INSTANCES: {
+        real_t extent = get_grid_extent( size );
+        write_header( fp, extent );
+        write_floor( fp, extent );
+        write_lights( fp, extent );
+        fprintf( fp, "    <mesh name=\"rock\" filename=\"%s\"/>\n", mesh_filename.c_str() );
+        size_t columns = static_cast< size_t >( extent * 2 / OBJECT_SPACING );
+        for ( size_t i = 0; i < size; ++i ) {
+            real_t scale = 0.4f + 0.4f * rng.next_real();
+            real_t x = -extent + OBJECT_SPACING * ( i % columns + 0.5f );
+            real_t z = -extent + OBJECT_SPACING * ( i / columns + 0.5f );
+            Vector3 axis( 2 * rng.next_real() - 1, 2 * rng.next_real() - 1, 2 * rng.next_real() - 1 );
+            if ( squared_length( axis ) < 1e-4f )
+                axis = Vector3::UnitY;
+            axis = normalize( axis );
+            fprintf( fp,
+                     "    <model material=\"%s\" mesh=\"rock\">\n"
+                     "        <position x=\"%g\" y=\"%g\" z=\"%g\"/>\n"
+                     "        <orientation a=\"%g\" x=\"%g\" y=\"%g\" z=\"%g\"/>\n"
+                     "        <scale x=\"%g\" y=\"%g\" z=\"%g\"/>\n"
+                     "    </model>\n",
+                     MATERIALS[NUM_GLASS_MATERIALS + i % NUM_OPAQUE_MATERIALS].name, x, scale, z,
+                     2 * PI * rng.next_real(), axis.x, axis.y, axis.z, scale, scale, scale );
+        }
+        break;
+    }
+    default:
+        break;
+    }
+
+    fprintf( fp, "</scene>\n" );
+    if ( 0 != fclose( fp ) ) {
+        std::cout << "Error writing scene '" << *filename << "'.\n";
+        return false;
+    }
+    return true;
+}
+
+} /* Luc */
@@ -0,0 +1,49 @@
+/**
+ * @file scene_generator.hpp
+ * @brief Procedurally generated scenes of a given size, written as scene
+ *  and OBJ files, for benchmarking the raytracer.
+ */
+
+#ifndef _LUC_SCENE_SCENE_GENERATOR_HPP_
+#define _LUC_SCENE_SCENE_GENERATOR_HPP_
+
+#include <string>
+
+namespace Luc {
+
+enum GeneratedSceneType
+{
+    // spheres scattered over a floor, size is the number of spheres
+    GENERATED_SPHERES,
+    // one height field mesh, size is its number of triangles
+    GENERATED_MESH,
+    // a few spheres lit by many point lights, size is the number of lights
+    GENERATED_LIGHTS,
+    // spheres over a floor, most of them glass, size is the number of spheres
+    GENERATED_GLASS,
+    // instances of one rock mesh, size is the number of instances
+    GENERATED_INSTANCES,
+    NUM_GENERATED_SCENE_TYPES
+};
+
+/// Name of a type of scene, as parse_generated_scene_type reads it.
+const char* get_generated_scene_name( GeneratedSceneType type );
+
+/// Parses "spheres", "mesh", "lights", "glass" or "instances".
+bool parse_generated_scene_type( const char* name, GeneratedSceneType* type );
+
+/*
+ * Writes a scene of a type and size as directory/TYPE_SIZE.scene, along
+ * with the meshes it uses. The same type and size always give the same
+ * scene, seen from a camera that frames all of it.
+ * @param directory     Existing directory for the files, empty for the
+ *                      current one. The scene refers to its meshes by it.
+ * @param filename[out] The scene file written.
+ * @return false if a file could not be written.
+ */
+bool generate_scene( GeneratedSceneType type, size_t size, const std::string& directory,
+                     std::string* filename );
+
+} /* Luc */
+
+#endif /* _LUC_SCENE_SCENE_GENERATOR_HPP_ */
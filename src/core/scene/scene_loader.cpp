@@ -61,11 +61,26 @@ static const char STR_BACKGROUND[] = "background_color";
 static const char STR_AMLIGHT[] = "ambient_light";
 static const char STR_CAMERA[] = "camera";
 static const char STR_PLIGHT[] = "point_light";
+static const char STR_SLIGHT[] = "sphere_light";
+static const char STR_RLIGHT[] = "rectangle_light";
+static const char STR_WIDTH[] = "width";
+static const char STR_HEIGHT[] = "height";
 static const char STR_MATERIAL[] = "material";
 static const char STR_SPHERE[] = "sphere";
 static const char STR_TRIANGLE[] = "triangle";
 static const char STR_MODEL[] = "model";
 static const char STR_MESH[] = "mesh";
+static const char STR_OUT_OF_CORE[] = "out_of_core";
+static const char STR_OPTIMIZE[] = "optimize";
+static const char STR_WELD_TOLERANCE[] = "weld_tolerance";
+static const char STR_SUBDIVIDE[] = "subdivide";
+static const char STR_PROXY[] = "proxy";
+static const char STR_ACCELERATION[] = "acceleration";
+static const char STR_TYPE[] = "type";
+static const char STR_DENSITY[] = "density";
+static const char STR_OCCLUSION[] = "ambient_occlusion";
+static const char STR_SAMPLES[] = "samples";
+static const char STR_DISTANCE[] = "distance";
 
 static void print_error_header( const TiXmlElement* base )
 {
@@ -110,6 +125,20 @@ static void parse_attrib_float( const TiXmlElement* elem, bool required, const c
     }
 }
 
+static void parse_attrib_int( const TiXmlElement* elem, bool required, const char* name, int* val )
+{
+    int rv = elem->QueryIntAttribute( name, val );
+    if ( rv == TIXML_WRONG_TYPE ) {
+        print_error_header( elem );
+        std::cout << "error parsing '" << name << "'.\n";
+        throw std::exception();
+    } else if ( required && rv == TIXML_NO_ATTRIBUTE ) {
+        print_error_header( elem );
+        std::cout << "missing '" << name << "'.\n";
+        throw std::exception();
+    }
+}
+
 static void parse_attrib_string( const TiXmlElement* elem, bool required, const char* name, const char** val )
 {
     const char* att = elem->Attribute( name );
@@ -214,6 +243,46 @@ static void parse_point_light( const TiXmlElement* elem, PointLight* light )
     parse_elem( elem, true,  STR_COLOR,     &light->color );
 }
 
+static void parse_area_light( const TiXmlElement* elem, AreaLight* light )
+{
+    parse_elem( elem, false, STR_ACON,      &light->attenuation.constant );
+    parse_elem( elem, false, STR_ALIN,      &light->attenuation.linear );
+    parse_elem( elem, false, STR_AQUAD,     &light->attenuation.quadratic );
+    parse_elem( elem, true,  STR_POSITION,  &light->position );
+    parse_elem( elem, true,  STR_COLOR,     &light->color );
+
+    if ( AreaLight::SPHERE == light->shape ) {
+        parse_elem( elem, true,  STR_RADIUS,    &light->radius );
+    } else {
+        Quaternion ori = Quaternion::Identity;
+        parse_elem( elem, false, STR_ORIENT,    &ori );
+        parse_elem( elem, true,  STR_WIDTH,     &light->width );
+        parse_elem( elem, true,  STR_HEIGHT,    &light->height );
+        light->orientation = normalize( ori );
+    }
+}
+
+static void parse_acceleration( const TiXmlElement* elem, AccelerationSettings* settings )
+{
+    const char* type = 0;
+    parse_attrib_string( elem, true,  STR_TYPE,    &type );
+    parse_attrib_float(  elem, false, STR_DENSITY, &settings->grid_density );
+
+    if ( !Acceleration::parse_type( type, &settings->type ) ) {
+        print_error_header( elem );
+        std::cout << "unknown acceleration type '" << type << "'.\n";
+        throw std::exception();
+    }
+}
+
+static void parse_occlusion( const TiXmlElement* elem, OcclusionSettings* settings )
+{
+    int samples = 0;
+    parse_attrib_int(   elem, true,  STR_SAMPLES,  &samples );
+    parse_attrib_float( elem, false, STR_DISTANCE, &settings->distance );
+    settings->samples = samples > 0 ? samples : 0;
+}
+
 template< typename T >
 static void parse_lookup_data( const std::map< const char*, T, StrCompare > tmap, const TiXmlElement* elem, const char* name, T* val )
 {
@@ -249,9 +318,20 @@ static const char* parse_material( const TiXmlElement* elem, Material* material
 static const char* parse_mesh( const TiXmlElement* elem, Mesh* mesh )
 {
     const char* name;
-
-    parse_attrib_string( elem, false, STR_FILENAME, &mesh->filename );
-    parse_attrib_string( elem, true,  STR_NAME,     &name );
+    int out_of_core = 0;
+    int optimize = 1;
+    int subdivide = 0;
+
+    parse_attrib_string( elem, false, STR_FILENAME,       &mesh->filename );
+    parse_attrib_string( elem, true,  STR_NAME,           &name );
+    parse_attrib_int(    elem, false, STR_OUT_OF_CORE,    &out_of_core );
+    parse_attrib_int(    elem, false, STR_OPTIMIZE,       &optimize );
+    parse_attrib_float(  elem, false, STR_WELD_TOLERANCE, &mesh->optimize_settings.weld_tolerance );
+    parse_attrib_int(    elem, false, STR_SUBDIVIDE,      &subdivide );
+    parse_attrib_float(  elem, false, STR_PROXY,          &mesh->proxy_ratio );
+    mesh->out_of_core = 0 != out_of_core;
+    mesh->optimize = 0 != optimize;
+    mesh->subdivision_level = subdivide > 0 ? subdivide : 0;
 
     return name;
 }
@@ -266,6 +346,8 @@ static const char* parse_triangle_vertex( const MaterialMap& matmap, const TiXml
     parse_elem( elem, true,  STR_TCOORD,    &vertex->tex_coord );
     parse_lookup_data( matmap, elem, STR_MATERIAL, &vertex->material );
     parse_attrib_string( elem, true,  STR_NAME,     &name );
+    // open until baked
+    vertex->occlusion = 1;
     // normalize normal
     vertex->normal = normalize( normal );
 
@@ -373,6 +455,14 @@ bool load_scene( Scene* scene, const char* filename )
         parse_elem( root, true,  STR_REFRACT, &scene->refractive_index );
         // parse ambient light
         parse_elem( root, false, STR_AMLIGHT, &scene->ambient_light );
+        // parse acceleration structure, a bvh if not given
+        elem = get_unique_child( root, false, STR_ACCELERATION );
+        if ( elem )
+            parse_acceleration( elem, &scene->acceleration );
+        // parse ambient occlusion, baked when the meshes load
+        elem = get_unique_child( root, false, STR_OCCLUSION );
+        if ( elem )
+            parse_occlusion( elem, &scene->occlusion );
 
         // parse the lights
         elem = root->FirstChildElement( STR_PLIGHT );
@@ -382,6 +472,22 @@ bool load_scene( Scene* scene, const char* filename )
             scene->add_light( pl );
             elem = elem->NextSiblingElement( STR_PLIGHT );
         }
+        elem = root->FirstChildElement( STR_SLIGHT );
+        while ( elem ) {
+            AreaLight al;
+            al.shape = AreaLight::SPHERE;
+            parse_area_light( elem, &al );
+            scene->add_area_light( al );
+            elem = elem->NextSiblingElement( STR_SLIGHT );
+        }
+        elem = root->FirstChildElement( STR_RLIGHT );
+        while ( elem ) {
+            AreaLight al;
+            al.shape = AreaLight::RECTANGLE;
+            parse_area_light( elem, &al );
+            scene->add_area_light( al );
+            elem = elem->NextSiblingElement( STR_RLIGHT );
+        }
 
         // parse the materials
         elem = root->FirstChildElement( STR_MATERIAL );
@@ -408,6 +514,7 @@ bool load_scene( Scene* scene, const char* filename )
             Mesh* mesh = new Mesh();
             check_mem( mesh );
             scene->add_mesh( mesh );
+            mesh->occlusion_settings = scene->occlusion;
             const char* name = parse_mesh( elem, mesh );
             assert( name );
             // place each mesh in map by it's name, so we can associate geometries
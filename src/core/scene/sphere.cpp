@@ -8,10 +8,13 @@
 #include "lucPCH.h"
 #include "app/raycasting.hpp"
 #include "scene/sphere.hpp"
+#include "scene/tessellation_cache.hpp"
+#include "scene/trace_counters.hpp"
 #include "application/opengl.hpp"
 #include "math/ray.hpp"
 #include "math/vector.hpp"
 
+#include <algorithm>
 #include <cmath>
 
 namespace Luc {
@@ -19,63 +22,59 @@ namespace Luc {
 #define SPHERE_NUM_LAT 80
 #define SPHERE_NUM_LON 100
 
-#define SPHERE_NUM_VERTICES ( ( SPHERE_NUM_LAT + 1 ) * ( SPHERE_NUM_LON + 1 ) )
-#define SPHERE_NUM_INDICES ( 6 * SPHERE_NUM_LAT * SPHERE_NUM_LON )
 // index of the x,y sphere where x is lat and y is lon
 #define SINDEX(x,y) ((x) * (SPHERE_NUM_LON + 1) + (y))
-#define VERTEX_SIZE 8
-#define TCOORD_OFFSET 0
-#define NORMAL_OFFSET 2
-#define VERTEX_OFFSET 5
 
-static unsigned int Indices[SPHERE_NUM_INDICES];
-static float Vertices[VERTEX_SIZE * SPHERE_NUM_VERTICES];
-
-static void init_sphere()
+/*
+ * Tessellates the unit sphere drawn by all spheres. It is built on the
+ * first draw and kept in the tessellation cache with the mesh patches.
+ */
+class SphereTessellator : public Tessellator
 {
-    static bool initialized = false;
-    if ( initialized )
-        return;
-
-    for ( int i = 0; i <= SPHERE_NUM_LAT; i++ ) {
-        for ( int j = 0; j <= SPHERE_NUM_LON; j++ ) {
-            real_t lat = real_t( i ) / SPHERE_NUM_LAT;
-            real_t lon = real_t( j ) / SPHERE_NUM_LON;
-            float* vptr = &Vertices[VERTEX_SIZE * SINDEX(i,j)];
-
-            vptr[TCOORD_OFFSET + 0] = lon;
-            vptr[TCOORD_OFFSET + 1] = 1-lat;
-
-            lat *= PI;
-            lon *= 2 * PI;
-            real_t sinlat = sin( lat );
-
-            vptr[NORMAL_OFFSET + 0] = vptr[VERTEX_OFFSET + 0] = sinlat * sin( lon );
-            vptr[NORMAL_OFFSET + 1] = vptr[VERTEX_OFFSET + 1] = cos( lat ),
-            vptr[NORMAL_OFFSET + 2] = vptr[VERTEX_OFFSET + 2] = sinlat * cos( lon );
+public:
+
+    virtual void tessellate( size_t /*index*/, TessellatedPatch* patch ) const
+    {
+        patch->vertices.resize( ( SPHERE_NUM_LAT + 1 ) * ( SPHERE_NUM_LON + 1 ) );
+        for ( int i = 0; i <= SPHERE_NUM_LAT; i++ ) {
+            for ( int j = 0; j <= SPHERE_NUM_LON; j++ ) {
+                real_t lat = real_t( i ) / SPHERE_NUM_LAT;
+                real_t lon = real_t( j ) / SPHERE_NUM_LON;
+                MeshVertex& vertex = patch->vertices[SINDEX(i,j)];
+
+                vertex.tex_coord = Vector2( lon, 1-lat );
+
+                lat *= PI;
+                lon *= 2 * PI;
+                real_t sinlat = sin( lat );
+
+                vertex.position = Vector3( sinlat * sin( lon ), cos( lat ), sinlat * cos( lon ) );
+                vertex.normal = vertex.position;
+            }
         }
-    }
 
-    for ( int i = 0; i < SPHERE_NUM_LAT; i++ ) {
-        for ( int j = 0; j < SPHERE_NUM_LON; j++ ) {
-            unsigned int* iptr = &Indices[6 * ( SPHERE_NUM_LON * i + j )];
-
-            unsigned int i00 = SINDEX(i,  j  );
-            unsigned int i10 = SINDEX(i+1,j  );
-            unsigned int i11 = SINDEX(i+1,j+1);
-            unsigned int i01 = SINDEX(i,  j+1);
-
-            iptr[0] = i00;
-            iptr[1] = i10;
-            iptr[2] = i11;
-            iptr[3] = i11;
-            iptr[4] = i01;
-            iptr[5] = i00;
+        patch->triangles.resize( 2 * SPHERE_NUM_LAT * SPHERE_NUM_LON );
+        for ( int i = 0; i < SPHERE_NUM_LAT; i++ ) {
+            for ( int j = 0; j < SPHERE_NUM_LON; j++ ) {
+                MeshTriangle* tptr = &patch->triangles[2 * ( SPHERE_NUM_LON * i + j )];
+
+                unsigned int i00 = SINDEX(i,  j  );
+                unsigned int i10 = SINDEX(i+1,j  );
+                unsigned int i11 = SINDEX(i+1,j+1);
+                unsigned int i01 = SINDEX(i,  j+1);
+
+                tptr[0].vertices[0] = i00;
+                tptr[0].vertices[1] = i10;
+                tptr[0].vertices[2] = i11;
+                tptr[1].vertices[0] = i11;
+                tptr[1].vertices[1] = i01;
+                tptr[1].vertices[2] = i00;
+            }
         }
     }
+};
 
-    initialized = true;
-}
+static SphereTessellator sphere_tessellator;
 
 Sphere::Sphere()
     : radius(0), material(0) 
@@ -87,8 +86,8 @@ Sphere::~Sphere() {}
 
 void Sphere::render() const
 {
-    // create geometry if we haven't already
-    init_sphere();
+    // tessellate the unit sphere on first use, or after it was evicted
+    TessellatedPatchPtr unit_sphere = TessellationCacheSingleton::Instance().get( &sphere_tessellator, 0 );
 
     if ( material )
         material->set_gl_state();
@@ -96,8 +95,7 @@ void Sphere::render() const
     // just scale by radius and draw unit sphere
     glPushMatrix();
     glScaled( radius, radius, radius );
-    glInterleavedArrays( GL_T2F_N3F_V3F, VERTEX_SIZE * sizeof Vertices[0], Vertices );
-    glDrawElements( GL_TRIANGLES, SPHERE_NUM_INDICES, GL_UNSIGNED_INT, Indices );
+    unit_sphere->render();
     glPopMatrix();
 
     if ( material )
@@ -118,6 +116,10 @@ bool Sphere::ray_casting(const Ray&      line,
     // 
     // e = invS*invR*invT*original_e, d = invS*invR*original_d
 
+    TraceCounters* counters = get_trace_counters();
+    if (counters)
+        counters->spheres++;
+
     // transform ray to geometry's coordinates
     Vector3 e = (m_invTransformMat * Vector4(line.Point(), 1)).xyz();
     Vector3 d = (m_invTransformMatWithoutTranslation * Vector4(line.Direction(), 1)).xyz();
@@ -153,6 +155,7 @@ bool Sphere::ray_casting(const Ray&      line,
     hit_vertex.diffuse      = material->diffuse;
     hit_vertex.specular     = material->specular;
     hit_vertex.refractive_index = material->refractive_index;
+    hit_vertex.occlusion    = 1;
 
     // transform to global coordinates
     hit_vertex.position     = (m_transformatMat * Vector4(hit_vertex.position, 1)).xyz(); // in global coordinates
@@ -166,10 +169,49 @@ bool Sphere::ray_casting(const Ray&      line,
     tx /= pi2;
     float ty = (PI - acos(hit_sphere_position.y / radius)) / pi2;
     Vector2 tex_coord(tx, ty);// texture coordinates
-    hit_vertex.tex_color = interpolate_texture_color(tex_coord, material);
+
+    hit_vertex.has_differential = line.HasDifferential();
+    if (!hit_vertex.has_differential)
+    {
+        hit_vertex.tex_color = interpolate_texture_color(tex_coord, material);
+        return true;
+    }
+
+    // footprint of the pixel on the sphere, then in the sphere's coordinates
+    transfer_ray_differential(line, t, hit_vertex.normal, hit_vertex.dpdx, hit_vertex.dpdy);
+    Vector3 dpdx = (m_invTransformMatWithoutTranslation * Vector4(hit_vertex.dpdx, 1)).xyz();
+    Vector3 dpdy = (m_invTransformMatWithoutTranslation * Vector4(hit_vertex.dpdy, 1)).xyz();
+
+    // derivatives of the longitude and latitude mapping above, the ring
+    // radius being the radius of the circle of latitude through the hit
+    const Vector3& p = hit_sphere_position;
+    real_t xz2 = std::max(p.x*p.x + p.z*p.z, real_t(1e-12f));
+    real_t ring_radius = std::max<real_t>(sqrt(xz2), 1e-6f);
+    Vector2 dtdx((p.z*dpdx.x - p.x*dpdx.z) / xz2 / pi2, dpdx.y / ring_radius / pi2);
+    Vector2 dtdy((p.z*dpdy.x - p.x*dpdy.z) / xz2 / pi2, dpdy.y / ring_radius / pi2);
+
+    // the unnormalized normal is the local position
+    real_t normal_length = length(m_normalMatrix * p);
+    hit_vertex.dndx = m_normalMatrix * dpdx / normal_length;
+    hit_vertex.dndy = m_normalMatrix * dpdy / normal_length;
+
+    hit_vertex.tex_color = interpolate_texture_color(tex_coord, material, dtdx, dtdy);
 
     return true;
 }
 
+BoundingBox Sphere::get_world_bounds()
+{
+    BoundingBox local_box;
+    local_box.filter_vertex(Vector3(-radius, -radius, -radius));
+    local_box.filter_vertex(Vector3( radius,  radius,  radius));
+    return transform_bounds(local_box);
+}
+
+bool Sphere::is_refractive() const
+{
+    return material && material->refractive_index != 0;
+}
+
 } /* Luc */
 
@@ -39,6 +39,10 @@ public:
                              float&          t, 
                              HitVertexInfor& hit_vertex) ;
 
+    virtual BoundingBox get_world_bounds();
+
+    virtual bool is_refractive() const;
+
 };
 
 } /* Luc */
@@ -0,0 +1,199 @@
+/**
+ * @file tessellation_cache.cpp
+ * @brief Patches tessellated on first use and kept under a memory budget.
+ */
+#include "lucPCH.h"
+#include "scene/tessellation_cache.hpp"
+#include "application/opengl.hpp"
+
+#include <iostream>
+
+namespace Luc {
+
+size_t TessellatedPatch::memory_size() const
+{
+    return sizeof( TessellatedPatch )
+         + vertices.capacity() * sizeof( MeshVertex )
+         + triangles.capacity() * sizeof( MeshTriangle )
+         + domain.capacity() * sizeof( Vector2 )
+         + bvh.num_nodes() * sizeof( BvhNode )
+         + bvh.num_indices() * sizeof( uint32_t );
+}
+
+void TessellatedPatch::render() const
+{
+    if ( triangles.empty() )
+        return;
+
+    GLsizei stride = sizeof( MeshVertex );
+    glPushClientAttrib( GL_CLIENT_VERTEX_ARRAY_BIT );
+    glEnableClientState( GL_VERTEX_ARRAY );
+    glEnableClientState( GL_NORMAL_ARRAY );
+    glEnableClientState( GL_TEXTURE_COORD_ARRAY );
+    glVertexPointer( 3, GL_FLOAT, stride, vertices[0].position.m_data );
+    glNormalPointer( GL_FLOAT, stride, vertices[0].normal.m_data );
+    glTexCoordPointer( 2, GL_FLOAT, stride, vertices[0].tex_coord.m_data );
+    glDrawElements( GL_TRIANGLES, static_cast< GLsizei >( triangles.size() * 3 ),
+                    GL_UNSIGNED_INT, triangles[0].vertices );
+    glPopClientAttrib();
+}
+
+Tessellator::~Tessellator() { }
+
+TessellationCache::TessellationCache()
+    : m_budget( DEFAULT_BUDGET ), m_resident( 0 ),
+      m_misses( 0 ), m_hits( 0 ), m_evictions( 0 ) { }
+
+TessellationCache::~TessellationCache() { }
+
+void TessellationCache::set_budget( size_t bytes )
+{
+    boost::mutex::scoped_lock lock( m_mutex );
+    m_budget = bytes;
+    evict_to( m_budget );
+}
+
+size_t TessellationCache::resident_bytes() const
+{
+    boost::mutex::scoped_lock lock( m_mutex );
+    return m_resident;
+}
+
+TessellatedPatchPtr TessellationCache::get( const Tessellator* tessellator, size_t index )
+{
+    PatchKey key = { tessellator, index };
+    {
+        boost::mutex::scoped_lock lock( m_mutex );
+        PatchMap::iterator it = m_patches.find( key );
+        if ( it != m_patches.end() ) {
+            m_hits++;
+            // move to the front of the LRU list
+            m_lru.splice( m_lru.begin(), m_lru, it->second.lru );
+            return it->second.patch;
+        }
+        m_misses++;
+    }
+
+    // tessellate without the lock, so other threads can use the cache meanwhile
+    TessellatedPatch* patch = new TessellatedPatch();
+    TessellatedPatchPtr result( patch );
+    tessellator->tessellate( index, patch );
+    size_t size = patch->memory_size();
+
+    boost::mutex::scoped_lock lock( m_mutex );
+    PatchMap::iterator it = m_patches.find( key );
+    if ( it != m_patches.end() ) {
+        // another thread got there first, share its patch
+        return it->second.patch;
+    }
+
+    // a patch larger than the whole budget is handed out, but not kept
+    if ( size > m_budget )
+        return result;
+
+    evict_to( m_budget - size );
+    m_lru.push_front( key );
+    PatchSlot slot = { result, size, m_lru.begin() };
+    m_patches.insert( std::make_pair( key, slot ) );
+    m_resident += size;
+    return result;
+}
+
+void TessellationCache::release( const Tessellator* tessellator )
+{
+    boost::mutex::scoped_lock lock( m_mutex );
+    PatchKey first = { tessellator, 0 };
+    PatchMap::iterator it = m_patches.lower_bound( first );
+    while ( it != m_patches.end() && it->first.tessellator == tessellator ) {
+        m_resident -= it->second.size;
+        m_lru.erase( it->second.lru );
+        m_patches.erase( it++ );
+    }
+}
+
+size_t TessellationCache::num_misses() const
+{
+    boost::mutex::scoped_lock lock( m_mutex );
+    return m_misses;
+}
+
+size_t TessellationCache::num_hits() const
+{
+    boost::mutex::scoped_lock lock( m_mutex );
+    return m_hits;
+}
+
+size_t TessellationCache::num_evictions() const
+{
+    boost::mutex::scoped_lock lock( m_mutex );
+    return m_evictions;
+}
+
+void TessellationCache::reset_stats()
+{
+    boost::mutex::scoped_lock lock( m_mutex );
+    m_misses = 0;
+    m_hits = 0;
+    m_evictions = 0;
+}
+
+void TessellationCache::print_stats( std::ostream& os ) const
+{
+    boost::mutex::scoped_lock lock( m_mutex );
+    size_t accesses = m_misses + m_hits;
+    os << "Tessellation cache: " << m_patches.size() << " patches, " << m_resident / 1024
+       << " of " << m_budget / 1024 << " KB, " << m_misses << " misses, " << m_hits << " hits, "
+       << m_evictions << " evictions";
+    if ( accesses > 0 )
+        os << " (" << 100.0 * m_misses / accesses << "% miss rate)";
+    os << ".\n";
+}
+
+LUC_THREAD_LOCAL RecentPatches* t_recent_patches = 0;
+
+RecentPatches::RecentPatches() : m_next( 0 ), m_hits( 0 )
+{
+    for ( size_t i = 0; i < SIZE; ++i ) {
+        m_entries[i].tessellator = 0;
+        m_entries[i].index = 0;
+    }
+}
+
+RecentPatches::~RecentPatches()
+{
+    TessellationCache& cache = TessellationCacheSingleton::Instance();
+    boost::mutex::scoped_lock lock( cache.m_mutex );
+    cache.m_hits += m_hits;
+}
+
+const TessellatedPatch& RecentPatches::get( const Tessellator* tessellator, size_t index )
+{
+    for ( size_t i = 0; i < SIZE; ++i ) {
+        const Entry& entry = m_entries[i];
+        if ( entry.tessellator == tessellator && entry.index == index ) {
+            m_hits++;
+            return *entry.patch;
+        }
+    }
+
+    Entry& entry = m_entries[m_next];
+    m_next = ( m_next + 1 ) % SIZE;
+    entry.patch = TessellationCacheSingleton::Instance().get( tessellator, index );
+    entry.tessellator = tessellator;
+    entry.index = index;
+    return *entry.patch;
+}
+
+void TessellationCache::evict_to( size_t bytes )
+{
+    while ( m_resident > bytes && !m_lru.empty() ) {
+        PatchMap::iterator it = m_patches.find( m_lru.back() );
+        m_lru.pop_back();
+        m_resident -= it->second.size;
+        // users still holding the patch keep it alive until they are done
+        m_patches.erase( it );
+        m_evictions++;
+    }
+}
+
+} /* Luc */
@@ -0,0 +1,203 @@
+/**
+ * @file tessellation_cache.hpp
+ * @brief Patches tessellated on first use and kept under a memory budget.
+ */
+
+#ifndef _LUC_SCENE_TESSELLATION_CACHE_HPP_
+#define _LUC_SCENE_TESSELLATION_CACHE_HPP_
+
+#include "scene/mesh.hpp"
+#include "scene/trace_counters.hpp"
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <list>
+#include <map>
+#include <iosfwd>
+
+namespace Luc {
+
+/*
+ * The triangles of one tessellated patch. 'domain' holds the parametric
+ * coordinates of each vertex on its patch, so a hit on a triangle can be
+ * mapped back onto the patch.
+ */
+struct TessellatedPatch
+{
+    std::vector< MeshVertex >   vertices;
+    std::vector< MeshTriangle > triangles;
+    std::vector< Vector2 >      domain;
+    // hierarchy over the triangles, empty for small patches
+    Bvh bvh;
+
+    /// Approximate heap size of the patch, charged against the budget.
+    size_t memory_size() const;
+
+    /// Draws the triangles using opengl.
+    void render() const;
+};
+
+typedef boost::shared_ptr< const TessellatedPatch > TessellatedPatchPtr;
+
+/*
+ * Source of patches, such as a curved surface over a control mesh.
+ * Implementations must be safe to call from several threads at once.
+ */
+class Tessellator
+{
+public:
+
+    virtual ~Tessellator();
+
+    /// Fills 'patch' with the tessellation of patch 'index'.
+    virtual void tessellate( size_t index, TessellatedPatch* patch ) const = 0;
+};
+
+/*
+ * Keeps tessellated patches of all tessellators, keyed by tessellator and
+ * patch index, and keeps their total size under a budget by dropping the
+ * least recently used patches first.
+ *
+ * Patches are handed out as shared pointers, so a patch in use stays valid
+ * after it is evicted. Tessellation runs outside the lock; two threads
+ * missing the same patch may both tessellate it, and the first one wins.
+ * Tracing threads look up patches through RecentPatches, so most of their
+ * lookups never reach the cache and its lock.
+ */
+class TessellationCache
+{
+public:
+
+    // default budget of the tessellated patches
+    static const size_t DEFAULT_BUDGET = 64 * 1024 * 1024;
+
+    TessellationCache();
+    ~TessellationCache();
+
+    /// Sets the budget in bytes, evicting patches if needed.
+    void set_budget( size_t bytes );
+    size_t get_budget() const { return m_budget; }
+
+    /// Bytes of all cached patches.
+    size_t resident_bytes() const;
+
+    /// Returns a patch, tessellating it if it is not cached.
+    TessellatedPatchPtr get( const Tessellator* tessellator, size_t index );
+
+    /// Drops every patch of a tessellator that is being destroyed.
+    void release( const Tessellator* tessellator );
+
+    size_t num_misses() const;
+    size_t num_hits() const;
+    size_t num_evictions() const;
+
+    void reset_stats();
+    void print_stats( std::ostream& os ) const;
+
+private:
+
+    friend class RecentPatches;
+
+    struct PatchKey
+    {
+        const Tessellator* tessellator;
+        size_t             index;
+
+        bool operator<( const PatchKey& rhs ) const
+        {
+            if ( tessellator != rhs.tessellator )
+                return tessellator < rhs.tessellator;
+            return index < rhs.index;
+        }
+    };
+    typedef std::list< PatchKey > PatchList;
+
+    struct PatchSlot
+    {
+        TessellatedPatchPtr patch;
+        size_t              size;
+        PatchList::iterator lru;
+    };
+    typedef std::map< PatchKey, PatchSlot > PatchMap;
+
+    // must be called with the mutex held
+    void evict_to( size_t bytes );
+
+    mutable boost::mutex m_mutex;
+
+    size_t    m_budget;
+    size_t    m_resident;
+    PatchMap  m_patches;
+    // most recently used patch first
+    PatchList m_lru;
+
+    size_t m_misses;
+    size_t m_hits;
+    size_t m_evictions;
+
+    // prevent copy/assignment
+    TessellationCache( const TessellationCache& );
+    TessellationCache& operator=( const TessellationCache& );
+};
+
+typedef Loki::SingletonHolder<TessellationCache> TessellationCacheSingleton;
+
+/*
+ * The patches a thread used last, looked up without locking. Tracing
+ * threads set one for as long as they trace, see set_recent_patches, and
+ * take patches from it; only the patches it does not hold are looked up in
+ * the tessellation cache. Its hits are added to the hits of the cache when
+ * it is destroyed.
+ *
+ * The patches it holds stay alive after the cache evicts them, so the
+ * budget can be exceeded by SIZE patches per tracing thread. No surface
+ * may be rebuilt or destroyed while a thread that traces it holds one.
+ */
+class RecentPatches
+{
+public:
+
+    // patches held, a few are enough for the coherent rays of a tile
+    static const size_t SIZE = 8;
+
+    RecentPatches();
+    ~RecentPatches();
+
+    /*
+     * Returns a patch, from the cache if it is not held. It stays valid
+     * until SIZE other patches have been looked up.
+     */
+    const TessellatedPatch& get( const Tessellator* tessellator, size_t index );
+
+private:
+
+    struct Entry
+    {
+        const Tessellator*  tessellator;
+        size_t              index;
+        TessellatedPatchPtr patch;
+    };
+
+    Entry  m_entries[SIZE];
+    // entry replaced by the next miss, in turn
+    size_t m_next;
+    size_t m_hits;
+
+    // prevent copy/assignment
+    RecentPatches( const RecentPatches& );
+    RecentPatches& operator=( const RecentPatches& );
+};
+
+// the recent patches of the calling thread, see get_recent_patches
+extern LUC_THREAD_LOCAL RecentPatches* t_recent_patches;
+
+/// The recent patches of the calling thread, or null if it keeps none.
+inline RecentPatches* get_recent_patches() { return t_recent_patches; }
+
+/// Makes the calling thread keep its recent patches in patches, or none if null.
+inline void set_recent_patches( RecentPatches* patches ) { t_recent_patches = patches; }
+
+} /* Luc */
+
+#endif /* _LUC_SCENE_TESSELLATION_CACHE_HPP_ */
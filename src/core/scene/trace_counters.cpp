@@ -0,0 +1,47 @@
+/**
+ * @file trace_counters.cpp
+ * @brief Counts of the work done tracing rays, kept by each thread for
+ *  itself.
+ */
+#include "lucPCH.h"
+#include "scene/trace_counters.hpp"
+
+#include <algorithm>
+
+namespace Luc {
+
+LUC_THREAD_LOCAL TraceCounters* t_trace_counters = 0;
+
+void TraceCounters::clear()
+{
+    for ( size_t i = 0; i < NUM_RAY_TYPES; ++i )
+        rays[i] = 0;
+    boxes = 0;
+    triangles = 0;
+    spheres = 0;
+    irradiance_lookups = 0;
+    irradiance_hits = 0;
+    max_depth = 0;
+}
+
+void TraceCounters::add( const TraceCounters& other )
+{
+    for ( size_t i = 0; i < NUM_RAY_TYPES; ++i )
+        rays[i] += other.rays[i];
+    boxes += other.boxes;
+    triangles += other.triangles;
+    spheres += other.spheres;
+    irradiance_lookups += other.irradiance_lookups;
+    irradiance_hits += other.irradiance_hits;
+    max_depth = std::max( max_depth, other.max_depth );
+}
+
+uint64_t TraceCounters::total_rays() const
+{
+    uint64_t total = 0;
+    for ( size_t i = 0; i < NUM_RAY_TYPES; ++i )
+        total += rays[i];
+    return total;
+}
+
+} /* Luc */
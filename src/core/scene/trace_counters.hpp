@@ -0,0 +1,59 @@
+/**
+ * @file trace_counters.hpp
+ * @brief Counts of the work done tracing rays, kept by each thread for
+ *  itself.
+ */
+
+#ifndef _LUC_SCENE_TRACE_COUNTERS_HPP_
+#define _LUC_SCENE_TRACE_COUNTERS_HPP_
+
+// a variable of which every thread has its own copy
+#ifdef _MSC_VER
+#define LUC_THREAD_LOCAL __declspec( thread )
+#else
+#define LUC_THREAD_LOCAL __thread
+#endif
+
+#include "math/ray.hpp"
+
+namespace Luc {
+
+/*
+ * What the rays traced by a thread cost. The tracing code adds to the
+ * counters of the thread it runs on, if that thread has any, so counting
+ * needs no locks, and threads that do not count pay only for the check.
+ */
+struct TraceCounters
+{
+    TraceCounters() { clear(); }
+    void clear();
+    /// Adds the counts of another thread, keeping the deeper bounce.
+    void add( const TraceCounters& other );
+    uint64_t total_rays() const;
+
+    // rays traced through the acceleration structure, by what they are for
+    uint64_t rays[NUM_RAY_TYPES];
+    // bounding boxes tested: hierarchy nodes, grid cells and model bounds
+    uint64_t boxes;
+    // triangles tested, of meshes, tessellated patches and triangle geometry
+    uint64_t triangles;
+    uint64_t spheres;
+    // irradiance cache lookups, and those answered from the cache
+    uint64_t irradiance_lookups;
+    uint64_t irradiance_hits;
+    // deepest bounce of the rays, 0 for eye rays, kept up by the tracer
+    uint32_t max_depth;
+};
+
+// the counters of the calling thread, see get_trace_counters
+extern LUC_THREAD_LOCAL TraceCounters* t_trace_counters;
+
+/// The counters of the calling thread, or null if it counts nothing.
+inline TraceCounters* get_trace_counters() { return t_trace_counters; }
+
+/// Makes the calling thread count into counters, or nothing if null.
+inline void set_trace_counters( TraceCounters* counters ) { t_trace_counters = counters; }
+
+} /* Luc */
+
+#endif /* _LUC_SCENE_TRACE_COUNTERS_HPP_ */
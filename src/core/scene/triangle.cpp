@@ -19,6 +19,9 @@ Triangle::Triangle()
     vertices[0].material = 0;
     vertices[1].material = 0;
     vertices[2].material = 0;
+    vertices[0].occlusion = 1;
+    vertices[1].occlusion = 1;
+    vertices[2].occlusion = 1;
 }
 
 Triangle::~Triangle() { }
@@ -30,27 +33,32 @@ void Triangle::render() const
         materials_nonnull = materials_nonnull && vertices[i].material;
 
     // this doesn't interpolate materials. Ah well.
-    if ( materials_nonnull )
+    if ( materials_nonnull ) {
         vertices[0].material->set_gl_state();
+        // the ambient color of each vertex, darkened by its baked occlusion
+        glColorMaterial( GL_FRONT_AND_BACK, GL_AMBIENT );
+        glEnable( GL_COLOR_MATERIAL );
+    }
 
     glBegin(GL_TRIANGLES);
 
-    glNormal3fv( &vertices[0].normal.x );
-    glTexCoord2fv( &vertices[0].tex_coord.x );
-    glVertex3fv( &vertices[0].position.x );
-
-    glNormal3fv( &vertices[1].normal.x );
-    glTexCoord2fv( &vertices[1].tex_coord.x );
-    glVertex3fv( &vertices[1].position.x);
-
-    glNormal3fv( &vertices[2].normal.x );
-    glTexCoord2fv( &vertices[2].tex_coord.x );
-    glVertex3fv( &vertices[2].position.x);
+    for ( int i = 0; i < 3; ++i ) {
+        if ( materials_nonnull ) {
+            float color[3];
+            ( vertices[i].material->ambient * vertices[i].occlusion ).to_array( color );
+            glColor3fv( color );
+        }
+        glNormal3fv( &vertices[i].normal.x );
+        glTexCoord2fv( &vertices[i].tex_coord.x );
+        glVertex3fv( &vertices[i].position.x );
+    }
 
     glEnd();
 
-    if ( materials_nonnull )
+    if ( materials_nonnull ) {
+        glDisable( GL_COLOR_MATERIAL );
         vertices[0].material->reset_gl_state();
+    }
 }
 
 // ray casting algorithm, check if a given line will hit this geometry.
@@ -81,6 +89,7 @@ bool Triangle::ray_casting(const Ray&      line,
     hit_vertex.position = barycentric_interpolation(v0.position, v1.position, v2.position, beta, gamma);
     hit_vertex.refractive_index = barycentric_interpolation(v0.material->refractive_index, v1.material->refractive_index, v2.material->refractive_index, beta, gamma);
     hit_vertex.specular = barycentric_interpolation(v0.material->specular, v1.material->specular, v2.material->specular, beta, gamma);
+    hit_vertex.occlusion = barycentric_interpolation(v0.occlusion, v1.occlusion, v2.occlusion, beta, gamma);
 
     // transform to global coordinates
     hit_vertex.position = (m_transformatMat * Vector4(hit_vertex.position, 1)).xyz();
@@ -91,16 +100,60 @@ bool Triangle::ray_casting(const Ray&      line,
     tex_coord.x = barycentric_interpolation(v0.tex_coord.x, v1.tex_coord.x, v2.tex_coord.x, beta, gamma);
     tex_coord.y = barycentric_interpolation(v0.tex_coord.y, v1.tex_coord.y, v2.tex_coord.y, beta, gamma);
 
+    hit_vertex.has_differential = line.HasDifferential();
+    if (!hit_vertex.has_differential)
+    {
+        // blending three textures
+        Color3 v0_tex_color = interpolate_texture_color(tex_coord, v0.material);
+        Color3 v1_tex_color = interpolate_texture_color(tex_coord, v1.material);
+        Color3 v2_tex_color = interpolate_texture_color(tex_coord, v2.material);
+
+        hit_vertex.tex_color = barycentric_interpolation(v0_tex_color, v1_tex_color, v2_tex_color, beta, gamma);
+        return true;
+    }
+
+    // footprint of the pixel on the triangle, in world coordinates
+    transfer_ray_differential(line, t, hit_vertex.normal, hit_vertex.dpdx, hit_vertex.dpdy);
+    Vector3 p0 = (m_transformatMat * Vector4(v0.position, 1)).xyz();
+    Vector3 p1 = (m_transformatMat * Vector4(v1.position, 1)).xyz();
+    Vector3 p2 = (m_transformatMat * Vector4(v2.position, 1)).xyz();
+    float dbdx, dgdx, dbdy, dgdy;
+    barycentric_differentials(p1-p0, p2-p0, hit_vertex.dpdx, dbdx, dgdx);
+    barycentric_differentials(p1-p0, p2-p0, hit_vertex.dpdy, dbdy, dgdy);
+
+    Vector2 dtdx = dbdx * (v1.tex_coord-v0.tex_coord) + dgdx * (v2.tex_coord-v0.tex_coord);
+    Vector2 dtdy = dbdy * (v1.tex_coord-v0.tex_coord) + dgdy * (v2.tex_coord-v0.tex_coord);
+    hit_vertex.dndx = m_normalMatrix * (dbdx * (v1.normal-v0.normal) + dgdx * (v2.normal-v0.normal));
+    hit_vertex.dndy = m_normalMatrix * (dbdy * (v1.normal-v0.normal) + dgdy * (v2.normal-v0.normal));
+
     // blending three textures
-    Color3 v0_tex_color = interpolate_texture_color(tex_coord, v0.material);
-    Color3 v1_tex_color = interpolate_texture_color(tex_coord, v1.material);
-    Color3 v2_tex_color = interpolate_texture_color(tex_coord, v2.material);
+    Color3 v0_tex_color = interpolate_texture_color(tex_coord, v0.material, dtdx, dtdy);
+    Color3 v1_tex_color = interpolate_texture_color(tex_coord, v1.material, dtdx, dtdy);
+    Color3 v2_tex_color = interpolate_texture_color(tex_coord, v2.material, dtdx, dtdy);
 
     hit_vertex.tex_color = barycentric_interpolation(v0_tex_color, v1_tex_color, v2_tex_color, beta, gamma);
 
     return true;
 }
 
+BoundingBox Triangle::get_world_bounds()
+{
+    BoundingBox box;
+    for (size_t i=0; i<3; ++i)
+        box.filter_vertex((m_transformatMat * Vector4(vertices[i].position, 1)).xyz());
+    return box;
+}
+
+bool Triangle::is_refractive() const
+{
+    for (size_t i=0; i<3; ++i)
+    {
+        if (vertices[i].material && vertices[i].material->refractive_index != 0)
+            return true;
+    }
+    return false;
+}
+
 
 } /* Luc */
 
@@ -33,6 +33,8 @@ public:
         Vector3 normal;
         Vector2 tex_coord;
         const Material* material;
+        // baked ambient occlusion, 1 if not baked
+        real_t occlusion;
     };
 
     // the triangle's vertices, in CCW order
@@ -50,6 +52,10 @@ public:
                              float&          t, 
                              HitVertexInfor& hit_vertex);
 
+    virtual BoundingBox get_world_bounds();
+
+    virtual bool is_refractive() const;
+
 };
 
 
@@ -0,0 +1,261 @@
+/**
+ * @file uniform_grid.cpp
+ * @brief Uniform grid over the geometries of a scene, traversed with a 3D-DDA.
+ */
+#include "lucPCH.h"
+#include "scene/uniform_grid.hpp"
+#include "scene/scene.hpp"
+#include "scene/trace_counters.hpp"
+
+#include <boost/thread/thread.hpp>
+#include <algorithm>
+#include <cmath>
+#include <float.h>
+
+namespace Luc {
+
+// geometries remembered per ray, so one spanning several cells is tested once
+static const size_t MAILBOX_SIZE = 8;
+
+/*
+ * Counts or fills the cell lists of a slab of the grid. Each worker only
+ * writes cells with z in [z_begin, z_end), so workers need no locking.
+ */
+struct GridBuildWorker
+{
+    UniformGrid*             grid;
+    int                      z_begin;
+    int                      z_end;
+    // pass 1 counts into 'counts', pass 2 appends at 'cursors'
+    bool                     fill;
+    std::vector< uint32_t >* counts;
+    std::vector< uint32_t >* cursors;
+
+    void operator()() const
+    {
+        for ( size_t i = 0; i < grid->m_bounds.size(); ++i ) {
+            const BoundingBox& box = grid->m_bounds[i];
+            int lo[3], hi[3];
+            Vector3 box_min = box.get_left_bottom_front_corner();
+            Vector3 box_max = box.get_right_top_back_corner();
+            for ( size_t axis = 0; axis < 3; ++axis ) {
+                lo[axis] = grid->get_cell( box_min[axis], axis );
+                hi[axis] = grid->get_cell( box_max[axis], axis );
+            }
+            lo[2] = std::max( lo[2], z_begin );
+            hi[2] = std::min( hi[2], z_end - 1 );
+
+            for ( int z = lo[2]; z <= hi[2]; ++z ) {
+                for ( int y = lo[1]; y <= hi[1]; ++y ) {
+                    for ( int x = lo[0]; x <= hi[0]; ++x ) {
+                        size_t cell = grid->get_cell_index( x, y, z );
+                        if ( fill )
+                            grid->m_cell_items[( *cursors )[cell]++] = static_cast< uint32_t >( i );
+                        else
+                            ( *counts )[cell]++;
+                    }
+                }
+            }
+        }
+    }
+};
+
+UniformGrid::UniformGrid( real_t density )
+    : m_density( density > 0 ? density : 1 )
+{
+    m_resolution[0] = m_resolution[1] = m_resolution[2] = 0;
+}
+
+UniformGrid::~UniformGrid() { }
+
+int UniformGrid::get_cell( real_t value, size_t axis ) const
+{
+    int cell = static_cast< int >( ( value - m_min[axis] ) * m_inv_cell_size[axis] );
+    return std::max( 0, std::min( cell, m_resolution[axis] - 1 ) );
+}
+
+void UniformGrid::build( Geometry* const* geometries, size_t count )
+{
+    m_geometries.assign( geometries, geometries + count );
+    m_bounds.resize( count );
+    m_box = BoundingBox();
+    m_cell_start.clear();
+    m_cell_items.clear();
+    m_resolution[0] = m_resolution[1] = m_resolution[2] = 0;
+    if ( 0 == count )
+        return;
+
+    for ( size_t i = 0; i < count; ++i ) {
+        m_bounds[i] = geometries[i]->get_world_bounds();
+        m_box.merge( m_bounds[i] );
+    }
+
+    // pad flat extents, so every axis has a volume to split
+    Vector3 extent = m_box.get_right_top_back_corner() - m_box.get_left_bottom_front_corner();
+    real_t max_extent = std::max( extent.x, std::max( extent.y, extent.z ) );
+    real_t padding = std::max( max_extent * 1e-3f, 1e-4f );
+    m_box.filter_vertex( m_box.get_left_bottom_front_corner() - Vector3( padding, padding, padding ) );
+    m_box.filter_vertex( m_box.get_right_top_back_corner() + Vector3( padding, padding, padding ) );
+    m_min = m_box.get_left_bottom_front_corner();
+    extent = m_box.get_right_top_back_corner() - m_min;
+
+    // cubic cells, about 'density' cells per geometry
+    real_t volume = extent.x * extent.y * extent.z;
+    real_t cells_per_unit = pow( m_density * count / volume, real_t( 1 ) / 3 );
+    size_t num_cells = 1;
+    for ( size_t axis = 0; axis < 3; ++axis ) {
+        int res = static_cast< int >( extent[axis] * cells_per_unit );
+        m_resolution[axis] = std::max( 1, std::min( res, static_cast< int >( MAX_RESOLUTION ) ) );
+        m_cell_size[axis] = extent[axis] / m_resolution[axis];
+        m_inv_cell_size[axis] = 1 / m_cell_size[axis];
+        num_cells *= m_resolution[axis];
+    }
+
+    // split the z slabs among the threads
+    size_t num_threads = std::max< size_t >( 1, boost::thread::hardware_concurrency() );
+    num_threads = std::min( num_threads, static_cast< size_t >( m_resolution[2] ) );
+
+    std::vector< uint32_t > counts( num_cells, 0 );
+    std::vector< GridBuildWorker > workers( num_threads );
+    for ( size_t i = 0; i < num_threads; ++i ) {
+        GridBuildWorker& worker = workers[i];
+        worker.grid    = this;
+        worker.z_begin = static_cast< int >( m_resolution[2] * i / num_threads );
+        worker.z_end   = static_cast< int >( m_resolution[2] * ( i + 1 ) / num_threads );
+        worker.fill    = false;
+        worker.counts  = &counts;
+        worker.cursors = NULL;
+    }
+
+    // pass 1, count the geometries of each cell
+    {
+        boost::thread_group threads;
+        for ( size_t i = 1; i < num_threads; ++i )
+            threads.create_thread( workers[i] );
+        workers[0]();
+        threads.join_all();
+    }
+
+    m_cell_start.resize( num_cells + 1 );
+    m_cell_start[0] = 0;
+    for ( size_t i = 0; i < num_cells; ++i ) {
+        m_cell_start[i + 1] = m_cell_start[i] + counts[i];
+    }
+    m_cell_items.resize( m_cell_start[num_cells] );
+
+    // pass 2, fill the cell lists, in geometry order within each cell
+    std::vector< uint32_t > cursors( m_cell_start.begin(), m_cell_start.end() - 1 );
+    {
+        boost::thread_group threads;
+        for ( size_t i = 0; i < num_threads; ++i ) {
+            workers[i].fill = true;
+            workers[i].cursors = &cursors;
+        }
+        for ( size_t i = 1; i < num_threads; ++i )
+            threads.create_thread( workers[i] );
+        workers[0]();
+        threads.join_all();
+    }
+}
+
+bool UniformGrid::intersect( const Ray& ray, real_t tMin, real_t tMax,
+                             real_t& t, HitVertexInfor& hit_vertex ) const
+{
+    if ( m_geometries.empty() )
+        return false;
+
+    Vector3 origin = ray.Point();
+    Vector3 direction = ray.Direction();
+
+    // clip the ray to the grid, a box test, and every cell stepped through is another
+    TraceCounters* counters = get_trace_counters();
+    if ( counters )
+        counters->boxes++;
+    Vector3 box_min = m_box.get_left_bottom_front_corner();
+    Vector3 box_max = m_box.get_right_top_back_corner();
+    real_t t_enter = tMin;
+    real_t t_leave = tMax;
+    for ( size_t axis = 0; axis < 3; ++axis ) {
+        if ( direction[axis] == 0 ) {
+            if ( origin[axis] < box_min[axis] || origin[axis] > box_max[axis] )
+                return false;
+            continue;
+        }
+        real_t t0 = ( box_min[axis] - origin[axis] ) / direction[axis];
+        real_t t1 = ( box_max[axis] - origin[axis] ) / direction[axis];
+        t_enter = std::max( t_enter, std::min( t0, t1 ) );
+        t_leave = std::min( t_leave, std::max( t0, t1 ) );
+    }
+    if ( t_enter > t_leave )
+        return false;
+
+    // setup of the 3D-DDA
+    Vector3 entry = origin + direction * t_enter;
+    int cell[3], step[3], end[3];
+    real_t t_next[3], t_delta[3];
+    for ( size_t axis = 0; axis < 3; ++axis ) {
+        cell[axis] = get_cell( entry[axis], axis );
+        if ( direction[axis] > 0 ) {
+            step[axis]    = 1;
+            end[axis]     = m_resolution[axis];
+            t_next[axis]  = ( m_min[axis] + ( cell[axis] + 1 ) * m_cell_size[axis] - origin[axis] ) / direction[axis];
+            t_delta[axis] = m_cell_size[axis] / direction[axis];
+        } else if ( direction[axis] < 0 ) {
+            step[axis]    = -1;
+            end[axis]     = -1;
+            t_next[axis]  = ( m_min[axis] + cell[axis] * m_cell_size[axis] - origin[axis] ) / direction[axis];
+            t_delta[axis] = -m_cell_size[axis] / direction[axis];
+        } else {
+            step[axis]    = 0;
+            end[axis]     = -1;
+            t_next[axis]  = FLT_MAX;
+            t_delta[axis] = FLT_MAX;
+        }
+    }
+
+    uint32_t mailbox[MAILBOX_SIZE];
+    for ( size_t i = 0; i < MAILBOX_SIZE; ++i )
+        mailbox[i] = ~0u;
+
+    bool hit = false;
+    uint32_t cells = 0;
+    while ( true ) {
+        size_t index = get_cell_index( cell[0], cell[1], cell[2] );
+        ++cells;
+        for ( uint32_t i = m_cell_start[index]; i < m_cell_start[index + 1]; ++i ) {
+            uint32_t geometry = m_cell_items[i];
+            uint32_t& slot = mailbox[geometry % MAILBOX_SIZE];
+            if ( slot == geometry )
+                continue;
+            slot = geometry;
+
+            float cur_t;
+            HitVertexInfor cur_hit_vertex;
+            if ( m_geometries[geometry]->ray_casting( ray, tMin, tMax, cur_t, cur_hit_vertex ) && cur_t < tMax ) {
+                tMax = cur_t;
+                t = cur_t;
+                hit_vertex = cur_hit_vertex;
+                hit = true;
+            }
+        }
+
+        // a hit inside this cell is closer than anything in later cells
+        size_t axis = 0;
+        if ( t_next[1] < t_next[axis] ) axis = 1;
+        if ( t_next[2] < t_next[axis] ) axis = 2;
+        real_t t_exit = t_next[axis];
+        if ( ( hit && tMax <= t_exit ) || t_exit > t_leave )
+            break;
+
+        cell[axis] += step[axis];
+        if ( cell[axis] == end[axis] )
+            break;
+        t_next[axis] += t_delta[axis];
+    }
+
+    if ( counters )
+        counters->boxes += cells;
+    return hit;
+}
+
+} /* Luc */
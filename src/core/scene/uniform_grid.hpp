@@ -0,0 +1,73 @@
+/**
+ * @file uniform_grid.hpp
+ * @brief Uniform grid over the geometries of a scene, traversed with a 3D-DDA.
+ */
+
+#ifndef _LUC_SCENE_UNIFORM_GRID_HPP_
+#define _LUC_SCENE_UNIFORM_GRID_HPP_
+
+#include "scene/acceleration.hpp"
+#include "scene/bounding_box.hpp"
+
+namespace Luc {
+
+/*
+ * Splits the scene bounds into equally sized cells, each listing the
+ * geometries whose bounds overlap it. A ray walks the cells it crosses in
+ * order (Amanatides & Woo) and stops at the first cell holding a hit.
+ *
+ * Well suited to many geometries of similar size, such as particles. The
+ * cell lists are built by several threads, each owning a slab of cells.
+ */
+class UniformGrid : public Acceleration
+{
+public:
+
+    // upper bound of the cells along one axis
+    static const int MAX_RESOLUTION = 256;
+
+    /*
+     * @param density   Cells per geometry, see AccelerationSettings.
+     */
+    explicit UniformGrid( real_t density );
+    virtual ~UniformGrid();
+
+    virtual void build( Geometry* const* geometries, size_t count );
+    virtual bool intersect( const Ray& ray, real_t tMin, real_t tMax,
+                            real_t& t, HitVertexInfor& hit_vertex ) const;
+    virtual const char* get_name() const { return "grid"; }
+
+    /// Number of cells along an axis.
+    int get_resolution( size_t axis ) const { return m_resolution[axis]; }
+
+private:
+
+    friend struct GridBuildWorker;
+
+    // cell coordinate of a point along an axis, clamped to the grid
+    int get_cell( real_t value, size_t axis ) const;
+    size_t get_cell_index( int x, int y, int z ) const
+    {
+        return ( static_cast< size_t >( z ) * m_resolution[1] + y ) * m_resolution[0] + x;
+    }
+
+    real_t m_density;
+
+    std::vector< Geometry* >   m_geometries;
+    std::vector< BoundingBox > m_bounds;
+
+    BoundingBox m_box;
+    Vector3     m_min;
+    Vector3     m_cell_size;
+    Vector3     m_inv_cell_size;
+    int         m_resolution[3];
+
+    // the geometries of cell i are m_cell_items[m_cell_start[i]] up to
+    // m_cell_items[m_cell_start[i + 1]]
+    std::vector< uint32_t > m_cell_start;
+    std::vector< uint32_t > m_cell_items;
+};
+
+} /* Luc */
+
+#endif /* _LUC_SCENE_UNIFORM_GRID_HPP_ */